@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "batch.h"
+#include "ir_frame.h"
+#include "ir_link.h"
+#include "fragment.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "kernel.h"
+#include "csma.h"
+
+/*
+ *  Small message batching (like Nagle in TCP)
+ *
+ *  Every frame costs SOH + COBS + type + crc + 0 = 6 bytes on top of the payload, so a
+ *  burst of short messages spends a lot of the airtime on overhead (plus the CSMA wait
+ *  in front of every frame). With a batch delay set, short text messages wait in a
+ *  buffer for up to that many ms and get packed into one frame:
+ *    length | message | length | message ...
+ *  It gets sent when the delay runs out (a timer in the wheel, its callback just flags
+ *  it for the pollBatch task) or when the next message wouldn't fit anymore.
+ *  The receiver splits it back up and handles each message like a normal text frame.
+ *
+ *  The send command (shell thread) and pollBatch (event thread, which can cut into the
+ *  shell) both fill / send the buffer, so batch_lock keeps them from doing it at the
+ *  same time. It is held while the frame is sent so the messages stay in order.
+ *  pollBatch never waits on it though, the shell can be holding it through a 2 s csma
+ *  send. If it's taken the flush is left for when the shell lets go, and the frame
+ *  itself goes out with queueIrFrame so it doesn't wait on the transmitter either.
+ */
+
+#define BATCH_MAX_MESSAGE 32    // anything longer goes out on its own right away
+
+static uint8_t buffer[IR_FRAME_MAX_PAYLOAD];
+static uint8_t length = 0;
+static uint8_t count = 0;
+static volatile bool flush_due = false;
+static uint16_t delay_ms = 0;   // 0 = batching off
+static BATCH_STATS stats;
+static SEMAPHORE batch_lock = { 1 };
+
+static void flushTimeout(void* context)
+{
+    flush_due = true;
+    postEvent(EVENT_BATCH);
+}
+
+static TIMER flush_timer = { .callback = flushTimeout };   // started by the oldest waiting message
+
+// sends whatever is waiting, batch_lock has to be held. From the events thread it
+// is queued instead, and if the transmit queue is full it stays here for another try
+static void sendBatch(bool from_events)
+{
+    if (count && from_events && !queueIrFrame(IR_FRAME_BATCH, buffer, length))
+    {
+        notifyIrTxRoom(EVENT_BATCH);
+        return;
+    }
+
+    stopTimer(&flush_timer);
+    flush_due = false;
+
+    if (!count)
+        return;
+
+    if (!from_events)
+        sendIrFrame(IR_FRAME_BATCH, buffer, length);
+    stats.frames++;
+    stats.histogram[(count < BATCH_HISTOGRAM_SIZE ? count : BATCH_HISTOGRAM_SIZE) - 1]++;
+
+    length = 0;
+    count = 0;
+}
+
+// the shell is done with the buffer, if the timer ran out while it had it pollBatch
+// skipped the flush, so it gets another go
+static void releaseBatch()
+{
+    postSemaphore(&batch_lock);
+
+    if (flush_due)
+        postEvent(EVENT_BATCH);
+}
+
+void setBatchDelay(uint16_t ms)
+{
+    waitSemaphore(&batch_lock);
+    sendBatch(false);
+    delay_ms = ms;
+    releaseBatch();
+}
+
+uint16_t getBatchDelay()
+{
+    return delay_ms;
+}
+
+void flushBatch()
+{
+    waitSemaphore(&batch_lock);
+    sendBatch(false);
+    releaseBatch();
+}
+
+// send command, text of any length
+void sendBatchedText(const uint8_t* data, uint16_t data_length)
+{
+    uint8_t i;
+
+    waitSemaphore(&batch_lock);
+
+    if (!delay_ms || data_length > BATCH_MAX_MESSAGE)
+    {
+        // keep the order, whatever is waiting goes first
+        sendBatch(false);
+        sendIrMessageTo(IR_FRAME_BROADCAST, IR_FRAME_TEXT, data, data_length);
+        releaseBatch();
+        return;
+    }
+
+    if (length + 1 + data_length > IR_FRAME_MAX_PAYLOAD)
+    {
+        stats.size_flushes++;
+        sendBatch(false);
+    }
+
+    if (!count)
+        startTimer(&flush_timer, delay_ms);
+
+    buffer[length++] = data_length;
+    for (i = 0; i < data_length; i++)
+        buffer[length++] = data[i];
+    count++;
+    stats.messages++;
+
+    releaseBatch();
+}
+
+// the EVENT_BATCH task
+void pollBatch()
+{
+    // the shell has it, releaseBatch posts EVENT_BATCH again
+    if (!tryWaitSemaphore(&batch_lock))
+        return;
+
+    // the shell might have sent it before the event got here
+    if (flush_due)
+    {
+        sendBatch(true);
+        if (!flush_due)     // still due if the transmit queue was full
+            stats.timer_flushes++;
+    }
+
+    postSemaphore(&batch_lock);
+}
+
+// batch frame came in, hand every message in it on by itself
+void handleBatchFrame(uint8_t channel, const uint8_t* data, uint8_t data_length)
+{
+    uint8_t i = 0;
+
+    while (i < data_length && i + 1 + data[i] <= data_length)
+    {
+        processIrMessage(channel, IR_FRAME_TEXT, &data[i + 1], data[i]);
+        i += 1 + data[i];
+    }
+}
+
+BATCH_STATS* getBatchStats()
+{
+    return &stats;
+}
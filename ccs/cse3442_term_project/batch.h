@@ -0,0 +1,27 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BATCH_HISTOGRAM_SIZE 8  // 1, 2, ... 7, 8+ messages per frame
+
+typedef struct _BATCH_STATS
+{
+    uint32_t messages;          // messages that went through the batcher
+    uint32_t frames;            // batch frames sent
+    uint32_t size_flushes;      // sent because the next message wouldn't fit
+    uint32_t timer_flushes;     // sent because the delay ran out
+    uint32_t histogram[BATCH_HISTOGRAM_SIZE];
+}
+BATCH_STATS;
+
+void setBatchDelay(uint16_t ms);
+uint16_t getBatchDelay();
+void sendBatchedText(const uint8_t* data, uint16_t length);
+void flushBatch();
+void pollBatch();
+void handleBatchFrame(uint8_t channel, const uint8_t* data, uint8_t length);
+BATCH_STATS* getBatchStats();
+
+#endif
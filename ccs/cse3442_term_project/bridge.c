@@ -0,0 +1,189 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "bridge.h"
+#include "ir_frame.h"
+#include "ir_channel.h"
+#include "uart.h"
+#include "uart0.h"
+#include "pwm.h"
+#include "scheduler.h"
+#include "priority.h"
+
+/*
+ *  Transparent bridge, UART0 <-> UART7 like a piece of wire
+ *
+ *  PC -> IR: UART0 RX is interrupt driven while the bridge is on (the main loop is
+ *  stuck sending a frame for most of the time and the 16 byte FIFO would overrun at
+ *  115200), the ISR puts the bytes in a ring buffer. The main loop takes them out and
+ *  sends them as stream frames, either 64 at a time or whatever is there once the PC
+ *  has been quiet for a few ms, so typing doesn't wait for a full frame.
+ *
+ *  The PC is way faster than the IR link, so once the buffer passes the high water mark
+ *  the ISR sends XOFF, and the main loop sends XON once it drained down to low water.
+ *  (so the data can't have raw XON / XOFF bytes in it, use xfer for binary files)
+ *
+ *  IR -> PC: stream frames just get written straight out of UART0.
+ *
+ *  To get out, same as a modem: 1 s of nothing, +++, 1 s of nothing.
+ */
+
+#define BRIDGE_MASK (BRIDGE_BUFFER_SIZE - 1)
+#define BRIDGE_HIGH_WATER (BRIDGE_BUFFER_SIZE * 3 / 4)
+#define BRIDGE_LOW_WATER (BRIDGE_BUFFER_SIZE / 4)
+#define BRIDGE_IDLE_MS 10           // send a partial frame after this long with no input
+#define BRIDGE_GUARD_MS 1000        // quiet time around the +++ escape
+#define XON 0x11
+#define XOFF 0x13
+
+static uint8_t buffer[BRIDGE_BUFFER_SIZE];
+static volatile uint16_t head = 0;          // written by the ISR
+static volatile uint16_t tail = 0;          // written by the main loop
+static volatile uint32_t last_rx_ms = 0;
+static volatile uint8_t escape_count = 0;   // '+' characters that might be the escape
+static volatile bool throttled = false;
+static bool active = false;
+static BRIDGE_STATS stats;
+
+uint16_t getBridgeOccupancy()
+{
+    return (head - tail) & BRIDGE_MASK;
+}
+
+// UART0 RX, only unmasked while the bridge is running (or while the tickless idle
+// is sleeping, then it is just the wake up and the bytes stay in the FIFO)
+void Uart0_Handler(void)
+{
+    uint32_t now = getUptimeMs();
+
+    if (!active)
+    {
+        UART0_IM_R &= ~(UART_IM_RXIM | UART_IM_RTIM);
+        return;
+    }
+
+    while (!(UART0_FR_R & UART_FR_RXFE))
+    {
+        uint8_t c = UART0_DR_R & 0xFF;
+        uint16_t next = (head + 1) & BRIDGE_MASK;
+
+        // +++ only counts if it comes after the guard time
+        if (c == '+' && escape_count < 3 && (escape_count || (now - last_rx_ms) >= BRIDGE_GUARD_MS))
+            escape_count++;
+        else
+            escape_count = 0;
+        last_rx_ms = now;
+
+        if (next == tail)
+        {
+            stats.overflows++;
+            continue;
+        }
+
+        buffer[head] = c;
+        head = next;
+    }
+
+    uint16_t used = getBridgeOccupancy();
+    if (used > stats.peak)
+        stats.peak = used;
+
+    if (!throttled && used >= BRIDGE_HIGH_WATER)
+    {
+        throttled = true;
+        stats.xoffs++;
+        UART0_DR_R = XOFF;  // TX FIFO is basically never full, the main loop only prints XON
+    }
+
+    UART0_ICR_R = UART_ICR_RXIC | UART_ICR_RTIC;
+}
+
+// sends up to one frame worth of what the PC typed, leaving the last count bytes alone
+static void sendBridgeFrame(uint16_t count)
+{
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+    uint8_t length = 0;
+
+    while (length < IR_FRAME_MAX_PAYLOAD && count--)
+    {
+        payload[length++] = buffer[tail];
+        tail = (tail + 1) & BRIDGE_MASK;
+    }
+
+    sendIrFrame(IR_FRAME_STREAM, payload, length);
+    stats.to_ir_bytes += length;
+    stats.to_ir_frames++;
+}
+
+bool isBridgeActive()
+{
+    return active;
+}
+
+// stream frame from the other board, straight out to the PC
+void handleBridgeData(const uint8_t* data, uint8_t length)
+{
+    uint8_t i;
+
+    for (i = 0; i < length; i++)
+        putcUart0(data[i]);
+
+    stats.from_ir_bytes += length;
+}
+
+// bridge command, doesn't come back until the +++ escape
+void runBridge()
+{
+    active = true;
+    tail = head;
+    escape_count = 0;
+    last_rx_ms = getUptimeMs();
+
+    enableUartRxInterrupt(0, PRIORITY_UART0);
+
+    while (1)
+    {
+        uint32_t quiet = getUptimeMs() - last_rx_ms;
+
+        runTasks();
+
+        // held back +++ either turns out to be the escape or just data
+        if (escape_count && quiet >= BRIDGE_GUARD_MS)
+        {
+            if (escape_count == 3)
+                break;
+
+            UART0_IM_R &= ~(UART_IM_RXIM | UART_IM_RTIM);
+            escape_count = 0;
+            UART0_IM_R |= UART_IM_RXIM | UART_IM_RTIM;
+        }
+
+        // whatever might still be the escape stays in the buffer for now
+        uint16_t used = getBridgeOccupancy();
+        uint8_t held = escape_count;
+        uint16_t ready = (used > held) ? used - held : 0;
+
+        if (ready >= IR_FRAME_MAX_PAYLOAD || (ready && quiet >= BRIDGE_IDLE_MS))
+            sendBridgeFrame(ready);
+
+        if (throttled && getBridgeOccupancy() <= BRIDGE_LOW_WATER)
+        {
+            throttled = false;
+            putcUart0(XON);
+        }
+    }
+
+    UART0_IM_R &= ~(UART_IM_RXIM | UART_IM_RTIM);
+    tail = head;
+    if (throttled)
+    {
+        throttled = false;
+        putcUart0(XON);
+    }
+    active = false;
+}
+
+BRIDGE_STATS* getBridgeStats()
+{
+    return &stats;
+}
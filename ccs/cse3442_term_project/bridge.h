@@ -0,0 +1,26 @@
+#ifndef BRIDGE_H_
+#define BRIDGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BRIDGE_BUFFER_SIZE 512  // power of 2
+
+typedef struct _BRIDGE_STATS
+{
+    uint32_t to_ir_bytes;       // PC -> IR
+    uint32_t to_ir_frames;
+    uint32_t from_ir_bytes;     // IR -> PC
+    uint32_t xoffs;             // times the PC got told to stop
+    uint32_t overflows;         // bytes lost because the PC kept going anyways
+    uint16_t peak;              // most bytes ever waiting in the buffer
+}
+BRIDGE_STATS;
+
+void runBridge();
+bool isBridgeActive();
+void handleBridgeData(const uint8_t* data, uint8_t length);
+uint16_t getBridgeOccupancy();
+BRIDGE_STATS* getBridgeStats();
+
+#endif
@@ -0,0 +1,417 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "bulk.h"
+#include "ir_frame.h"
+#include "ir_channel.h"
+#include "fragment.h"
+#include "uart0.h"
+#include "uart7.h"
+#include "pwm.h"
+#include "strings.h"
+#include "scheduler.h"
+
+/*
+ *  Bulk file transfer, PC -> board -> IR -> board -> PC
+ *
+ *  UART0 runs at 115200 and the IR link at 1200, so the PC can't just stream a file at
+ *  the board. Instead the xfer command makes the board an XMODEM / YMODEM receiver on
+ *  UART0 (CRC mode, 128 or 1024 byte blocks, so tools/irxfer or sb from lrzsz can send
+ *  to it). That is stop and wait: the PC only sends the next block after the board ACKs
+ *  the last one, and the board only ACKs once the block made it across the IR link,
+ *  so the PC automatically slows down to whatever the IR link can do.
+ *
+ *  On the IR side every block goes out as one bulk message (fragmented since they are
+ *  bigger than a frame) and the other board sends back an ack with the same sequence
+ *  number. No ack in time = send it again, a few times before giving up.
+ *
+ *  The receiving board prints what it gets as hex lines so it can't mess up the terminal:
+ *    Bulk transfer start <size> <name>
+ *    :<offset, 8 hex digits><data, 2 hex digits per byte>
+ *    Bulk transfer end <bytes>
+ *  and tools/irxfer recv turns that back into the file.
+ */
+
+#define XMODEM_SOH 0x01     // 128 byte block
+#define XMODEM_STX 0x02     // 1024 byte block
+#define XMODEM_EOT 0x04
+#define XMODEM_ACK 0x06
+#define XMODEM_NAK 0x15
+#define XMODEM_CAN 0x18
+#define XMODEM_CRC 'C'      // receiver wants CRC mode
+
+#define XMODEM_BLOCK_MAX 1024
+#define BULK_START_TRIES 20         // 'C' every 3 s, so the PC has a minute to start
+#define BULK_START_INTERVAL_MS 3000
+#define BULK_PACKET_TIMEOUT_MS 10000
+#define BULK_BYTE_TIMEOUT_MS 1000
+#define BULK_RETRIES 5
+#define BULK_ACK_TIMEOUT_MS 1000    // plus the time the message takes on the wire
+#define BULK_LINE_BYTES 64
+
+// op + seq + the biggest block + its 2 byte XMODEM crc, which gets read in right behind it
+static uint8_t message[BULK_HEADER_LENGTH + XMODEM_BLOCK_MAX + 2];
+static uint8_t address;
+static uint16_t tx_seq;
+static volatile bool acked;
+
+static uint16_t rx_expected = 0;
+static uint32_t rx_offset = 0;
+
+static BULK_STATS stats;
+
+// returns the next byte from the PC, or -1 if nothing came in time
+static int16_t readUart0(uint32_t timeout_ms)
+{
+    uint32_t start = getUptimeMs();
+
+    while (!kbhitUart0())
+    {
+        if ((getUptimeMs() - start) > timeout_ms)
+            return -1;
+    }
+
+    return (uint8_t)getcUart0();
+}
+
+// throws away whatever the PC is still sending, until it has been quiet for a bit
+static void purgeUart0()
+{
+    while (readUart0(BULK_BYTE_TIMEOUT_MS) >= 0);
+}
+
+static void cancel()
+{
+    putcUart0(XMODEM_CAN);
+    putcUart0(XMODEM_CAN);
+    stats.failed++;
+}
+
+// reads the rest of an XMODEM packet after the SOH / STX into message, returns the
+// block size or 0 if it was bad
+static uint16_t readPacket(uint8_t start, uint8_t* block)
+{
+    uint16_t size = (start == XMODEM_STX) ? 1024 : 128;
+    uint8_t* data = &message[BULK_HEADER_LENGTH];
+    uint8_t number[2];
+    int16_t c;
+    uint16_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if ((c = readUart0(BULK_BYTE_TIMEOUT_MS)) < 0)
+            return 0;
+        number[i] = c;
+    }
+
+    for (i = 0; i < size + 2; i++)
+    {
+        if ((c = readUart0(BULK_BYTE_TIMEOUT_MS)) < 0)
+            return 0;
+        data[i] = c;
+    }
+
+    if ((uint8_t)(number[0] + number[1]) != 0xFF)
+        return 0;
+    if (crc16Seed(0, data, size) != ((data[size] << 8) | data[size + 1]))
+        return 0;
+
+    *block = number[0];
+    return size;
+}
+
+// sends message (data already filled in) over IR and waits for the ack
+static bool forwardBulk(uint8_t op, uint16_t length)
+{
+    uint8_t frames = (length + BULK_HEADER_LENGTH) / FRAGMENT_DATA + 2;   // + the ack
+    uint32_t timeout = BULK_ACK_TIMEOUT_MS + (frames * IR_FRAME_MAX_WIRE * 11 * 1000) / getUart7BaudRate();
+    uint8_t attempt;
+
+    message[BULK_OP] = op;
+    message[BULK_SEQ] = tx_seq & 0xFF;
+    message[BULK_SEQ + 1] = tx_seq >> 8;
+
+    for (attempt = 0; attempt <= BULK_RETRIES; attempt++)
+    {
+        acked = false;
+        sendIrMessageTo(address, IR_FRAME_BULK, message, length + BULK_HEADER_LENGTH);
+
+        uint32_t start = getUptimeMs();
+        while (!acked && (getUptimeMs() - start) < timeout)
+            runTasks();
+
+        if (acked)
+        {
+            tx_seq++;
+            return true;
+        }
+
+        stats.tx_retries++;
+    }
+
+    return false;
+}
+
+// START message from a YMODEM block 0 ("name\0size ...") or nothing for plain XMODEM
+static bool forwardStart(bool ymodem)
+{
+    uint8_t* data = &message[BULK_HEADER_LENGTH];
+    uint32_t size = 0;
+    uint8_t name_length = 0;
+    uint8_t i;
+
+    if (ymodem)
+    {
+        while (name_length < 64 && data[name_length])
+            name_length++;
+
+        i = name_length + 1;
+        while (data[i] >= '0' && data[i] <= '9')
+            size = size * 10 + (data[i++] - '0');
+
+        // name moves over to make room for the size
+        for (i = name_length; i > 0; i--)
+            data[i + 3] = data[i - 1];
+    }
+
+    data[0] = size & 0xFF;
+    data[1] = (size >> 8) & 0xFF;
+    data[2] = (size >> 16) & 0xFF;
+    data[3] = (size >> 24) & 0xFF;
+
+    return forwardBulk(BULK_OP_START, 4 + name_length);
+}
+
+static bool forwardEnd(uint32_t bytes)
+{
+    uint8_t* data = &message[BULK_HEADER_LENGTH];
+
+    data[0] = bytes & 0xFF;
+    data[1] = (bytes >> 8) & 0xFF;
+    data[2] = (bytes >> 16) & 0xFF;
+    data[3] = (bytes >> 24) & 0xFF;
+
+    return forwardBulk(BULK_OP_END, 4);
+}
+
+// xfer command: receives a file from the PC and sends it across, returns true if
+// the whole thing made it
+bool runBulkTransfer(uint8_t ir_address)
+{
+    uint8_t expected = 1;
+    uint8_t tries = 0;
+    uint32_t bytes = 0;
+    bool started = false;
+    bool ymodem = false;
+
+    address = ir_address;
+    tx_seq = 0;
+
+    purgeUart0();
+    putcUart0(XMODEM_CRC);
+
+    while (1)
+    {
+        int16_t c = readUart0(started ? BULK_PACKET_TIMEOUT_MS : BULK_START_INTERVAL_MS);
+        uint8_t block;
+        uint16_t size;
+
+        if (c < 0)
+        {
+            if (!started && ++tries < BULK_START_TRIES)
+            {
+                putcUart0(XMODEM_CRC);
+                continue;
+            }
+
+            cancel();
+            return false;
+        }
+
+        if (c == XMODEM_CAN)
+        {
+            stats.failed++;
+            return false;
+        }
+
+        if (c == XMODEM_EOT && started)
+        {
+            if (!forwardEnd(bytes))
+            {
+                cancel();
+                return false;
+            }
+            putcUart0(XMODEM_ACK);
+
+            // YMODEM asks for the next file, and an empty block 0 ends the batch
+            if (ymodem)
+            {
+                putcUart0(XMODEM_CRC);
+                c = readUart0(BULK_START_INTERVAL_MS);
+                if ((c == XMODEM_SOH || c == XMODEM_STX) && readPacket(c, &block))
+                    putcUart0(XMODEM_ACK);
+            }
+            return true;
+        }
+
+        // anything else between packets is line noise
+        if (c != XMODEM_SOH && c != XMODEM_STX)
+            continue;
+
+        size = readPacket(c, &block);
+        if (!size)
+        {
+            stats.bad_packets++;
+            purgeUart0();
+            putcUart0(XMODEM_NAK);
+            continue;
+        }
+
+        if (!started)
+        {
+            started = true;
+            ymodem = (block == 0);
+
+            if (!forwardStart(ymodem))
+            {
+                cancel();
+                return false;
+            }
+
+            // the YMODEM header block gets acked and then the receiver asks again
+            if (ymodem)
+            {
+                putcUart0(XMODEM_ACK);
+                putcUart0(XMODEM_CRC);
+                continue;
+            }
+        }
+
+        // the PC missed our ACK and sent the last one again
+        if (block == (uint8_t)(expected - 1))
+        {
+            putcUart0(XMODEM_ACK);
+            continue;
+        }
+
+        if (block != expected || !forwardBulk(BULK_OP_DATA, size))
+        {
+            cancel();
+            return false;
+        }
+
+        putcUart0(XMODEM_ACK);
+        expected++;
+        bytes += size;
+        stats.tx_blocks++;
+        stats.tx_bytes += size;
+    }
+}
+
+static void putHexByte(uint8_t value)
+{
+    const char digits[] = "0123456789ABCDEF";
+
+    putcUart0(digits[value >> 4]);
+    putcUart0(digits[value & 0xF]);
+}
+
+static uint32_t readLittleEndian(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void sendAck(uint16_t seq)
+{
+    uint8_t ack[BULK_HEADER_LENGTH];
+
+    ack[BULK_OP] = BULK_OP_ACK;
+    ack[BULK_SEQ] = seq & 0xFF;
+    ack[BULK_SEQ + 1] = seq >> 8;
+    queueIrFrame(IR_FRAME_BULK, ack, BULK_HEADER_LENGTH);     // from the events thread
+}
+
+// a whole bulk message came in over IR (put back together from its fragments)
+void handleBulkMessage(const uint8_t* data, uint16_t length)
+{
+    char str[12];
+    uint8_t op;
+    uint16_t seq;
+    uint16_t i;
+
+    if (length < BULK_HEADER_LENGTH)
+        return;
+
+    op = data[BULK_OP];
+    seq = data[BULK_SEQ] | (data[BULK_SEQ + 1] << 8);
+    data += BULK_HEADER_LENGTH;
+    length -= BULK_HEADER_LENGTH;
+
+    // sender side
+    if (op == BULK_OP_ACK)
+    {
+        if (seq == tx_seq)
+            acked = true;
+        return;
+    }
+
+    // receiver side, a START begins a new transfer unless it is the one we just acked
+    if (op == BULK_OP_START && !((uint16_t)(seq + 1) == rx_expected && rx_offset == 0))
+        rx_expected = seq;
+
+    if (seq != rx_expected)
+    {
+        // already had it, the sender just didn't hear the ack
+        if ((uint16_t)(rx_expected - seq) <= BULK_RETRIES + 1)
+        {
+            stats.rx_duplicates++;
+            sendAck(seq);
+        }
+        return;
+    }
+
+    if (op == BULK_OP_START && length >= 4)
+    {
+        rx_offset = 0;
+
+        putsUart0("\r\nBulk transfer start ");
+        putsUart0(toAsciiDec(str, readLittleEndian(data)));
+        putsUart0(" ");
+        for (i = 4; i < length; i++)
+            putcUart0(data[i]);
+        putsUart0("\r\n");
+    }
+    else if (op == BULK_OP_DATA)
+    {
+        for (i = 0; i < length; i++)
+        {
+            if (i % BULK_LINE_BYTES == 0)
+            {
+                putcUart0(':');
+                putsUart0(toAsciiHex(str, rx_offset + i));
+            }
+            putHexByte(data[i]);
+            if (i % BULK_LINE_BYTES == BULK_LINE_BYTES - 1 || i == length - 1)
+                putsUart0("\r\n");
+        }
+
+        rx_offset += length;
+        stats.rx_blocks++;
+        stats.rx_bytes += length;
+    }
+    else if (op == BULK_OP_END && length >= 4)
+    {
+        putsUart0("Bulk transfer end ");
+        putsUart0(toAsciiDec(str, readLittleEndian(data)));
+        putsUart0("\r\n");
+    }
+    else
+        return;
+
+    rx_expected = seq + 1;
+    sendAck(seq);
+}
+
+BULK_STATS* getBulkStats()
+{
+    return &stats;
+}
@@ -0,0 +1,34 @@
+#ifndef BULK_H_
+#define BULK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// bulk header at the front of an IR_FRAME_BULK message
+#define BULK_OP 0           // one of the BULK_OP_ values
+#define BULK_SEQ 1          // 16 bit message number (little endian), the ack echoes it
+#define BULK_HEADER_LENGTH 3
+
+#define BULK_OP_START 'S'   // size (4 bytes, little endian, 0 = unknown) + file name
+#define BULK_OP_DATA  'D'   // up to 1024 bytes of the file
+#define BULK_OP_END   'E'   // number of bytes sent (4 bytes, little endian)
+#define BULK_OP_ACK   'A'   // receiver got message BULK_SEQ
+
+typedef struct _BULK_STATS
+{
+    uint32_t tx_blocks;     // XMODEM blocks from the PC forwarded over IR
+    uint32_t tx_bytes;
+    uint32_t tx_retries;    // IR messages sent again because no ack came back
+    uint32_t bad_packets;   // XMODEM packets with a bad crc / block number, NAKed
+    uint32_t failed;        // transfers that were cancelled
+    uint32_t rx_blocks;     // blocks received over IR and printed
+    uint32_t rx_bytes;
+    uint32_t rx_duplicates; // block received again because our ack got lost
+}
+BULK_STATS;
+
+bool runBulkTransfer(uint8_t address);
+void handleBulkMessage(const uint8_t* data, uint16_t length);
+BULK_STATS* getBulkStats();
+
+#endif
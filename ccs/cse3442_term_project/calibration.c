@@ -0,0 +1,265 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "calibration.h"
+#include "csma.h"
+#include "ir_frame.h"
+#include "ir_channel.h"
+#include "timestamp.h"
+#include "priority.h"
+#include "uart0.h"
+#include "uart7.h"
+#include "pwm.h"
+#include "wait.h"
+#include "strings.h"
+#include "scheduler.h"
+
+/*
+ *  Pulse width distortion calibration
+ *
+ *  The TSOP134 does not give back the exact same pulse widths that went in, the
+ *  datasheet says the output pulse can be up to ~5-6 carrier periods longer or shorter
+ *  than the burst and it changes with distance, ambient light and the carrier duty cycle.
+ *  If the marks (low = carrier on) get stretched too much the UART samples the wrong bit.
+ *
+ *  So the handshake goes like this:
+ *  1. transmitter sends a CAL_REQUEST frame, receiver turns on edge capture on PE0
+ *  2. transmitter sends a CAL_PATTERN frame full of 0x55 (alternating 1s and 0s)
+ *  3. receiver timestamps every edge, and every pulse should be a whole number of
+ *     bit times, so whatever is left over is the distortion. It averages that for
+ *     the marks and spaces and sends it back in a CAL_RESULT frame
+ *  4. transmitter nudges the carrier duty cycle (CMPA) and repeats until the mark
+ *     bias is within one carrier period
+ *
+ *  The edge capture uses the GPIO port E interrupt on PE0, the GPIO interrupt logic
+ *  still sees the pin even though AFSEL gives it to UART7. The interrupt stays on all
+ *  the time since csma.c uses the edge timestamps for carrier sense.
+ */
+
+#define RX_PIN_MASK 1   // PE0 = U7Rx
+
+#define CAL_ROUNDS 6
+#define CAL_PATTERN_LENGTH 32
+#define CAL_TIMEOUT_MS 3000
+#define CAL_TOLERANCE_US 26     // about one period of the 38 kHz carrier
+#define CAL_DUTY_STEP 5
+#define CAL_DUTY_MIN 10
+#define CAL_DUTY_MAX 60
+#define CAL_MAX_BITS 10         // anything longer is an idle gap and not a pulse
+
+// receiver side capture state, written in the edge interrupt
+static volatile bool capture_armed = false;
+static volatile bool have_edge = false;
+static volatile uint32_t last_edge = 0;
+static volatile uint32_t bit_cycles = 0;
+static volatile int32_t mark_error_sum = 0;
+static volatile int32_t space_error_sum = 0;
+static volatile uint16_t mark_count = 0;
+static volatile uint16_t space_count = 0;
+
+// transmitter side, filled in when the CAL_RESULT frame comes back
+static volatile bool result_ready = false;
+static volatile int16_t result_mark_bias = 0;
+static volatile int16_t result_space_bias = 0;
+static volatile uint16_t result_mark_count = 0;
+
+void initCalibration()
+{
+    // PE0 is already set up as U7Rx by initUart7, here we just make it
+    // interrupt on both edges
+    GPIO_PORTE_IM_R &= ~RX_PIN_MASK;    // mask first so nothing fires while configuring
+    GPIO_PORTE_IS_R &= ~RX_PIN_MASK;    // edge sensitive
+    GPIO_PORTE_IBE_R |= RX_PIN_MASK;    // both edges
+    GPIO_PORTE_ICR_R = RX_PIN_MASK;     // clear anything pending
+    GPIO_PORTE_IM_R |= RX_PIN_MASK;
+
+    // page 104: GPIO Port E = Interrupt 4, which is in NVIC_EN0_R bit 4
+    NVIC_PRI1_R = (NVIC_PRI1_R & ~NVIC_PRI1_INT4_M) | (PRIORITY_EDGE << NVIC_PRI1_INT4_S);
+    NVIC_EN0_R |= 1 << (INT_GPIOE - 16);
+}
+
+// receiver: start timing the pulses of the next frame
+void armCalibrationCapture()
+{
+    bit_cycles = (TIMESTAMP_TICKS_PER_US * 1000000) / getUart7BaudRate();
+    mark_error_sum = 0;
+    space_error_sum = 0;
+    mark_count = 0;
+    space_count = 0;
+    have_edge = false;
+    capture_armed = true;
+}
+
+// times the pulse that just ended against the bit time
+static void capturePulse(uint32_t now)
+{
+    bool high_now = GPIO_PORTE_DATA_R & RX_PIN_MASK;
+    uint32_t width = now - last_edge;
+    last_edge = now;
+
+    // the first edge is just the reference point
+    if (!have_edge)
+    {
+        have_edge = true;
+        return;
+    }
+
+    // round to the nearest whole number of bits
+    uint32_t bits = (width + bit_cycles / 2) / bit_cycles;
+    if (bits == 0 || bits > CAL_MAX_BITS)
+        return;
+
+    int32_t error = (int32_t)(width - bits * bit_cycles);
+
+    // if the line is high now then a low (mark, carrier on) just ended
+    if (high_now)
+    {
+        mark_error_sum += error;
+        mark_count++;
+    }
+    else
+    {
+        space_error_sum += error;
+        space_count++;
+    }
+}
+
+// edge interrupt on PE0, feeds carrier sense and times pulses while a capture is armed
+void PortE_Handler(void)
+{
+    uint32_t now = getTimestamp();
+    GPIO_PORTE_ICR_R = RX_PIN_MASK;
+
+    noteRxEdge();
+
+    if (capture_armed)
+        capturePulse(now);
+
+    // it shares priority 0 with UART7, so this is also how long UART7 can wait on it
+    noteEdgeIsr(now);
+}
+
+// the pulse widths are DWT cycles, which stop in a tickless sleep, so the board stays
+// awake while a capture is armed
+bool isCalibrationCapturing()
+{
+    return capture_armed;
+}
+
+// receiver: the pattern frame finished, so work out the bias and send it back
+void finishCalibrationCapture()
+{
+    char str[12];
+    uint8_t payload[6];
+
+    if (!capture_armed)
+        return;
+
+    capture_armed = false;
+
+    int16_t mark_bias = 0;
+    int16_t space_bias = 0;
+
+    if (mark_count)
+        mark_bias = (mark_error_sum / mark_count) / TIMESTAMP_TICKS_PER_US;
+    if (space_count)
+        space_bias = (space_error_sum / space_count) / TIMESTAMP_TICKS_PER_US;
+
+    payload[0] = mark_bias & 0xFF;
+    payload[1] = (mark_bias >> 8) & 0xFF;
+    payload[2] = space_bias & 0xFF;
+    payload[3] = (space_bias >> 8) & 0xFF;
+    payload[4] = mark_count & 0xFF;
+    payload[5] = (mark_count >> 8) & 0xFF;
+    queueIrFrame(IR_FRAME_CAL_RESULT, payload, sizeof(payload));   // from the events thread
+
+    putsUart0("\r\nCalibration: mark bias ");
+    putsUart0(toAsciiDec(str, mark_bias));
+    putsUart0(" us, space bias ");
+    putsUart0(toAsciiDec(str, space_bias));
+    putsUart0(" us, ");
+    putsUart0(toAsciiDec(str, mark_count));
+    putsUart0(" marks\r\n");
+}
+
+// transmitter: the receiver sent back what it measured
+void handleCalibrationResult(IR_FRAME* frame)
+{
+    if (frame->length < 6)
+        return;
+
+    result_mark_bias = (int16_t)(frame->payload[0] | (frame->payload[1] << 8));
+    result_space_bias = (int16_t)(frame->payload[2] | (frame->payload[3] << 8));
+    result_mark_count = frame->payload[4] | (frame->payload[5] << 8);
+    result_ready = true;
+}
+
+// transmitter: runs the whole handshake, returns true if it ended up in tolerance
+bool runCalibration()
+{
+    char str[12];
+    uint8_t pattern[CAL_PATTERN_LENGTH];
+    uint8_t round;
+    uint8_t i;
+
+    for (i = 0; i < CAL_PATTERN_LENGTH; i++)
+        pattern[i] = 0x55;
+
+    for (round = 1; round <= CAL_ROUNDS; round++)
+    {
+        result_ready = false;
+
+        sendIrFrame(IR_FRAME_CAL_REQUEST, &round, 1);
+        sendIrFrame(IR_FRAME_CAL_PATTERN, pattern, CAL_PATTERN_LENGTH);
+
+        uint32_t ms = 0;
+        while (!result_ready && ms < CAL_TIMEOUT_MS)
+        {
+            runTasks();   // the result frame is handled from the channel 0 ring
+            waitMicrosecond(1000);
+            ms++;
+        }
+
+        if (!result_ready)
+        {
+            putsUart0("\r\nCalibration: no response from the other board\r\n");
+            return false;
+        }
+
+        putsUart0("\r\nCalibration round ");
+        putsUart0(toAsciiDec(str, round));
+        putsUart0(": duty ");
+        putsUart0(toAsciiDec(str, getPWMDutyCycle()));
+        putsUart0("%, mark bias ");
+        putsUart0(toAsciiDec(str, result_mark_bias));
+        putsUart0(" us, space bias ");
+        putsUart0(toAsciiDec(str, result_space_bias));
+        putsUart0(" us\r\n");
+
+        if (result_mark_count == 0)
+        {
+            putsUart0("Calibration: receiver did not see any pulses\r\n");
+            return false;
+        }
+
+        int16_t bias = result_mark_bias;
+        if (bias <= CAL_TOLERANCE_US && bias >= -CAL_TOLERANCE_US)
+        {
+            putsUart0("Calibration done\r\n");
+            return true;
+        }
+
+        // more carrier energy per cycle makes the TSOP trigger sooner and release
+        // later, so stretched marks mean the duty cycle should go down
+        uint8_t duty = getPWMDutyCycle();
+        if (bias > 0)
+            duty = (duty - CAL_DUTY_STEP < CAL_DUTY_MIN) ? CAL_DUTY_MIN : duty - CAL_DUTY_STEP;
+        else
+            duty = (duty + CAL_DUTY_STEP > CAL_DUTY_MAX) ? CAL_DUTY_MAX : duty + CAL_DUTY_STEP;
+
+        setPWMDutyCycle(duty);
+    }
+
+    putsUart0("Calibration: still out of tolerance, keeping the last duty cycle\r\n");
+    return false;
+}
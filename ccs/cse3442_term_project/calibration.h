@@ -0,0 +1,15 @@
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+
+void initCalibration();
+void armCalibrationCapture();
+void finishCalibrationCapture();
+bool isCalibrationCapturing();
+void handleCalibrationResult(IR_FRAME* frame);
+bool runCalibration();
+
+#endif
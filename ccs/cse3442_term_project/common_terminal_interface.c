@@ -5,6 +5,15 @@
 #include "uart7.h"
 #include "strings.h"
 
+// called over and over while getsUart0 is waiting for the next character,
+// so other stuff (like the extra IR channels) can get handled in the meantime
+static void (*idle_callback)() = 0;
+
+void setTerminalIdleCallback(void (*callback)())
+{
+    idle_callback = callback;
+}
+
 // this function is what receives the input string from the terminal
 void getsUart0(USER_DATA *input)
 {
@@ -13,6 +22,12 @@ void getsUart0(USER_DATA *input)
 
     while(1)
     {
+        while (!kbhitUart0())
+        {
+            if (idle_callback)
+                idle_callback();
+        }
+
         // read each inputted character from terminal and store into temp variable
         temp_char = getcUart0();
 
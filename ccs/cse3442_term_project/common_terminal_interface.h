@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define MAX_CHARS 80
+#define MAX_CHARS 250     // has to fit in the uint8_t field positions
 #define MAX_FIELDS 5
 
 typedef struct _USER_DATA
@@ -16,6 +16,7 @@ typedef struct _USER_DATA
 }
 USER_DATA;
 
+void setTerminalIdleCallback(void (*callback)());
 void getsUart0(USER_DATA *input);
 void parseFields(USER_DATA *input);
 char* getFieldString(USER_DATA *input, uint8_t fieldNumber);
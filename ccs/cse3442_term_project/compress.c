@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "compress.h"
+#include "ir_frame.h"
+#include "timestamp.h"
+
+/*
+ *  LZSS compression for frame payloads
+ *
+ *  At 1200 baud a byte is ~9 ms on the wire, so a few saved bytes matter. The payload
+ *  is at most 64 bytes, so the window is just the payload itself and everything works
+ *  on small fixed buffers (no heap). The output is groups of 8 items behind a flag byte,
+ *  bit n of the flag says what item n is:
+ *    0 = literal byte
+ *    1 = match, 2 bytes: how far back it starts - 1, length - LZSS_MIN_MATCH
+ *  The match can run into the bytes it is copying (like "abababab" = "ab" + match 2 back).
+ *
+ *  If it doesn't come out smaller the frame just goes raw. Compressed frames have
+ *  IR_FRAME_COMPRESSED set in the type byte, so raw and compressed can be mixed and
+ *  the receiver always understands both, even with compression off.
+ */
+
+#define LZSS_MIN_MATCH 3        // a match costs 2 bytes so it has to cover at least 3
+#define LZSS_MIN_LENGTH 12      // shorter payloads aren't worth trying
+
+static bool enabled = false;
+static COMPRESS_STATS stats;
+
+void setCompression(bool on)
+{
+    enabled = on;
+}
+
+bool getCompression()
+{
+    return enabled;
+}
+
+static uint8_t lzss(const uint8_t* in, uint8_t length, uint8_t* out, uint8_t max)
+{
+    uint8_t in_pos = 0;
+    uint8_t out_pos = 0;
+    uint8_t flag_pos = 0;
+    uint8_t bit = 8;
+
+    while (in_pos < length)
+    {
+        uint8_t best_length = 0;
+        uint8_t best_start = 0;
+        uint8_t start;
+
+        // new flag byte every 8 items
+        if (bit == 8)
+        {
+            if (out_pos >= max)
+                return 0;
+            flag_pos = out_pos++;
+            out[flag_pos] = 0;
+            bit = 0;
+        }
+
+        // longest match anywhere before this point, payloads are tiny so just try them all
+        for (start = 0; start < in_pos; start++)
+        {
+            uint8_t match = 0;
+
+            while (in_pos + match < length && in[start + match] == in[in_pos + match])
+                match++;
+
+            if (match > best_length)
+            {
+                best_length = match;
+                best_start = start;
+            }
+        }
+
+        if (best_length >= LZSS_MIN_MATCH)
+        {
+            if (out_pos + 2 > max)
+                return 0;
+            out[flag_pos] |= 1 << bit;
+            out[out_pos++] = in_pos - best_start - 1;
+            out[out_pos++] = best_length - LZSS_MIN_MATCH;
+            in_pos += best_length;
+        }
+        else
+        {
+            if (out_pos + 1 > max)
+                return 0;
+            out[out_pos++] = in[in_pos++];
+        }
+
+        bit++;
+    }
+
+    return out_pos;
+}
+
+// returns the compressed length, or 0 if the payload should just be sent raw.
+// out needs to be IR_FRAME_MAX_PAYLOAD bytes
+uint8_t compressPayload(const uint8_t* in, uint8_t length, uint8_t* out)
+{
+    uint32_t start;
+    uint8_t out_length;
+
+    if (!enabled || length < LZSS_MIN_LENGTH)
+        return 0;
+
+    start = getTimestamp();
+    out_length = lzss(in, length, out, length - 1);
+    stats.cycles += getTimestamp() - start;
+
+    if (!out_length)
+    {
+        stats.raw++;
+        return 0;
+    }
+
+    stats.compressed++;
+    stats.bytes_in += length;
+    stats.bytes_out += out_length;
+    return out_length;
+}
+
+// undoes compressPayload, out needs to be IR_FRAME_MAX_PAYLOAD bytes.
+// returns false if the data doesn't make sense
+bool decompressPayload(const uint8_t* in, uint8_t length, uint8_t* out, uint8_t* out_length)
+{
+    uint8_t in_pos = 0;
+    uint8_t out_pos = 0;
+    uint8_t flags = 0;
+    uint8_t bit = 8;
+
+    while (in_pos < length)
+    {
+        if (bit == 8)
+        {
+            flags = in[in_pos++];
+            bit = 0;
+            continue;
+        }
+
+        if (flags & (1 << bit))
+        {
+            if (in_pos + 2 > length)
+                break;
+
+            uint8_t back = in[in_pos++] + 1;
+            uint16_t match = in[in_pos++] + LZSS_MIN_MATCH;
+
+            if (back > out_pos || out_pos + match > IR_FRAME_MAX_PAYLOAD)
+                break;
+
+            while (match--)
+            {
+                out[out_pos] = out[out_pos - back];
+                out_pos++;
+            }
+        }
+        else
+        {
+            if (out_pos >= IR_FRAME_MAX_PAYLOAD)
+                break;
+            out[out_pos++] = in[in_pos++];
+        }
+
+        bit++;
+    }
+
+    if (in_pos != length)
+    {
+        stats.errors++;
+        return false;
+    }
+
+    stats.decompressed++;
+    *out_length = out_pos;
+    return true;
+}
+
+COMPRESS_STATS* getCompressStats()
+{
+    return &stats;
+}
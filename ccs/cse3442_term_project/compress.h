@@ -0,0 +1,25 @@
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _COMPRESS_STATS
+{
+    uint32_t compressed;    // frames that went out compressed
+    uint32_t raw;           // tried but it didn't get any smaller
+    uint32_t bytes_in;      // payload bytes before / after, for the frames that got compressed
+    uint32_t bytes_out;
+    uint32_t cycles;        // CPU cycles spent compressing (all tries)
+    uint32_t decompressed;  // compressed frames received
+    uint32_t errors;        // compressed frames that didn't decompress
+}
+COMPRESS_STATS;
+
+void setCompression(bool on);
+bool getCompression();
+uint8_t compressPayload(const uint8_t* in, uint8_t length, uint8_t* out);
+bool decompressPayload(const uint8_t* in, uint8_t length, uint8_t* out, uint8_t* out_length);
+COMPRESS_STATS* getCompressStats();
+
+#endif
@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "csma.h"
+#include "echo.h"
+#include "timestamp.h"
+#include "uart7.h"
+#include "ir_channel.h"
+#include "ir_frame.h"
+#include "kernel.h"
+#include "scheduler.h"
+#include "priority.h"
+
+/*
+ *  Carrier sense multiple access for UART7
+ *
+ *  With 3+ boards in the same room everyone hears everyone, so two send commands at
+ *  the same time land on top of each other and both frames are garbage. Before a frame
+ *  goes out this listens to the medium first:
+ *  1. carrier sense: the PE0 edge interrupt (see calibration.c) timestamps every edge
+ *     from the TSOP134, the medium is busy until there has been no edge for a couple
+ *     of byte times (a frame never has a gap that long between bytes)
+ *  2. random backoff: wait a random number of slots (1 byte time each) from the
+ *     contention window, and the countdown freezes while the medium is busy so the
+ *     boards that lost don't all jump in at the same time once it frees up
+ *  3. collision detection: we hear our own echo, so if the bytes that come back
+ *     don't match what was sent (echo mismatch) somebody else was talking too.
+ *     Then the window doubles and the frame is sent again
+ *
+ *  Collision detection only works when an echo has been seen, otherwise it is just
+ *  CSMA without the CD part and a collision shows up as a CRC error at the receiver.
+ *
+ *  A send can take up to CSMA_MAX_DEFER_MS plus the retries, and the shell holds
+ *  tx_lock for all of that. The events thread (RX side) can't sit behind it, so its
+ *  replies (pongs, sync replies, calibration results, mesh relays, batch flushes) use
+ *  queueIrWire: it goes out right away if nobody is sending, otherwise it is copied
+ *  into a small queue. Whoever has tx_lock next sends the queue first so nothing gets
+ *  out of order, and the EVENT_TX task (pollIrTx) picks up the rest once it is free.
+ */
+
+#define BITS_PER_BYTE 11            // 8E1 = start + 8 data + parity + stop
+#define CSMA_IDLE_BYTES 2           // quiet time before the medium counts as free
+#define CSMA_MIN_WINDOW 8           // slots in the contention window on the first try
+#define CSMA_MAX_WINDOW 128
+#define CSMA_MAX_RETRIES 5
+#define CSMA_MAX_DEFER_MS 2000      // medium stuck busy (sunlight, jammer), send anyways
+#define CSMA_ECHO_BITS 48           // same as the echo late window in echo.c
+#define CSMA_TX_QUEUE 4             // replies waiting while the shell has the transmitter
+
+typedef struct _TX_ENTRY
+{
+    uint8_t address;
+    uint8_t length;
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+}
+TX_ENTRY;
+
+static bool enabled = true;
+static volatile uint32_t last_edge = 0;  // getUptimeUs, the DWT stops in a tickless sleep
+static uint32_t seed = 0;
+static CSMA_STATS stats;
+static SEMAPHORE tx_lock = { 1 };
+static TX_ENTRY tx_queue[CSMA_TX_QUEUE];
+static uint8_t tx_head = 0;
+static volatile uint8_t tx_count = 0;
+static uint32_t room_events = 0;        // posted once a spot in tx_queue frees up
+
+static uint32_t bitUs()
+{
+    return 1000000 / getUart7BaudRate();
+}
+
+// xorshift32, seeded from the cycle counter the first time so each board gets a
+// different sequence (it depends on when the user typed the first command)
+static uint32_t nextRandom()
+{
+    if (seed == 0)
+        seed = getTimestamp() | 1;
+
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// puts the frame in the TX FIFO, behind a node address byte if addressing is on
+static void putWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    uint8_t i;
+
+    if (getIrNode() != IR_NODE_NONE)
+        putAddressUart7(address);
+
+    for (i = 0; i < length; i++)
+        putcUart7(wire[i]);
+}
+
+static void waitUs(uint32_t us)
+{
+    uint32_t start = getUptimeUs();
+    while (((uint32_t)getUptimeUs() - start) < us);
+}
+
+void setCsma(bool on)
+{
+    enabled = on;
+}
+
+bool getCsma()
+{
+    return enabled;
+}
+
+// called by the PE0 edge interrupt for every edge out of the TSOP134, the edge can be
+// what woke the board up so it can't be a cycle count
+void noteRxEdge()
+{
+    last_edge = getUptimeUs();
+}
+
+bool isMediumBusy()
+{
+    return ((uint32_t)getUptimeUs() - last_edge) < CSMA_IDLE_BYTES * BITS_PER_BYTE * bitUs();
+}
+
+// waits for the medium to go quiet, returns false if it gave up
+static bool waitForIdleMedium()
+{
+    uint32_t start = getUptimeUs();
+
+    while (isMediumBusy())
+    {
+        if (((uint32_t)getUptimeUs() - start) > CSMA_MAX_DEFER_MS * 1000)
+            return false;
+    }
+
+    return true;
+}
+
+// sends one encoded frame out of UART7, listening first if csma is on
+static void transmit(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    uint8_t attempt;
+
+    if (!enabled)
+    {
+        putWire(address, wire, length);
+        return;
+    }
+
+    stats.frames++;
+
+    for (attempt = 0; attempt <= CSMA_MAX_RETRIES; attempt++)
+    {
+        uint32_t window = CSMA_MIN_WINDOW << attempt;
+        uint32_t slot_us = BITS_PER_BYTE * bitUs();
+        bool forced = false;
+
+        if (window > CSMA_MAX_WINDOW)
+            window = CSMA_MAX_WINDOW;
+
+        // mix in the last edge time too, two boards that started at the same time
+        // still hear slightly different things
+        seed ^= last_edge;
+        uint32_t slots = nextRandom() % window;
+        stats.backoff_slots += slots;
+
+        if (isMediumBusy())
+            stats.deferrals++;
+
+        // count down the backoff, but only while the medium is free
+        if (!waitForIdleMedium())
+            forced = true;
+        while (slots && !forced)
+        {
+            waitUs(slot_us);
+            if (isMediumBusy())
+                forced = !waitForIdleMedium();
+            else
+                slots--;
+        }
+
+        if (forced)
+            stats.forced++;
+
+        uint32_t mismatches = getEchoStats()->mismatches;
+
+        stats.attempts++;
+        putWire(address, wire, length);
+
+        // no echo means there is nothing to check the frame against
+        if (!isEchoSeen())
+            return;
+
+        // let the last byte finish and give its echo time to come back
+        while (UART7_FR_R & UART_FR_BUSY);
+        waitUs(CSMA_ECHO_BITS * bitUs());
+
+        if (getEchoStats()->mismatches == mismatches)
+            return;
+
+        stats.collisions++;
+    }
+
+    stats.dropped++;
+}
+
+// sends the queued replies oldest first, tx_lock has to be held
+static void sendQueued()
+{
+    TX_ENTRY entry;
+
+    while (true)
+    {
+        uint32_t state = enterCritical();
+        uint32_t events = room_events;
+
+        if (!tx_count)
+        {
+            exitCritical(state);
+            return;
+        }
+
+        // copied out so the events thread can queue into the spot while it's sent
+        entry = tx_queue[tx_head];
+        tx_head = (tx_head + 1) % CSMA_TX_QUEUE;
+        tx_count--;
+        room_events = 0;
+        exitCritical(state);
+
+        if (events)
+            postEvent(events);
+
+        transmit(entry.address, entry.wire, entry.length);
+    }
+}
+
+// lets go of the transmitter, if something got queued while we had it the events
+// thread sends it
+static void releaseTx()
+{
+    postSemaphore(&tx_lock);
+
+    if (tx_count)
+        postEvent(EVENT_TX);
+}
+
+// the shell sends frames through here and waits its turn for the transmitter
+void transmitIrWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    waitSemaphore(&tx_lock);
+    sendQueued();
+    transmit(address, wire, length);
+    releaseTx();
+}
+
+// same for the events thread, which never waits for the shell: it goes out now if the
+// transmitter is free, otherwise it is queued for later. False if the queue is full
+bool queueIrWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    uint8_t i;
+
+    if (tryWaitSemaphore(&tx_lock))
+    {
+        sendQueued();
+        transmit(address, wire, length);
+        releaseTx();
+        return true;
+    }
+
+    uint32_t state = enterCritical();
+
+    if (tx_count == CSMA_TX_QUEUE)
+    {
+        stats.queue_full++;
+        exitCritical(state);
+        return false;
+    }
+
+    TX_ENTRY* entry = &tx_queue[(tx_head + tx_count) % CSMA_TX_QUEUE];
+    entry->address = address;
+    entry->length = length;
+    for (i = 0; i < length; i++)
+        entry->wire[i] = wire[i];
+    tx_count++;
+    stats.queued++;
+
+    exitCritical(state);
+
+    // if the shell let go in the meantime it didn't see this one, so look again
+    postEvent(EVENT_TX);
+    return true;
+}
+
+// something that couldn't be queued wants these events posted once there is room
+void notifyIrTxRoom(uint32_t events)
+{
+    uint32_t state = enterCritical();
+    bool room = tx_count < CSMA_TX_QUEUE;
+
+    if (!room)
+        room_events |= events;
+
+    exitCritical(state);
+
+    if (room)
+        postEvent(events);
+}
+
+// the EVENT_TX task, sends the queue once the shell is done with the transmitter (it
+// posts EVENT_TX again when it lets go if it's still busy now)
+void pollIrTx()
+{
+    if (!tryWaitSemaphore(&tx_lock))
+        return;
+
+    sendQueued();
+    releaseTx();
+}
+
+CSMA_STATS* getCsmaStats()
+{
+    return &stats;
+}
@@ -0,0 +1,31 @@
+#ifndef CSMA_H_
+#define CSMA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _CSMA_STATS
+{
+    uint32_t frames;        // frames handed to transmitIrWire
+    uint32_t attempts;      // times a frame actually went out (first try + retries)
+    uint32_t deferrals;     // times the medium was busy when we wanted to send
+    uint32_t backoff_slots; // total random backoff slots waited
+    uint32_t collisions;    // attempts where the echo came back wrong
+    uint32_t dropped;       // frames that collided on every retry
+    uint32_t forced;        // medium never went quiet so it was sent anyways
+    uint32_t queued;        // replies from the events thread that had to wait for the shell
+    uint32_t queue_full;    // replies that didn't fit in the queue either
+}
+CSMA_STATS;
+
+void setCsma(bool on);
+bool getCsma();
+void noteRxEdge();
+bool isMediumBusy();
+void transmitIrWire(uint8_t address, const uint8_t* wire, uint8_t length);
+bool queueIrWire(uint8_t address, const uint8_t* wire, uint8_t length);
+void notifyIrTxRoom(uint32_t events);
+void pollIrTx();
+CSMA_STATS* getCsmaStats();
+
+#endif
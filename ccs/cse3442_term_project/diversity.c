@@ -0,0 +1,237 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "diversity.h"
+#include "ir_frame.h"
+
+/*
+ *  Receiver diversity combiner
+ *
+ *  With 2 or 3 TSOP134s looking at the same transmitter, every frame shows up once
+ *  per receiver at almost the same time. All the copies that end within window_ms
+ *  of the first one are treated as the same frame:
+ *  - the first copy that passes its crc gets delivered right away, the rest are dropped
+ *  - if none pass and there are 3 copies, each byte is voted on (2 out of 3 wins) and
+ *    the voted frame is delivered if that passes the crc
+ *  - otherwise the frame is lost
+ *
+ *  This file doesn't touch any hardware, the caller passes in the raw copies and the
+ *  time, so the same code can be compiled on a PC to try it with made up errors.
+ */
+
+static void copyBytes(uint8_t* to, const uint8_t* from, uint8_t length)
+{
+    uint8_t i;
+    for (i = 0; i < length; i++)
+        to[i] = from[i];
+}
+
+static bool sameBytes(const uint8_t* a, const uint8_t* b, uint8_t length)
+{
+    uint8_t i;
+    for (i = 0; i < length; i++)
+    {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+// receivers = 0 turns it off, window_ms should be a couple of byte times
+void initDiversity(DIVERSITY* d, uint8_t receivers, uint32_t window_ms)
+{
+    uint8_t i;
+
+    if (receivers > DIVERSITY_MAX_RECEIVERS)
+        receivers = DIVERSITY_MAX_RECEIVERS;
+
+    d->receivers = receivers;
+    d->window_ms = window_ms;
+    d->window_open = false;
+    d->delivered = false;
+    d->last_length = 0;
+
+    for (i = 0; i < DIVERSITY_MAX_RECEIVERS; i++)
+    {
+        d->copies[i].present = false;
+        d->stats[i].good = 0;
+        d->stats[i].bad = 0;
+        d->stats[i].missing = 0;
+    }
+
+    d->delivered_frames = 0;
+    d->voted_frames = 0;
+    d->lost_frames = 0;
+    d->duplicates = 0;
+}
+
+// remembers what got delivered and passes it up
+static bool deliver(DIVERSITY* d, const uint8_t* raw, uint8_t length, uint32_t now_ms)
+{
+    copyBytes(d->last_raw, raw, length);
+    d->last_length = length;
+    d->last_time = now_ms;
+    d->delivered = true;
+    d->delivered_frames++;
+    return true;
+}
+
+// 2 out of 3 vote on every byte, needs at least 2 copies with the same length
+static bool voteCopies(DIVERSITY* d, uint8_t* voted, uint8_t* length)
+{
+    DIVERSITY_COPY* a = &d->copies[0];
+    DIVERSITY_COPY* b = &d->copies[1];
+    DIVERSITY_COPY* c = &d->copies[2];
+    uint8_t i;
+
+    if (d->receivers < 3 || !a->present || !b->present || !c->present)
+        return false;
+
+    // a dropped or extra byte shifts everything, so only vote on the length most copies agree on
+    if (a->length == b->length || a->length == c->length)
+        *length = a->length;
+    else if (b->length == c->length)
+        *length = b->length;
+    else
+        return false;
+
+    for (i = 0; i < *length; i++)
+    {
+        uint8_t va = (i < a->length) ? a->raw[i] : 0;
+        uint8_t vb = (i < b->length) ? b->raw[i] : 0;
+        uint8_t vc = (i < c->length) ? c->raw[i] : 0;
+
+        if (va == vb || va == vc)
+            voted[i] = va;
+        else
+            voted[i] = vb;  // either b == c, or all three are different and it doesn't matter
+    }
+
+    return true;
+}
+
+// the window is over, if nothing got through yet then use a good copy that had to
+// wait, or vote, and then update the stats
+static bool closeWindow(DIVERSITY* d, uint32_t now_ms, IR_FRAME* frame)
+{
+    bool result = false;
+    uint8_t i;
+
+    if (!d->delivered)
+    {
+        uint8_t voted[IR_FRAME_MAX_ENCODED];
+        uint8_t length;
+
+        for (i = 0; i < d->receivers && !result; i++)
+        {
+            DIVERSITY_COPY* copy = &d->copies[i];
+
+            if (copy->present && decodeIrFrame(copy->raw, copy->length, frame))
+                result = deliver(d, copy->raw, copy->length, now_ms);
+        }
+
+        if (!result)
+        {
+            if (voteCopies(d, voted, &length) && decodeIrFrame(voted, length, frame))
+            {
+                d->voted_frames++;
+                result = deliver(d, voted, length, now_ms);
+            }
+            else
+            {
+                d->lost_frames++;
+            }
+        }
+    }
+
+    for (i = 0; i < d->receivers; i++)
+    {
+        if (!d->copies[i].present)
+            d->stats[i].missing++;
+
+        d->copies[i].present = false;
+    }
+
+    d->window_open = false;
+    d->delivered = false;
+
+    return result;
+}
+
+// hands the combiner one copy of a frame from one receiver, returns true if a frame
+// should be delivered (it is then in *frame)
+bool submitDiversityCopy(DIVERSITY* d, uint8_t receiver, const uint8_t* raw, uint8_t length,
+                         uint32_t now_ms, IR_FRAME* frame)
+{
+    IR_FRAME decoded;
+    bool result = false;
+    uint8_t i;
+
+    if (receiver >= d->receivers || length > IR_FRAME_MAX_ENCODED)
+        return false;
+
+    // the time ran out, or this receiver already has a copy in the window
+    // so this must be the next frame
+    if (d->window_open && (d->copies[receiver].present || now_ms - d->window_start > d->window_ms))
+        result = closeWindow(d, now_ms, frame);
+
+    if (!d->window_open)
+    {
+        d->window_open = true;
+        d->window_start = now_ms;
+    }
+
+    DIVERSITY_COPY* copy = &d->copies[receiver];
+    copyBytes(copy->raw, raw, length);
+    copy->length = length;
+    copy->present = true;
+
+    if (decodeIrFrame(raw, length, &decoded))
+    {
+        d->stats[receiver].good++;
+
+        // a late copy of the frame that was just delivered
+        bool repeat = (length == d->last_length) && (now_ms - d->last_time <= 2 * d->window_ms)
+                      && sameBytes(raw, d->last_raw, length);
+
+        if (d->delivered || repeat)
+        {
+            d->duplicates++;
+            d->delivered = true;
+        }
+        else if (!result)
+        {
+            *frame = decoded;
+            result = deliver(d, raw, length, now_ms);
+        }
+        // else the last window just gave a frame, so this one waits for closeWindow
+    }
+    else
+    {
+        d->stats[receiver].bad++;
+    }
+
+    // once every receiver has its copy there is nothing left to wait for
+    for (i = 0; i < d->receivers; i++)
+    {
+        if (!d->copies[i].present)
+            return result;
+    }
+
+    if (result)
+    {
+        closeWindow(d, now_ms, &decoded);
+        return true;
+    }
+
+    return closeWindow(d, now_ms, frame);
+}
+
+// call this every so often, it closes the window once the time runs out (which is
+// when the vote happens if some receivers didn't send a good copy)
+bool pollDiversity(DIVERSITY* d, uint32_t now_ms, IR_FRAME* frame)
+{
+    if (d->window_open && now_ms - d->window_start > d->window_ms)
+        return closeWindow(d, now_ms, frame);
+
+    return false;
+}
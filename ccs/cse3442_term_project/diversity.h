@@ -0,0 +1,56 @@
+#ifndef DIVERSITY_H_
+#define DIVERSITY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+
+#define DIVERSITY_MAX_RECEIVERS 3
+
+// one received copy of a frame, still COBS encoded
+typedef struct _DIVERSITY_COPY
+{
+    uint8_t raw[IR_FRAME_MAX_ENCODED];
+    uint8_t length;
+    bool present;
+}
+DIVERSITY_COPY;
+
+typedef struct _DIVERSITY_RECEIVER_STATS
+{
+    uint32_t good;      // copies that passed crc on their own
+    uint32_t bad;       // copies that failed crc
+    uint32_t missing;   // frames this receiver didn't get at all
+}
+DIVERSITY_RECEIVER_STATS;
+
+// the combiner, no hardware in here so it only depends on what is passed in
+typedef struct _DIVERSITY
+{
+    uint8_t receivers;              // 0 = off, 2 or 3
+    uint32_t window_ms;             // how long to wait for the other copies of a frame
+
+    DIVERSITY_COPY copies[DIVERSITY_MAX_RECEIVERS];
+    bool window_open;
+    bool delivered;                 // a good copy of the current frame was already passed up
+    uint32_t window_start;
+
+    // last frame passed up, so a late copy of it doesn't get delivered twice
+    uint8_t last_raw[IR_FRAME_MAX_ENCODED];
+    uint8_t last_length;
+    uint32_t last_time;
+
+    DIVERSITY_RECEIVER_STATS stats[DIVERSITY_MAX_RECEIVERS];
+    uint32_t delivered_frames;
+    uint32_t voted_frames;          // frames only recovered by the byte-wise vote
+    uint32_t lost_frames;           // no copy was good and the vote didn't work either
+    uint32_t duplicates;            // extra good copies that were dropped
+}
+DIVERSITY;
+
+void initDiversity(DIVERSITY* d, uint8_t receivers, uint32_t window_ms);
+bool submitDiversityCopy(DIVERSITY* d, uint8_t receiver, const uint8_t* raw, uint8_t length,
+                         uint32_t now_ms, IR_FRAME* frame);
+bool pollDiversity(DIVERSITY* d, uint32_t now_ms, IR_FRAME* frame);
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "echo.h"
+#include "timestamp.h"
+#include "uart7.h"
+
+/*
+ *  Self echo suppression for UART7
+ *
+ *  The IR333A light bounces off stuff and lands in our own TSOP134, so while the board
+ *  is sending it also receives its own bytes. To run full duplex we remember every
+ *  byte that goes into the UART7 TX FIFO and when it should be done on the wire, and
+ *  when a byte comes in around that time and it is the same byte, it is our echo and
+ *  gets dropped before the message / frame code ever sees it.
+ *
+ *  If an echo does show up, the other board's signal is going to land on top of our
+ *  own echo whenever both send at the same time, so in auto mode it switches to half
+ *  duplex: before starting to send, it waits until nothing has been received for a
+ *  few byte times (the turnaround), and anything heard while sending is thrown away.
+ *
+ *  The times are getUptimeUs, not DWT cycles. The board can be in a tickless sleep
+ *  between a byte going out or coming in and the next one, and the DWT doesn't count
+ *  while it sleeps.
+ */
+
+#define ECHO_RING_SIZE 32           // power of 2, more than the 16 byte TX FIFO
+#define ECHO_RING_MASK (ECHO_RING_SIZE - 1)
+#define BITS_PER_BYTE 11            // 8E1 = start + 8 data + parity + stop
+#define ECHO_LATE_BITS 48           // RX time out is 32 bit times, plus TSOP delay and slack
+#define TURNAROUND_BYTES 4          // quiet time needed before sending in half duplex
+#define TURNAROUND_MAX_MS 1000      // give up waiting after this and send anyways
+
+typedef struct _ECHO_ENTRY
+{
+    uint8_t c;
+    uint32_t due;   // getUptimeUs when the stop bit is done on the wire
+}
+ECHO_ENTRY;
+
+static ECHO_ENTRY entries[ECHO_RING_SIZE];
+static volatile uint8_t head = 0;       // written by putcUart7
+static volatile uint8_t tail = 0;       // written by the RX interrupt
+static uint32_t busy_until = 0;         // when the last byte in the TX FIFO will be done
+static volatile uint32_t last_rx = 0;   // when the last byte from the other board came in
+
+static uint8_t mode = DUPLEX_AUTO;
+static volatile bool echo_seen = false;
+static ECHO_STATS stats;
+
+static uint32_t bitUs()
+{
+    return 1000000 / getUart7BaudRate();
+}
+
+void setDuplexMode(uint8_t new_mode)
+{
+    mode = new_mode;
+    echo_seen = false;
+}
+
+uint8_t getDuplexMode()
+{
+    return mode;
+}
+
+bool isHalfDuplex()
+{
+    return (mode == DUPLEX_HALF) || (mode == DUPLEX_AUTO && echo_seen);
+}
+
+// true once any of our own bytes came back, so a mismatch can mean a collision
+bool isEchoSeen()
+{
+    return echo_seen;
+}
+
+// called by putcUart7 right before each byte goes into the TX FIFO
+void noteEchoTx(uint8_t c)
+{
+    uint32_t now = getUptimeUs();
+    uint32_t byte_us = BITS_PER_BYTE * bitUs();
+    uint8_t next = (head + 1) & ECHO_RING_MASK;
+
+    // the byte starts once everything in front of it is out
+    if ( !(UART7_FR_R & UART_FR_BUSY) || (int32_t)(busy_until - now) < 0 )
+        busy_until = now;
+    busy_until += byte_us;
+
+    if (next == tail)
+        return; // can't happen with a 16 byte FIFO, but then it just won't be filtered
+
+    entries[head].c = c;
+    entries[head].due = busy_until;
+    head = next;
+}
+
+// called by the UART7 RX interrupt for every byte, returns true if it is our own echo
+// (or anything heard while sending in half duplex) and should be dropped
+bool isEcho(uint8_t c)
+{
+    uint32_t now = getUptimeUs();
+    uint32_t bit_us = bitUs();
+    int32_t late = ECHO_LATE_BITS * bit_us;
+    int32_t early = BITS_PER_BYTE * bit_us;
+
+    // anything whose echo should have shown up by now never will
+    while (tail != head && (int32_t)(now - entries[tail].due) > late)
+    {
+        tail = (tail + 1) & ECHO_RING_MASK;
+        stats.expired++;
+    }
+
+    if (tail != head && (int32_t)(now - entries[tail].due) >= -early)
+    {
+        uint8_t i = tail;
+
+        // the echoes come back in order, but the ones in front of this byte may have been
+        // lost or garbled (or drowned out by the other board), so it can be any of the
+        // bytes that are on the wire by now
+        while (i != head && (int32_t)(now - entries[i].due) >= -early && entries[i].c != c)
+            i = (i + 1) & ECHO_RING_MASK;
+
+        if (i != head && (int32_t)(now - entries[i].due) >= -early)
+        {
+            stats.expired += (i - tail) & ECHO_RING_MASK;
+            tail = (i + 1) & ECHO_RING_MASK;
+            stats.echoes++;
+            echo_seen = true;
+            return true;
+        }
+
+        stats.mismatches++;
+
+        // in half duplex nobody else should be sending now, so it is a garbled echo
+        if (isHalfDuplex())
+        {
+            tail = (tail + 1) & ECHO_RING_MASK;
+            return true;
+        }
+
+        // in full duplex it can be the other board's byte coming in between our echoes,
+        // so the one we are waiting for stays put. A byte of the other board that is the
+        // same as one of ours on the wire right then can't be told apart
+    }
+
+    last_rx = now;
+    return false;
+}
+
+// called by putcUart7 before the first byte of a burst, in half duplex it waits for the
+// other board to be quiet for a few byte times so we don't talk over it.
+// This busy waits in the caller's thread (shell or event thread) for up to
+// TURNAROUND_MAX_MS, nothing else at that thread's priority or below runs meanwhile
+void waitForTurnaround()
+{
+    uint32_t quiet_us;
+    uint32_t start;
+    bool waited = false;
+
+    if (!isHalfDuplex() || (UART7_FR_R & UART_FR_BUSY))
+        return;
+
+    quiet_us = TURNAROUND_BYTES * BITS_PER_BYTE * bitUs();
+    start = getUptimeUs();
+
+    while (((uint32_t)getUptimeUs() - last_rx) < quiet_us &&
+           ((uint32_t)getUptimeUs() - start) < TURNAROUND_MAX_MS * 1000)
+    {
+        waited = true;
+    }
+
+    if (waited)
+        stats.turnarounds++;
+}
+
+ECHO_STATS* getEchoStats()
+{
+    return &stats;
+}
@@ -0,0 +1,29 @@
+#ifndef ECHO_H_
+#define ECHO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DUPLEX_FULL 0   // send whenever, just filter out our own echo
+#define DUPLEX_HALF 1   // wait for the other board to finish before sending
+#define DUPLEX_AUTO 2   // full duplex until an echo shows up, then half duplex
+
+typedef struct _ECHO_STATS
+{
+    uint32_t echoes;        // own bytes that came back and were dropped
+    uint32_t mismatches;    // byte heard while sending that was not our own
+    uint32_t expired;       // sent bytes that never came back (no reflection)
+    uint32_t turnarounds;   // times a send had to wait for the other board
+}
+ECHO_STATS;
+
+void setDuplexMode(uint8_t mode);
+uint8_t getDuplexMode();
+bool isHalfDuplex();
+bool isEchoSeen();
+void noteEchoTx(uint8_t c);
+bool isEcho(uint8_t c);
+void waitForTurnaround();
+ECHO_STATS* getEchoStats();
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "fragment.h"
+#include "ir_frame.h"
+#include "ir_link.h"
+#include "pwm.h"
+#include "uart7.h"
+
+/*
+ *  Fragmentation and reassembly
+ *
+ *  A frame only holds 64 bytes, so anything bigger gets cut into numbered fragments
+ *  (each one its own frame with its own crc) and put back together on the other side.
+ *  The fragments can show up in any order, each one goes straight to its spot in the
+ *  buffer and a bitmap keeps track of which ones are in. Once they all are, the whole
+ *  message gets handled like a normal frame of that type would be (processIrMessage).
+ *
+ *  If a fragment gets lost there is no resend at this level, so a message that stops
+ *  getting new fragments for a while is thrown away to free up the buffer.
+ */
+
+// messages that can be put back together at the same time, 2 is a file going across and
+// something else on the side. Each is FRAGMENT_MAX_MESSAGE of RAM, about 2 KB for both
+#ifndef FRAGMENT_SLOTS
+#define FRAGMENT_SLOTS 2
+#endif
+#define FRAGMENT_MAX_COUNT ((FRAGMENT_MAX_MESSAGE + FRAGMENT_DATA - 1) / FRAGMENT_DATA)
+#define FRAGMENT_TIMEOUT_MS 2000    // plus a few frame times, see fragmentTimeoutMs
+
+typedef struct _FRAGMENT_SLOT
+{
+    bool used;
+    uint8_t channel;
+    uint8_t id;
+    uint8_t type;
+    uint8_t count;
+    uint8_t received;
+    uint16_t length;                            // known once the last fragment is in
+    uint32_t last_ms;                           // when the last fragment came in
+    uint32_t have[(FRAGMENT_MAX_COUNT + 31) / 32];
+    uint8_t buffer[FRAGMENT_MAX_MESSAGE];
+}
+FRAGMENT_SLOT;
+
+static FRAGMENT_SLOT slots[FRAGMENT_SLOTS];
+static uint8_t next_id = 0;
+static FRAGMENT_STATS stats;
+
+// about 3 frame times at the current baud rate on top of the fixed part, so it still
+// works at 300 baud where one full frame takes over 2 seconds
+static uint32_t fragmentTimeoutMs()
+{
+    return FRAGMENT_TIMEOUT_MS + (3 * IR_FRAME_MAX_WIRE * 11 * 1000) / getUart7BaudRate();
+}
+
+// sends data of any length up to FRAGMENT_MAX_MESSAGE, one frame if it fits
+bool sendIrMessageTo(uint8_t address, uint8_t type, const uint8_t* data, uint16_t length)
+{
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+    uint8_t count;
+    uint8_t index;
+    uint8_t i;
+
+    if (length <= IR_FRAME_MAX_PAYLOAD)
+    {
+        sendIrFrameTo(address, type, data, length);
+        return true;
+    }
+
+    // the receiver drops any fragment with offset + size past FRAGMENT_MAX_MESSAGE, and
+    // the last fragment ends at length, so this is the same check for all of them
+    if (length > FRAGMENT_MAX_MESSAGE)
+        return false;
+
+    count = (length + FRAGMENT_DATA - 1) / FRAGMENT_DATA;
+    payload[FRAGMENT_ID] = next_id++;
+    payload[FRAGMENT_COUNT] = count;
+    payload[FRAGMENT_TYPE] = type;
+
+    for (index = 0; index < count; index++)
+    {
+        uint16_t offset = index * FRAGMENT_DATA;
+        uint8_t size = (length - offset > FRAGMENT_DATA) ? FRAGMENT_DATA : length - offset;
+
+        payload[FRAGMENT_INDEX] = index;
+        for (i = 0; i < size; i++)
+            payload[FRAGMENT_HEADER_LENGTH + i] = data[offset + i];
+
+        sendIrFrameTo(address, IR_FRAME_FRAGMENT, payload, FRAGMENT_HEADER_LENGTH + size);
+        stats.sent_fragments++;
+    }
+
+    stats.sent_messages++;
+    return true;
+}
+
+// finds the slot for this message, or starts a new one (kicking out the oldest if full)
+static FRAGMENT_SLOT* findSlot(uint8_t channel, uint8_t id, uint8_t count, uint8_t type)
+{
+    FRAGMENT_SLOT* oldest = &slots[0];
+    FRAGMENT_SLOT* slot = 0;
+    uint8_t i;
+
+    for (i = 0; i < FRAGMENT_SLOTS; i++)
+    {
+        if (slots[i].used && slots[i].channel == channel && slots[i].id == id &&
+            slots[i].count == count && slots[i].type == type)
+            return &slots[i];
+
+        if (!slots[i].used)
+            slot = &slots[i];
+        else if (oldest->used && (int32_t)(slots[i].last_ms - oldest->last_ms) < 0)
+            oldest = &slots[i];
+    }
+
+    if (!slot)
+    {
+        slot = oldest;
+        stats.evicted++;
+    }
+
+    slot->used = true;
+    slot->channel = channel;
+    slot->id = id;
+    slot->count = count;
+    slot->type = type;
+    slot->received = 0;
+    slot->length = 0;
+    for (i = 0; i < sizeof(slot->have) / sizeof(slot->have[0]); i++)
+        slot->have[i] = 0;
+
+    return slot;
+}
+
+void handleFragmentFrame(uint8_t channel, IR_FRAME* frame)
+{
+    uint8_t i;
+
+    if (frame->length <= FRAGMENT_HEADER_LENGTH)
+    {
+        stats.bad++;
+        return;
+    }
+
+    uint8_t index = frame->payload[FRAGMENT_INDEX];
+    uint8_t count = frame->payload[FRAGMENT_COUNT];
+    uint8_t size = frame->length - FRAGMENT_HEADER_LENGTH;
+
+    uint16_t offset = index * FRAGMENT_DATA;
+
+    // only the last fragment can be short, and it has to fit in the buffer (the last
+    // fragment slot of FRAGMENT_MAX_COUNT goes past FRAGMENT_MAX_MESSAGE)
+    if (count > FRAGMENT_MAX_COUNT || index >= count ||
+        (index < count - 1 && size != FRAGMENT_DATA) ||
+        offset + size > FRAGMENT_MAX_MESSAGE)
+    {
+        stats.bad++;
+        return;
+    }
+
+    stats.rx_fragments++;
+
+    FRAGMENT_SLOT* slot = findSlot(channel, frame->payload[FRAGMENT_ID], count, frame->payload[FRAGMENT_TYPE]);
+    slot->last_ms = getUptimeMs();
+
+    if (slot->have[index / 32] & (1u << (index % 32)))
+    {
+        stats.duplicates++;
+        return;
+    }
+
+    slot->have[index / 32] |= 1u << (index % 32);
+    slot->received++;
+
+    for (i = 0; i < size; i++)
+        slot->buffer[offset + i] = frame->payload[FRAGMENT_HEADER_LENGTH + i];
+
+    if (index == count - 1)
+        slot->length = offset + size;
+
+    if (slot->received == slot->count)
+    {
+        slot->used = false;
+        stats.reassembled++;
+        processIrMessage(channel, slot->type, slot->buffer, slot->length);
+    }
+}
+
+// runs every tick, throws away messages that stopped getting fragments
+void pollFragments()
+{
+    uint32_t now = getUptimeMs();
+    uint8_t i;
+
+    for (i = 0; i < FRAGMENT_SLOTS; i++)
+    {
+        if (slots[i].used && (now - slots[i].last_ms) > fragmentTimeoutMs())
+        {
+            slots[i].used = false;
+            stats.timeouts++;
+        }
+    }
+}
+
+FRAGMENT_STATS* getFragmentStats()
+{
+    return &stats;
+}
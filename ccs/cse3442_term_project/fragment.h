@@ -0,0 +1,42 @@
+#ifndef FRAGMENT_H_
+#define FRAGMENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+#include "bulk.h"
+
+// fragment header at the front of an IR_FRAME_FRAGMENT payload
+#define FRAGMENT_ID 0       // message id, the same for every fragment of one message
+#define FRAGMENT_INDEX 1    // which fragment this is, 0 to count - 1
+#define FRAGMENT_COUNT 2    // how many fragments the message has
+#define FRAGMENT_TYPE 3     // frame type the whole message is (like IR_FRAME_TEXT)
+#define FRAGMENT_HEADER_LENGTH 4
+#define FRAGMENT_DATA (IR_FRAME_MAX_PAYLOAD - FRAGMENT_HEADER_LENGTH)
+
+// every reassembly slot has a buffer this big. send lines are at most MAX_CHARS (250),
+// so the biggest message is an xfer block: 1 KB of the file behind the bulk header.
+// Build with -DFRAGMENT_MAX_MESSAGE=4096 to take bigger ones from somewhere else
+#ifndef FRAGMENT_MAX_MESSAGE
+#define FRAGMENT_MAX_MESSAGE (BULK_HEADER_LENGTH + 1024)
+#endif
+
+typedef struct _FRAGMENT_STATS
+{
+    uint32_t sent_messages;     // messages that had to be split up
+    uint32_t sent_fragments;
+    uint32_t rx_fragments;
+    uint32_t reassembled;       // messages that came in complete
+    uint32_t duplicates;        // fragment already had, dropped
+    uint32_t timeouts;          // incomplete messages thrown away
+    uint32_t evicted;           // incomplete, pushed out by a new message (slots full)
+    uint32_t bad;               // header doesn't make sense, or no room
+}
+FRAGMENT_STATS;
+
+bool sendIrMessageTo(uint8_t address, uint8_t type, const uint8_t* data, uint16_t length);
+void handleFragmentFrame(uint8_t channel, IR_FRAME* frame);
+void pollFragments();
+FRAGMENT_STATS* getFragmentStats();
+
+#endif
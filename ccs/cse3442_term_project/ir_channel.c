@@ -0,0 +1,523 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "ir_channel.h"
+#include "ir_frame.h"
+#include "ir_link.h"
+#include "diversity.h"
+#include "echo.h"
+#include "uart.h"
+#include "uart0.h"
+#include "pwm.h"
+#include "uart7.h"
+#include "priority.h"
+#include "scheduler.h"
+#include "trace.h"
+
+/*
+ *  Extra IR channels
+ *
+ *  Each extra channel is its own UART with its own LED / TSOP134 circuit (same inverter +
+ *  AND gate as UART7, all fed from the PB6 carrier). Unlike UART7 they are fully interrupt
+ *  driven: the ISR only moves bytes between the FIFOs and the ring buffers, and the main
+ *  loop (pollIrRx) does the message handling and printing. That way an ISR never
+ *  does more than one FIFO worth of work, so one busy channel can't starve the others.
+ *
+ *  TX uses the EOT interrupt like UART7: fill the FIFO, and once it is completely sent
+ *  refill it or release the carrier if the ring is empty.
+ *
+ *  UART7 (channel 0) still sends with the blocking putcUart7, but its RX goes through
+ *  the ring the same way, so every channel is handled in pollIrRx (the ISRs post
+ *  EVENT_IR_RX for it).
+ *
+ *  Receiver diversity: with diversity on, channel 3 (U5Rx on PE4) and channel 2
+ *  (U3Rx on PC6) are wired to extra TSOP134s looking at the same transmitter as UART7,
+ *  and the frames from all of them go through the combiner in diversity.c instead of
+ *  being handled on their own.
+ *
+ *  Message timeout: when a message or frame stops in the middle (lost terminator, beam
+ *  blocked), nothing would ever end it and the next one gets glued on. The RX timeout
+ *  interrupt (RTIM) hands over the last few bytes as soon as the line goes quiet, and
+ *  after every batch of bytes that leaves a channel mid-message its timer gets started.
+ *  If it runs out with nothing new in the ring, a frame is thrown away and a text line
+ *  is ended where it is, and either way it counts as truncated.
+ *
+ *  Node addressing: with a node id set, UART7 (and the diversity receivers) run in 9 bit
+ *  mode and every frame goes out behind an address byte. The UART hardware throws away
+ *  frames for other nodes, so a busy shared room doesn't cost us RX interrupts. The
+ *  matching address byte itself still lands in the FIFO, and since it is outside of a
+ *  frame it just gets dropped here.
+ */
+
+#define UART_FIFO_SIZE 16
+#define RX_GAP_BYTES 8          // quiet time (in characters) that ends a message
+#define RX_GAP_MIN_MS 10
+#define BITS_PER_CHAR 11        // start + 8 data + parity + stop
+#define RING_MASK (IR_CHANNEL_BUFFER_SIZE - 1)
+
+static DIVERSITY diversity;
+static int8_t node = IR_NODE_NONE;
+
+IR_CHANNEL irChannels[IR_CHANNEL_COUNT] =
+{
+    { .uart = 7, .start = true },
+    { .uart = 1, .start = true },
+    { .uart = 3, .start = true },
+    { .uart = 5, .start = true },
+};
+
+// SysTick context, the pollIrRx task does the actual reset
+static void rxTimeout(void* context)
+{
+    IR_CHANNEL* ch = context;
+
+    ch->rx_timed_out = true;
+    postEvent(EVENT_IR_RX);
+}
+
+static uint32_t rxTimeoutMs()
+{
+    return (RX_GAP_BYTES * BITS_PER_CHAR * 1000) / getUart7BaudRate() + RX_GAP_MIN_MS;
+}
+
+void initIrChannels()
+{
+    uint8_t i;
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        initTimer(&irChannels[i].rx_timer, rxTimeout, &irChannels[i]);
+
+    // channel 0 (UART7) is set up by initUart7 / init_uart7_rx_interrupt
+    for (i = 1; i < IR_CHANNEL_COUNT; i++)
+    {
+        uint32_t base = uartConfig[irChannels[i].uart].uart_base;
+
+        initUart(irChannels[i].uart, 1200, UART_8E1);
+
+        // EOT so the TX interrupt means "completely sent", same as UART7
+        UART_REG(base, UART_O_CTL) &= ~UART_CTL_UARTEN;
+        UART_REG(base, UART_O_CTL) |= UART_CTL_EOT;
+        UART_REG(base, UART_O_CTL) |= UART_CTL_UARTEN;
+
+        enableUartRxInterrupt(irChannels[i].uart, PRIORITY_IR_CHANNEL);
+    }
+}
+
+// fills the TX FIFO from the ring, or releases the carrier once everything is out
+// (called with the TX interrupt masked or from the ISR itself)
+static void fillTxFifo(uint8_t channel)
+{
+    IR_CHANNEL* ch = &irChannels[channel];
+    uint32_t base = uartConfig[ch->uart].uart_base;
+    uint8_t count = 0;
+
+    if (ch->tx_tail == ch->tx_head)
+    {
+        if ( !(UART_REG(base, UART_O_FR) & UART_FR_BUSY) )
+        {
+            UART_REG(base, UART_O_IM) &= ~UART_IM_TXIM;
+            carrierOff(channel);
+        }
+        else
+        {
+            UART_REG(base, UART_O_IM) |= UART_IM_TXIM; // still sending, check again at EOT
+        }
+        return;
+    }
+
+    carrierOn(channel);
+
+    while (ch->tx_tail != ch->tx_head && count < UART_FIFO_SIZE && !(UART_REG(base, UART_O_FR) & UART_FR_TXFF))
+    {
+        UART_REG(base, UART_O_DR) = ch->tx_buffer[ch->tx_tail];
+        ch->tx_tail = (ch->tx_tail + 1) & RING_MASK;
+        ch->tx_bytes++;
+        count++;
+    }
+
+    UART_REG(base, UART_O_IM) |= UART_IM_TXIM;
+}
+
+// moves everything in a channel's RX FIFO into its ring (called from its ISR)
+void drainIrChannelRx(uint8_t channel)
+{
+    IR_CHANNEL* ch = &irChannels[channel];
+    uint32_t base = uartConfig[ch->uart].uart_base;
+    uint16_t head = ch->rx_head;
+
+    while ( !(UART_REG(base, UART_O_FR) & UART_FR_RXFE) )
+    {
+        uint32_t data = UART_REG(base, UART_O_DR);
+        uint8_t c = data & UART_DR_DATA_M;
+        uint16_t next = (ch->rx_head + 1) & RING_MASK;
+
+        // UART7 hears its own LED, drop those before anything else sees them (a garbled
+        // echo still goes through here so it counts as a mismatch for csma)
+        if (channel == 0)
+        {
+            bool echo = isEcho(c);
+
+            traceByte(c, ((data & UART_RX_ERRORS) >> 8) | (echo ? TRACE_ECHO : 0));
+            if (echo)
+                continue;
+        }
+
+        if (data & UART_RX_ERRORS)
+        {
+            // overrun means bytes were lost before this one, but this one is fine
+            if (data & UART_DR_OE)
+                ch->rx_overruns++;
+
+            // the others mean this byte itself is junk, so it never makes it into the
+            // ring and the frame it was in fails its crc instead of printing garbage
+            if (data & (UART_DR_BE | UART_DR_PE | UART_DR_FE))
+            {
+                if (data & UART_DR_BE)
+                    ch->rx_breaks++;
+                else if (data & UART_DR_FE)
+                    ch->rx_framing_errors++;
+                else
+                    ch->rx_parity_errors++;
+
+                ch->rx_bytes++;
+                continue;
+            }
+        }
+
+        if (next == ch->rx_tail)
+        {
+            ch->rx_overflows++; // main loop is not keeping up, drop it
+        }
+        else
+        {
+            ch->rx_buffer[ch->rx_head] = c;
+            ch->rx_head = next;
+        }
+        ch->rx_bytes++;
+    }
+
+    // the RX ISRs are above the kernel's critical sections, so the event gets posted
+    // from IrRxEvent_Handler at a priority that is allowed to
+    if (ch->rx_head != head)
+        triggerRxEvent();
+}
+
+// the shared ISR for every extra channel
+static void irChannelIsr(uint8_t channel)
+{
+    IR_CHANNEL* ch = &irChannels[channel];
+    uint32_t base = uartConfig[ch->uart].uart_base;
+    uint32_t status = UART_REG(base, UART_O_MIS);
+
+    UART_REG(base, UART_O_ICR) = status;
+
+    drainIrChannelRx(channel);
+
+    if (status & UART_MIS_TXMIS)
+    {
+        fillTxFifo(channel);
+    }
+}
+
+void Uart1_Handler(void)
+{
+    irChannelIsr(1);
+}
+
+void Uart3_Handler(void)
+{
+    irChannelIsr(2);
+}
+
+void Uart5_Handler(void)
+{
+    irChannelIsr(3);
+}
+
+// queues bytes to be sent on an extra channel, returns false (and sends nothing)
+// if they don't all fit in the ring
+bool writeIrChannel(uint8_t channel, const uint8_t* data, uint16_t length)
+{
+    IR_CHANNEL* ch = &irChannels[channel];
+    uint32_t base;
+    uint16_t free_space;
+    uint16_t i;
+
+    if (channel == 0 || channel >= IR_CHANNEL_COUNT)
+        return false;
+
+    free_space = (ch->tx_tail - ch->tx_head - 1) & RING_MASK;
+    if (length > free_space)
+    {
+        ch->tx_overflows++;
+        return false;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        ch->tx_buffer[ch->tx_head] = data[i];
+        ch->tx_head = (ch->tx_head + 1) & RING_MASK;
+    }
+
+    // kick the transmitter, mask the TX interrupt so the ISR doesn't refill at the same time
+    base = uartConfig[ch->uart].uart_base;
+    UART_REG(base, UART_O_IM) &= ~UART_IM_TXIM;
+    fillTxFifo(channel);
+
+    return true;
+}
+
+// diversity receiver number for a channel, or -1 if the channel is not one of them
+static int8_t diversityReceiver(uint8_t channel)
+{
+    int8_t receiver = -1;
+
+    if (channel == 0)
+        receiver = 0;   // UART7 on PE0
+    else if (channel == 3)
+        receiver = 1;   // UART5 on PE4
+    else if (channel == 2)
+        receiver = 2;   // UART3 on PC6
+
+    if (receiver >= diversity.receivers)
+        return -1;
+
+    return receiver;
+}
+
+// handles one received byte: frames start with SOH and get decoded (or go to the
+// diversity combiner), anything else is an old style text message that is printed
+// as it comes in and ends with a 0
+static void handleChannelByte(uint8_t channel, uint8_t c)
+{
+    IR_CHANNEL* ch = &irChannels[channel];
+    int8_t receiver = diversityReceiver(channel);
+    IR_FRAME frame;
+
+    // a second SOH right after the first one restarts the frame, that happens when the
+    // node 0 address byte (0x01) comes in just before the frame. An encoded frame can't
+    // start with 0x01 since the type byte is never 0
+    if (c == IR_FRAME_SOH && (ch->start || (ch->in_frame && ch->frame_rx.length == 0)))
+    {
+        resetIrFrameRx(&ch->frame_rx);
+        ch->in_frame = true;
+        ch->start = false;
+        return;
+    }
+
+    if (ch->in_frame)
+    {
+        if (receiver >= 0)
+        {
+            // the combiner decides which copy (if any) gets used
+            if (collectIrFrameRaw(&ch->frame_rx, c) && !ch->frame_rx.overflow)
+            {
+                ch->rx_frames++;
+                if (submitDiversityCopy(&diversity, receiver, ch->frame_rx.buffer, ch->frame_rx.length,
+                                        getUptimeMs(), &frame))
+                {
+                    processIrFrame(0, &frame);
+                }
+            }
+        }
+        else if (collectIrFrameByte(&ch->frame_rx, c, &frame))
+        {
+            ch->rx_frames++;
+            processIrFrame(channel, &frame);
+        }
+
+        if (!c)
+        {
+            ch->in_frame = false;
+            ch->start = true;
+        }
+        return;
+    }
+
+    // the extra receivers would just print the same text again
+    if (receiver > 0)
+        return;
+
+    // only address bytes show up outside of frames in 9 bit mode
+    if (node != IR_NODE_NONE && channel == 0)
+        return;
+
+    if (ch->start)
+    {
+        printIrMessageHeader(channel);
+        ch->start = false;
+    }
+
+    putcUart0(c);
+
+    if (!c)
+    {
+        putsUart0("\r\n");
+        ch->rx_messages++;
+        ch->start = true;
+    }
+}
+
+// ends whatever message the channel was in the middle of, called when it went quiet.
+// Returns true if that was a text message, so the caller can say it got cut off (not
+// in here since it runs with interrupts off)
+static bool resetChannelMessage(IR_CHANNEL* ch)
+{
+    bool cut_off = false;
+
+    if (ch->in_frame)
+    {
+        ch->in_frame = false;   // no terminator, so it never got decoded, just drop it
+        ch->rx_truncated++;
+    }
+    else if (!ch->start)
+    {
+        cut_off = true;
+        ch->rx_truncated++;
+    }
+
+    ch->start = true;
+    return cut_off;
+}
+
+// the EVENT_IR_RX task, handles whatever the ISRs put in the RX rings, round robin
+// one byte per channel so no channel hogs it
+void pollIrRx()
+{
+    bool more = true;
+    uint8_t touched = 0;
+    uint8_t i;
+
+    while (more)
+    {
+        more = false;
+
+        for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        {
+            IR_CHANNEL* ch = &irChannels[i];
+
+            if (ch->rx_tail != ch->rx_head)
+            {
+                uint8_t c = ch->rx_buffer[ch->rx_tail];
+                ch->rx_tail = (ch->rx_tail + 1) & RING_MASK;
+                handleChannelByte(i, c);
+                touched |= 1 << i;
+                more = true;
+            }
+        }
+    }
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+    {
+        IR_CHANNEL* ch = &irChannels[i];
+
+        if (touched & (1 << i))
+        {
+            ch->rx_timed_out = false;   // anything from before these bytes is stale
+
+            if (ch->in_frame || !ch->start)
+                startTimer(&ch->rx_timer, rxTimeoutMs());
+            else
+                stopTimer(&ch->rx_timer);
+        }
+        else if (ch->rx_timed_out)
+        {
+            // a byte that came in after the loop above means the message is still
+            // going, so the ring has to be empty at the same moment as the reset. The
+            // RX ISRs are above enterCritical, so it takes interrupts off. If it isn't
+            // empty the flag stays and the next pass handles those bytes first
+            uint32_t state = disableInterrupts();
+            bool cut_off = false;
+
+            if (ch->rx_tail == ch->rx_head)
+            {
+                ch->rx_timed_out = false;
+                cut_off = resetChannelMessage(ch);
+            }
+
+            restoreInterrupts(state);
+
+            if (cut_off)
+                putsUart0(" (cut off)\r\n");
+        }
+    }
+}
+
+// runs every tick, the combiner votes / gives up on a frame once its window runs out
+void pollIrDiversity()
+{
+    IR_FRAME frame;
+
+    if (diversity.receivers && pollDiversity(&diversity, getUptimeMs(), &frame))
+    {
+        processIrFrame(0, &frame);
+    }
+}
+
+// true when the IR side has nothing going on until the next interrupt, so the core
+// can go to sleep (fragment timeouts are just checked on the next wake up)
+bool isIrChannelIdle()
+{
+    uint8_t i;
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+    {
+        if (irChannels[i].rx_tail != irChannels[i].rx_head)
+            return false;
+    }
+
+    return !diversity.window_open;
+}
+
+// sets the baud rate of the extra channels, they have to match UART7 for diversity
+void setIrChannelBaudRate(uint32_t baudRate)
+{
+    uint8_t i;
+
+    for (i = 1; i < IR_CHANNEL_COUNT; i++)
+        setUartBaudRate(irChannels[i].uart, baudRate, UART_SYSCLOCK);
+
+    if (diversity.receivers)
+        setIrDiversity(diversity.receivers);
+}
+
+// receivers = 0 (off), 2 (PE0 + PE4) or 3 (PE0 + PE4 + PC6)
+void setIrDiversity(uint8_t receivers)
+{
+    // give the other copies about 20 bit times to show up after the first one
+    initDiversity(&diversity, receivers, (20 * 1000) / getUart7BaudRate() + 2);
+    setIrNode(node);
+}
+
+DIVERSITY* getIrDiversity()
+{
+    return &diversity;
+}
+
+// node = 0 to 7, or IR_NODE_NONE to go back to 8E1 and hear everything
+void setIrNode(int8_t new_node)
+{
+    uint8_t i;
+
+    node = new_node;
+
+    if (node == IR_NODE_NONE)
+        clearUart7Address();
+    else
+        setUart7Address(IR_NODE_ADDRESS(node), IR_NODE_ADDRESS(node));
+
+    // the diversity receivers have to filter the same way or they would pass along
+    // the frames UART7 dropped, the rest are separate links and stay 8E1
+    for (i = 1; i < IR_CHANNEL_COUNT; i++)
+    {
+        if (node != IR_NODE_NONE && diversityReceiver(i) > 0)
+            setUartAddress(irChannels[i].uart, IR_NODE_ADDRESS(node), IR_NODE_ADDRESS(node));
+        else
+            clearUartAddress(irChannels[i].uart, UART_8E1);
+    }
+}
+
+int8_t getIrNode()
+{
+    return node;
+}
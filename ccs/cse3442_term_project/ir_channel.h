@@ -0,0 +1,72 @@
+#ifndef IR_CHANNEL_H_
+#define IR_CHANNEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+#include "diversity.h"
+#include "timer.h"
+
+// channel 0 is the original UART7 link (handled by Uart7_Rx_Handler in main.c),
+// channels 1 - 3 are extra IR transceivers on UART1 (PB0/PB1), UART3 (PC6/PC7)
+// and UART5 (PE4/PE5), all sharing the one 38 KHz carrier on PB6
+#define IR_CHANNEL_COUNT 4
+
+// has to be a power of 2 so the ring indexes can just be masked
+#define IR_CHANNEL_BUFFER_SIZE 128
+
+// node addressing, node n matches any address byte with bit n set, so an address
+// can be one node (1 << n), a few of them, or IR_FRAME_BROADCAST for all of them
+#define IR_NODE_COUNT 8
+#define IR_NODE_NONE -1
+#define IR_NODE_ADDRESS(node) (1 << (node))
+
+typedef struct _IR_CHANNEL
+{
+    uint8_t uart;
+
+    // ring buffers, the ISR writes rx_head / reads tx_tail and the main loop does the opposite
+    uint8_t rx_buffer[IR_CHANNEL_BUFFER_SIZE];
+    volatile uint16_t rx_head;
+    volatile uint16_t rx_tail;
+    uint8_t tx_buffer[IR_CHANNEL_BUFFER_SIZE];
+    volatile uint16_t tx_head;
+    volatile uint16_t tx_tail;
+
+    // message / frame state
+    bool start;
+    bool in_frame;
+    IR_FRAME_RX frame_rx;
+    TIMER rx_timer;                 // inter-byte deadline while in the middle of a message
+    volatile bool rx_timed_out;
+
+    // stats
+    volatile uint32_t rx_bytes;
+    volatile uint32_t tx_bytes;
+    uint32_t rx_messages;
+    uint32_t rx_frames;
+    uint32_t rx_truncated;          // messages / frames cut off by the inter-byte timeout
+    volatile uint32_t rx_overflows;
+    volatile uint32_t rx_overruns;          // UART FIFO overran (OE)
+    volatile uint32_t rx_breaks;            // line held low a whole character (BE)
+    volatile uint32_t rx_parity_errors;     // PE, never set in node mode (parity is the address bit)
+    volatile uint32_t rx_framing_errors;    // no stop bit (FE)
+    uint32_t tx_overflows;
+}
+IR_CHANNEL;
+
+extern IR_CHANNEL irChannels[IR_CHANNEL_COUNT];
+
+void initIrChannels();
+bool writeIrChannel(uint8_t channel, const uint8_t* data, uint16_t length);
+void drainIrChannelRx(uint8_t channel);
+void pollIrRx();
+void pollIrDiversity();
+bool isIrChannelIdle();
+void setIrChannelBaudRate(uint32_t baudRate);
+void setIrDiversity(uint8_t receivers);
+DIVERSITY* getIrDiversity();
+void setIrNode(int8_t node);
+int8_t getIrNode();
+
+#endif
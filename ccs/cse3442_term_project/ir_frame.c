@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+#include "csma.h"
+#include "compress.h"
+
+/*
+ *  Frames are used for the control messages between the boards (not the normal
+ *  text messages from the send command). On the wire a frame looks like:
+ *
+ *  SOH | COBS( type | payload... | crc_hi | crc_lo ) | 0
+ *
+ *  COBS (consistent overhead byte stuffing) gets rid of every 0 byte inside the
+ *  body, so the 0 at the end still means "end of message" just like the text
+ *  messages, and the payload can have any binary data in it.
+ */
+
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF), bit by bit since the link is slow anyways
+uint16_t crc16(const uint8_t* data, uint32_t length)
+{
+    return crc16Seed(0xFFFF, data, length);
+}
+
+// same polynomial with any starting value, XMODEM uses init 0
+uint16_t crc16Seed(uint16_t crc, const uint8_t* data, uint32_t length)
+{
+    uint32_t i;
+    uint8_t bit;
+
+    for (i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x8000)
+                crc = (crc << 1) ^ 0x1021;
+            else
+                crc = crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+// builds the whole frame (SOH, COBS encoded body, 0) into out, which needs to be
+// IR_FRAME_MAX_WIRE bytes, and returns how many bytes it is (0 if the payload is too big)
+uint8_t encodeIrFrame(uint8_t type, const uint8_t* payload, uint8_t length, uint8_t* out)
+{
+    uint8_t body[IR_FRAME_MAX_BODY];
+    uint8_t* encoded = &out[1];
+    uint8_t body_length = 0;
+    uint8_t i;
+
+    uint8_t packed[IR_FRAME_MAX_PAYLOAD];
+    uint8_t packed_length;
+
+    if (length > IR_FRAME_MAX_PAYLOAD)
+        return 0;
+
+    // only used if compression is on and it actually came out smaller
+    packed_length = compressPayload(payload, length, packed);
+    if (packed_length)
+    {
+        type |= IR_FRAME_COMPRESSED;
+        payload = packed;
+        length = packed_length;
+    }
+
+    body[body_length++] = type;
+    for (i = 0; i < length; i++)
+        body[body_length++] = payload[i];
+
+    uint16_t crc = crc16(body, body_length);
+    body[body_length++] = crc >> 8;
+    body[body_length++] = crc & 0xFF;
+
+    // COBS: each block starts with a code byte which is the distance to the next 0
+    // (or to the end of the block), and the 0 itself gets dropped
+    uint8_t code_index = 0;
+    uint8_t code = 1;
+    uint8_t out_length = 1;
+
+    for (i = 0; i < body_length; i++)
+    {
+        if (body[i] == 0)
+        {
+            encoded[code_index] = code;
+            code_index = out_length++;
+            code = 1;
+        }
+        else
+        {
+            encoded[out_length++] = body[i];
+            code++;
+        }
+    }
+    encoded[code_index] = code;
+
+    out[0] = IR_FRAME_SOH;
+    out[out_length + 1] = 0;
+
+    return out_length + 2;
+}
+
+// builds the frame and writes it out on UART7 (blocking)
+void sendIrFrame(uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    sendIrFrameTo(IR_FRAME_BROADCAST, type, payload, length);
+}
+
+// same but only the nodes matching address get it (when node addressing is on)
+void sendIrFrameTo(uint8_t address, uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+    uint8_t wire_length = encodeIrFrame(type, payload, length, wire);
+
+    transmitIrWire(address, wire, wire_length);
+}
+
+// from the events thread: never waits for the shell to finish sending, if it can't go
+// right away it is queued (see queueIrWire). False if it was dropped
+bool queueIrFrame(uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    return queueIrFrameTo(IR_FRAME_BROADCAST, type, payload, length);
+}
+
+bool queueIrFrameTo(uint8_t address, uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+    uint8_t wire_length = encodeIrFrame(type, payload, length, wire);
+
+    return queueIrWire(address, wire, wire_length);
+}
+
+// call this when the SOH byte is seen to start collecting a new frame
+void resetIrFrameRx(IR_FRAME_RX* rx)
+{
+    rx->length = 0;
+    rx->overflow = false;
+}
+
+// feed every byte after the SOH into this, it returns true once the terminating 0
+// comes in, and the still encoded frame is left in rx->buffer / rx->length
+bool collectIrFrameRaw(IR_FRAME_RX* rx, uint8_t c)
+{
+    if (c != 0)
+    {
+        if (rx->length < IR_FRAME_MAX_ENCODED)
+            rx->buffer[rx->length++] = c;
+        else
+            rx->overflow = true;
+
+        return false;
+    }
+
+    return true;
+}
+
+// same as collectIrFrameRaw but it also decodes the frame, so it only returns true
+// if the frame decoded with a good crc, the frame is then copied into *frame
+bool collectIrFrameByte(IR_FRAME_RX* rx, uint8_t c, IR_FRAME* frame)
+{
+    if (!collectIrFrameRaw(rx, c))
+        return false;
+
+    if (rx->overflow || !decodeIrFrame(rx->buffer, rx->length, frame))
+    {
+        rx->errors++;
+        return false;
+    }
+
+    return true;
+}
+
+// undoes the COBS encoding (the bytes between the SOH and the 0) and checks the crc,
+// returns true and fills in *frame if it is good
+bool decodeIrFrame(const uint8_t* encoded, uint8_t length, IR_FRAME* frame)
+{
+    uint8_t body[IR_FRAME_MAX_BODY];
+    uint8_t body_length = 0;
+    uint8_t i = 0;
+
+    if (length == 0)
+        return false;
+
+    while (i < length)
+    {
+        uint8_t code = encoded[i++];
+        uint8_t j;
+
+        if (code == 0)
+            return false;
+
+        for (j = 1; j < code; j++)
+        {
+            if (i >= length || body_length >= IR_FRAME_MAX_BODY)
+                return false;
+
+            body[body_length++] = encoded[i++];
+        }
+
+        // the code byte stands for a 0, except for the last block
+        if (code < 0xFF && i < length)
+        {
+            if (body_length >= IR_FRAME_MAX_BODY)
+                return false;
+
+            body[body_length++] = 0;
+        }
+    }
+
+    // need at least the type and the 2 crc bytes
+    if (body_length < 3)
+        return false;
+
+    uint16_t crc = ((uint16_t)body[body_length - 2] << 8) | body[body_length - 1];
+    if (crc16(body, body_length - 2) != crc)
+        return false;
+
+    frame->type = body[0];
+
+    if (frame->type & IR_FRAME_COMPRESSED)
+    {
+        frame->type &= ~IR_FRAME_COMPRESSED;
+        return decompressPayload(&body[1], body_length - 3, frame->payload, &frame->length);
+    }
+
+    frame->length = body_length - 3;
+    for (i = 0; i < frame->length; i++)
+        frame->payload[i] = body[i + 1];
+
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef IR_FRAME_H_
+#define IR_FRAME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// every frame starts with this byte so the receiver can tell it apart from a
+// normal text message (text from the terminal is always >= 32)
+#define IR_FRAME_SOH 0x01
+
+#define IR_FRAME_MAX_PAYLOAD 64
+
+// body = type + payload + 2 byte crc, and COBS adds 1 byte per 254 (+1)
+#define IR_FRAME_MAX_BODY (IR_FRAME_MAX_PAYLOAD + 3)
+#define IR_FRAME_MAX_ENCODED (IR_FRAME_MAX_BODY + 2)
+
+// whole frame on the wire: SOH + encoded body + 0
+#define IR_FRAME_MAX_WIRE (IR_FRAME_MAX_ENCODED + 2)
+
+// node address byte that every node matches (see setIrNode)
+#define IR_FRAME_BROADCAST 0xFF
+
+// set in the type byte when the payload is LZSS compressed (compress.c)
+#define IR_FRAME_COMPRESSED 0x80
+
+// frame types
+#define IR_FRAME_CAL_REQUEST 'C'    // peer should start measuring pulse widths
+#define IR_FRAME_CAL_PATTERN 'P'    // the alternating 0x55 pattern being measured
+#define IR_FRAME_CAL_RESULT  'R'    // measured mark / space bias sent back
+#define IR_FRAME_TEXT        'T'    // a message from the send command
+#define IR_FRAME_MESH        'M'    // mesh message that can be relayed (mesh.h header)
+#define IR_FRAME_FRAGMENT    'F'    // one piece of a message longer than 64 bytes
+#define IR_FRAME_BULK        'B'    // file transfer data / ack (bulk.h header)
+#define IR_FRAME_STREAM      'S'    // raw bytes from the bridge command
+#define IR_FRAME_BATCH       'N'    // several short text messages, each with a length byte
+#define IR_FRAME_PING        'Q'    // RTT probe, echoed right back (ping.h header)
+#define IR_FRAME_PONG        'E'    // the echo of a probe
+#define IR_FRAME_SYNC        'K'    // clock sync request (timesync.h)
+#define IR_FRAME_SYNC_REPLY  'L'    // clock sync answer with the other board's timestamps
+
+typedef struct _IR_FRAME
+{
+    uint8_t type;
+    uint8_t length;
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+}
+IR_FRAME;
+
+// receive state for one link, every IR channel has its own so they don't mix
+typedef struct _IR_FRAME_RX
+{
+    uint8_t buffer[IR_FRAME_MAX_ENCODED];
+    uint8_t length;
+    bool overflow;
+    uint32_t errors;    // frames dropped for bad COBS / crc / overflow
+}
+IR_FRAME_RX;
+
+uint16_t crc16(const uint8_t* data, uint32_t length);
+uint16_t crc16Seed(uint16_t crc, const uint8_t* data, uint32_t length);
+uint8_t encodeIrFrame(uint8_t type, const uint8_t* payload, uint8_t length, uint8_t* out);
+void sendIrFrame(uint8_t type, const uint8_t* payload, uint8_t length);
+void sendIrFrameTo(uint8_t address, uint8_t type, const uint8_t* payload, uint8_t length);
+bool queueIrFrame(uint8_t type, const uint8_t* payload, uint8_t length);
+bool queueIrFrameTo(uint8_t address, uint8_t type, const uint8_t* payload, uint8_t length);
+void resetIrFrameRx(IR_FRAME_RX* rx);
+bool collectIrFrameRaw(IR_FRAME_RX* rx, uint8_t c);
+bool collectIrFrameByte(IR_FRAME_RX* rx, uint8_t c, IR_FRAME* frame);
+bool decodeIrFrame(const uint8_t* encoded, uint8_t length, IR_FRAME* frame);
+
+#endif
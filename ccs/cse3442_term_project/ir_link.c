@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_link.h"
+#include "ir_frame.h"
+#include "ir_channel.h"
+#include "calibration.h"
+#include "mesh.h"
+#include "fragment.h"
+#include "bulk.h"
+#include "bridge.h"
+#include "batch.h"
+#include "ping.h"
+#include "timesync.h"
+#include "uart0.h"
+#include "strings.h"
+
+/*
+ *  this is where every good frame from any IR channel ends up (after the crc check,
+ *  and after the diversity combiner if that is on), and it gets handled by its type.
+ *  Messages that were too long for one frame end up in processIrMessage once all of
+ *  their fragments are in
+ */
+
+// prints the "UART7 RX (IR) Message: " part in front of a received message
+void printIrMessageHeader(uint8_t channel)
+{
+    char str[12];
+
+    if (channel == 0)
+    {
+        putsUart0("\r\nUART7 RX (IR) Message: ");
+        return;
+    }
+
+    putsUart0("\r\nUART");
+    putsUart0(toAsciiDec(str, irChannels[channel].uart));
+    putsUart0(" RX (IR channel ");
+    putsUart0(toAsciiDec(str, channel));
+    putsUart0(") Message: ");
+}
+
+// handles a frame that came in over IR (decoded and crc checked already)
+void processIrFrame(uint8_t channel, IR_FRAME* frame)
+{
+    switch (frame->type)
+    {
+        case IR_FRAME_TEXT:
+        case IR_FRAME_BULK:
+            processIrMessage(channel, frame->type, frame->payload, frame->length);
+            break;
+
+        // bridge data goes straight to the PC if we are bridging too, otherwise it
+        // is just printed like a message
+        case IR_FRAME_STREAM:
+            if (channel == 0 && isBridgeActive())
+                handleBridgeData(frame->payload, frame->length);
+            else
+                processIrMessage(channel, IR_FRAME_TEXT, frame->payload, frame->length);
+            break;
+
+        case IR_FRAME_BATCH:
+            handleBatchFrame(channel, frame->payload, frame->length);
+            break;
+
+        case IR_FRAME_FRAGMENT:
+            handleFragmentFrame(channel, frame);
+            break;
+
+        // the calibration measures edges on PE0, so it only works on UART7
+        case IR_FRAME_CAL_REQUEST:
+            if (channel == 0)
+                armCalibrationCapture();
+            break;
+        case IR_FRAME_CAL_PATTERN:
+            if (channel == 0)
+                finishCalibrationCapture();
+            break;
+        case IR_FRAME_CAL_RESULT:
+            if (channel == 0)
+                handleCalibrationResult(frame);
+            break;
+
+        // ping is timed on the UART7 link
+        case IR_FRAME_PING:
+            if (channel == 0)
+                handlePingFrame(frame);
+            break;
+        case IR_FRAME_PONG:
+            if (channel == 0)
+                handlePongFrame(frame);
+            break;
+
+        // so is the clock sync
+        case IR_FRAME_SYNC:
+            if (channel == 0)
+                handleSyncFrame(frame);
+            break;
+        case IR_FRAME_SYNC_REPLY:
+            if (channel == 0)
+                handleSyncReplyFrame(frame);
+            break;
+
+        // mesh addresses are the UART7 node ids
+        case IR_FRAME_MESH:
+            if (channel == 0)
+                handleMeshFrame(frame);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// handles a whole message of any length, either from one frame or put back together
+// from fragments
+void processIrMessage(uint8_t channel, uint8_t type, const uint8_t* data, uint16_t length)
+{
+    uint16_t i;
+
+    switch (type)
+    {
+        case IR_FRAME_TEXT:
+            printIrMessageHeader(channel);
+            for (i = 0; i < length; i++)
+                putcUart0(data[i]);
+            putsUart0("\r\n");
+            irChannels[channel].rx_messages++;
+            break;
+
+        // the acks go back out on UART7
+        case IR_FRAME_BULK:
+            if (channel == 0)
+                handleBulkMessage(data, length);
+            break;
+
+        default:
+            break;
+    }
+}
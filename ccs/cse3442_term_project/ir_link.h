@@ -0,0 +1,11 @@
+#ifndef IR_LINK_H_
+#define IR_LINK_H_
+
+#include <stdint.h>
+#include "ir_frame.h"
+
+void printIrMessageHeader(uint8_t channel);
+void processIrFrame(uint8_t channel, IR_FRAME* frame);
+void processIrMessage(uint8_t channel, uint8_t type, const uint8_t* data, uint16_t length);
+
+#endif
@@ -0,0 +1,343 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "kernel.h"
+#include "timer.h"
+#include "priority.h"
+
+/*
+ *  Small preemptive kernel
+ *
+ *  Fixed priority threads, the most important ready one always runs. A thread only
+ *  stops running when it blocks (semaphore, queue, sleep), yields, or when an ISR
+ *  makes a more important thread ready. Threads with the same priority take turns
+ *  whenever they block or yield.
+ *
+ *  The switch itself is done in PendSV_Handler (kernel_asm.asm). PendSV has the lowest
+ *  priority, so it only runs once every other ISR is done, and anything that wants a
+ *  switch just sets it pending. Threads run on PSP and the ISRs on MSP, so each thread
+ *  stack only needs room for its own stuff plus one exception frame. The FPU registers
+ *  are only saved for threads that actually used the FPU (lazy stacking, EXC_RETURN
+ *  bit 4 tells PendSV which kind of frame it is).
+ *
+ *  startKernel turns whatever called it (main) into a thread, so main keeps its stack.
+ */
+
+#define THREAD_READY    0
+#define THREAD_BLOCKED  1
+#define THREAD_DONE     2
+
+#define EXC_RETURN_THREAD_PSP 0xFFFFFFFD   // back to thread mode on PSP, no FPU frame
+#define XPSR_THUMB 0x01000000
+
+#define HANDLER_STACK_WORDS 256
+#define IDLE_STACK_WORDS 64
+
+static THREAD threads[THREAD_MAX + 1];  // + the idle thread
+static uint8_t thread_count = 0;
+static THREAD* current = 0;
+static bool running = false;
+static KERNEL_STATS stats;
+
+// AAPCS wants sp 8 byte aligned at every public function call
+#pragma DATA_ALIGN(handler_stack, 8)
+static uint32_t handler_stack[HANDLER_STACK_WORDS];
+#pragma DATA_ALIGN(idle_stack, 8)
+static uint32_t idle_stack[IDLE_STACK_WORDS];
+
+// written by PendSV_Handler
+uint32_t switch_start;
+volatile uint32_t switch_cycles;
+
+// in kernel_asm.asm
+extern void useProcessStack(uint32_t* handler_stack_top);
+
+// a thread that returns ends up here
+static void threadExit()
+{
+    current->state = THREAD_DONE;
+    yieldThread();
+
+    while (1);
+}
+
+// runs when every other thread is blocked
+static void idleThread()
+{
+    while (1)
+        __asm(" WFI");
+}
+
+// sets up a thread's stack so the first PendSV "returns" into entry
+static THREAD* addThread(const char* name, void (*entry)(), uint32_t* stack, uint32_t stack_words, uint8_t priority)
+{
+    THREAD* thread = &threads[thread_count++];
+    // 8 byte aligned, the stack array itself might only be 4 byte aligned
+    uint32_t* sp = (uint32_t*)((uint32_t)&stack[stack_words] & ~7);
+
+    // what the hardware pops on exception return
+    *--sp = XPSR_THUMB;
+    *--sp = (uint32_t)entry;        // pc
+    *--sp = (uint32_t)threadExit;   // lr
+    sp -= 5;                        // r12, r3 - r0
+
+    // what PendSV_Handler pops: r4 - r11 and the EXC_RETURN
+    *--sp = EXC_RETURN_THREAD_PSP;
+    sp -= 8;
+
+    thread->sp = sp;
+    thread->name = name;
+    thread->priority = priority;
+    thread->state = THREAD_READY;
+    thread->waiting_on = 0;
+    thread->switches = 0;
+
+    return thread;
+}
+
+// adds a thread, call it before startKernel. Returns 0 if there is no room
+THREAD* createThread(const char* name, void (*entry)(), uint32_t* stack, uint32_t stack_words, uint8_t priority)
+{
+    if (running || thread_count >= THREAD_MAX - 1)
+        return 0;
+
+    return addThread(name, entry, stack, stack_words, priority);
+}
+
+static void requestSwitch()
+{
+    NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+}
+
+// main becomes the thread called name, and from then on the threads get switched
+void startKernel(const char* name, uint8_t priority)
+{
+    THREAD* thread;
+
+    addThread("idle", idleThread, idle_stack, IDLE_STACK_WORDS, THREAD_LOWEST_PRIORITY + 1);
+
+    // this one doesn't need a made up stack, PendSV fills in sp the first time
+    thread = &threads[thread_count++];
+    thread->name = name;
+    thread->priority = priority;
+    thread->state = THREAD_READY;
+    thread->waiting_on = 0;
+    thread->switches = 1;
+    current = thread;
+
+    // PendSV goes below every ISR, and FPU registers are only stacked if they were used
+    NVIC_SYS_PRI3_R = (NVIC_SYS_PRI3_R & ~NVIC_SYS_PRI3_PENDSV_M) | (PRIORITY_PENDSV << NVIC_SYS_PRI3_PENDSV_S);
+    NVIC_FPCC_R |= NVIC_FPCC_ASPEN | NVIC_FPCC_LSPEN;
+
+    stats.min_switch_cycles = 0xFFFFFFFF;
+
+    // main keeps going on the same stack but as PSP, the ISRs get their own
+    useProcessStack(&handler_stack[HANDLER_STACK_WORDS]);
+
+    running = true;
+    requestSwitch();    // a more important thread may be ready already
+}
+
+bool isKernelRunning()
+{
+    return running;
+}
+
+THREAD* getCurrentThread()
+{
+    return current;
+}
+
+// called from PendSV_Handler with the stack pointer of the thread that was running,
+// returns the stack pointer of the one to run next
+uint32_t* kernelSwitch(uint32_t* sp)
+{
+    THREAD* next = 0;
+    uint8_t start = current - threads;
+    uint8_t i;
+
+    current->sp = sp;
+
+    // time of the switch before this one (it is measured all the way to the end)
+    if (stats.switches)
+    {
+        stats.last_switch_cycles = switch_cycles;
+        stats.switch_cycles += switch_cycles;
+        if (switch_cycles < stats.min_switch_cycles)
+            stats.min_switch_cycles = switch_cycles;
+        if (switch_cycles > stats.max_switch_cycles)
+            stats.max_switch_cycles = switch_cycles;
+    }
+    stats.switches++;
+
+    // most important ready thread, starting after the current one so equal ones take turns
+    for (i = 1; i <= thread_count; i++)
+    {
+        THREAD* thread = &threads[(start + i) % thread_count];
+
+        if (thread->state == THREAD_READY && (!next || thread->priority < next->priority))
+            next = thread;
+    }
+
+    if (next != current)
+        next->switches++;
+
+    current = next;
+    return current->sp;
+}
+
+void yieldThread()
+{
+    if (running)
+        requestSwitch();
+}
+
+static void wakeThread(void* context)
+{
+    THREAD* thread = context;
+
+    thread->state = THREAD_READY;
+    if (thread->priority < current->priority)
+        requestSwitch();
+}
+
+// blocks the thread for ms, the timer wheel makes it ready again
+void sleepThread(uint32_t ms)
+{
+    uint32_t state = enterCritical();
+
+    initTimer(&current->sleep_timer, wakeThread, current);
+    startTimer(&current->sleep_timer, ms);
+    current->state = THREAD_BLOCKED;
+    requestSwitch();
+
+    exitCritical(state);
+}
+
+void initSemaphore(SEMAPHORE* semaphore, uint16_t count)
+{
+    semaphore->count = count;
+}
+
+// takes one from the semaphore, blocking until there is one (only from a thread,
+// and before startKernel it can't block so it just doesn't take one)
+void waitSemaphore(SEMAPHORE* semaphore)
+{
+    uint32_t state = enterCritical();
+
+    if (semaphore->count)
+    {
+        semaphore->count--;
+    }
+    else if (running)
+    {
+        // the post hands its count straight to us, so nothing to take after waking up
+        current->waiting_on = semaphore;
+        current->state = THREAD_BLOCKED;
+        requestSwitch();
+    }
+
+    exitCritical(state);
+}
+
+// takes one if there is one, never blocks. For the events thread, which can't wait on a
+// lock the shell holds (it would sit behind a whole csma send)
+bool tryWaitSemaphore(SEMAPHORE* semaphore)
+{
+    uint32_t state = enterCritical();
+    bool taken = semaphore->count != 0;
+
+    if (taken)
+        semaphore->count--;
+
+    exitCritical(state);
+    return taken;
+}
+
+// gives one back, or wakes up the most important thread waiting on it (ok from an ISR)
+void postSemaphore(SEMAPHORE* semaphore)
+{
+    uint32_t state = enterCritical();
+    THREAD* waiter = 0;
+    uint8_t i;
+
+    for (i = 0; i < thread_count; i++)
+    {
+        THREAD* thread = &threads[i];
+
+        if (thread->state == THREAD_BLOCKED && thread->waiting_on == semaphore &&
+            (!waiter || thread->priority < waiter->priority))
+            waiter = thread;
+    }
+
+    if (waiter)
+    {
+        waiter->waiting_on = 0;
+        waiter->state = THREAD_READY;
+        if (waiter->priority < current->priority)
+            requestSwitch();
+    }
+    else
+    {
+        semaphore->count++;
+    }
+
+    exitCritical(state);
+}
+
+void initQueue(QUEUE* queue, uint32_t* items, uint8_t size)
+{
+    queue->items = items;
+    queue->size = size;
+    queue->head = 0;
+    queue->tail = 0;
+    initSemaphore(&queue->filled, 0);
+}
+
+// adds an item, returns false if the queue is full (never blocks, so ok from an ISR)
+bool putQueue(QUEUE* queue, uint32_t item)
+{
+    uint32_t state = enterCritical();
+    uint8_t next = (queue->head + 1) % queue->size;
+
+    if (next == queue->tail)
+    {
+        exitCritical(state);
+        return false;
+    }
+
+    queue->items[queue->head] = item;
+    queue->head = next;
+    exitCritical(state);
+
+    postSemaphore(&queue->filled);
+    return true;
+}
+
+// takes the oldest item, blocking until there is one (only from a thread)
+uint32_t getQueue(QUEUE* queue)
+{
+    waitSemaphore(&queue->filled);
+
+    uint32_t state = enterCritical();
+    uint32_t item = queue->items[queue->tail];
+    queue->tail = (queue->tail + 1) % queue->size;
+    exitCritical(state);
+
+    return item;
+}
+
+uint8_t getThreadCount()
+{
+    return thread_count;
+}
+
+THREAD* getThread(uint8_t index)
+{
+    return (index < thread_count) ? &threads[index] : 0;
+}
+
+KERNEL_STATS* getKernelStats()
+{
+    return &stats;
+}
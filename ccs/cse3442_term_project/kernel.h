@@ -0,0 +1,70 @@
+#ifndef KERNEL_H_
+#define KERNEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+
+#define THREAD_MAX 4
+#define THREAD_LOWEST_PRIORITY 7    // 0 is the most important, like the event loop tasks
+
+typedef struct _SEMAPHORE
+{
+    volatile uint16_t count;
+}
+SEMAPHORE;
+
+// fixed size queue of 32 bit items, put never blocks so it works from an ISR
+typedef struct _QUEUE
+{
+    uint32_t* items;
+    uint8_t size;
+    uint8_t head;
+    uint8_t tail;
+    SEMAPHORE filled;
+}
+QUEUE;
+
+typedef struct _THREAD
+{
+    uint32_t* sp;           // saved stack pointer, has to be first (PendSV_Handler uses it)
+    const char* name;
+    uint8_t priority;
+    uint8_t state;
+    SEMAPHORE* waiting_on;
+    TIMER sleep_timer;
+    uint32_t switches;      // times it was switched to
+}
+THREAD;
+
+typedef struct _KERNEL_STATS
+{
+    uint32_t switches;
+    uint32_t last_switch_cycles;
+    uint32_t min_switch_cycles;
+    uint32_t max_switch_cycles;
+    uint64_t switch_cycles;     // total, for the average
+}
+KERNEL_STATS;
+
+THREAD* createThread(const char* name, void (*entry)(), uint32_t* stack, uint32_t stack_words, uint8_t priority);
+void startKernel(const char* name, uint8_t priority);
+bool isKernelRunning();
+THREAD* getCurrentThread();
+void yieldThread();
+void sleepThread(uint32_t ms);
+
+void initSemaphore(SEMAPHORE* semaphore, uint16_t count);
+void waitSemaphore(SEMAPHORE* semaphore);
+bool tryWaitSemaphore(SEMAPHORE* semaphore);
+void postSemaphore(SEMAPHORE* semaphore);
+
+void initQueue(QUEUE* queue, uint32_t* items, uint8_t size);
+bool putQueue(QUEUE* queue, uint32_t item);
+uint32_t getQueue(QUEUE* queue);
+
+uint8_t getThreadCount();
+THREAD* getThread(uint8_t index);
+KERNEL_STATS* getKernelStats();
+
+#endif
@@ -0,0 +1,76 @@
+; Context switch for kernel.c
+;
+; PendSV_Handler saves r4 - r11 and the EXC_RETURN of the thread that was running on
+; its own stack (plus s16 - s31 if it used the FPU, bit 4 of EXC_RETURN is 0 then, the
+; hardware already stacked s0 - s15 lazily), asks kernelSwitch which thread is next and
+; pops the same things off that one's stack. The DWT cycle counter is read at the start
+; and at the end so kernel.c can report how long a switch takes.
+;
+; kernelSwitch walks the thread list that waitSemaphore / postSemaphore / the timer
+; wheel change in their critical sections, so BASEPRI goes up to PRIORITY_SYSCALL while
+; it runs, the same as enterCritical. PendSV (priority 7) is masked by any BASEPRI, so
+; it was 0 when the handler started and that is what it goes back to.
+
+        .thumb
+        .text
+
+        .global PendSV_Handler
+        .global useProcessStack
+        .global kernelSwitch
+        .global switch_start
+        .global switch_cycles
+
+DWT_CYCCNT      .field 0xE0001004, 32
+SWITCH_START    .field switch_start, 32
+SWITCH_CYCLES   .field switch_cycles, 32
+BASEPRI_SYSCALL .equ    0x40            ; PRIORITY_SYSCALL << 5 (priority.h)
+
+PendSV_Handler: .asmfunc
+        LDR     r2, DWT_CYCCNT
+        LDR     r1, [r2]
+        LDR     r2, SWITCH_START
+        STR     r1, [r2]
+
+        MRS     r0, PSP
+        TST     lr, #0x10
+        IT      EQ
+        VSTMDBEQ r0!, {s16-s31}
+        STMDB   r0!, {r4-r11, lr}
+
+        MOV     r1, #BASEPRI_SYSCALL
+        MSR     BASEPRI, r1
+        BL      kernelSwitch            ; r0 = old stack pointer in, new one out
+        MOV     r1, #0
+        MSR     BASEPRI, r1
+
+        LDMIA   r0!, {r4-r11, lr}
+        TST     lr, #0x10
+        IT      EQ
+        VLDMIAEQ r0!, {s16-s31}
+        MSR     PSP, r0
+
+        LDR     r2, DWT_CYCCNT
+        LDR     r1, [r2]
+        LDR     r2, SWITCH_START
+        LDR     r2, [r2]
+        SUB     r1, r1, r2
+        LDR     r2, SWITCH_CYCLES
+        STR     r1, [r2]
+
+        BX      lr
+        .endasmfunc
+
+; useProcessStack(handler_stack_top): the caller keeps running on the same stack but
+; as PSP, and MSP (used by every ISR from now on) moves to handler_stack_top
+useProcessStack: .asmfunc
+        MRS     r1, MSP
+        MSR     PSP, r1
+        MRS     r1, CONTROL
+        ORR     r1, r1, #2
+        MSR     CONTROL, r1
+        ISB
+        MSR     MSP, r0
+        BX      lr
+        .endasmfunc
+
+        .end
@@ -9,8 +9,30 @@
 #include "common_terminal_interface.h"
 #include "strings.h"
 #include "pwm.h"
+#include "ir_frame.h"
+#include "calibration.h"
+#include "stats.h"
+#include "ir_channel.h"
+#include "echo.h"
+#include "csma.h"
+#include "mesh.h"
+#include "fragment.h"
+#include "bulk.h"
+#include "bridge.h"
+#include "batch.h"
+#include "compress.h"
+#include "timer.h"
+#include "power.h"
+#include "scheduler.h"
+#include "kernel.h"
+#include "priority.h"
+#include "ping.h"
+#include "timesync.h"
+#include "timestamp.h"
+#include "trace.h"
 
 // #define DEBUG
+// #define CALIBRATE_AT_STARTUP
 
 // bit banded alias for on-board blue LED
 #define BLUE_LED (*((volatile uint32_t *)(0x42000000 + (0x400253FC - 0x40000000)*32 + 2*4))) //PF2
@@ -26,48 +48,66 @@
  * M0PWM0: PB6
 */
 
-volatile uint32_t LED_off_timer = 0;
+TIMER LED_off_timer;
+volatile bool LED_restart = false; // set by the UART7 ISR, it can't touch the timer wheel itself
+
+// turn the blue led off after 500 ms
+void ledOff(void* context)
+{
+    BLUE_LED = 0;
+}
 
 void SysTick_Handler(void)
 {
-    if (LED_off_timer > 0)
+    // every timeout lives in the timer wheel now, and after a tickless sleep
+    // one interrupt can stand for a lot of ms
+    advanceTicks(takeSysTickMs());
+    postEvent(EVENT_TICK);
+}
+
+// what happens while the terminal waits for a key
+void terminalIdle()
+{
+    runTasks();
+    sleepUntilNextEvent(); // only does something in tickless mode
+}
+
+void Uart7_Rx_Handler(void)
+{
+    // the same vector is used for the end of transmission interrupt (carrier gating)
+    if (UART7_MIS_R & UART_MIS_TXMIS)
     {
-        LED_off_timer--; // count down 1 ms
+        uart7TxDoneIsr();
     }
-    if (!LED_off_timer) // if the timer has counted down to 0
+
+    if ( !(UART7_MIS_R & (UART_MIS_RXMIS | UART_MIS_RTMIS)) )
     {
-        BLUE_LED = 0; // turn the blue led off after 500 ms
+        return;
     }
-}
 
-void Uart7_Rx_Handler(void)
-{
     BLUE_LED = 1;
-    LED_off_timer = 500; // keep LED on for 500 ms
+    LED_restart = true; // the 500 ms starts in IrRxEvent_Handler
 
     // first we clear the interrupt since we are in the handler now
     UART7_ICR_R = (UART_ICR_RXIC | UART_ICR_RTIC);
 
-    char temp_char;
-    static bool start = true; // flag variable to determine if start of message
-
-    while ( !(UART7_FR_R & UART_FR_RXFE) ) // loop when the FIFO is not empty
-    {
-        if (start) // determine if it is the start of a message to print intro to it
-        {
-            putsUart0("\r\nUART7 RX (IR) Message: ");
-            start = false;
-        }
+    // the bytes go into the channel 0 ring and get handled by the pollIrRx task
+    drainIrChannelRx(0);
+}
 
-        temp_char = getcUart7(); // read and store each character from the terminal
-        putcUart0(temp_char);    // then print out the character into the terminal
+// software triggered by the IR RX ISRs once they put bytes in a ring, this one runs at
+// PRIORITY_IR_RX_EVENT so it is allowed to use the timer wheel and post events
+void IrRxEvent_Handler(void)
+{
+    noteRxEventStart();
 
-        if ( !(temp_char) ) // make a new line if it is the last character which is 0
-        {
-            putsUart0("\r\n");
-            start = true;
-        }
+    if (LED_restart)
+    {
+        LED_restart = false;
+        startTimer(&LED_off_timer, 500); // keep LED on for 500 ms
     }
+
+    postEvent(EVENT_IR_RX);
 }
 
 int main(void)
@@ -80,6 +120,14 @@ int main(void)
     GPIO_PORTF_DIR_R |= BLUE_LED_MASK;  // make the blue LED an output
     GPIO_PORTF_DEN_R |= BLUE_LED_MASK;   // enable digital functions for blue LED
 
+    initTimer(&LED_off_timer, ledOff, 0);
+
+    // grouping and the SysTick / PendSV / RX event priorities, before anything is enabled
+    initInterruptPriorities();
+
+    // the DWT cycle counter and the us uptime, before any interrupt can timestamp something
+    initTimestamp();
+
     NVIC_ST_RELOAD_R = 3999; // Set RELOAD for 1 ms
 
     NVIC_ST_CURRENT_R = 0x0; // Clear Current
@@ -99,6 +147,22 @@ int main(void)
     // Initialize PWM signal to 38 KHz on PB6
     initPWM();
 
+    // Set up the PE0 edge capture used by the pulse width calibration
+    initCalibration();
+
+    // Set up the extra IR channels on UART1, UART3 and UART5, and handle
+    // whatever they receive while the terminal is waiting for input
+    initIrChannels();
+    setTerminalIdleCallback(terminalIdle);
+
+    // the event loop tasks, most important first (the command loop is below all of them)
+    addTask("ir rx", pollIrRx, EVENT_IR_RX, 0);
+    addTask("diversity", pollIrDiversity, EVENT_TICK, 1);
+    addTask("ir tx", pollIrTx, EVENT_TX, 1);
+    addTask("mesh", pollMesh, EVENT_MESH, 2);
+    addTask("batch", pollBatch, EVENT_BATCH, 3);
+    addTask("fragments", pollFragments, EVENT_TICK, 4);
+
     // create variable of struct USER_DATA, you can see it in common_terminal_interface.h
     USER_DATA input;
 
@@ -110,7 +174,81 @@ int main(void)
     putsUart0("<rate> = 300, 1200, 2400, 4800 \r\n\r\n");
 
     putsUart0("Command: send <message> \r\n");
-    putsUart0("<message> limited to 64 characters \r\n\r\n");
+    putsUart0("<message> over 64 characters is split into fragments \r\n\r\n");
+
+    putsUart0("Command: batch <ms|off> \r\n");
+    putsUart0("short messages wait up to <ms> to be packed into one frame \r\n\r\n");
+
+    putsUart0("Command: compress <on|off> \r\n");
+    putsUart0("LZSS compresses frame payloads when it makes them smaller \r\n\r\n");
+
+    putsUart0("Command: tickless <on|off> \r\n");
+    putsUart0("sleeps between events instead of a 1 ms SysTick \r\n\r\n");
+
+    putsUart0("Command: sendto <node> <message> \r\n");
+    putsUart0("only node <node> gets it, needs node addressing on \r\n\r\n");
+
+    putsUart0("Command: node <0-7|off> \r\n");
+    putsUart0("sets this board's node id, the UART drops frames for other nodes \r\n\r\n");
+
+    putsUart0("Command: mesh <node|all> <message> \r\n");
+    putsUart0("sends through other boards to a node that is out of view \r\n\r\n");
+
+    putsUart0("Command: relay <on|off> \r\n");
+    putsUart0("passes on mesh messages for other nodes \r\n\r\n");
+
+    putsUart0("Command: route <node> <next node|off> \r\n");
+    putsUart0("fixed mesh route, off goes back to learning it \r\n\r\n");
+
+    putsUart0("Command: xfer [node] \r\n");
+    putsUart0("receives a file with XMODEM / YMODEM and sends it over IR \r\n\r\n");
+
+    putsUart0("Command: bridge \r\n");
+    putsUart0("UART0 <-> UART7 like a wire, 1 s pause + +++ + 1 s pause to get out \r\n\r\n");
+
+    putsUart0("Command: channel <n> <message> \r\n");
+    putsUart0("sends on extra IR channel <n> = 1 (UART1), 2 (UART3), 3 (UART5) \r\n\r\n");
+
+    putsUart0("Command: duplex <full|half|auto> \r\n");
+    putsUart0("auto goes half duplex once the board hears its own echo \r\n\r\n");
+
+    putsUart0("Command: csma <on|off> \r\n");
+    putsUart0("listens for other boards and backs off before sending a frame \r\n\r\n");
+
+    putsUart0("Command: diversity <off|2|3> \r\n");
+    putsUart0("combines frames from 2 or 3 receivers (PE0, PE4, PC6) \r\n\r\n");
+
+    putsUart0("Command: carrier [frequency] [duty] \r\n");
+    putsUart0("[frequency] = 30000 to 56000 Hz, [duty] = 1 to 99 % \r\n\r\n");
+
+    putsUart0("Command: carrier gate <on|off> \r\n");
+    putsUart0("only runs the carrier while UART7 is sending \r\n\r\n");
+
+    putsUart0("Command: trace <on|off|clear|dump [hex|bin]> \r\n");
+    putsUart0("records every UART7 byte with a cycle timestamp, dump sends the last 512 \r\n\r\n");
+
+    putsUart0("Command: stats \r\n\r\n");
+
+    putsUart0("Command: ping [count] [size] \r\n");
+    putsUart0("round trip time to the other board, count up to 100, size 6 to 64 \r\n\r\n");
+
+    putsUart0("Command: time [sync] \r\n");
+    putsUart0("shows the local and synced clocks, sync sets the offset / drift from the other board \r\n\r\n");
+
+    putsUart0("Command: tasks \r\n");
+    putsUart0("event loop tasks, threads and context switch cycles \r\n\r\n");
+
+    putsUart0("Command: calibrate \r\n");
+    putsUart0("tunes the carrier duty cycle using the other board \r\n\r\n");
+
+#ifdef CALIBRATE_AT_STARTUP
+    runCalibration();
+#endif
+
+    // from here on the event loop tasks get their own thread, which can cut in on
+    // whatever command is running (main becomes the "shell" thread)
+    startEventThread(1);
+    startKernel("shell", 3);
 
     while(1)
     {
@@ -139,13 +277,262 @@ int main(void)
 
             uint32_t length = str_len(IR_msg);
 
-            // limit messages to 64 bytes
-            if (length <= 64)
+            // it is sent as a frame so the receiver can check the crc, and anything
+            // over 64 bytes goes out as fragments
+            // short ones might wait a few ms to share a frame (batch command)
+            if (length <= FRAGMENT_MAX_MESSAGE)
+            {
+                sendBatchedText((uint8_t*)IR_msg, length);
+                valid = true;
+            }
+        }
+
+        if (isCommand(&input, "batch", 1))
+        {
+            char* delay = getFieldString(&input, 1);
+
+            if (str_cmp(delay, "off") == 0)
             {
-                putsUart7(IR_msg);
-                putcUart7(0);
+                setBatchDelay(0);
+                putsUart0("\r\nBatching off\r\n");
                 valid = true;
             }
+            else if (input.fieldType[1] == 'n' && getFieldInteger(&input, 1) > 0 &&
+                     getFieldInteger(&input, 1) <= 1000)
+            {
+                setBatchDelay(getFieldInteger(&input, 1));
+                putsUart0("\r\nBatch delay ");
+                putsUart0(delay);
+                putsUart0(" ms\r\n");
+                valid = true;
+            }
+        }
+
+        if (isCommand(&input, "compress", 1))
+        {
+            char* state = getFieldString(&input, 1);
+            valid = true;
+
+            if (str_cmp(state, "on") == 0)
+                setCompression(true);
+            else if (str_cmp(state, "off") == 0)
+                setCompression(false);
+            else
+                valid = false;
+
+            if (valid)
+                putsUart0(getCompression() ? "\r\nCompression on\r\n" : "\r\nCompression off\r\n");
+        }
+
+        if (isCommand(&input, "tickless", 1))
+        {
+            char* state = getFieldString(&input, 1);
+            valid = true;
+
+            if (str_cmp(state, "on") == 0)
+                setTickless(true);
+            else if (str_cmp(state, "off") == 0)
+                setTickless(false);
+            else
+                valid = false;
+
+            if (valid)
+                putsUart0(getTickless() ? "\r\nTickless idle on\r\n" : "\r\nTickless idle off\r\n");
+        }
+
+        if (isCommand(&input, "trace", 1))
+        {
+            char* action = getFieldString(&input, 1);
+            valid = true;
+
+            if (str_cmp(action, "on") == 0)
+                setTrace(true);
+            else if (str_cmp(action, "off") == 0)
+                setTrace(false);
+            else if (str_cmp(action, "clear") == 0)
+                clearTrace();
+            else if (str_cmp(action, "dump") == 0 && input.fieldCount == 2)
+                dumpTrace(false);
+            else if (str_cmp(action, "dump") == 0 && str_cmp(getFieldString(&input, 2), "hex") == 0)
+                dumpTrace(false);
+            else if (str_cmp(action, "dump") == 0 && str_cmp(getFieldString(&input, 2), "bin") == 0)
+                dumpTrace(true);
+            else
+                valid = false;
+
+            if (valid && str_cmp(action, "dump") != 0)
+                putsUart0(getTrace() ? "\r\nTrace on\r\n" : "\r\nTrace off\r\n");
+        }
+
+        if (isCommand(&input, "sendto", 2) && input.fieldType[1] == 'n')
+        {
+            // same as send but behind the node address byte
+            uint32_t node = getFieldInteger(&input, 1);
+            char *IR_msg = &og_msg[input.fieldPosition[2]];
+            uint32_t length = str_len(IR_msg);
+
+            if (node < IR_NODE_COUNT && getIrNode() != IR_NODE_NONE)
+                valid = sendIrMessageTo(IR_NODE_ADDRESS(node), IR_FRAME_TEXT, (uint8_t*)IR_msg, length);
+        }
+
+        if (isCommand(&input, "node", 1))
+        {
+            char* id = getFieldString(&input, 1);
+
+            if (str_cmp(id, "off") == 0)
+            {
+                setIrNode(IR_NODE_NONE);
+                putsUart0("\r\nNode addressing off\r\n");
+                valid = true;
+            }
+            else if (input.fieldType[1] == 'n' && getFieldInteger(&input, 1) < IR_NODE_COUNT)
+            {
+                setIrNode(getFieldInteger(&input, 1));
+                putsUart0("\r\nNode id set to ");
+                putsUart0(id);
+                putsUart0("\r\n");
+                valid = true;
+            }
+        }
+
+        if (isCommand(&input, "mesh", 2))
+        {
+            char* to = getFieldString(&input, 1);
+            char *IR_msg = &og_msg[input.fieldPosition[2]];
+            uint32_t length = str_len(IR_msg);
+
+            if (str_cmp(to, "all") == 0)
+                valid = sendMeshMessage(MESH_BROADCAST, (uint8_t*)IR_msg, length);
+            else if (input.fieldType[1] == 'n' && getFieldInteger(&input, 1) < IR_NODE_COUNT)
+                valid = sendMeshMessage(getFieldInteger(&input, 1), (uint8_t*)IR_msg, length);
+        }
+
+        if (isCommand(&input, "relay", 1))
+        {
+            char* state = getFieldString(&input, 1);
+            valid = true;
+
+            if (str_cmp(state, "on") == 0)
+                setMeshRelay(true);
+            else if (str_cmp(state, "off") == 0)
+                setMeshRelay(false);
+            else
+                valid = false;
+
+            if (valid)
+                putsUart0(getMeshRelay() ? "\r\nRelay on\r\n" : "\r\nRelay off\r\n");
+        }
+
+        if (isCommand(&input, "route", 2) && input.fieldType[1] == 'n')
+        {
+            uint32_t destination = getFieldInteger(&input, 1);
+            char* hop = getFieldString(&input, 2);
+
+            if (destination < IR_NODE_COUNT && str_cmp(hop, "off") == 0)
+            {
+                setMeshRoute(destination, IR_NODE_NONE);
+                valid = true;
+            }
+            else if (destination < IR_NODE_COUNT && input.fieldType[2] == 'n' &&
+                     getFieldInteger(&input, 2) < IR_NODE_COUNT)
+            {
+                setMeshRoute(destination, getFieldInteger(&input, 2));
+                valid = true;
+            }
+        }
+
+        if (isCommand(&input, "ping", 0))
+        {
+            uint32_t count = PING_DEFAULT_COUNT;
+            uint32_t size = PING_DEFAULT_SIZE;
+            valid = true;
+
+            if (input.fieldCount > 1)
+            {
+                count = getFieldInteger(&input, 1);
+                valid = (input.fieldType[1] == 'n' && count >= 1 && count <= PING_MAX_COUNT);
+            }
+            if (input.fieldCount > 2)
+            {
+                size = getFieldInteger(&input, 2);
+                valid = valid && (input.fieldType[2] == 'n' && size >= PING_HEADER_LENGTH &&
+                                  size <= IR_FRAME_MAX_PAYLOAD);
+            }
+
+            if (valid)
+                runPing(count, size);
+        }
+
+        if (isCommand(&input, "time", 0))
+        {
+            valid = true;
+
+            if (input.fieldCount > 1)
+            {
+                if (str_cmp(getFieldString(&input, 1), "sync") == 0)
+                {
+                    if (!syncClock())
+                        putsUart0("\r\nNo sync replies\r\n");
+                }
+                else
+                {
+                    valid = false;
+                }
+            }
+
+            if (valid)
+            {
+                putsUart0("\r\n");
+                printClock();
+            }
+        }
+
+        if (isCommand(&input, "xfer", 0))
+        {
+            uint8_t address = IR_FRAME_BROADCAST;
+            valid = true;
+
+            if (input.fieldCount > 1)
+            {
+                if (input.fieldType[1] == 'n' && getFieldInteger(&input, 1) < IR_NODE_COUNT &&
+                    getIrNode() != IR_NODE_NONE)
+                    address = IR_NODE_ADDRESS(getFieldInteger(&input, 1));
+                else
+                    valid = false;
+            }
+
+            if (valid)
+            {
+                putsUart0("\r\nStart the XMODEM / YMODEM send now\r\n");
+                if (runBulkTransfer(address))
+                    putsUart0("\r\nTransfer done\r\n");
+                else
+                    putsUart0("\r\nTransfer failed\r\n");
+            }
+        }
+
+        if (isCommand(&input, "bridge", 0))
+        {
+            putsUart0("\r\nBridge on, 1 s pause + +++ + 1 s pause to get out\r\n");
+            runBridge();
+            putsUart0("\r\nBridge off\r\n");
+            valid = true;
+        }
+
+        if (isCommand(&input, "channel", 2) && input.fieldType[1] == 'n')
+        {
+            // same as send but on one of the extra IR channels
+            uint32_t channel = getFieldInteger(&input, 1);
+            char *IR_msg = &og_msg[input.fieldPosition[2]];
+            uint32_t length = str_len(IR_msg);
+
+            if (channel >= 1 && channel < IR_CHANNEL_COUNT && length <= 64)
+            {
+                uint8_t wire[IR_FRAME_MAX_WIRE];
+                uint8_t wire_length = encodeIrFrame(IR_FRAME_TEXT, (uint8_t*)IR_msg, length, wire);
+
+                valid = writeIrChannel(channel, wire, wire_length);
+            }
         }
 
         if ( isCommand(&input, "baud", 1) )
@@ -156,6 +543,7 @@ int main(void)
             if ( (baud == 300) || (baud == 1200) || (baud == 2400) || (baud == 4800) )
             {
                 setUart7BaudRate(baud, 40000000);
+                setIrChannelBaudRate(baud);
                 putsUart0("\r\nUART7 (IR) baud rate set to ");
                 putsUart0(baud_str);
                 putsUart0("\r\n");
@@ -163,6 +551,131 @@ int main(void)
             }
         }
 
+        if (isCommand(&input, "carrier", 2) && str_cmp(getFieldString(&input, 1), "gate") == 0)
+        {
+            // carrier gate on|off, turns the carrier gating on or off
+            char* mode = getFieldString(&input, 2);
+
+            if (str_cmp(mode, "on") == 0 || str_cmp(mode, "off") == 0)
+            {
+                setCarrierGating(str_cmp(mode, "on") == 0);
+                putsUart0("\r\nCarrier gating ");
+                putsUart0(mode);
+                putsUart0("\r\n");
+                valid = true;
+            }
+        }
+        else if (isCommand(&input, "carrier", 0))
+        {
+            // carrier with no arguments just prints the current setting
+            bool ok = true;
+
+            if (input.fieldCount > 1)
+            {
+                uint32_t frequency = getFieldInteger(&input, 1);
+                int32_t duty = getPWMDutyCycle();
+
+                if (input.fieldCount > 2)
+                    duty = getFieldInteger(&input, 2);
+
+                ok = (duty >= 1) && (duty <= 99) && setPWMCarrier(frequency, duty);
+            }
+
+            if (ok)
+            {
+                char str[12];
+
+                putsUart0("\r\nCarrier ");
+                putsUart0(toAsciiDec(str, getPWMFrequency()));
+                putsUart0(" Hz (error ");
+                putsUart0(toAsciiDec(str, getPWMFrequencyError()));
+                putsUart0(" Hz), duty ");
+                putsUart0(toAsciiDec(str, getPWMDutyCycle()));
+                putsUart0("%\r\n");
+                valid = true;
+            }
+        }
+
+        if (isCommand(&input, "csma", 1))
+        {
+            char* state = getFieldString(&input, 1);
+            valid = true;
+
+            if (str_cmp(state, "on") == 0)
+                setCsma(true);
+            else if (str_cmp(state, "off") == 0)
+                setCsma(false);
+            else
+                valid = false;
+
+            if (valid)
+                putsUart0(getCsma() ? "\r\nCSMA on\r\n" : "\r\nCSMA off\r\n");
+        }
+
+        if (isCommand(&input, "duplex", 1))
+        {
+            char* mode = getFieldString(&input, 1);
+            valid = true;
+
+            if (str_cmp(mode, "full") == 0)
+                setDuplexMode(DUPLEX_FULL);
+            else if (str_cmp(mode, "half") == 0)
+                setDuplexMode(DUPLEX_HALF);
+            else if (str_cmp(mode, "auto") == 0)
+                setDuplexMode(DUPLEX_AUTO);
+            else
+                valid = false;
+
+            if (valid)
+            {
+                putsUart0("\r\nDuplex mode ");
+                putsUart0(mode);
+                putsUart0("\r\n");
+            }
+        }
+
+        if (isCommand(&input, "diversity", 1))
+        {
+            char* mode = getFieldString(&input, 1);
+            uint32_t receivers = 0;
+
+            // only "off" or the number 2 or 3, anything else (like "of") is an error
+            // instead of turning diversity off
+            if (str_cmp(mode, "off") == 0)
+                valid = true;
+            else if (input.fieldType[1] == 'n')
+            {
+                receivers = getFieldInteger(&input, 1);
+                valid = (receivers == 2 || receivers == 3);
+            }
+
+            if (valid)
+            {
+                setIrDiversity(receivers);
+                putsUart0("\r\nReceiver diversity ");
+                putsUart0(receivers ? mode : "off");
+                putsUart0("\r\n");
+            }
+        }
+
+        if (isCommand(&input, "stats", 0))
+        {
+            printStats();
+            valid = true;
+        }
+
+        if (isCommand(&input, "tasks", 0))
+        {
+            printTasks();
+            valid = true;
+        }
+
+        if (isCommand(&input, "calibrate", 0))
+        {
+            runCalibration();
+            valid = true;
+        }
+
         if(!valid)
         {
             putsUart0("\r\nInvalid command\r\n");
@@ -0,0 +1,320 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "mesh.h"
+#include "ir_frame.h"
+#include "ir_channel.h"
+#include "csma.h"
+#include "uart0.h"
+#include "strings.h"
+#include "scheduler.h"
+#include "priority.h"
+
+/*
+ *  Store and forward relaying
+ *
+ *  The IR link only reaches boards that can see each other, so to get a message to a
+ *  board around the corner it gets handed from node to node. Every mesh message has a
+ *  small header in front (see mesh.h) with the final destination, the original source,
+ *  the node that sent this hop, a TTL and a sequence number.
+ *
+ *  - routing: the table says which neighbor to hand a message to for each destination.
+ *    Routes can be set with the route command, otherwise they are learned: whenever a
+ *    message from node S comes in from neighbor H, S must be reachable through H. With
+ *    no route the message is flooded (node address broadcast) and every relay passes it on
+ *  - the link level node address byte is the next hop, so with 9 bit mode the nodes that
+ *    are not on the path never even get interrupted by it
+ *  - duplicate suppression: the last few (source, sequence) pairs are remembered so a
+ *    flooded message doesn't go around in circles, and the TTL is the backstop
+ *  - each neighbor has its own small queue that pollMesh sends from round robin, so one
+ *    slow / dead neighbor can't hold up the traffic going to the others
+ *
+ *  Needs node addressing (node command), since the node ids are the mesh addresses.
+ *
+ *  The shell thread starts messages and the event thread (which can cut into it) relays
+ *  and sends them, so the queues, the seen list, the routes and the stats are only
+ *  touched in a critical section. Those are short, the frame itself is sent after the
+ *  entry is copied out.
+ */
+
+#define MESH_QUEUE_DEPTH 2          // messages waiting per neighbor
+#define MESH_QUEUES (IR_NODE_COUNT + 1)
+#define MESH_FLOOD_QUEUE IR_NODE_COUNT
+#define MESH_SEEN_SIZE 16
+
+typedef struct _MESH_ENTRY
+{
+    uint8_t length;
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+}
+MESH_ENTRY;
+
+typedef struct _MESH_QUEUE
+{
+    MESH_ENTRY entries[MESH_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+}
+MESH_QUEUE;
+
+typedef struct _MESH_SEEN
+{
+    uint8_t src;
+    uint8_t seq;
+}
+MESH_SEEN;
+
+static bool relay = false;
+static int8_t next_hop[IR_NODE_COUNT] = { IR_NODE_NONE, IR_NODE_NONE, IR_NODE_NONE, IR_NODE_NONE,
+                                          IR_NODE_NONE, IR_NODE_NONE, IR_NODE_NONE, IR_NODE_NONE };
+static bool static_route[IR_NODE_COUNT];
+static MESH_QUEUE queues[MESH_QUEUES];
+static uint8_t next_queue = 0;
+static MESH_SEEN seen[MESH_SEEN_SIZE];
+static uint8_t seen_count = 0;
+static uint8_t seen_next = 0;
+static uint8_t sequence = 0;
+static MESH_STATS stats;
+
+void setMeshRelay(bool on)
+{
+    relay = on;
+}
+
+bool getMeshRelay()
+{
+    return relay;
+}
+
+// next_hop = IR_NODE_NONE goes back to learning the route
+void setMeshRoute(uint8_t destination, int8_t hop)
+{
+    if (destination >= IR_NODE_COUNT)
+        return;
+
+    // both at once, or a relay could learn over a route that was just set
+    uint32_t state = enterCritical();
+    next_hop[destination] = hop;
+    static_route[destination] = (hop != IR_NODE_NONE);
+    exitCritical(state);
+}
+
+int8_t getMeshRoute(uint8_t destination)
+{
+    if (destination >= IR_NODE_COUNT)
+        return IR_NODE_NONE;
+
+    return next_hop[destination];
+}
+
+// returns true if (src, seq) was seen before, and remembers it if not
+static bool alreadySeen(uint8_t src, uint8_t seq)
+{
+    uint8_t i;
+
+    for (i = 0; i < seen_count; i++)
+    {
+        if (seen[i].src == src && seen[i].seq == seq)
+            return true;
+    }
+
+    seen[seen_next].src = src;
+    seen[seen_next].seq = seq;
+    seen_next = (seen_next + 1) % MESH_SEEN_SIZE;
+    if (seen_count < MESH_SEEN_SIZE)
+        seen_count++;
+
+    return false;
+}
+
+// puts a message (header already filled in) in the queue for its next hop
+static bool queueMesh(const uint8_t* payload, uint8_t length)
+{
+    uint8_t destination = payload[MESH_DST];
+    uint8_t q = MESH_FLOOD_QUEUE;
+    uint8_t i;
+
+    if (destination < IR_NODE_COUNT && next_hop[destination] != IR_NODE_NONE)
+        q = next_hop[destination];
+    else if (destination != MESH_BROADCAST)
+        stats.flooded++;
+
+    MESH_QUEUE* queue = &queues[q];
+    if (queue->count == MESH_QUEUE_DEPTH)
+    {
+        stats.queue_full++;
+        return false;
+    }
+
+    MESH_ENTRY* entry = &queue->entries[(queue->head + queue->count) % MESH_QUEUE_DEPTH];
+    for (i = 0; i < length; i++)
+        entry->payload[i] = payload[i];
+    entry->length = length;
+    queue->count++;
+    postEvent(EVENT_MESH);
+
+    return true;
+}
+
+// starts a new message from this node
+bool sendMeshMessage(uint8_t destination, const uint8_t* data, uint8_t length)
+{
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+    int8_t node = getIrNode();
+    uint8_t i;
+
+    if (node == IR_NODE_NONE || length > MESH_MAX_DATA)
+        return false;
+
+    payload[MESH_DST] = destination;
+    payload[MESH_SRC] = node;
+    payload[MESH_HOP] = node;
+    payload[MESH_TTL] = MESH_DEFAULT_TTL;
+    payload[MESH_SEQ] = sequence;
+    for (i = 0; i < length; i++)
+        payload[MESH_HEADER_LENGTH + i] = data[i];
+
+    uint32_t state = enterCritical();
+    bool queued = queueMesh(payload, MESH_HEADER_LENGTH + length);
+
+    // only a message that went in uses up a sequence number, otherwise a shell retrying
+    // a full queue wraps it around to one the other nodes still have as seen
+    if (queued)
+    {
+        // so our own message doesn't get relayed back out when a neighbor floods it
+        alreadySeen(node, payload[MESH_SEQ]);
+        sequence++;
+        stats.sent++;
+    }
+
+    exitCritical(state);
+    return queued;
+}
+
+// a mesh frame came in on UART7
+void handleMeshFrame(IR_FRAME* frame)
+{
+    char str[12];
+    int8_t node = getIrNode();
+    uint8_t i;
+    uint32_t state;
+    bool seen_before;
+
+    if (node == IR_NODE_NONE || frame->length < MESH_HEADER_LENGTH)
+        return;
+
+    uint8_t destination = frame->payload[MESH_DST];
+    uint8_t src = frame->payload[MESH_SRC];
+    uint8_t hop = frame->payload[MESH_HOP];
+
+    if (src >= IR_NODE_COUNT || hop >= IR_NODE_COUNT || src == node)
+        return;
+
+    state = enterCritical();
+    seen_before = alreadySeen(src, frame->payload[MESH_SEQ]);
+
+    if (seen_before)
+        stats.duplicates++;
+    else
+    {
+        // learn where src is, and the neighbor is always reachable directly. Only from
+        // the first copy, a flooded duplicate comes in later over a longer path and
+        // would otherwise replace the shorter route
+        if (!static_route[src])
+            next_hop[src] = hop;
+        if (!static_route[hop])
+            next_hop[hop] = hop;
+    }
+
+    exitCritical(state);
+
+    if (seen_before)
+        return;
+
+    if (destination == node || destination == MESH_BROADCAST)
+    {
+        putsUart0("\r\nMesh message from node ");
+        putsUart0(toAsciiDec(str, src));
+        putsUart0(" (");
+        putsUart0(toAsciiDec(str, MESH_DEFAULT_TTL - frame->payload[MESH_TTL] + 1));
+        putsUart0(" hops): ");
+        for (i = MESH_HEADER_LENGTH; i < frame->length; i++)
+            putcUart0(frame->payload[i]);
+        putsUart0("\r\n");
+
+        state = enterCritical();
+        stats.delivered++;
+        exitCritical(state);
+
+        if (destination == node)
+            return;
+    }
+
+    if (!relay)
+        return;
+
+    state = enterCritical();
+
+    if (frame->payload[MESH_TTL] <= 1)
+        stats.ttl_expired++;
+    else
+    {
+        frame->payload[MESH_TTL]--;
+        frame->payload[MESH_HOP] = node;
+
+        if (queueMesh(frame->payload, frame->length))
+            stats.forwarded++;
+    }
+
+    exitCritical(state);
+}
+
+// the EVENT_MESH task, sends at most one queued message per run and takes the
+// neighbor queues in turns, so anything more important gets to go in between
+void pollMesh()
+{
+    MESH_ENTRY entry;
+    MESH_QUEUE* queue = 0;
+    uint8_t address = 0;
+    uint8_t q = 0;
+    uint8_t i;
+    uint32_t state = enterCritical();
+
+    for (i = 0; i < MESH_QUEUES && !queue; i++)
+    {
+        q = (next_queue + i) % MESH_QUEUES;
+
+        if (queues[q].count)
+        {
+            queue = &queues[q];
+            entry = queue->entries[queue->head];
+            address = (q == MESH_FLOOD_QUEUE) ? IR_FRAME_BROADCAST : IR_NODE_ADDRESS(q);
+        }
+    }
+
+    exitCritical(state);
+
+    if (!queue)
+        return;
+
+    // this is the events thread so it can't wait for the shell to finish sending. If
+    // even the transmit queue is full it stays at the front here until there is room
+    if (!queueIrFrameTo(address, IR_FRAME_MESH, entry.payload, entry.length))
+    {
+        notifyIrTxRoom(EVENT_MESH);
+        return;
+    }
+
+    // only this task takes them out, the shell just adds at the back
+    state = enterCritical();
+    queue->head = (queue->head + 1) % MESH_QUEUE_DEPTH;
+    queue->count--;
+    next_queue = (q + 1) % MESH_QUEUES;
+    exitCritical(state);
+
+    postEvent(EVENT_MESH);  // check again for the rest
+}
+
+MESH_STATS* getMeshStats()
+{
+    return &stats;
+}
@@ -0,0 +1,41 @@
+#ifndef MESH_H_
+#define MESH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+
+// mesh header at the front of an IR_FRAME_MESH payload
+#define MESH_DST 0      // final destination node, or MESH_BROADCAST
+#define MESH_SRC 1      // node that wrote the message
+#define MESH_HOP 2      // node that sent it on this hop
+#define MESH_TTL 3      // hops left
+#define MESH_SEQ 4      // per source sequence number, for duplicate suppression
+#define MESH_HEADER_LENGTH 5
+#define MESH_MAX_DATA (IR_FRAME_MAX_PAYLOAD - MESH_HEADER_LENGTH)
+
+#define MESH_BROADCAST 0xFF
+#define MESH_DEFAULT_TTL 4
+
+typedef struct _MESH_STATS
+{
+    uint32_t sent;          // messages that started here
+    uint32_t delivered;     // messages for us that got printed
+    uint32_t forwarded;     // messages relayed on to another node
+    uint32_t duplicates;    // copies already seen, dropped
+    uint32_t ttl_expired;   // ran out of hops before getting there
+    uint32_t flooded;       // no route known so it went out as a broadcast
+    uint32_t queue_full;    // neighbor queue was full, dropped
+}
+MESH_STATS;
+
+void setMeshRelay(bool on);
+bool getMeshRelay();
+void setMeshRoute(uint8_t destination, int8_t next_hop);
+int8_t getMeshRoute(uint8_t destination);
+bool sendMeshMessage(uint8_t destination, const uint8_t* data, uint8_t length);
+void handleMeshFrame(IR_FRAME* frame);
+void pollMesh();
+MESH_STATS* getMeshStats();
+
+#endif
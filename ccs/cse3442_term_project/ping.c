@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "ping.h"
+#include "ir_frame.h"
+#include "uart0.h"
+#include "uart7.h"
+#include "pwm.h"
+#include "timestamp.h"
+#include "scheduler.h"
+#include "strings.h"
+
+/*
+ *  ping: round trip time over the IR link
+ *
+ *  Each probe carries a sequence number and the getUptimeUs from when it was sent.
+ *  The other board sends the same payload straight back from its RX path as a pong, so
+ *  the RTT is just "now - the time in the pong" and the responder doesn't need the same
+ *  clock. Both frames are counted in full, so it is airtime both ways plus whatever the
+ *  boards add (csma wait, compressing, RX handling).
+ *
+ *  It isn't DWT cycles so the RTT stays right even if a tickless sleep gets in between,
+ *  the DWT stops while the core sleeps.
+ */
+
+#define PING_GAP_MS 50          // between a reply and the next probe
+#define PING_MARGIN_MS 500      // on top of the airtime for both frames
+#define BITS_PER_CHAR 11
+
+static volatile bool waiting = false;
+static volatile uint16_t waiting_seq;
+static volatile uint32_t reply_us;
+static volatile bool replied;
+static PING_STATS stats;
+
+static uint16_t read16(const uint8_t* p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t read32(const uint8_t* p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write32(uint8_t* p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+// probe came in, send it right back
+void handlePingFrame(IR_FRAME* frame)
+{
+    if (frame->length < PING_HEADER_LENGTH)
+        return;
+
+    // from the events thread, so it can't wait behind a send the shell is doing
+    if (queueIrFrame(IR_FRAME_PONG, frame->payload, frame->length))
+        stats.answered++;
+}
+
+// our probe came back
+void handlePongFrame(IR_FRAME* frame)
+{
+    uint32_t now = getUptimeUs();
+
+    if (frame->length < PING_HEADER_LENGTH)
+        return;
+
+    // only the first copy of the probe we are waiting on counts
+    if (!waiting || replied || read16(&frame->payload[PING_SEQ]) != waiting_seq)
+    {
+        stats.late_replies++;
+        return;
+    }
+
+    reply_us = now - read32(&frame->payload[PING_TIME]);
+    replied = true;
+}
+
+static void printUs(char* label, uint32_t us)
+{
+    char str[12];
+
+    putsUart0(label);
+    putsUart0(toAsciiDec(str, us));
+    putsUart0(" us");
+}
+
+// sends count probes of size bytes (6 to 64) one after the other and prints the RTTs
+void runPing(uint8_t count, uint8_t size)
+{
+    static uint32_t rtt_us[PING_MAX_COUNT];
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+    uint8_t received = 0;
+    uint8_t i;
+    char str[12];
+
+    if (count > PING_MAX_COUNT)
+        count = PING_MAX_COUNT;
+    if (size < PING_HEADER_LENGTH)
+        size = PING_HEADER_LENGTH;
+    if (size > IR_FRAME_MAX_PAYLOAD)
+        size = IR_FRAME_MAX_PAYLOAD;
+
+    // SOH + COBS + crc + 0 is about size + 6 bytes each way
+    uint32_t timeout = (2 * (size + 6) * BITS_PER_CHAR * 1000) / getUart7BaudRate() + PING_MARGIN_MS;
+
+    // padding that doesn't compress, so the size is what really goes over the air
+    for (i = PING_HEADER_LENGTH; i < size; i++)
+        payload[i] = i * 37;
+
+    putsUart0("\r\n");
+
+    for (i = 0; i < count; i++)
+    {
+        payload[PING_SEQ] = i;
+        payload[PING_SEQ + 1] = 0;
+
+        replied = false;
+        waiting_seq = i;
+        waiting = true;
+
+        write32(&payload[PING_TIME], getUptimeUs());
+        sendIrFrame(IR_FRAME_PING, payload, size);
+
+        uint32_t start = getUptimeMs();
+        while (!replied && (getUptimeMs() - start) < timeout)
+            runTasks();
+
+        waiting = false;
+
+        putsUart0("Probe ");
+        putsUart0(toAsciiDec(str, i));
+        if (replied)
+        {
+            rtt_us[received] = reply_us;
+            printUs(": ", rtt_us[received]);
+            putsUart0("\r\n");
+            received++;
+        }
+        else
+        {
+            putsUart0(": timed out\r\n");
+        }
+
+        start = getUptimeMs();
+        while ((getUptimeMs() - start) < PING_GAP_MS);
+    }
+
+    putsUart0(toAsciiDec(str, count));
+    putsUart0(" sent, ");
+    putsUart0(toAsciiDec(str, received));
+    putsUart0(" received\r\n");
+
+    if (!received)
+        return;
+
+    // sorted for the percentile, insertion sort is plenty for 100 of them
+    uint8_t j;
+    uint64_t total = 0;
+
+    for (i = 1; i < received; i++)
+    {
+        uint32_t value = rtt_us[i];
+
+        for (j = i; j > 0 && rtt_us[j - 1] > value; j--)
+            rtt_us[j] = rtt_us[j - 1];
+        rtt_us[j] = value;
+    }
+
+    for (i = 0; i < received; i++)
+        total += rtt_us[i];
+
+    // nearest rank: the smallest RTT that at least 99% of them are under
+    uint8_t p99 = (received * 99 + 99) / 100 - 1;
+
+    printUs("RTT min ", rtt_us[0]);
+    printUs(", avg ", total / received);
+    printUs(", max ", rtt_us[received - 1]);
+    printUs(", p99 ", rtt_us[p99]);
+    putsUart0("\r\n");
+}
+
+PING_STATS* getPingStats()
+{
+    return &stats;
+}
@@ -0,0 +1,29 @@
+#ifndef PING_H_
+#define PING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+
+// ping header at the front of IR_FRAME_PING / IR_FRAME_PONG, the rest is padding
+#define PING_SEQ 0          // 16 bit probe number (little endian)
+#define PING_TIME 2         // sender's getUptimeUs (low 32 bits, little endian)
+#define PING_HEADER_LENGTH 6
+
+#define PING_MAX_COUNT 100
+#define PING_DEFAULT_COUNT 4
+#define PING_DEFAULT_SIZE 16
+
+typedef struct _PING_STATS
+{
+    uint32_t answered;      // probes from the other board we echoed back
+    uint32_t late_replies;  // echoes that came in after their probe timed out
+}
+PING_STATS;
+
+void runPing(uint8_t count, uint8_t size);
+void handlePingFrame(IR_FRAME* frame);
+void handlePongFrame(IR_FRAME* frame);
+PING_STATS* getPingStats();
+
+#endif
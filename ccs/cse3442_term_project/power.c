@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "power.h"
+#include "timer.h"
+#include "pwm.h"
+#include "uart.h"
+#include "uart0.h"
+#include "ir_channel.h"
+#include "bridge.h"
+#include "calibration.h"
+#include "scheduler.h"
+#include "priority.h"
+
+/*
+ *  Tickless idle
+ *
+ *  Normally SysTick goes off every 1 ms even if nothing is happening. In tickless mode,
+ *  when the terminal is waiting for input and no task is ready to run, SysTick gets stretched to the next timer in the timer wheel (up to about 4 s,
+ *  the 24 bit reload at 4 MHz) and the core sleeps with WFI until then.
+ *
+ *  Anything that can make work still wakes it up: the IR UART RX interrupts, the PE0
+ *  edge interrupt, and UART0 RX (its interrupt is only unmasked while sleeping). If it
+ *  wakes up early, SysTick is cut back to the next ms boundary and the ms that already
+ *  went by are handed to the timer wheel and uptime right away, so no time is lost.
+ *
+ *  Sleep-on-exit isn't used since the main loop has to run after every wake up anyways
+ *  (the ISRs only fill rings). The DWT cycle counter stops while sleeping, so anything
+ *  that times a window that can have a sleep in it (the echo filter, csma, ping, the
+ *  trace) uses getUptimeUs, which keeps counting. The calibration capture needs cycle
+ *  resolution, so it doesn't sleep at all while one is armed.
+ */
+
+#define TICK_CYCLES 4000    // SysTick runs off PIOSC / 4 = 4 MHz, so 1 ms
+#define MAX_SLEEP_MS 4000   // 24 bit reload at 4 MHz is 4194 ms
+
+static bool tickless = false;
+static volatile uint32_t period_ms = 1; // how many ms the current SysTick period is
+static SLEEP_STATS stats;
+
+void setTickless(bool on)
+{
+    tickless = on;
+
+    // UART0 RX is the wake up for a key press, the interrupt stays masked in the UART
+    // itself except while sleeping (Uart0_Handler masks it again if it fires)
+    if (on)
+    {
+        enableUartRxInterrupt(0, PRIORITY_UART0);
+        UART0_IM_R &= ~(UART_IM_RXIM | UART_IM_RTIM);
+    }
+}
+
+bool getTickless()
+{
+    return tickless;
+}
+
+// called by SysTick_Handler, returns how many ms went by since the last one
+uint32_t takeSysTickMs()
+{
+    uint32_t ms = period_ms;
+
+    period_ms = 1;
+    stats.ticks++;
+
+    return ms;
+}
+
+// moves the timers and uptime along, from SysTick or after an early wake up
+void advanceTicks(uint32_t ms)
+{
+    tickCarrierStats(ms);
+
+    while (ms--)
+        tickTimers();
+}
+
+// starts a SysTick period of cycles, after which it goes back to 1 ms by itself
+static void startPeriod(uint32_t cycles, uint32_t ms)
+{
+    if (cycles < 2)
+        cycles = 2; // a reload of 0 would stop SysTick
+
+    NVIC_ST_RELOAD_R = cycles - 1;
+    NVIC_ST_CURRENT_R = 0;
+
+    // the new reload value gets loaded on the next SysTick clock, after that the
+    // reload can go back to 1 ms for every period after this one
+    while (NVIC_ST_CURRENT_R == 0);
+    NVIC_ST_RELOAD_R = TICK_CYCLES - 1;
+
+    period_ms = ms;
+}
+
+// called from the terminal idle callback, sleeps until the next timer or interrupt
+// if tickless is on and nothing is waiting to be handled
+void sleepUntilNextEvent()
+{
+    if (!tickless)
+        return;
+
+    uint32_t state = disableInterrupts();
+
+    // a tick that is already pending has to be handled first
+    if (isTaskPending() || !isIrChannelIdle() || isBridgeActive() || kbhitUart0() ||
+        isCalibrationCapturing() || (NVIC_INT_CTRL_R & NVIC_INT_CTRL_PENDSTSET))
+    {
+        restoreInterrupts(state);
+        return;
+    }
+
+    uint32_t ms = getNextTimerMs(MAX_SLEEP_MS);
+    if (ms < 2)
+    {
+        restoreInterrupts(state); // the tick is coming anyways
+        return;
+    }
+
+    // the ms in progress right now is the first one of the long period
+    uint32_t remaining = NVIC_ST_CURRENT_R;
+    uint32_t cycles = remaining + (ms - 1) * TICK_CYCLES;
+    startPeriod(cycles, ms);
+
+    UART0_ICR_R = UART_ICR_RXIC | UART_ICR_RTIC;
+    UART0_IM_R |= UART_IM_RXIM | UART_IM_RTIM;
+
+    stats.sleeps++;
+
+    // interrupts are still off, but a pending one still ends the WFI and then
+    // runs as soon as they are restored
+    __asm(" WFI");
+
+    UART0_IM_R &= ~(UART_IM_RXIM | UART_IM_RTIM);
+
+    uint32_t left = NVIC_ST_CURRENT_R;
+
+    if (NVIC_INT_CTRL_R & NVIC_INT_CTRL_PENDSTSET)
+    {
+        stats.sleep_ms += ms; // slept the whole way, SysTick_Handler does the accounting
+    }
+    else
+    {
+        // woke up early, the ms slots still to go are left / TICK_CYCLES rounded up,
+        // and the one that is partly done ends with the next (short) SysTick period
+        uint32_t slots_left = (left + TICK_CYCLES - 1) / TICK_CYCLES;
+        uint32_t done = ms - slots_left;
+
+        if (slots_left > 1)
+            startPeriod(left - (slots_left - 1) * TICK_CYCLES, 1);
+        else
+            period_ms = 1;
+
+        advanceTicks(done);
+
+        stats.early_wakes++;
+        stats.sleep_ms += done;
+    }
+
+    restoreInterrupts(state);
+}
+
+SLEEP_STATS* getSleepStats()
+{
+    return &stats;
+}
@@ -0,0 +1,23 @@
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _SLEEP_STATS
+{
+    uint32_t ticks;         // SysTick interrupts taken
+    uint32_t sleeps;        // times the core went into WFI
+    uint32_t early_wakes;   // woken up by something other than SysTick
+    uint32_t sleep_ms;      // time spent asleep
+}
+SLEEP_STATS;
+
+void setTickless(bool on);
+bool getTickless();
+uint32_t takeSysTickMs();
+void advanceTicks(uint32_t ms);
+void sleepUntilNextEvent();
+SLEEP_STATS* getSleepStats();
+
+#endif
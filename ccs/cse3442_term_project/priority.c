@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "priority.h"
+#include "timestamp.h"
+
+// priority values go in the top 3 bits of the byte
+#define PRIORITY_BITS(priority) ((priority) << 5)
+
+static uint32_t critical_start;
+static uint32_t longest_critical = 0;
+static uint32_t masked_start;
+static uint32_t rx_event_start;
+static volatile bool rx_event_waiting = false;
+static LATENCY_STATS latency;
+
+// grouping, the system exception priorities and the RX event interrupt, the UART and
+// GPIO ones get theirs when they are enabled
+void initInterruptPriorities()
+{
+    NVIC_APINT_R = NVIC_APINT_VECTKEY | NVIC_APINT_PRIGROUP_7_1;
+
+    NVIC_SYS_PRI3_R = (NVIC_SYS_PRI3_R & ~(NVIC_SYS_PRI3_TICK_M | NVIC_SYS_PRI3_PENDSV_M))
+                    | (PRIORITY_SYSTICK << NVIC_SYS_PRI3_TICK_S)
+                    | (PRIORITY_PENDSV << NVIC_SYS_PRI3_PENDSV_S);
+
+    // IR_RX_EVENT_IRQ is interrupt 13
+    NVIC_PRI3_R = (NVIC_PRI3_R & ~NVIC_PRI3_INT13_M) | (PRIORITY_IR_RX_EVENT << NVIC_PRI3_INT13_S);
+    NVIC_EN0_R = 1 << IR_RX_EVENT_IRQ;
+}
+
+// masks every interrupt at PRIORITY_SYSCALL and below (and PendSV, so no thread switch
+// either), returns what to hand to exitCritical. Nesting is fine
+uint32_t enterCritical()
+{
+    uint32_t state = _set_interrupt_priority(PRIORITY_BITS(PRIORITY_SYSCALL));
+
+    // only the outermost one is timed, that is how long the low priority ISRs can be held off
+    if (state == 0)
+        critical_start = getTimestamp();
+
+    return state;
+}
+
+void exitCritical(uint32_t state)
+{
+    if (state == 0)
+    {
+        uint32_t cycles = getTimestamp() - critical_start;
+        if (cycles > longest_critical)
+            longest_critical = cycles;
+    }
+
+    _set_interrupt_priority(state);
+}
+
+uint32_t getLongestCritical()
+{
+    return longest_critical;
+}
+
+// _disable_interrupts / _restore_interrupts, but the outermost one is timed since that
+// is how long even UART7 can be held off. The tickless sleep goes through here too, the
+// DWT stops in WFI so only the awake part counts, which is the part that delays an ISR
+uint32_t disableInterrupts()
+{
+    uint32_t state = _disable_interrupts();
+
+    if (state == 0)
+        masked_start = getTimestamp();
+
+    return state;
+}
+
+void restoreInterrupts(uint32_t state)
+{
+    if (state == 0)
+    {
+        uint32_t cycles = getTimestamp() - masked_start;
+        if (cycles > latency.masked_max)
+            latency.masked_max = cycles;
+    }
+
+    _restore_interrupts(state);
+}
+
+// the RX ISRs trigger IrRxEvent_Handler through here. Only the first trigger is timed,
+// the ones after it until the handler runs are the same interrupt
+void triggerRxEvent()
+{
+    if (!rx_event_waiting)
+    {
+        rx_event_start = getTimestamp();
+        rx_event_waiting = true;
+    }
+
+    NVIC_SW_TRIG_R = IR_RX_EVENT_IRQ;
+}
+
+// first thing in IrRxEvent_Handler, the wait is everything at priority 2 and above that
+// ran first plus any critical section that was open
+void noteRxEventStart()
+{
+    if (rx_event_waiting)
+    {
+        uint32_t cycles = getTimestamp() - rx_event_start;
+
+        rx_event_waiting = false;
+        latency.rx_event_last = cycles;
+        if (cycles > latency.rx_event_max)
+            latency.rx_event_max = cycles;
+    }
+}
+
+// last thing in PortE_Handler, with the timestamp it took at the start
+void noteEdgeIsr(uint32_t start)
+{
+    uint32_t cycles = getTimestamp() - start;
+
+    if (cycles > latency.edge_max)
+        latency.edge_max = cycles;
+}
+
+LATENCY_STATS* getLatencyStats()
+{
+    return &latency;
+}
@@ -0,0 +1,51 @@
+#ifndef PRIORITY_H_
+#define PRIORITY_H_
+
+#include <stdint.h>
+
+/*
+ *  Interrupt priority map, 0 is the most urgent. The TM4C only has the top 3 bits of
+ *  each priority byte, so there are 8 levels, and all 3 bits are preemption bits (no
+ *  sub-priority) so a more urgent ISR always cuts into a less urgent one.
+ *
+ *  Everything at PRIORITY_SYSCALL or below can use the timer wheel, the event flags and
+ *  the kernel, since those are protected by raising BASEPRI to PRIORITY_SYSCALL. The
+ *  ISRs above it (the UART FIFO draining and the PE0 edge timestamps) are never held off
+ *  by a critical section, they just can't call any of that. They trigger IR_RX_EVENT_IRQ
+ *  instead, which posts the event for them from the syscall level.
+ */
+
+#define PRIORITY_UART7          0   // IR RX FIFO to the ring
+#define PRIORITY_EDGE           0   // PE0 edge timestamps (calibration, csma)
+#define PRIORITY_IR_CHANNEL     1   // the extra IR UARTs
+#define PRIORITY_SYSCALL        2   // highest priority that may use the kernel
+#define PRIORITY_IR_RX_EVENT    2   // posts EVENT_IR_RX for the RX ISRs
+#define PRIORITY_UART0          3   // bridge input and the tickless wake up
+#define PRIORITY_SYSTICK        4   // timer wheel callbacks
+#define PRIORITY_PENDSV         7   // context switches go after everything else
+
+// unused peripheral vector (QEI0, never clocked) that the RX ISRs trigger through NVIC_SW_TRIG_R
+#define IR_RX_EVENT_IRQ (INT_QEI0 - 16)
+
+// what can hold an interrupt off, in DWT cycles
+typedef struct _LATENCY_STATS
+{
+    uint32_t rx_event_last;     // an RX ISR triggering IR_RX_EVENT_IRQ to IrRxEvent_Handler running
+    uint32_t rx_event_max;
+    uint32_t edge_max;          // longest PE0 edge ISR, UART7 can wait behind it
+    uint32_t masked_max;        // longest with every interrupt off, UART7 included
+}
+LATENCY_STATS;
+
+void initInterruptPriorities();
+uint32_t enterCritical();
+void exitCritical(uint32_t state);
+uint32_t getLongestCritical();
+uint32_t disableInterrupts();
+void restoreInterrupts(uint32_t state);
+void triggerRxEvent();
+void noteRxEventStart();
+void noteEdgeIsr(uint32_t start);
+LATENCY_STATS* getLatencyStats();
+
+#endif
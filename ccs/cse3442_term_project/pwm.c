@@ -2,8 +2,23 @@
 #include "pwm.h"
 #include "tm4c123gh6pm.h"
 #include "wait.h"
+#include "priority.h"
 
-#define PB6 0x40 // 0100.0000 = bit 6 is ON
+static uint32_t period = PWM_PERIOD_FOR(PWM_DEFAULT_FREQUENCY); // PWM clocks per carrier period
+static uint32_t requested_frequency = PWM_DEFAULT_FREQUENCY;     // what was asked for in Hz
+static uint8_t duty_cycle = PWM_DEFAULT_DUTY; // percent of the carrier period the output is high
+
+// carrier gating, when enabled the M0PWM0 output is only on while an IR channel is sending
+static volatile bool gating = true;
+static volatile bool carrier_on = true;
+
+// one bit per IR channel that is sending right now, the carrier stays on while any are set
+static volatile uint32_t carrier_users = 0;
+
+// carrier on time instrumentation, counted in 1 ms SysTick ticks
+static volatile uint32_t uptime_ms = 0;
+static volatile uint32_t carrier_on_ms = 0;
+static volatile uint32_t carrier_starts = 0;
 
 // GPIO Port B is where the PWM signal is coming from
 void initPWM()
@@ -45,12 +60,13 @@ void initPWM()
 
     // Now we will put the reload value for a 38 KHz output signal
     // Calculated as follows: PWM Clock Source / desired clock
-    // 10,000,000 / 38,000 = 263.16
-    PWM0_0_LOAD_R = 263 - 1;
+    // 10,000,000 / 38,000 = 263.16 (the macro works it out at compile time)
+    PWM0_0_LOAD_R = PWM_PERIOD_FOR(PWM_DEFAULT_FREQUENCY) - 1;
 
-    PWM0_0_CMPA_R = 131; // default duty cycle set to 50% so its equally on/off
-                         // this is calculated by doing the load * (1 - desired_duty_cycle)
-                         // so 263 * ( 1 - 0.5 ) = 131.5, so it will turn off once counter counts down to 131.5
+    // default duty cycle set to 50% so its equally on/off
+    // this is calculated by doing the load * (1 - desired_duty_cycle)
+    // so 263 * ( 1 - 0.5 ) = 131.5, so it will turn off once counter counts down to 131.5
+    PWM0_0_CMPA_R = PWM_COMPARE_FOR(PWM_PERIOD_FOR(PWM_DEFAULT_FREQUENCY), PWM_DEFAULT_DUTY);
 
     // after modifying the values we update PWM0 to be synced
     PWM0_CTL_R |= PWM_CTL_GLOBALSYNC0;
@@ -59,4 +75,164 @@ void initPWM()
     PWM0_0_CTL_R |= PWM_0_CTL_ENABLE; // enable PWM module 0, generator 0
 
     PWM0_ENABLE_R |= PWM_ENABLE_PWM0EN; // enable the M0PWM0 output signal to pin PB6
+
+    // with gating on, the generator keeps running but the pin is held low until
+    // there is something to send (see carrierOn / carrierOff)
+    if (gating)
+    {
+        carrier_on = false;
+        PWM0_ENABLE_R &= ~PWM_ENABLE_PWM0EN;
+    }
+}
+
+// changes the carrier period (in 10 MHz PWM clocks) and the duty cycle together,
+// frequency is just what was asked for so the error can be reported later
+// (call setPWMCarrier instead of this, it works out the period)
+void loadPWMCarrier(uint32_t new_period, uint8_t percent, uint32_t frequency)
+{
+    if (new_period < 2 || new_period > 0xFFFF) // the generator counter is only 16 bits
+        return;
+
+    period = new_period;
+    requested_frequency = frequency;
+
+    // the generator picks up the new load and compare values when the counter
+    // reloads so there is no glitch in the middle of a carrier period
+    PWM0_0_LOAD_R = period - 1;
+    setPWMDutyCycle(percent);
+}
+
+// changes the carrier duty cycle (percent of each period the PWM is high)
+// same math as the default CMPA in initPWM: load * (1 - duty)
+void setPWMDutyCycle(uint8_t percent)
+{
+    if (percent < 1)
+        percent = 1;
+    if (percent > 99)
+        percent = 99;
+
+    duty_cycle = percent;
+    PWM0_0_CMPA_R = PWM_COMPARE_FOR(period, percent);
+}
+
+uint8_t getPWMDutyCycle()
+{
+    return duty_cycle;
+}
+
+// the frequency actually coming out, which is off a bit since the period is a whole number of clocks
+uint32_t getPWMFrequency()
+{
+    return (PWM_CLOCK + period / 2) / period;
+}
+
+// actual - requested frequency in Hz, ex: 38 KHz gives 10 MHz / 263 = 38023 so +23 Hz
+int32_t getPWMFrequencyError()
+{
+    return (int32_t)getPWMFrequency() - (int32_t)requested_frequency;
+}
+
+/*
+ *  Carrier gating
+ *
+ *  The LED only lights when the inverted UART7 TX is low AND the PWM is high, so
+ *  while the UART is idle the LED is off anyways, but the 38 KHz signal is still
+ *  switching the AND gate and running the PWM pin. So instead the M0PWM0 output
+ *  is only enabled while UART7 has data in flight: putcUart7 calls carrierOn
+ *  before it writes the data register, and the UART7 end of transmission
+ *  interrupt calls carrierOff once the last stop bit is out. The generator itself
+ *  keeps counting so the carrier comes back instantly and with the right period.
+ *  When the output is disabled the pin is driven low, which keeps the LED off.
+ *
+ *  The carrier is shared by all the IR channels (see ir_channel.c), so each one
+ *  passes its channel number and it only goes off once none of them are sending.
+ *  Those calls come from the UART ISRs (priority 0 and 1, above what enterCritical
+ *  masks), so carrier_users and the enable bit are changed with interrupts off.
+ *  Otherwise another channel could turn the carrier on right between the check for
+ *  no users and the disable, and then send without it.
+ */
+
+// turns the carrier output on, has to happen before the start bit goes out
+void carrierOn(uint8_t channel)
+{
+    uint32_t state = disableInterrupts();
+
+    carrier_users |= 1 << channel;
+
+    if (!carrier_on)
+    {
+        carrier_starts++;
+    }
+    carrier_on = true;
+    PWM0_ENABLE_R |= PWM_ENABLE_PWM0EN;
+
+    restoreInterrupts(state);
+}
+
+// this channel is done sending, the carrier goes off (only if gating is enabled)
+// once every channel is done
+void carrierOff(uint8_t channel)
+{
+    uint32_t state = disableInterrupts();
+
+    carrier_users &= ~(1 << channel);
+
+    if (gating && carrier_users == 0)
+    {
+        carrier_on = false;
+        PWM0_ENABLE_R &= ~PWM_ENABLE_PWM0EN;
+    }
+
+    restoreInterrupts(state);
+}
+
+bool isCarrierOn()
+{
+    return carrier_on;
+}
+
+// turning gating off just leaves the carrier running all the time like before
+void setCarrierGating(bool enable)
+{
+    uint32_t state = disableInterrupts();
+
+    gating = enable;
+
+    if (!gating)
+    {
+        carrier_on = true;
+        PWM0_ENABLE_R |= PWM_ENABLE_PWM0EN;
+    }
+
+    restoreInterrupts(state);
+}
+
+bool getCarrierGating()
+{
+    return gating;
+}
+
+// called from SysTick to keep track of how long the carrier was on, ms is usually 1
+// but it is more after a tickless sleep
+void tickCarrierStats(uint32_t ms)
+{
+    uptime_ms += ms;
+
+    if (carrier_on)
+        carrier_on_ms += ms;
+}
+
+uint32_t getUptimeMs()
+{
+    return uptime_ms;
+}
+
+uint32_t getCarrierOnMs()
+{
+    return carrier_on_ms;
+}
+
+uint32_t getCarrierStarts()
+{
+    return carrier_starts;
 }
@@ -2,9 +2,54 @@
 #define PWM_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define PB6 0x40 // 0100.0000 = bit 6 is ON
 
+// PWM clock is sys-clock / 4 = 40 MHz / 4 = 10 MHz (PWMDIV_4 in initPWM)
+#define PWM_CLOCK 10000000
+
+#define PWM_DEFAULT_FREQUENCY 38000
+#define PWM_DEFAULT_DUTY 50
+
+// TSOP variants come in 30, 33, 36, 38, 40 and 56 kHz
+#define PWM_MIN_FREQUENCY 30000
+#define PWM_MAX_FREQUENCY 56000
+
+// number of PWM clocks in one carrier period, rounded to the nearest clock
+// ex: 10,000,000 / 38,000 = 263.16 -> 263
+#define PWM_PERIOD_FOR(frequency) ((PWM_CLOCK + (frequency) / 2) / (frequency))
+
+// the output goes low once the counter counts down to CMPA, so CMPA = period * (1 - duty)
+#define PWM_COMPARE_FOR(period, percent) (((period) * (100 - (percent))) / 100)
+
 void initPWM();
+void loadPWMCarrier(uint32_t period, uint8_t percent, uint32_t frequency);
+void setPWMDutyCycle(uint8_t percent);
+uint8_t getPWMDutyCycle();
+uint32_t getPWMFrequency();
+int32_t getPWMFrequencyError();
+void carrierOn(uint8_t channel);
+void carrierOff(uint8_t channel);
+bool isCarrierOn();
+void setCarrierGating(bool enable);
+bool getCarrierGating();
+void tickCarrierStats(uint32_t ms);
+uint32_t getUptimeMs();
+uint32_t getCarrierOnMs();
+uint32_t getCarrierStarts();
+
+// sets the carrier frequency (Hz) and duty cycle (percent), returns false if out of range
+// this is inline so when it is called with constants the divide happens at compile time
+static inline bool setPWMCarrier(uint32_t frequency, uint8_t percent)
+{
+    if (frequency < PWM_MIN_FREQUENCY || frequency > PWM_MAX_FREQUENCY)
+        return false;
+    if (percent < 1 || percent > 99)
+        return false;
+
+    loadPWMCarrier(PWM_PERIOD_FOR(frequency), percent, frequency);
+    return true;
+}
 
 #endif
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "scheduler.h"
+#include "timestamp.h"
+#include "kernel.h"
+#include "priority.h"
+
+/*
+ *  Event loop
+ *
+ *  The ISRs don't do any of the real work, they just post event flags. Each task says
+ *  which flags it waits for, and runTasks runs the most important task that has one of
+ *  its flags set, clearing them first. Tasks run to completion (no task switching), so
+ *  they have to be short, and after every task it looks from the top again, so something
+ *  posted for a more important task in the meantime goes next.
+ *
+ *  runTasks is called while the terminal waits for a key and from the loops that wait
+ *  for an answer over IR (calibration, xfer, bridge), the command loop itself is like the
+ *  lowest priority task.
+ *
+ *  With the kernel running, the tasks get their own "events" thread instead, which
+ *  waits on a semaphore that postEvent gives. It is more important than the command
+ *  loop, so a long command (compressing, sending with csma, an xfer block) can't hold
+ *  up the RX side anymore, and runTasks from anywhere else does nothing.
+ */
+
+#define EVENT_STACK_WORDS 512
+
+static TASK tasks[TASK_MAX];    // kept sorted by priority
+static uint8_t task_count = 0;
+static volatile uint32_t pending = 0;
+static uint32_t used_events = 0;  // flags some task is waiting for
+
+static THREAD* event_thread = 0;
+static SEMAPHORE event_ready;
+#pragma DATA_ALIGN(event_stack, 8)
+static uint32_t event_stack[EVENT_STACK_WORDS];
+
+static void eventThread()
+{
+    while (1)
+    {
+        waitSemaphore(&event_ready);
+        runTasks();
+    }
+}
+
+// runs the tasks from their own thread once the kernel is started
+void startEventThread(uint8_t priority)
+{
+    initSemaphore(&event_ready, 0);
+    event_thread = createThread("events", eventThread, event_stack, EVENT_STACK_WORDS, priority);
+}
+
+// adds a task, returns false if there is no room
+bool addTask(const char* name, void (*run)(), uint32_t events, uint8_t priority)
+{
+    uint8_t i;
+
+    if (task_count == TASK_MAX)
+        return false;
+
+    // move the less important ones down to make a spot (same priority keeps the order added)
+    for (i = task_count; i > 0 && tasks[i - 1].priority > priority; i--)
+        tasks[i] = tasks[i - 1];
+
+    tasks[i].name = name;
+    tasks[i].run = run;
+    tasks[i].events = events;
+    tasks[i].priority = priority;
+    tasks[i].runs = 0;
+    tasks[i].cycles = 0;
+    tasks[i].max_cycles = 0;
+    task_count++;
+    used_events |= events;
+
+    return true;
+}
+
+// ok to call from an interrupt
+void postEvent(uint32_t events)
+{
+    uint32_t state = enterCritical();
+    bool idle = !(pending & used_events);
+
+    pending |= events;
+
+    // if something was pending already the event thread is going to look again anyways
+    if (event_thread && idle && (events & used_events))
+        postSemaphore(&event_ready);
+
+    exitCritical(state);
+}
+
+// true if a task is ready to run (flags nobody waits for don't count)
+bool isTaskPending()
+{
+    return (pending & used_events) != 0;
+}
+
+// runs ready tasks in priority order until none are left
+void runTasks()
+{
+    if (isKernelRunning() && getCurrentThread() != event_thread)
+        return;
+
+    while (1)
+    {
+        TASK* task = 0;
+        uint8_t i;
+
+        uint32_t state = enterCritical();
+        for (i = 0; i < task_count; i++)
+        {
+            if (tasks[i].events & pending)
+            {
+                task = &tasks[i];
+                pending &= ~task->events;
+                break;
+            }
+        }
+        exitCritical(state);
+
+        if (!task)
+            return;
+
+        uint32_t start = getTimestamp();
+        task->run();
+        uint32_t cycles = getTimestamp() - start;
+
+        task->runs++;
+        task->cycles += cycles;
+        if (cycles > task->max_cycles)
+            task->max_cycles = cycles;
+    }
+}
+
+uint8_t getTaskCount()
+{
+    return task_count;
+}
+
+TASK* getTask(uint8_t index)
+{
+    return (index < task_count) ? &tasks[index] : 0;
+}
@@ -0,0 +1,36 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TASK_MAX 8
+
+// event flags, set from the ISRs (or anywhere) with postEvent
+#define EVENT_IR_RX     0x01    // an IR UART put bytes in its RX ring
+#define EVENT_TICK      0x02    // SysTick went off
+#define EVENT_BATCH     0x04    // the batch flush timer ran out
+#define EVENT_MESH      0x08    // a mesh message is waiting in a neighbor queue
+#define EVENT_TX        0x10    // a reply is queued for UART7 (csma.c queueIrWire)
+
+typedef struct _TASK
+{
+    const char* name;
+    void (*run)();
+    uint32_t events;        // which event flags make it ready
+    uint8_t priority;       // 0 is the most important
+    uint32_t runs;
+    uint64_t cycles;        // total time spent in run, in DWT cycles (32 bits is only 107 s)
+    uint32_t max_cycles;
+}
+TASK;
+
+void startEventThread(uint8_t priority);
+bool addTask(const char* name, void (*run)(), uint32_t events, uint8_t priority);
+void postEvent(uint32_t events);
+bool isTaskPending();
+void runTasks();
+uint8_t getTaskCount();
+TASK* getTask(uint8_t index);
+
+#endif
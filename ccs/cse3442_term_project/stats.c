@@ -0,0 +1,334 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "stats.h"
+#include "uart0.h"
+#include "pwm.h"
+#include "ir_frame.h"
+#include "ir_channel.h"
+#include "echo.h"
+#include "csma.h"
+#include "mesh.h"
+#include "fragment.h"
+#include "bulk.h"
+#include "bridge.h"
+#include "batch.h"
+#include "compress.h"
+#include "timer.h"
+#include "power.h"
+#include "scheduler.h"
+#include "kernel.h"
+#include "priority.h"
+#include "ping.h"
+#include "timesync.h"
+#include "trace.h"
+#include "timestamp.h"
+#include "strings.h"
+
+/*
+ *  stats command, just collects the counters from the other modules and prints them
+ */
+
+// values at the last time stats was printed, so the "since last" numbers can be worked out
+static uint32_t last_uptime_ms = 0;
+static uint32_t last_carrier_on_ms = 0;
+
+// prints "label value\r\n"
+static void printStat(char* label, int32_t value)
+{
+    char str[12];
+
+    putsUart0(label);
+    putsUart0(toAsciiDec(str, value));
+    putsUart0("\r\n");
+}
+
+// percent of part / whole, done in 64 bits so big ms counts don't overflow
+static uint32_t percentOf(uint32_t part, uint32_t whole)
+{
+    if (whole == 0)
+        return 0;
+
+    return ((uint64_t)part * 100) / whole;
+}
+
+void printStats()
+{
+    uint32_t uptime = getUptimeMs();
+    uint32_t carrier_on = getCarrierOnMs();
+    uint32_t interval = uptime - last_uptime_ms;
+    uint32_t interval_on = carrier_on - last_carrier_on_ms;
+
+    last_uptime_ms = uptime;
+    last_carrier_on_ms = carrier_on;
+
+    putsUart0("\r\n");
+    printStat("Uptime (ms):                 ", uptime);
+
+    TIMER_STATS* timers = getTimerStats();
+
+    printStat("Timers fired:                ", timers->fired);
+    printStat("Timers cascaded:             ", timers->cascaded);
+    printStat("Most timers in one tick:     ", timers->max_per_tick);
+    printStat("Longest tick (cycles):       ", timers->max_tick_cycles);
+    printStat("Longest critical (cycles):   ", getLongestCritical());
+
+    // what UART7 can wait behind is the PE0 ISR and interrupts off, the RX event is
+    // measured from the trigger to the handler starting
+    LATENCY_STATS* latency = getLatencyStats();
+
+    printStat("Longest PE0 ISR (cycles):    ", latency->edge_max);
+    printStat("Longest ints off (cycles):   ", latency->masked_max);
+    printStat("RX event latency (cycles):   ", latency->rx_event_last);
+    printStat("  Longest (cycles)           ", latency->rx_event_max);
+
+    // the per second numbers are since boot, so turn tickless on right after reset to
+    // see what it really does
+    SLEEP_STATS* sleep = getSleepStats();
+    putsUart0(getTickless() ? "Tickless idle:               on\r\n" : "Tickless idle:               off\r\n");
+    printStat("SysTick interrupts per s:    ", uptime ? ((uint64_t)sleep->ticks * 1000) / uptime : 0);
+    printStat("Sleeps:                      ", sleep->sleeps);
+    printStat("  Woken up early             ", sleep->early_wakes);
+    printStat("Wake ups per s:              ", uptime ? ((uint64_t)sleep->sleeps * 1000) / uptime : 0);
+    printStat("Sleep residency (%):         ", percentOf(sleep->sleep_ms, uptime));
+
+    putsUart0(getCarrierGating() ? "Carrier gating:              on\r\n" : "Carrier gating:              off\r\n");
+    printStat("Carrier on (ms):             ", carrier_on);
+    printStat("Carrier on (% of uptime):    ", percentOf(carrier_on, uptime));
+    printStat("Carrier on since last (ms):  ", interval_on);
+    printStat("Carrier on since last (%):   ", percentOf(interval_on, interval));
+    printStat("Carrier starts:              ", getCarrierStarts());
+
+    ECHO_STATS* echo = getEchoStats();
+    uint8_t mode = getDuplexMode();
+
+    putsUart0(mode == DUPLEX_FULL ? "Duplex mode:                 full\r\n" :
+              mode == DUPLEX_HALF ? "Duplex mode:                 half\r\n" :
+                                    "Duplex mode:                 auto\r\n");
+    putsUart0(isHalfDuplex() ? "Running half duplex:         yes\r\n" : "Running half duplex:         no\r\n");
+    printStat("Own echoes dropped:          ", echo->echoes);
+    printStat("Echo mismatches:             ", echo->mismatches);
+    printStat("Sent bytes with no echo:     ", echo->expired);
+    printStat("Half duplex turnaround waits:", echo->turnarounds);
+
+    CSMA_STATS* csma = getCsmaStats();
+
+    putsUart0(getCsma() ? "CSMA:                        on\r\n" : "CSMA:                        off\r\n");
+    printStat("  Frames                     ", csma->frames);
+    printStat("  Attempts                   ", csma->attempts);
+    printStat("  Deferred (medium busy)     ", csma->deferrals);
+    printStat("  Backoff slots              ", csma->backoff_slots);
+    printStat("  Collisions                 ", csma->collisions);
+    printStat("  Collision rate (%)         ", percentOf(csma->collisions, csma->attempts));
+    printStat("  Dropped after retries      ", csma->dropped);
+    printStat("  Sent without going idle    ", csma->forced);
+    printStat("  Replies queued behind shell", csma->queued);
+    printStat("  Replies dropped, queue full", csma->queue_full);
+
+    if (getIrNode() == IR_NODE_NONE)
+        putsUart0("Node addressing:             off\r\n");
+    else
+        printStat("Node id:                     ", getIrNode());
+
+    MESH_STATS* mesh = getMeshStats();
+
+    putsUart0(getMeshRelay() ? "Mesh relay:                  on\r\n" : "Mesh relay:                  off\r\n");
+    printStat("  Sent                       ", mesh->sent);
+    printStat("  Delivered to us            ", mesh->delivered);
+    printStat("  Forwarded                  ", mesh->forwarded);
+    printStat("  Duplicates dropped         ", mesh->duplicates);
+    printStat("  TTL expired                ", mesh->ttl_expired);
+    printStat("  Flooded (no route)         ", mesh->flooded);
+    printStat("  Neighbor queue full        ", mesh->queue_full);
+
+    uint8_t i;
+    for (i = 0; i < IR_NODE_COUNT; i++)
+    {
+        if (getMeshRoute(i) != IR_NODE_NONE)
+        {
+            char str[12];
+
+            putsUart0("  Route to node ");
+            putsUart0(toAsciiDec(str, i));
+            putsUart0(" via node ");
+            putsUart0(toAsciiDec(str, getMeshRoute(i)));
+            putsUart0("\r\n");
+        }
+    }
+
+    FRAGMENT_STATS* fragment = getFragmentStats();
+
+    putsUart0("Fragmentation\r\n");
+    printStat("  Messages split up          ", fragment->sent_messages);
+    printStat("  Fragments sent             ", fragment->sent_fragments);
+    printStat("  Fragments received         ", fragment->rx_fragments);
+    printStat("  Messages put back together ", fragment->reassembled);
+    printStat("  Duplicate fragments        ", fragment->duplicates);
+    printStat("  Incomplete, timed out      ", fragment->timeouts);
+    printStat("  Incomplete, pushed out     ", fragment->evicted);
+    printStat("  Bad fragments              ", fragment->bad);
+
+    BULK_STATS* bulk = getBulkStats();
+
+    putsUart0("Bulk transfer\r\n");
+    printStat("  Blocks sent                ", bulk->tx_blocks);
+    printStat("  Bytes sent                 ", bulk->tx_bytes);
+    printStat("  IR resends                 ", bulk->tx_retries);
+    printStat("  Bad XMODEM packets         ", bulk->bad_packets);
+    printStat("  Failed transfers           ", bulk->failed);
+    printStat("  Blocks received            ", bulk->rx_blocks);
+    printStat("  Bytes received             ", bulk->rx_bytes);
+    printStat("  Duplicate blocks           ", bulk->rx_duplicates);
+
+    PING_STATS* ping = getPingStats();
+
+    printStat("Pings answered:              ", ping->answered);
+    printStat("Late / extra ping replies:   ", ping->late_replies);
+
+    TIMESYNC_STATS* timesync = getTimesyncStats();
+
+    putsUart0("Clock sync\r\n");
+    printStat("  Syncs                      ", timesync->syncs);
+    printStat("  Requests sent              ", timesync->exchanges);
+    printStat("  Replies                    ", timesync->replies);
+    printStat("  Requests answered          ", timesync->answered);
+    printStat("  Best delay (us)            ", timesync->last_delay_us);
+
+    printStat("Trace bytes recorded:        ", getTraceCount());
+
+    BRIDGE_STATS* bridge = getBridgeStats();
+
+    putsUart0("Bridge\r\n");
+    printStat("  PC -> IR bytes             ", bridge->to_ir_bytes);
+    printStat("  PC -> IR frames            ", bridge->to_ir_frames);
+    printStat("  IR -> PC bytes             ", bridge->from_ir_bytes);
+    printStat("  Buffer now (bytes)         ", getBridgeOccupancy());
+    printStat("  Buffer peak (bytes)        ", bridge->peak);
+    printStat("  Buffer size (bytes)        ", BRIDGE_BUFFER_SIZE);
+    printStat("  XOFF sent                  ", bridge->xoffs);
+    printStat("  Overflowed bytes           ", bridge->overflows);
+
+    COMPRESS_STATS* compress = getCompressStats();
+
+    putsUart0(getCompression() ? "Compression:                 on\r\n" : "Compression:                 off\r\n");
+    printStat("  Frames compressed          ", compress->compressed);
+    printStat("  Frames sent raw            ", compress->raw);
+    printStat("  Bytes before               ", compress->bytes_in);
+    printStat("  Bytes after                ", compress->bytes_out);
+    printStat("  Size after (%)             ", percentOf(compress->bytes_out, compress->bytes_in));
+    printStat("  Cycles per input byte      ", compress->cycles / (compress->bytes_in + (compress->bytes_in == 0)));
+    printStat("  Frames decompressed        ", compress->decompressed);
+    printStat("  Decompress errors          ", compress->errors);
+
+    BATCH_STATS* batch = getBatchStats();
+
+    printStat("Batch delay (ms, 0 = off)    ", getBatchDelay());
+    printStat("  Messages batched           ", batch->messages);
+    printStat("  Batch frames               ", batch->frames);
+    printStat("  Sent because full          ", batch->size_flushes);
+    printStat("  Sent because of the timer  ", batch->timer_flushes);
+    for (i = 0; i < BATCH_HISTOGRAM_SIZE; i++)
+    {
+        char str[12];
+
+        putsUart0("  Frames with ");
+        putsUart0(toAsciiDec(str, i + 1));
+        putsUart0(i == BATCH_HISTOGRAM_SIZE - 1 ? "+ messages:     " : " messages:      ");
+        putsUart0(toAsciiDec(str, batch->histogram[i]));
+        putsUart0("\r\n");
+    }
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+    {
+        IR_CHANNEL* ch = &irChannels[i];
+
+        printStat("\r\nIR channel                   ", i);
+        printStat("  UART                       ", ch->uart);
+        printStat("  RX bytes                   ", ch->rx_bytes);
+        printStat("  TX bytes                   ", ch->tx_bytes);
+        printStat("  RX messages                ", ch->rx_messages);
+        printStat("  RX frames                  ", ch->rx_frames);
+        printStat("  Bad frames (crc/cobs)      ", ch->frame_rx.errors);
+        printStat("  Cut off by RX timeout      ", ch->rx_truncated);
+        printStat("  RX ring overflows          ", ch->rx_overflows);
+        printStat("  UART overruns              ", ch->rx_overruns);
+        printStat("  Breaks (dropped)           ", ch->rx_breaks);
+        printStat("  Parity errors (dropped)    ", ch->rx_parity_errors);
+        printStat("  Framing errors (dropped)   ", ch->rx_framing_errors);
+        printStat("  TX ring full               ", ch->tx_overflows);
+    }
+
+    DIVERSITY* d = getIrDiversity();
+    if (d->receivers)
+    {
+        printStat("\r\nDiversity receivers          ", d->receivers);
+        printStat("  Delivered frames           ", d->delivered_frames);
+        printStat("  Recovered by vote          ", d->voted_frames);
+        printStat("  Lost frames                ", d->lost_frames);
+        printStat("  Duplicate copies dropped   ", d->duplicates);
+
+        for (i = 0; i < d->receivers; i++)
+        {
+            printStat("  Receiver                   ", i);
+            printStat("    Good copies              ", d->stats[i].good);
+            printStat("    Bad copies (crc)         ", d->stats[i].bad);
+            printStat("    Missing copies           ", d->stats[i].missing);
+        }
+    }
+}
+
+// tasks command, one line per event loop task in priority order, the CPU percent
+// is since boot
+void printTasks()
+{
+    uint64_t uptime_cycles = (uint64_t)getUptimeMs() * 1000 * TIMESTAMP_TICKS_PER_US;
+    char str[12];
+    uint8_t i;
+
+    putsUart0("\r\n");
+
+    for (i = 0; i < getTaskCount(); i++)
+    {
+        TASK* task = getTask(i);
+        uint32_t average = task->runs ? task->cycles / task->runs : 0;
+        uint32_t load = uptime_cycles ? (task->cycles * 100) / uptime_cycles : 0;
+
+        putsUart0((char*)task->name);
+        putsUart0(": priority ");
+        putsUart0(toAsciiDec(str, task->priority));
+        putsUart0(", runs ");
+        putsUart0(toAsciiDec(str, task->runs));
+        putsUart0(", average ");
+        putsUart0(toAsciiDec(str, average));
+        putsUart0(" cycles, longest ");
+        putsUart0(toAsciiDec(str, task->max_cycles));
+        putsUart0(" cycles, CPU ");
+        putsUart0(toAsciiDec(str, load));
+        putsUart0(" %\r\n");
+    }
+
+    putsUart0("\r\n");
+
+    for (i = 0; i < getThreadCount(); i++)
+    {
+        THREAD* thread = getThread(i);
+
+        putsUart0("Thread ");
+        putsUart0((char*)thread->name);
+        putsUart0(": priority ");
+        putsUart0(toAsciiDec(str, thread->priority));
+        putsUart0(", switched to ");
+        putsUart0(toAsciiDec(str, thread->switches));
+        putsUart0(" times\r\n");
+    }
+
+    KERNEL_STATS* kernel = getKernelStats();
+    uint32_t measured = kernel->switches ? kernel->switches - 1 : 0;   // the last one isn't done yet
+
+    printStat("Context switches:            ", kernel->switches);
+    if (measured)
+    {
+        printStat("  Shortest (cycles)          ", kernel->min_switch_cycles);
+        printStat("  Average (cycles)           ", kernel->switch_cycles / measured);
+        printStat("  Longest (cycles)           ", kernel->max_switch_cycles);
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+void printStats();
+void printTasks();
+
+#endif
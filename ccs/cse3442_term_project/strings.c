@@ -99,3 +99,40 @@ char *str_cpy(char* paste, char* copy)
     paste[i] = '\0';
     return paste;
 }
+
+// converts a signed number into a decimal string, buffer needs to be at least 12 chars
+// (sign + 10 digits + null terminator)
+char* toAsciiDec(char* buffer, int32_t value)
+{
+    char digits[10];
+    uint8_t count = 0;
+    uint8_t i = 0;
+    uint32_t magnitude;
+
+    if (value < 0)
+    {
+        buffer[i++] = '-';
+        magnitude = -(uint32_t)value;
+    }
+    else
+    {
+        magnitude = value;
+    }
+
+    // pull the digits off LSB first, then write them back in the right order
+    do
+    {
+        digits[count++] = (magnitude % 10) + '0';
+        magnitude /= 10;
+    }
+    while (magnitude > 0);
+
+    while (count > 0)
+    {
+        buffer[i++] = digits[--count];
+    }
+
+    buffer[i] = 0;
+
+    return buffer;
+}
@@ -7,6 +7,6 @@ char* toAsciiHex(char* buffer, uint32_t value);
 uint32_t str_cmp(const char* str1, const char* str2);
 uint32_t str_len(const char* str);
 char* str_cpy(char* paste, char* copy);
-// int to decimal ascii / string maybe
+char* toAsciiDec(char* buffer, int32_t value);
 
 #endif
@@ -0,0 +1,225 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+#include "timestamp.h"
+#include "priority.h"
+
+/*
+ *  Hierarchical timer wheel, ticked by SysTick every 1 ms
+ *
+ *  Instead of every module keeping its own countdown in SysTick_Handler, anything that
+ *  needs a timeout has a TIMER and calls startTimer. There are 3 wheels of 64 slots:
+ *    level 0: 1 ms per slot, timers going off in the current 64 ms block
+ *    level 1: 64 ms per slot, timers in the current 4096 ms block
+ *    level 2: 4096 ms per slot, everything further out (up to TIMER_MAX_MS)
+ *  Each slot is a linked list, so start / stop is O(1) no matter how many timers there
+ *  are. When level 0 wraps around, the next level 1 slot gets emptied into level 0
+ *  (and the same for level 2 into level 1), so each timer only moves at most twice.
+ *
+ *  The callbacks run inside the SysTick interrupt, so they need to be short. Anything
+ *  that sends / prints should just set a flag for the main loop.
+ */
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define LEVELS 3
+#define BLOCK_MASK (0xFFFFFFFF >> WHEEL_BITS)  // so the block math still works when now wraps
+
+static TIMER* wheel[LEVELS][WHEEL_SIZE];
+static volatile uint32_t now = 0;
+static TIMER_STATS stats;
+
+void initTimer(TIMER* timer, void (*callback)(void* context), void* context)
+{
+    timer->next = 0;
+    timer->prev = 0;
+    timer->slot = 0;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+// puts the timer in the right slot for how far away it is, interrupts have to be off
+static void place(TIMER* timer)
+{
+    uint32_t expires = timer->expires;
+    uint8_t level;
+
+    // the level is picked by how many blocks away it is, not by ms, so a timer never
+    // lands in a slot that was already passed
+    if ((expires >> WHEEL_BITS) == (now >> WHEEL_BITS))
+        level = 0;
+    else if ((((expires >> WHEEL_BITS) - (now >> WHEEL_BITS)) & BLOCK_MASK) < WHEEL_SIZE)
+        level = 1;
+    else
+        level = 2;
+
+    TIMER** slot = &wheel[level][(expires >> (level * WHEEL_BITS)) & WHEEL_MASK];
+
+    timer->prev = 0;
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->prev = timer;
+    *slot = timer;
+    timer->slot = slot;
+}
+
+static void unlink(TIMER* timer)
+{
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        *timer->slot = timer->next;
+
+    if (timer->next)
+        timer->next->prev = timer->prev;
+
+    timer->slot = 0;
+}
+
+// (re)starts the timer so it goes off ms from now, ok to call from an interrupt at
+// PRIORITY_SYSCALL or below
+void startTimer(TIMER* timer, uint32_t ms)
+{
+    uint32_t state = enterCritical();
+
+    if (timer->slot)
+        unlink(timer);
+
+    if (ms == 0)
+        ms = 1;
+    if (ms > TIMER_MAX_MS)
+        ms = TIMER_MAX_MS;
+
+    timer->expires = now + ms;
+    place(timer);
+
+    exitCritical(state);
+}
+
+void stopTimer(TIMER* timer)
+{
+    uint32_t state = enterCritical();
+
+    if (timer->slot)
+        unlink(timer);
+
+    exitCritical(state);
+}
+
+bool isTimerRunning(TIMER* timer)
+{
+    return timer->slot != 0;
+}
+
+// empties one slot of a higher level back into the wheel
+static void cascade(uint8_t level, uint8_t index)
+{
+    TIMER* timer = wheel[level][index];
+
+    wheel[level][index] = 0;
+    while (timer)
+    {
+        TIMER* next = timer->next;
+        place(timer);
+        stats.cascaded++;
+        timer = next;
+    }
+}
+
+// called from SysTick_Handler every 1 ms
+void tickTimers()
+{
+    uint32_t start = getTimestamp();
+    uint16_t count = 0;
+    uint32_t state;
+
+    // IrRxEvent_Handler is above SysTick and starts timers, so the lists can't be half
+    // moved when it cuts in. Only the list work is in the critical section, not the
+    // callbacks
+    state = enterCritical();
+
+    now++;
+
+    // level 0 wrapped, pull down the next block (level 2 first since it can feed level 1)
+    if ((now & WHEEL_MASK) == 0)
+    {
+        if (((now >> WHEEL_BITS) & WHEEL_MASK) == 0)
+            cascade(2, (now >> (2 * WHEEL_BITS)) & WHEEL_MASK);
+        cascade(1, (now >> WHEEL_BITS) & WHEEL_MASK);
+    }
+
+    exitCritical(state);
+
+    TIMER** slot = &wheel[0][now & WHEEL_MASK];
+    while (true)
+    {
+        state = enterCritical();
+
+        // taken out first so the callback can start it again
+        TIMER* timer = *slot;
+        if (timer)
+            unlink(timer);
+
+        exitCritical(state);
+
+        if (!timer)
+            break;
+
+        timer->callback(timer->context);
+        count++;
+    }
+
+    stats.fired += count;
+    if (count > stats.max_per_tick)
+        stats.max_per_tick = count;
+
+    uint32_t cycles = getTimestamp() - start;
+    if (cycles > stats.max_tick_cycles)
+        stats.max_tick_cycles = cycles;
+}
+
+// how many ticks until tickTimers has something to do (a timer going off or a higher
+// level slot to cascade), up to max. Used by the tickless idle to know how long it can
+// sleep, interrupts have to be off
+uint32_t getNextTimerMs(uint32_t max)
+{
+    uint32_t offset = now & WHEEL_MASK;
+    uint32_t i;
+
+    // rest of the current block
+    for (i = 1; i < WHEEL_SIZE - offset; i++)
+    {
+        if (wheel[0][(now + i) & WHEEL_MASK])
+            return (i < max) ? i : max;
+    }
+
+    // anything further out only shows up in level 0 after a cascade, so wake up at the
+    // start of the block that has something in it and check again from there
+    uint32_t until_block = WHEEL_SIZE - offset;
+    uint32_t until_level2 = (1UL << (2 * WHEEL_BITS)) - (now & ((1UL << (2 * WHEEL_BITS)) - 1));
+
+    for (i = 0; i < WHEEL_SIZE && until_block < max; i++, until_block += WHEEL_SIZE)
+    {
+        // level 2 gets cascaded on the 4096 ms boundary
+        if (until_block == until_level2)
+        {
+            uint8_t j;
+            for (j = 0; j < WHEEL_SIZE; j++)
+            {
+                if (wheel[2][j])
+                    return until_block;
+            }
+        }
+
+        if (wheel[1][((now >> WHEEL_BITS) + 1 + i) & WHEEL_MASK])
+            return until_block;
+    }
+
+    return max;
+}
+
+TIMER_STATS* getTimerStats()
+{
+    return &stats;
+}
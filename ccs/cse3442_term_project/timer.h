@@ -0,0 +1,38 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// longest timeout the wheel can hold, about 4 minutes
+#define TIMER_MAX_MS (62UL * 4096)
+
+typedef struct _TIMER
+{
+    struct _TIMER* next;
+    struct _TIMER* prev;
+    struct _TIMER** slot;           // list the timer is in, 0 when it isn't running
+    uint32_t expires;               // tick it goes off on
+    void (*callback)(void* context);    // runs in the SysTick interrupt
+    void* context;
+}
+TIMER;
+
+typedef struct _TIMER_STATS
+{
+    uint32_t fired;
+    uint32_t cascaded;      // timers moved down a level
+    uint32_t max_tick_cycles;
+    uint16_t max_per_tick;  // most callbacks in one tick
+}
+TIMER_STATS;
+
+void initTimer(TIMER* timer, void (*callback)(void* context), void* context);
+void startTimer(TIMER* timer, uint32_t ms);
+void stopTimer(TIMER* timer);
+bool isTimerRunning(TIMER* timer);
+void tickTimers();
+uint32_t getNextTimerMs(uint32_t max);
+TIMER_STATS* getTimerStats();
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include "tm4c123gh6pm.h"
+#include "timestamp.h"
+
+/*
+ *  the DWT (data watchpoint and trace) unit in the cortex-m4 has a free running
+ *  cycle counter that just counts every system clock cycle, so at 40 MHz each
+ *  tick is 25 ns and it wraps every ~107 seconds which is way more than enough
+ *  for measuring pulse widths and timing stuff on the IR link
+ *
+ *  the tm4c123gh6pm.h header does not have the DWT registers so they are defined here
+ *  (ARM v7-M architecture reference manual, section C1.8)
+ *
+ *  the catch is the DWT stops while the core sleeps in WFI (tickless idle), so anything
+ *  timed across a sleep (the echo windows, csma, ping, the trace) uses getUptimeUs
+ *  instead. That is wide timer 5 as one 64 bit counter on the same 40 MHz clock, it
+ *  keeps counting in sleep mode and never needs an interrupt
+ */
+
+#define DWT_CTRL_R      (*((volatile uint32_t *)0xE0001000))
+#define DWT_CYCCNT_R    (*((volatile uint32_t *)0xE0001004))
+#define DWT_CTRL_CYCCNTENA 0x00000001
+
+// NVIC_DBG_INT_R is at 0xE000EDFC which is the DEMCR register,
+// and bit 24 (TRCENA) has to be set or else the DWT does not run
+#define DEMCR_TRCENA 0x01000000
+
+void initTimestamp()
+{
+    NVIC_DBG_INT_R |= DEMCR_TRCENA;     // turn on the trace / DWT block
+    DWT_CYCCNT_R = 0;                   // start counting from 0
+    DWT_CTRL_R |= DWT_CTRL_CYCCNTENA;   // enable the cycle counter
+
+    SYSCTL_RCGCWTIMER_R |= SYSCTL_RCGCWTIMER_R5;
+    _delay_cycles(3);
+
+    WTIMER5_CTL_R = 0;                              // off while configuring
+    WTIMER5_CFG_R = TIMER_CFG_32_BIT_TIMER;         // A and B as one 64 bit timer
+    WTIMER5_TAMR_R = TIMER_TAMR_TAMR_PERIOD | TIMER_TAMR_TACDIR;    // counts up and wraps
+    WTIMER5_TAILR_R = 0xFFFFFFFF;
+    WTIMER5_TBILR_R = 0xFFFFFFFF;
+    WTIMER5_CTL_R = TIMER_CTL_TAEN;
+}
+
+// returns the current cycle count, subtracting two of these (as uint32_t)
+// gives the elapsed cycles even if it wrapped around in between
+uint32_t getTimestamp()
+{
+    return DWT_CYCCNT_R;
+}
+
+// microseconds since initTimestamp, it doesn't stop in sleep and doesn't wrap. The low
+// half can carry between the two reads, so the high half is read again until it holds
+// still. Safe from any interrupt. The low 32 bits of it wrap every 71 minutes, plenty
+// for the windows that only compare two of them
+uint64_t getUptimeUs()
+{
+    uint32_t high;
+    uint32_t low;
+
+    do
+    {
+        high = WTIMER5_TBV_R;
+        low = WTIMER5_TAV_R;
+    }
+    while (high != WTIMER5_TBV_R);
+
+    return (((uint64_t)high << 32) | low) / TIMESTAMP_TICKS_PER_US;
+}
@@ -0,0 +1,13 @@
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+#include <stdint.h>
+
+// the cycle counter runs off the 40 MHz system clock
+#define TIMESTAMP_TICKS_PER_US 40
+
+void initTimestamp();
+uint32_t getTimestamp();
+uint64_t getUptimeUs();
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "timesync.h"
+#include "ir_frame.h"
+#include "uart7.h"
+#include "pwm.h"
+#include "timestamp.h"
+#include "scheduler.h"
+#include "uart0.h"
+#include "strings.h"
+
+/*
+ *  Clock sync with the other board (the NTP exchange, just over IR)
+ *
+ *  Both boards keep a 64 bit microsecond clock (getLocalTimeUs, from wide timer 5 so it
+ *  keeps going through tickless sleep). The board that runs "time sync" sends a
+ *  request with its clock (t1), the other board notes when it came in (t2) and when the
+ *  reply goes out (t3), and the reply comes back at t4. Then
+ *    offset = ((t2 - t1) + (t3 - t4)) / 2     how far the other clock is ahead of ours
+ *    delay  = (t4 - t1) - (t3 - t2)           time on the wire both ways
+ *  The request is padded to the same length as the reply so the airtime cancels out.
+ *  CSMA backoff and RX handling are not symmetric, so a few exchanges are done and the
+ *  one with the least delay is used (it is the one with the least random waiting in it).
+ *
+ *  Two syncs a while apart also give the drift: how much the offset moved divided by
+ *  how long it has been, in parts per billion. The synced clock is then our clock plus
+ *  the offset plus the drift since the last sync, so it stays close in between.
+ */
+
+#define SYNC_GAP_MS 50
+#define SYNC_MARGIN_MS 500
+#define SYNC_MIN_DRIFT_US 2000000       // syncs closer than 2 s are too noisy for the drift
+#define SYNC_MAX_DRIFT_PPB 500000       // 500 ppm, anything more is a bad sample not a crystal
+#define BITS_PER_CHAR 11
+
+static bool synced = false;
+static int64_t offset_us = 0;       // other clock minus ours, measured at ref_us
+static uint64_t ref_us = 0;
+static int32_t drift_ppb = 0;
+
+static volatile bool waiting = false;
+static volatile bool replied;
+static uint64_t waiting_t1;
+static int64_t sample_offset;
+static int64_t sample_delay;
+static uint64_t sample_time;        // middle of the exchange on our clock
+
+static TIMESYNC_STATS stats;
+
+static uint64_t read64(const uint8_t* p)
+{
+    uint64_t value = 0;
+    int8_t i;
+
+    for (i = 7; i >= 0; i--)
+        value = (value << 8) | p[i];
+
+    return value;
+}
+
+static void write64(uint8_t* p, uint64_t value)
+{
+    uint8_t i;
+
+    for (i = 0; i < 8; i++)
+    {
+        p[i] = value;
+        value >>= 8;
+    }
+}
+
+uint64_t getLocalTimeUs()
+{
+    return getUptimeUs();
+}
+
+// our clock moved onto the other board's time base
+uint64_t getSyncedTimeUs()
+{
+    uint64_t now = getLocalTimeUs();
+
+    if (!synced)
+        return now;
+
+    return now + offset_us + ((int64_t)(now - ref_us) * drift_ppb) / 1000000000;
+}
+
+bool isClockSynced()
+{
+    return synced;
+}
+
+int64_t getClockOffsetUs()
+{
+    return offset_us;
+}
+
+int32_t getClockDriftPpb()
+{
+    return drift_ppb;
+}
+
+// request from the other board, stamp it and send it right back
+void handleSyncFrame(IR_FRAME* frame)
+{
+    uint8_t payload[SYNC_LENGTH];
+    uint8_t i;
+
+    if (frame->length < SYNC_LENGTH)
+        return;
+
+    write64(&payload[SYNC_T2], getLocalTimeUs());
+
+    for (i = 0; i < 8; i++)
+        payload[SYNC_T1 + i] = frame->payload[SYNC_T1 + i];
+
+    // queued if the shell is sending, then t3 is early and the sample shows a long delay,
+    // which syncClock throws out since it keeps the least delay
+    write64(&payload[SYNC_T3], getLocalTimeUs());
+    if (queueIrFrame(IR_FRAME_SYNC_REPLY, payload, SYNC_LENGTH))
+        stats.answered++;
+}
+
+void handleSyncReplyFrame(IR_FRAME* frame)
+{
+    uint64_t t4 = getLocalTimeUs();
+
+    if (frame->length < SYNC_LENGTH)
+        return;
+
+    uint64_t t1 = read64(&frame->payload[SYNC_T1]);
+    uint64_t t2 = read64(&frame->payload[SYNC_T2]);
+    uint64_t t3 = read64(&frame->payload[SYNC_T3]);
+
+    if (!waiting || replied || t1 != waiting_t1)
+        return;
+
+    sample_offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+    sample_delay = (int64_t)(t4 - t1) - (int64_t)(t3 - t2);
+    sample_time = t1 + (t4 - t1) / 2;
+    replied = true;
+}
+
+// runs SYNC_SAMPLES exchanges and takes the best one, returns false if nothing came back
+bool syncClock()
+{
+    uint8_t payload[SYNC_LENGTH] = { 0 };
+    bool have_best = false;
+    int64_t best_offset = 0;
+    int64_t best_delay = 0;
+    uint64_t best_time = 0;
+    uint8_t i;
+
+    uint32_t timeout = (2 * (SYNC_LENGTH + 6) * BITS_PER_CHAR * 1000) / getUart7BaudRate() + SYNC_MARGIN_MS;
+
+    for (i = 0; i < SYNC_SAMPLES; i++)
+    {
+        replied = false;
+        waiting_t1 = getLocalTimeUs();
+        waiting = true;
+
+        write64(&payload[SYNC_T1], waiting_t1);
+        sendIrFrame(IR_FRAME_SYNC, payload, SYNC_LENGTH);
+        stats.exchanges++;
+
+        uint32_t start = getUptimeMs();
+        while (!replied && (getUptimeMs() - start) < timeout)
+            runTasks();
+
+        waiting = false;
+
+        if (replied)
+        {
+            stats.replies++;
+
+            if (!have_best || sample_delay < best_delay)
+            {
+                best_offset = sample_offset;
+                best_delay = sample_delay;
+                best_time = sample_time;
+                have_best = true;
+            }
+        }
+
+        start = getUptimeMs();
+        while ((getUptimeMs() - start) < SYNC_GAP_MS);
+    }
+
+    if (!have_best)
+        return false;
+
+    // drift from how far the offset moved since the last sync
+    if (synced && (best_time - ref_us) >= SYNC_MIN_DRIFT_US)
+    {
+        int64_t drift = ((best_offset - offset_us) * 1000000000) / (int64_t)(best_time - ref_us);
+
+        if (drift > -SYNC_MAX_DRIFT_PPB && drift < SYNC_MAX_DRIFT_PPB)
+            drift_ppb = drift;
+    }
+
+    offset_us = best_offset;
+    ref_us = best_time;
+    synced = true;
+
+    stats.syncs++;
+    stats.last_delay_us = best_delay;
+
+    return true;
+}
+
+// seconds.microseconds, the seconds fit in 32 bits for a good 136 years
+static void printSeconds(uint64_t us)
+{
+    char str[12];
+    uint32_t fraction = us % 1000000;
+    uint32_t place;
+
+    putsUart0(toAsciiDec(str, us / 1000000));
+    putcUart0('.');
+
+    for (place = 100000; place > 0; place /= 10)
+        putcUart0('0' + (fraction / place) % 10);
+
+    putsUart0(" s\r\n");
+}
+
+void printClock()
+{
+    char str[12];
+
+    putsUart0("Local time:  ");
+    printSeconds(getLocalTimeUs());
+
+    if (!synced)
+    {
+        putsUart0("Not synced yet, run time sync\r\n");
+        return;
+    }
+
+    putsUart0("Synced time: ");
+    printSeconds(getSyncedTimeUs());
+
+    // the boards started at different times, so this can be a lot more than 32 bits of us
+    putsUart0("Offset:      ");
+    if (offset_us < 0)
+        putcUart0('-');
+    printSeconds(offset_us < 0 ? -offset_us : offset_us);
+
+    putsUart0("Drift:       ");
+    putsUart0(toAsciiDec(str, drift_ppb));
+    putsUart0(" ppb\r\nDelay:       ");
+    putsUart0(toAsciiDec(str, stats.last_delay_us));
+    putsUart0(" us\r\n");
+}
+
+TIMESYNC_STATS* getTimesyncStats()
+{
+    return &stats;
+}
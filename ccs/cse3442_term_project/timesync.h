@@ -0,0 +1,37 @@
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir_frame.h"
+
+// sync frames are the same length both ways so their airtime cancels out
+#define SYNC_T1 0           // requester's clock when the request went out (64 bits, little endian)
+#define SYNC_T2 8           // responder's clock when the request came in
+#define SYNC_T3 16          // responder's clock when the reply went out
+#define SYNC_LENGTH 24
+
+#define SYNC_SAMPLES 8      // exchanges per sync, the one with the least delay is used
+
+typedef struct _TIMESYNC_STATS
+{
+    uint32_t syncs;         // time sync commands that got at least one reply
+    uint32_t exchanges;     // requests sent
+    uint32_t replies;
+    uint32_t answered;      // requests from the other board we replied to
+    uint32_t last_delay_us; // round trip minus the other board's turnaround, best sample
+}
+TIMESYNC_STATS;
+
+bool syncClock();
+uint64_t getLocalTimeUs();
+uint64_t getSyncedTimeUs();
+bool isClockSynced();
+int64_t getClockOffsetUs();
+int32_t getClockDriftPpb();
+void handleSyncFrame(IR_FRAME* frame);
+void handleSyncReplyFrame(IR_FRAME* frame);
+void printClock();
+TIMESYNC_STATS* getTimesyncStats();
+
+#endif
@@ -36,6 +36,13 @@ static void IntDefaultHandler(void);
 
 extern void Uart7_Rx_Handler(void);
 extern void SysTick_Handler(void);
+extern void PortE_Handler(void);
+extern void Uart1_Handler(void);
+extern void Uart3_Handler(void);
+extern void Uart5_Handler(void);
+extern void Uart0_Handler(void);
+extern void PendSV_Handler(void);
+extern void IrRxEvent_Handler(void);
 
 //*****************************************************************************
 //
@@ -84,22 +91,22 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // SVCall handler
     IntDefaultHandler,                      // Debug monitor handler
     0,                                      // Reserved
-    IntDefaultHandler,                      // The PendSV handler
+    PendSV_Handler,                         // The PendSV handler
     SysTick_Handler,                      // The SysTick handler
     IntDefaultHandler,                      // GPIO Port A
     IntDefaultHandler,                      // GPIO Port B
     IntDefaultHandler,                      // GPIO Port C
     IntDefaultHandler,                      // GPIO Port D
-    IntDefaultHandler,                      // GPIO Port E
-    IntDefaultHandler,                      // UART0 Rx and Tx
-    IntDefaultHandler,                      // UART1 Rx and Tx
+    PortE_Handler,                      // GPIO Port E
+    Uart0_Handler,                          // UART0 Rx and Tx
+    Uart1_Handler,                      // UART1 Rx and Tx
     IntDefaultHandler,                      // SSI0 Rx and Tx
     IntDefaultHandler,                      // I2C0 Master and Slave
     IntDefaultHandler,                      // PWM Fault
     IntDefaultHandler,                      // PWM Generator 0
     IntDefaultHandler,                      // PWM Generator 1
     IntDefaultHandler,                      // PWM Generator 2
-    IntDefaultHandler,                      // Quadrature Encoder 0
+    IrRxEvent_Handler,                      // Quadrature Encoder 0 (software triggered IR RX event)
     IntDefaultHandler,                      // ADC Sequence 0
     IntDefaultHandler,                      // ADC Sequence 1
     IntDefaultHandler,                      // ADC Sequence 2
@@ -145,9 +152,9 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port L
     IntDefaultHandler,                      // SSI2 Rx and Tx
     IntDefaultHandler,                      // SSI3 Rx and Tx
-    IntDefaultHandler,                      // UART3 Rx and Tx
+    Uart3_Handler,                      // UART3 Rx and Tx
     IntDefaultHandler,                      // UART4 Rx and Tx
-    IntDefaultHandler,                      // UART5 Rx and Tx
+    Uart5_Handler,                      // UART5 Rx and Tx
     IntDefaultHandler,                      // UART6 Rx and Tx
     Uart7_Rx_Handler,                      // UART7 Rx and Tx
     0,                                      // Reserved
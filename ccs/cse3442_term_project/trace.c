@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "trace.h"
+#include "timestamp.h"
+#include "priority.h"
+#include "uart0.h"
+#include "strings.h"
+
+/*
+ *  Trace of the bytes on the UART7 link
+ *
+ *  Every byte received in Uart7_Rx_Handler and every byte written to UART7 goes into a
+ *  ring with its getUptimeUs time and flags (the UART error bits, TX, dropped echo,
+ *  address byte). The ring just keeps overwriting itself, so after something goes wrong
+ *  the last TRACE_SIZE bytes are still there for "trace dump". tools/irtrace.c turns the
+ *  dump into a timeline.
+ *
+ *  Recording is a timer read and a few stores, with interrupts masked for those few
+ *  instructions since the TX side runs in a thread and UART7 RX can interrupt it. It
+ *  isn't the DWT cycle count since that stops in a tickless sleep and the gaps would
+ *  come out short. The 32 bit us wrap every 71 minutes.
+ */
+
+#define TRACE_MASK (TRACE_SIZE - 1)
+
+static TRACE_ENTRY ring[TRACE_SIZE];
+static volatile uint32_t count = 0;     // bytes recorded since the last clear, not wrapped
+static volatile bool enabled = true;
+
+void traceByte(uint8_t data, uint8_t flags)
+{
+    if (!enabled)
+        return;
+
+    uint32_t state = disableInterrupts();
+    TRACE_ENTRY* entry = &ring[count & TRACE_MASK];
+
+    entry->us = getUptimeUs();
+    entry->data = data;
+    entry->flags = flags;
+    count++;
+
+    restoreInterrupts(state);
+}
+
+void setTrace(bool enable)
+{
+    enabled = enable;
+}
+
+bool getTrace()
+{
+    return enabled;
+}
+
+void clearTrace()
+{
+    count = 0;
+}
+
+uint32_t getTraceCount()
+{
+    return count;
+}
+
+static void putBinary(uint32_t value, uint8_t bytes)
+{
+    while (bytes--)
+    {
+        putcUart0(value);
+        value >>= 8;
+    }
+}
+
+// oldest to newest, either as ":TTTTTTTTDDFF" lines or raw (see trace.h)
+void dumpTrace(bool binary)
+{
+    bool was_enabled = enabled;
+    uint32_t entries;
+    uint32_t i;
+    char str[12];
+
+    // nothing new gets recorded while it is being sent
+    enabled = false;
+
+    entries = (count < TRACE_SIZE) ? count : TRACE_SIZE;
+
+    if (binary)
+    {
+        putsUart0(TRACE_MAGIC);
+        putBinary(entries, 2);
+        putBinary(1000000, 4);
+    }
+    else
+    {
+        putsUart0("\r\nTrace start ");
+        putsUart0(toAsciiDec(str, entries));
+        putcUart0(' ');
+        putsUart0(toAsciiDec(str, 1000000));
+        putsUart0("\r\n");
+    }
+
+    for (i = count - entries; i != count; i++)
+    {
+        TRACE_ENTRY* entry = &ring[i & TRACE_MASK];
+
+        if (binary)
+        {
+            putBinary(entry->us, 4);
+            putcUart0(entry->data);
+            putcUart0(entry->flags);
+        }
+        else
+        {
+            putcUart0(':');
+            putsUart0(toAsciiHex(str, entry->us));
+            putsUart0(&toAsciiHex(str, (entry->data << 8) | entry->flags)[4]);
+            putsUart0("\r\n");
+        }
+    }
+
+    if (!binary)
+        putsUart0("Trace end\r\n");
+
+    enabled = was_enabled;
+}
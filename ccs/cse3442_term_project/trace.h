@@ -0,0 +1,39 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// has to be a power of 2 so the index can just be masked, 8 bytes each in RAM (4 KB)
+#define TRACE_SIZE 512
+
+// flags, the low 4 bits are the UART RX error bits (UARTDR 11:8)
+#define TRACE_FE        0x01
+#define TRACE_PE        0x02
+#define TRACE_BE        0x04
+#define TRACE_OE        0x08
+#define TRACE_TX        0x10    // sent on UART7, otherwise received
+#define TRACE_ECHO      0x20    // received but dropped as our own echo
+#define TRACE_ADDRESS   0x40    // 9 bit mode address byte
+
+// what "trace dump bin" sends: the magic, a 16 bit entry count, the 32 bit ticks per
+// second (1000000), then each entry as a 32 bit us time, the byte and the flags (little endian)
+#define TRACE_MAGIC "IRTR"
+#define TRACE_ENTRY_LENGTH 6
+
+typedef struct _TRACE_ENTRY
+{
+    uint32_t us;            // low 32 bits of getUptimeUs
+    uint8_t data;
+    uint8_t flags;
+}
+TRACE_ENTRY;
+
+void traceByte(uint8_t data, uint8_t flags);
+void setTrace(bool enable);
+bool getTrace();
+void clearTrace();
+uint32_t getTraceCount();
+void dumpTrace(bool binary);
+
+#endif
@@ -0,0 +1,224 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "uart.h"
+
+/*
+ *  uart0.c and uart7.c used to be the same code copy pasted with the register names
+ *  changed, so this does it once for any UART. The only things that change between
+ *  them are the base addresses, which GPIO pins they are on, the PCTL values for those
+ *  pins, and the interrupt number, so those are all in the table below and every
+ *  function just takes the UART number (0 - 7).
+ *
+ *  pins are from the table on page 1351 of the data-sheet, the interrupt numbers are the
+ *  vector numbers from tm4c123gh6pm.h (page 104) minus the 16 system exceptions
+ */
+
+#define GPIO_O_AFSEL 0x420
+#define GPIO_O_DR2R  0x500
+#define GPIO_O_DEN   0x51C
+#define GPIO_O_LOCK  0x520
+#define GPIO_O_CR    0x524
+#define GPIO_O_AMSEL 0x528
+#define GPIO_O_PCTL  0x52C
+
+#define GPIO_UNLOCK_KEY 0x4C4F434B
+
+// NVIC enable and priority registers (one enable bit per interrupt, one priority byte per interrupt)
+#define NVIC_EN_REG(irq)  (*((volatile uint32_t *)(0xE000E100 + 4 * ((irq) / 32))))
+#define NVIC_PRI_REG(irq) (*((volatile uint8_t *)(0xE000E400 + (irq))))
+
+const UART_CONFIG uartConfig[UART_COUNT] =
+{
+    // UART0: PA0 / PA1, goes to the ICDI virtual COM port
+    { 0x4000C000, 0x40004000, 0, 0x01, 0x02, false,
+      GPIO_PCTL_PA0_M | GPIO_PCTL_PA1_M, GPIO_PCTL_PA0_U0RX | GPIO_PCTL_PA1_U0TX, INT_UART0 - 16 },
+    // UART1: PB0 / PB1
+    { 0x4000D000, 0x40005000, 1, 0x01, 0x02, false,
+      GPIO_PCTL_PB0_M | GPIO_PCTL_PB1_M, GPIO_PCTL_PB0_U1RX | GPIO_PCTL_PB1_U1TX, INT_UART1 - 16 },
+    // UART2: PD6 / PD7, PD7 is locked (NMI pin) by default
+    { 0x4000E000, 0x40007000, 3, 0x40, 0x80, true,
+      GPIO_PCTL_PD6_M | GPIO_PCTL_PD7_M, GPIO_PCTL_PD6_U2RX | GPIO_PCTL_PD7_U2TX, INT_UART2 - 16 },
+    // UART3: PC6 / PC7
+    { 0x4000F000, 0x40006000, 2, 0x40, 0x80, false,
+      GPIO_PCTL_PC6_M | GPIO_PCTL_PC7_M, GPIO_PCTL_PC6_U3RX | GPIO_PCTL_PC7_U3TX, INT_UART3 - 16 },
+    // UART4: PC4 / PC5
+    { 0x40010000, 0x40006000, 2, 0x10, 0x20, false,
+      GPIO_PCTL_PC4_M | GPIO_PCTL_PC5_M, GPIO_PCTL_PC4_U4RX | GPIO_PCTL_PC5_U4TX, INT_UART4 - 16 },
+    // UART5: PE4 / PE5
+    { 0x40011000, 0x40024000, 4, 0x10, 0x20, false,
+      GPIO_PCTL_PE4_M | GPIO_PCTL_PE5_M, GPIO_PCTL_PE4_U5RX | GPIO_PCTL_PE5_U5TX, INT_UART5 - 16 },
+    // UART6: PD4 / PD5
+    { 0x40012000, 0x40007000, 3, 0x10, 0x20, false,
+      GPIO_PCTL_PD4_M | GPIO_PCTL_PD5_M, GPIO_PCTL_PD4_U6RX | GPIO_PCTL_PD5_U6TX, INT_UART6 - 16 },
+    // UART7: PE0 / PE1, the IR link
+    { 0x40013000, 0x40024000, 4, 0x01, 0x02, false,
+      GPIO_PCTL_PE0_M | GPIO_PCTL_PE1_M, GPIO_PCTL_PE0_U7RX | GPIO_PCTL_PE1_U7TX, INT_UART7 - 16 },
+};
+
+// turns on the clocks, gives the pins to the UART, and sets the baud rate and line settings
+// lcrh is the line control value, like UART_8N1 or UART_8E1
+void initUart(uint8_t uart, uint32_t baudRate, uint32_t lcrh)
+{
+    const UART_CONFIG* config = &uartConfig[uart];
+    uint32_t gpio = config->gpio_base;
+    uint8_t pins = config->rx_pin | config->tx_pin;
+
+    // Enable clocks for the UART and its GPIO port
+    SYSCTL_RCGCUART_R |= 1 << uart;
+    SYSCTL_RCGCGPIO_R |= 1 << config->gpio_clock;
+    _delay_cycles(3);
+
+    // some pins (PD7) have to be unlocked before AFSEL / DEN / PCTL can be changed
+    if (config->locked)
+    {
+        UART_REG(gpio, GPIO_O_LOCK) = GPIO_UNLOCK_KEY;
+        UART_REG(gpio, GPIO_O_CR) |= pins;
+    }
+
+    // Configure the pins
+    UART_REG(gpio, GPIO_O_DR2R) |= config->tx_pin;      // 2mA drive on the transmitting end
+    UART_REG(gpio, GPIO_O_AMSEL) &= ~pins;              // no analog
+    UART_REG(gpio, GPIO_O_DEN) |= pins;                 // enable digital on the UART pins
+    UART_REG(gpio, GPIO_O_AFSEL) |= pins;               // pins are driven by a peripheral
+    UART_REG(gpio, GPIO_O_PCTL) &= ~config->pctl_mask;  // clear the old pin functions
+    UART_REG(gpio, GPIO_O_PCTL) |= config->pctl_value;  // and pick the UART
+
+    // Configure the UART, it has to be off while being programmed
+    UART_REG(config->uart_base, UART_O_CTL) = 0;
+    UART_REG(config->uart_base, UART_O_CC) = UART_CC_CS_SYSCLK;    // use system clock (40 MHz)
+    UART_REG(config->uart_base, UART_O_LCRH) = lcrh;
+
+    setUartBaudRate(uart, baudRate, UART_SYSCLOCK);
+}
+
+// Set baud rate as function of instruction cycle frequency
+// this keeps whatever line settings and control bits the UART already had
+void setUartBaudRate(uint8_t uart, uint32_t baudRate, uint32_t fcyc)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+    uint32_t divisorTimes128 = (fcyc * 8) / baudRate;   // calculate divisor (r) in units of 1/128,
+                                                        // where r = fcyc / 16 * baudRate
+    divisorTimes128 += 1;                               // add 1/128 to allow rounding
+
+    uint32_t ctl = UART_REG(base, UART_O_CTL);
+    uint32_t lcrh = UART_REG(base, UART_O_LCRH);
+
+    UART_REG(base, UART_O_CTL) = 0;                         // turn-off UART to allow safe programming
+    UART_REG(base, UART_O_IBRD) = divisorTimes128 >> 7;     // set integer value to floor(r)
+    UART_REG(base, UART_O_FBRD) = ((divisorTimes128) >> 1) & 63; // set fractional value to round(fract(r)*64)
+    UART_REG(base, UART_O_LCRH) = lcrh;                     // the divisors only latch on a LCRH write
+    UART_REG(base, UART_O_CTL) = ctl | UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN;
+                                                            // Enable UART/transmitter/receiver
+}
+
+// makes the UART interrupt whenever something is received (FIFO 1/8 full or RX time out)
+// priority is 0 (highest) to 7
+void enableUartRxInterrupt(uint8_t uart, uint8_t priority)
+{
+    const UART_CONFIG* config = &uartConfig[uart];
+    uint32_t base = config->uart_base;
+
+    // first you have to turn off the UART
+    UART_REG(base, UART_O_CTL) &= ~UART_CTL_UARTEN;
+
+    // interrupt when the RX fifo is 1/8th full
+    UART_REG(base, UART_O_IFLS) &= ~UART_IFLS_RX_M;
+    UART_REG(base, UART_O_IFLS) |= UART_IFLS_RX1_8;
+
+    // clear the flags so no interrupt happens immediately, then enable receive and receive time out
+    UART_REG(base, UART_O_ICR) = UART_ICR_RXIC | UART_ICR_RTIC;
+    UART_REG(base, UART_O_IM) |= UART_IM_RXIM | UART_IM_RTIM;
+
+    // priority is in the top 3 bits of the interrupt's priority byte
+    NVIC_PRI_REG(config->irq) = (priority & 7) << 5;
+    NVIC_EN_REG(config->irq) = 1 << (config->irq % 32);
+
+    // now that the interrupt is enabled, we can enable the UART again
+    UART_REG(base, UART_O_CTL) |= UART_CTL_UARTEN;
+}
+
+// turns on 9 bit mode (UART9BITADDR / UART9BITAMASK), after this the hardware drops any
+// bytes after an address byte that does not match, so they never interrupt the CPU.
+// It matches when (received & mask) == (address & mask)
+void setUartAddress(uint8_t uart, uint8_t address, uint8_t mask)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+    uint32_t ctl = UART_REG(base, UART_O_CTL);
+
+    UART_REG(base, UART_O_CTL) = 0;                         // turn-off UART to allow safe programming
+    UART_REG(base, UART_O_LCRH) = UART_9BIT_DATA;
+    UART_REG(base, UART_O_9BITAMASK) = mask;
+    UART_REG(base, UART_O_9BITADDR) = UART_9BITADDR_9BITEN | address;
+    UART_REG(base, UART_O_CTL) = ctl;
+}
+
+// back to normal 8 bit mode with the given line settings (like UART_8E1)
+void clearUartAddress(uint8_t uart, uint32_t lcrh)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+    uint32_t ctl = UART_REG(base, UART_O_CTL);
+
+    UART_REG(base, UART_O_CTL) = 0;
+    UART_REG(base, UART_O_9BITADDR) = 0;
+    UART_REG(base, UART_O_9BITAMASK) = 0xFF;                // reset value
+    UART_REG(base, UART_O_LCRH) = lcrh;
+    UART_REG(base, UART_O_CTL) = ctl;
+}
+
+// Blocking function that sends an address byte in 9 bit mode. The parity setting
+// can only change while nothing is going out, so it waits for the FIFO to empty
+// before and after
+void putAddressUart(uint8_t uart, uint8_t address)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+    uint32_t lcrh = UART_REG(base, UART_O_LCRH);
+
+    while ((UART_REG(base, UART_O_FR) & (UART_FR_TXFE | UART_FR_BUSY)) != UART_FR_TXFE);
+    UART_REG(base, UART_O_LCRH) = lcrh & ~UART_LCRH_EPS;   // stick parity 1 = address
+    UART_REG(base, UART_O_DR) = address;
+    while ((UART_REG(base, UART_O_FR) & (UART_FR_TXFE | UART_FR_BUSY)) != UART_FR_TXFE);
+    UART_REG(base, UART_O_LCRH) = lcrh;
+}
+
+// Blocking function that writes a serial character when the UART buffer is not full
+void putcUart(uint8_t uart, char c)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+
+    while (UART_REG(base, UART_O_FR) & UART_FR_TXFF);  // wait if tx fifo full
+    UART_REG(base, UART_O_DR) = c;                      // write character to fifo
+}
+
+// Blocking function that writes a string when the UART buffer is not full
+void putsUart(uint8_t uart, char* str)
+{
+    uint32_t i = 0;
+    while (str[i] != '\0')
+        putcUart(uart, str[i++]);
+}
+
+// Blocking function that returns with serial data once the buffer is not empty
+char getcUart(uint8_t uart)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+
+    while (UART_REG(base, UART_O_FR) & UART_FR_RXFE);  // wait if rx fifo empty
+    return UART_REG(base, UART_O_DR) & 0xFF;            // get character from fifo
+}
+
+// Same as getcUart but it keeps the overrun / break / parity / framing bits that
+// come out of the data register with the byte (UART_RX_ERRORS)
+uint16_t getcUartStatus(uint8_t uart)
+{
+    uint32_t base = uartConfig[uart].uart_base;
+
+    while (UART_REG(base, UART_O_FR) & UART_FR_RXFE);
+    return UART_REG(base, UART_O_DR) & (UART_RX_ERRORS | UART_DR_DATA_M);
+}
+
+// Returns the status of the receive buffer
+bool kbhitUart(uint8_t uart)
+{
+    return !(UART_REG(uartConfig[uart].uart_base, UART_O_FR) & UART_FR_RXFE);
+}
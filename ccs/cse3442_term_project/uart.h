@@ -0,0 +1,74 @@
+// Generic UART driver for all eight UARTs on the TM4C123GH6PM
+
+#ifndef UART_H_
+#define UART_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UART_SYSCLOCK 40000000 // everything runs off the 40 MHz system clock
+
+#define UART_COUNT 8
+
+// getcUartStatus returns the byte in the low 8 bits and the error flags the UART keeps
+// with every received byte above it (UART_DR_OE, UART_DR_BE, UART_DR_PE, UART_DR_FE)
+#define UART_RX_ERRORS 0x00000F00
+
+// register offsets from the UART base address (page 904 of the data-sheet)
+#define UART_O_DR        0x000
+#define UART_O_RSR       0x004
+#define UART_O_FR        0x018
+#define UART_O_IBRD      0x024
+#define UART_O_FBRD      0x028
+#define UART_O_LCRH      0x02C
+#define UART_O_CTL       0x030
+#define UART_O_IFLS      0x034
+#define UART_O_IM        0x038
+#define UART_O_RIS       0x03C
+#define UART_O_MIS       0x040
+#define UART_O_ICR       0x044
+#define UART_O_9BITADDR  0x0A4
+#define UART_O_9BITAMASK 0x0A8
+#define UART_O_CC        0xFC8
+
+// access a register of a UART (or GPIO port) by its base address and offset
+#define UART_REG(base, offset) (*((volatile uint32_t *)((base) + (offset))))
+
+// line settings used by the project
+#define UART_8N1 (UART_LCRH_WLEN_8 | UART_LCRH_FEN)
+#define UART_8E1 (UART_LCRH_WLEN_8 | UART_LCRH_PEN | UART_LCRH_EPS | UART_LCRH_FEN)
+
+// 9 bit mode, the parity bit is the address flag. Data bytes go out with stick
+// parity 0, and putAddressUart flips it to 1 for the address byte
+#define UART_9BIT_DATA (UART_LCRH_WLEN_8 | UART_LCRH_PEN | UART_LCRH_SPS | UART_LCRH_EPS | UART_LCRH_FEN)
+
+// everything that is different between the UARTs, one of these per UART in uart.c
+typedef struct _UART_CONFIG
+{
+    uint32_t uart_base;     // UARTn register base address
+    uint32_t gpio_base;     // base address of the GPIO port the pins are on (APB)
+    uint8_t gpio_clock;     // bit in RCGCGPIO for that port
+    uint8_t rx_pin;         // pin masks in that port
+    uint8_t tx_pin;
+    bool locked;            // pin is one of the locked ones (PD7) and needs GPIOCR unlocked
+    uint32_t pctl_mask;     // PCTL fields for the two pins
+    uint32_t pctl_value;    // PCTL values that pick the UART function
+    uint8_t irq;            // interrupt number (vector number - 16)
+}
+UART_CONFIG;
+
+extern const UART_CONFIG uartConfig[UART_COUNT];
+
+void initUart(uint8_t uart, uint32_t baudRate, uint32_t lcrh);
+void setUartBaudRate(uint8_t uart, uint32_t baudRate, uint32_t fcyc);
+void enableUartRxInterrupt(uint8_t uart, uint8_t priority);
+void setUartAddress(uint8_t uart, uint8_t address, uint8_t mask);
+void clearUartAddress(uint8_t uart, uint32_t lcrh);
+void putAddressUart(uint8_t uart, uint8_t address);
+void putcUart(uint8_t uart, char c);
+void putsUart(uint8_t uart, char* str);
+char getcUart(uint8_t uart);
+uint16_t getcUartStatus(uint8_t uart);
+bool kbhitUart(uint8_t uart);
+
+#endif
@@ -22,67 +22,20 @@
 #include <stdbool.h>
 #include "tm4c123gh6pm.h"
 #include "uart0.h"
+#include "uart.h"
 
-// PortA masks
+// UART0 is PA0 (RX) / PA1 (TX), all the register work is in uart.c now
 
-// Transmitting end is 2 = 0010 which corresponds to PA1
-#define UART_TX_MASK 2
-
-// Receiving end is 1 = 0001 which corresponds to PA0
-#define UART_RX_MASK 1
-
-//-----------------------------------------------------------------------------
-// Global variables
-//-----------------------------------------------------------------------------
+#define UART0 0
 
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
-
-/*
- *
- * We are using Port A because every UART pin has a corresponding GPIO pin (page 1351 of data-sheet)
- * We are using UART0, so the corresponding GPIO pins are:
- * PA0 for the receiving end of the UART and
- * PA1 for the transmitting end of the UART
- *
- * */
-
-// Initialize UART0
+// Initialize UART0 to 115200 baud, 8N1 format
 void initUart0()
 {
-    // Enable clocks
-    SYSCTL_RCGCUART_R |= SYSCTL_RCGCUART_R0; // Enable UART0
-    SYSCTL_RCGCGPIO_R |= SYSCTL_RCGCGPIO_R0; // Enable GPIO Port A
-    _delay_cycles(3);
-
-    // Configure UART0 pins
-    GPIO_PORTA_DR2R_R |= UART_TX_MASK;                  // set drive strength to 2mA (not needed since default configuration -- for clarity)
-    GPIO_PORTA_DEN_R |= UART_TX_MASK | UART_RX_MASK;    // enable digital on UART0 pins
-
-    // Basically makes the GPIO pin be controlled by an alternate hardware function
-    // and in our case, we are making the GPIO pin be controlled by UART0
-    GPIO_PORTA_AFSEL_R |= UART_TX_MASK | UART_RX_MASK;  // use peripheral to drive PA0, PA1
-
-    // Used with AFSEL to make the GPIO pin controlled by the UART
-    // First we are getting clearing the bits, and then we are
-    // configuring UART0 to control the pins PA0 and PA1
-    GPIO_PORTA_PCTL_R &= ~(GPIO_PCTL_PA1_M | GPIO_PCTL_PA0_M); // clear bits 0-7
-    GPIO_PORTA_PCTL_R |= GPIO_PCTL_PA1_U0TX | GPIO_PCTL_PA0_U0RX;
-                                                        // select UART0 to drive pins PA0 and PA1: default, added for clarity
-
-    // Configure UART0 to 115200 baud, 8N1 format
-    UART0_CTL_R = 0;                                    // turn-off UART0 to allow safe programming
-    UART0_CC_R = UART_CC_CS_SYSCLK;                     // use system clock (40 MHz)
-
-    UART0_IBRD_R = 21;                                  // r = 40 MHz / (Nx115.2kHz), set floor(r)=21, where N=16
-    UART0_FBRD_R = 45;                                  // round(fract(r)*64)=45
-
-    // Enable 8 bit word length | Enable FIFOs
-    UART0_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_FEN;    // configure for 8N1 w/ 16-level FIFO
-    UART0_CTL_R = UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN;
-                                                        // enable TX, RX, and module
+    initUart(UART0, 115200, UART_8N1);
 }
 
 // Set baud rate as function of instruction cycle frequency
@@ -91,42 +44,29 @@ void initUart0()
 // to any other value
 void setUart0BaudRate(uint32_t baudRate, uint32_t fcyc)
 {
-    uint32_t divisorTimes128 = (fcyc * 8) / baudRate;   // calculate divisor (r) in units of 1/128,
-                                                        // where r = fcyc / 16 * baudRate
-    divisorTimes128 += 1;                               // add 1/128 to allow rounding
-    UART0_CTL_R = 0;                                    // turn-off UART0 to allow safe programming
-    UART0_IBRD_R = divisorTimes128 >> 7;                // set integer value to floor(r)
-    UART0_FBRD_R = ((divisorTimes128) >> 1) & 63;       // set fractional value to round(fract(r)*64)
-    UART0_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_FEN;    // configure for 8N1 w/ 16-level FIFO
-    UART0_CTL_R = UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN;
-                                                        // turn-on UART0
+    setUartBaudRate(UART0, baudRate, fcyc);
 }
 
 // Blocking function that writes a serial character when the UART buffer is not full
 void putcUart0(char c)
 {
-    while (UART0_FR_R & UART_FR_TXFF);               // wait if uart0 tx fifo full
-    // Writing to the UART0 data register
-    UART0_DR_R = c;                                  // write character to fifo
+    putcUart(UART0, c);
 }
 
 // Blocking function that writes a string when the UART buffer is not full
 void putsUart0(char* str)
 {
-    uint8_t i = 0;
-    while (str[i] != '\0')
-        putcUart0(str[i++]);
+    putsUart(UART0, str);
 }
 
 // Blocking function that returns with serial data once the buffer is not empty
 char getcUart0()
 {
-    while (UART0_FR_R & UART_FR_RXFE);               // wait if uart0 rx fifo empty
-    return UART0_DR_R & 0xFF;                        // get character from fifo
+    return getcUart(UART0);
 }
 
 // Returns the status of the receive buffer
 bool kbhitUart0()
 {
-    return !(UART0_FR_R & UART_FR_RXFE);
+    return kbhitUart(UART0);
 }
@@ -2,81 +2,116 @@
 #include <stdbool.h>
 #include "tm4c123gh6pm.h"
 #include "uart7.h"
+#include "pwm.h"
+#include "uart.h"
+#include "ir_channel.h"
+#include "echo.h"
+#include "trace.h"
 
 /*
  *  Since we want to use UART7, we need to check which GPIO pins it corresponds to in the data sheet
  *  This is on page 1351, and we can see that:
  *  PE0 = U7Rx
  *  PE1 = U7Tx
- *  so we can define the pin-masks as follows:
+ *  so the pin-masks are:
  *  Receiving end is PE0 so we must have a mask for bit 0, which would be 1 = 0000.0001
  *  Transmitting end is PE1 so we must have a mask for bit 1, which would be 2 = 0000.0010
+ *  and those live in the UART7 entry of the table in uart.c now
  */
 
-#define UART_RX_MASK 1  // Receiving end PE0, so activate bit 0, which is 1
-#define UART_TX_MASK 2  // Transmitting end PE1, so activate bit 1, which is 2
+#define UART7 7
 
+static uint32_t current_baud = 1200; // so other code can figure out the bit time
+static bool echo_expected = true;    // false while sending to a node address we don't match
+
+// the pins, clocks and PCTL are all in the UART7 entry of the table in uart.c
 void initUart7()
 {
-    // First we need to enable the clocks for UART7 and also GPIO Port E
-    SYSCTL_RCGCUART_R |= SYSCTL_RCGCUART_R7;    // 0x80 = 1000.0000 , which enables UART 7
-    SYSCTL_RCGCGPIO_R |= SYSCTL_RCGCGPIO_R4;    // 0x10 = 0001.0000 , which enables GPIO port E
-    _delay_cycles(3);
-
-    GPIO_PORTE_DR2R_R |= UART_TX_MASK;   // it defaults to 2mA, but the uart0 one had it so I might as well have it
-                                        // because you need to enable current for transmitting end
-
-    GPIO_PORTE_DEN_R |= UART_TX_MASK | UART_RX_MASK;    // enable the digital functions for the UART7 pins
-
-    // Basically makes the GPIO pins PE0 and PE1 be controlled
-    // by an alternate hardware function, which is UART7
-    GPIO_PORTE_AFSEL_R |= UART_TX_MASK | UART_RX_MASK;
-
-    // We also need to configure this register so that the GPIO pins can be controlled by UART7
-    GPIO_PORTE_PCTL_R &= ~(GPIO_PCTL_PE1_M | GPIO_PCTL_PE0_M);      // we first clear the register with the mask
-    GPIO_PORTE_PCTL_R |= GPIO_PCTL_PE1_U7TX | GPIO_PCTL_PE0_U7RX;   // now enable PE1 and PE0 as U7Tx and U7Rx
-
-    UART7_CTL_R = 0;    // Turn off UART7 so we can configure it properly
-
-    UART7_CC_R = UART_CC_CS_SYSCLK; // use system clock (40 MHz)
-
     // Set the Baud Rate to 1200
     // The formula for IBRD is (system clock) / (16 * baud_rate) = 2083.33
     // Then for FBRD, we take the factional part of the result so like 2083.XX
     // Then take the decimal, do (0.XXXX) * 64 + 0.5 = 21.8333
-    UART7_IBRD_R = 2083;
-    UART7_FBRD_R = 21;
-
-    // Now we will configure the UART line control register
-    // which will allow us to make it into 8E1, like 8 bit word length, parity, stop bit, FIFOs, etc.
-    UART7_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_PEN | UART_LCRH_EPS | UART_LCRH_FEN;
-
-    // Enable the UART, transmitter, and receiver
-    UART7_CTL_R = UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN;
+    // and the line control is 8E1, like 8 bit word length, even parity, 1 stop bit, FIFOs
+    initUart(UART7, 1200, UART_8E1);
+    current_baud = 1200;
+
+    // EOT makes the TX interrupt happen once the last stop bit is out (not on a FIFO level)
+    // which is when the carrier can be turned off
+    UART7_CTL_R &= ~UART_CTL_UARTEN;
+    UART7_CTL_R |= UART_CTL_EOT;
+    UART7_CTL_R |= UART_CTL_UARTEN;
 }
 
 // Set baud rate as function of instruction cycle frequency
-// The init function will initialize it to 115200 baud, but
+// The init function will initialize it to 1200 baud, but
 // this function is if you ever want to change the baud rate later on
-// to any other value
+// to any other value (the 8E1 format and EOT bit are kept)
 void setUart7BaudRate(uint32_t baudRate, uint32_t fcyc)
 {
-    uint32_t divisorTimes128 = (fcyc * 8) / baudRate;   // calculate divisor (r) in units of 1/128,
-                                                        // where r = fcyc / 16 * baudRate
-    divisorTimes128 += 1;                               // add 1/128 to allow rounding
-    UART7_CTL_R = 0;                                    // turn-off UART7 to allow safe programming
-    UART7_IBRD_R = divisorTimes128 >> 7;                // set integer value to floor(r)
-    UART7_FBRD_R = ((divisorTimes128) >> 1) & 63;       // set fractional value to round(fract(r)*64)
-    UART7_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_PEN | UART_LCRH_EPS | UART_LCRH_FEN; // set it to 8E1
-    UART7_CTL_R = UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN;        // Enable UART/transmitter/receiver
+    current_baud = baudRate;
+    setUartBaudRate(UART7, baudRate, fcyc);
+}
+
+// node addressing, see setUartAddress in uart.c
+void setUart7Address(uint8_t address, uint8_t mask)
+{
+    setUartAddress(UART7, address, mask);
+    echo_expected = true;
+}
+
+void clearUart7Address()
+{
+    clearUartAddress(UART7, UART_8E1);
+    echo_expected = true;
+}
+
+// Blocking function that sends a 9 bit mode address byte, everything after it
+// (until the next address) only gets received by the nodes that match it
+void putAddressUart7(uint8_t address)
+{
+    uint8_t mask = UART7_9BITAMASK_R;
+
+    // our own receiver filters the echo the same as everyone else's
+    echo_expected = (address & mask) == (UART7_9BITADDR_R & mask);
+
+    waitForTurnaround();
+    UART7_IM_R &= ~UART_IM_TXIM;
+    carrierOn(0);
+
+    // a matching address byte lands in our RX FIFO too
+    if (echo_expected)
+        noteEchoTx(address);
+
+    putAddressUart(UART7, address);
+    irChannels[0].tx_bytes++;
+    traceByte(address, TRACE_TX | TRACE_ADDRESS);
+
+    UART7_IM_R |= UART_IM_TXIM;
 }
 
 // Blocking function that writes a serial character when the UART buffer is not full
 void putcUart7(char c)
 {
+    waitForTurnaround();                             // half duplex: let the other board finish
     while (UART7_FR_R & UART_FR_TXFF);               // wait if uart7 tx fifo full
+
+    // the carrier has to be on before the start bit goes out, the TX interrupt is
+    // masked while doing this so the end of transmission interrupt from the last
+    // message can't turn the carrier back off in between
+    UART7_IM_R &= ~UART_IM_TXIM;
+    carrierOn(0);                                    // UART7 is IR channel 0
+
+    // remember it so its echo can be filtered out of RX (unless our own address
+    // filter is going to throw the echo away anyways)
+    if (echo_expected)
+        noteEchoTx(c);
+
     // Writing to the UART7 data register
     UART7_DR_R = c;                                  // write character to fifo
+    irChannels[0].tx_bytes++;
+    traceByte(c, TRACE_TX);
+
+    UART7_IM_R |= UART_IM_TXIM;                      // end of transmission turns the carrier off
 }
 
 // Blocking function that writes a string when the UART buffer is not full
@@ -90,14 +125,36 @@ void putsUart7(char* str)
 // Blocking function that returns with serial data once the buffer is not empty
 char getcUart7()
 {
-    while (UART7_FR_R & UART_FR_RXFE);               // wait if uart7 rx fifo empty
-    return UART7_DR_R & 0xFF;                        // get character from fifo
+    return getcUart(UART7);
+}
+
+// Blocking, returns the byte along with its UART_RX_ERRORS flags
+uint16_t getcUart7Status()
+{
+    return getcUartStatus(UART7);
 }
 
 // Returns the status of the receive buffer
 bool kbhitUart7()
 {
-    // if fifo is empty evaluates to !(1) = 0
-    // if something in RX fifo !(0) = 1
-    return !(UART7_FR_R & UART_FR_RXFE);
+    return kbhitUart(UART7);
+}
+
+// Returns the baud rate UART7 was last set to
+uint32_t getUart7BaudRate()
+{
+    return current_baud;
+}
+
+// Called from the UART7 interrupt when the TX (end of transmission) interrupt fires
+void uart7TxDoneIsr()
+{
+    UART7_ICR_R = UART_ICR_TXIC;
+
+    // BUSY stays set until the stop bit of the last character in the FIFO is out
+    if ( !(UART7_FR_R & UART_FR_BUSY) )
+    {
+        UART7_IM_R &= ~UART_IM_TXIM;
+        carrierOff(0);
+    }
 }
@@ -9,9 +9,15 @@
 // Subroutines
 void initUart7();
 void setUart7BaudRate(uint32_t baudRate, uint32_t fcyc);
+void setUart7Address(uint8_t address, uint8_t mask);
+void clearUart7Address();
+void putAddressUart7(uint8_t address);
 void putcUart7(char c);
 void putsUart7(char* str);
 char getcUart7();
+uint16_t getcUart7Status();
 bool kbhitUart7();
+uint32_t getUart7BaudRate();
+void uart7TxDoneIsr();
 
 #endif
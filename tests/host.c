@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "tm4c123gh6pm.h"
+#include "uart.h"
+
+/*
+ *  The host side of host.h: fake register memory, the intrinsics, the UART simulator and
+ *  the CHECK counters. x86-64 Linux only (the UART simulator single steps with the trap flag).
+ */
+
+#define PERIPHERAL_BASE 0x40000000  // APB / AHB peripherals and system control
+#define PERIPHERAL_SIZE 0x00100000
+#define BITBAND_BASE    0x42000000  // bit-band alias of the peripherals
+#define BITBAND_SIZE    0x02000000
+#define SYSTEM_BASE     0xE0000000  // DWT, SysTick, NVIC, SCB
+#define SYSTEM_SIZE     0x00100000
+
+#define UART_PAGE_BASE  0x4000C000  // UART0 - UART7, one 4 KB page each
+#define UART_PAGE_SIZE  0x1000
+#define NVIC_PAGE_BASE  0xE000E000  // SysTick, NVIC and SCB
+#define NVIC_PAGE_SIZE  0x1000
+#define NVIC_O_EN       0x100       // interrupt set enable, writing 0 bits does nothing
+#define NVIC_O_DIS      0x180       // interrupt clear enable
+#define NVIC_EN_COUNT   5
+#define TRAP_FLAG       0x100
+
+typedef struct _SIM_UART
+{
+    uint16_t rx[HOST_RX_MAX];
+    uint16_t rx_head;
+    uint16_t rx_tail;
+    uint16_t tx[HOST_TX_MAX];
+    uint16_t tx_count;
+    bool address_matched;   // 9 bit mode, the last address byte was for us
+}
+SIM_UART;
+
+uint32_t hostPrimask = 0;
+uint32_t hostBasepri = 0;
+uint32_t hostCycles = 0;
+uint32_t hostCyclesPerRead = 40;
+uint32_t hostMs = 0;
+
+static SIM_UART uarts[UART_COUNT];
+static bool simulating = false;
+
+// the fake interrupt from hostInterruptAfter
+static struct
+{
+    bool starting;      // the raise that turns on single stepping
+    bool armed;         // counting down instructions
+    bool pending;       // went off while masked, runs once it isn't
+    uint32_t left;
+    uint8_t priority;
+    void (*isr)();
+}
+interrupt;
+
+// the access being single stepped
+static struct
+{
+    bool active;
+    bool nvic;          // the NVIC page, otherwise a UART
+    uint8_t uart;
+    uint32_t offset;
+    bool write;
+    uint32_t before;    // register value before the access
+}
+stepping;
+
+static int checks = 0;
+static int failures = 0;
+
+static void mapRegion(uintptr_t base, size_t size)
+{
+    void* p = mmap((void*)base, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+
+    if (p != (void*)base)
+    {
+        fprintf(stderr, "can't map the fake registers at 0x%08lX\n", (unsigned long)base);
+        exit(2);
+    }
+}
+
+// before main, so the firmware can touch registers from the very first line of a test
+__attribute__((constructor)) static void mapRegisters()
+{
+    mapRegion(PERIPHERAL_BASE, PERIPHERAL_SIZE);
+    mapRegion(BITBAND_BASE, BITBAND_SIZE);
+    mapRegion(SYSTEM_BASE, SYSTEM_SIZE);
+}
+
+// BASEPRI masks its priority and everything less urgent, PRIMASK masks all of them
+static bool isMasked(uint8_t priority)
+{
+    return hostPrimask || (hostBasepri && (uint32_t)(priority << 5) >= hostBasepri);
+}
+
+// what the NVIC does when a masked interrupt is pending and the mask goes down
+static void runPendingInterrupt()
+{
+    if (interrupt.pending && !isMasked(interrupt.priority))
+    {
+        interrupt.pending = false;
+        interrupt.isr();
+    }
+}
+
+uint32_t _disable_interrupts()
+{
+    uint32_t state = hostPrimask;
+    hostPrimask = 1;
+    return state;
+}
+
+uint32_t _restore_interrupts(uint32_t state)
+{
+    uint32_t old = hostPrimask;
+    hostPrimask = state;
+    runPendingInterrupt();
+    return old;
+}
+
+uint32_t _set_interrupt_priority(uint32_t priority)
+{
+    uint32_t old = hostBasepri;
+    hostBasepri = priority;
+    runPendingInterrupt();
+    return old;
+}
+
+static volatile uint32_t* uartRegs(uint8_t uart)
+{
+    return (volatile uint32_t*)(uintptr_t)(UART_PAGE_BASE + uart * UART_PAGE_SIZE);
+}
+
+static volatile uint32_t* nvicRegs()
+{
+    return (volatile uint32_t*)(uintptr_t)NVIC_PAGE_BASE;
+}
+
+static void protectPages(int protection)
+{
+    mprotect((void*)UART_PAGE_BASE, UART_COUNT * UART_PAGE_SIZE, protection);
+    mprotect((void*)NVIC_PAGE_BASE, NVIC_PAGE_SIZE, protection);
+}
+
+static bool isUartPage(uintptr_t address)
+{
+    return address >= UART_PAGE_BASE && address < UART_PAGE_BASE + UART_COUNT * UART_PAGE_SIZE;
+}
+
+static bool isNvicPage(uintptr_t address)
+{
+    return address >= NVIC_PAGE_BASE && address < NVIC_PAGE_BASE + NVIC_PAGE_SIZE;
+}
+
+static bool rxEmpty(SIM_UART* sim)
+{
+    return sim->rx_head == sim->rx_tail;
+}
+
+// a register access hit a protected page, do what the hardware would do before it
+static void onFault(int signal, siginfo_t* info, void* context)
+{
+    ucontext_t* uc = context;
+    uintptr_t address = (uintptr_t)info->si_addr;
+
+    if (!simulating || !(isUartPage(address) || isNvicPage(address)))
+    {
+        // a real crash, let it happen again without the handler
+        (void)signal;
+        sigaction(SIGSEGV, &(struct sigaction){ .sa_handler = SIG_DFL }, NULL);
+        return;
+    }
+
+    stepping.active = true;
+    stepping.nvic = isNvicPage(address);
+    stepping.uart = (address - UART_PAGE_BASE) / UART_PAGE_SIZE;
+    stepping.offset = (address % UART_PAGE_SIZE) & ~3;
+    stepping.write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+
+    protectPages(PROT_READ | PROT_WRITE);
+    uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+
+    if (stepping.nvic)
+    {
+        stepping.before = nvicRegs()[stepping.offset / 4];
+        return;
+    }
+
+    SIM_UART* sim = &uarts[stepping.uart];
+    volatile uint32_t* regs = uartRegs(stepping.uart);
+
+    // the TX side is instant, so the FIFO is always empty and never busy
+    if (stepping.offset == UART_O_FR)
+        regs[UART_O_FR / 4] = UART_FR_TXFE | (rxEmpty(sim) ? UART_FR_RXFE : 0);
+    else if (stepping.offset == UART_O_DR && !stepping.write)
+        regs[UART_O_DR / 4] = rxEmpty(sim) ? 0 : sim->rx[sim->rx_tail];
+}
+
+// the enable registers only set (or clear) the bits that are written as 1
+static void afterNvicWrite()
+{
+    volatile uint32_t* regs = nvicRegs();
+    uint32_t offset = stepping.offset;
+
+    if (offset >= NVIC_O_EN && offset < NVIC_O_EN + 4 * NVIC_EN_COUNT)
+    {
+        regs[offset / 4] |= stepping.before;
+    }
+    else if (offset >= NVIC_O_DIS && offset < NVIC_O_DIS + 4 * NVIC_EN_COUNT)
+    {
+        uint32_t en = (NVIC_O_EN + offset - NVIC_O_DIS) / 4;
+
+        regs[en] &= ~regs[offset / 4];
+        regs[offset / 4] = regs[en];
+    }
+}
+
+// one instruction closer to the fake interrupt, it runs right here in the signal
+// handler, in between two instructions of whatever it cut into like a real one
+static void stepInterrupt(ucontext_t* uc)
+{
+    if (interrupt.starting)
+    {
+        interrupt.starting = false;
+        interrupt.armed = true;
+    }
+    else if (interrupt.armed && --interrupt.left == 0)
+    {
+        interrupt.armed = false;
+
+        if (isMasked(interrupt.priority))
+            interrupt.pending = true;
+        else
+            interrupt.isr();
+    }
+
+    if (interrupt.armed)
+        uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+}
+
+// the access is done, take care of what it did and protect the pages again
+static void onTrap(int signal, siginfo_t* info, void* context)
+{
+    ucontext_t* uc = context;
+    (void)signal;
+    (void)info;
+
+    uc->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+    stepInterrupt(uc);
+
+    if (!stepping.active)
+        return;
+
+    if (stepping.nvic)
+    {
+        if (stepping.write)
+            afterNvicWrite();
+
+        stepping.active = false;
+        protectPages(PROT_NONE);
+        return;
+    }
+
+    SIM_UART* sim = &uarts[stepping.uart];
+    volatile uint32_t* regs = uartRegs(stepping.uart);
+
+    if (stepping.offset == UART_O_DR && stepping.write)
+    {
+        uint32_t lcrh = regs[UART_O_LCRH / 4];
+        uint16_t flags = 0;
+
+        // stick parity with EPS clear sends a 1 in the parity bit, the address flag
+        if ((lcrh & (UART_LCRH_PEN | UART_LCRH_SPS)) == (UART_LCRH_PEN | UART_LCRH_SPS) &&
+            !(lcrh & UART_LCRH_EPS))
+            flags = HOST_ADDRESS;
+
+        if (sim->tx_count < HOST_TX_MAX)
+            sim->tx[sim->tx_count++] = (regs[UART_O_DR / 4] & 0xFF) | flags;
+    }
+    else if (stepping.offset == UART_O_DR && !rxEmpty(sim))
+    {
+        sim->rx_tail = (sim->rx_tail + 1) % HOST_RX_MAX;
+    }
+
+    stepping.active = false;
+    protectPages(PROT_NONE);
+}
+
+void hostSimulateUarts()
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_flags = SA_SIGINFO;
+
+    action.sa_sigaction = onFault;
+    sigaction(SIGSEGV, &action, NULL);
+    action.sa_sigaction = onTrap;
+    sigaction(SIGTRAP, &action, NULL);
+
+    simulating = true;
+    protectPages(PROT_NONE);
+}
+
+// single steps from here on and runs isr after that many instructions, or once
+// BASEPRI / PRIMASK let its priority through if it is masked right then
+void hostInterruptAfter(uint32_t instructions, uint8_t priority, void (*isr)())
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_flags = SA_SIGINFO;
+    action.sa_sigaction = onTrap;
+    sigaction(SIGTRAP, &action, NULL);
+
+    interrupt.left = instructions ? instructions : 1;
+    interrupt.priority = priority;
+    interrupt.isr = isr;
+    interrupt.pending = false;
+    interrupt.starting = true;
+    raise(SIGTRAP);
+}
+
+// true if it hasn't gone off (or is still pending), so the code was shorter than that
+bool hostInterruptArmed()
+{
+    return interrupt.armed || interrupt.pending;
+}
+
+void hostInterruptCancel()
+{
+    interrupt.armed = false;
+    interrupt.pending = false;
+}
+
+// puts bytes on the RX pin of a UART. HOST_ADDRESS in flags sends them with the 9th
+// bit set, and in 9 bit mode the address filter drops what the hardware would drop
+void hostUartReceive(uint8_t uart, const uint8_t* data, uint16_t length, uint16_t flags)
+{
+    SIM_UART* sim = &uarts[uart];
+    volatile uint32_t* regs = uartRegs(uart);
+    uint16_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        uint16_t value = data[i];
+        uint32_t address = regs[UART_O_9BITADDR / 4];
+        uint32_t mask = regs[UART_O_9BITAMASK / 4];
+
+        if (address & UART_9BITADDR_9BITEN)
+        {
+            if (flags & HOST_ADDRESS)
+                sim->address_matched = (data[i] & mask) == (address & mask);
+            if (!sim->address_matched)
+                continue;
+        }
+        else if (flags & HOST_ADDRESS)
+        {
+            value |= UART_DR_PE;    // the 9th bit is a wrong parity bit in 8E1
+        }
+
+        sim->rx[sim->rx_head] = value;
+        sim->rx_head = (sim->rx_head + 1) % HOST_RX_MAX;
+    }
+}
+
+uint16_t hostUartRxLeft(uint8_t uart)
+{
+    SIM_UART* sim = &uarts[uart];
+    return (sim->rx_head - sim->rx_tail + HOST_RX_MAX) % HOST_RX_MAX;
+}
+
+// copies out what was written to DR since the last clear, returns how many
+uint16_t hostUartSent(uint8_t uart, uint16_t* out, uint16_t max)
+{
+    uint16_t count = uarts[uart].tx_count < max ? uarts[uart].tx_count : max;
+
+    memcpy(out, uarts[uart].tx, count * sizeof(uint16_t));
+    return count;
+}
+
+void hostUartClear(uint8_t uart)
+{
+    uarts[uart].rx_head = uarts[uart].rx_tail = 0;
+    uarts[uart].tx_count = 0;
+    uarts[uart].address_matched = false;
+}
+
+void hostCheck(bool ok, const char* text, const char* file, int line)
+{
+    checks++;
+
+    if (!ok)
+    {
+        failures++;
+        printf("FAIL %s:%d: %s\n", file, line, text);
+    }
+}
+
+int hostResult(const char* name)
+{
+    printf("%s: %d checks, %d failed\n", name, checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ *  host.h - builds the firmware sources with gcc on a Linux PC for the host tests
+ *
+ *  Every test is built with -include host.h, so this comes before anything in the
+ *  firmware. It swaps the TI compiler intrinsics for plain C, and host.c maps RAM where
+ *  the TM4C peripherals and the NVIC are, so the register macros from tm4c123gh6pm.h
+ *  work unchanged (they just read and write memory).
+ *
+ *  The UARTs can also be simulated (hostSimulateUarts): their register pages get
+ *  protected, and every access is single stepped so reading DR pops the next received
+ *  byte, FR tells the truth about the RX FIFO, and whatever gets written to DR is kept
+ *  so the test can look at what went out. That way the real ISRs and drivers run. The
+ *  NVIC page is handled the same way so its enable registers only set bits like the
+ *  real ones do. The same single stepping can also cut in with a fake interrupt after
+ *  any instruction (hostInterruptAfter) to check a race.
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// TI compiler intrinsics
+#define _delay_cycles(cycles) ((void)(cycles))
+#define __asm(text) ((void)0)
+uint32_t _disable_interrupts();
+uint32_t _restore_interrupts(uint32_t state);
+uint32_t _set_interrupt_priority(uint32_t priority);
+
+// what the intrinsics above did, so a test can check something ran in a critical section
+extern uint32_t hostPrimask;
+extern uint32_t hostBasepri;
+
+// virtual time: getTimestamp (DWT cycles) and getUptimeUs move forward by
+// hostCyclesPerRead every time they are read, so busy waits in the firmware still end
+extern uint32_t hostCycles;
+extern uint32_t hostCyclesPerRead;
+extern uint32_t hostMs;             // getUptimeMs when pwm.c isn't linked in
+
+// a fake interrupt at the given priority (0 - 7) that cuts in after that many instructions
+// (single stepped), or waits until BASEPRI / PRIMASK let it through. Stepping through the
+// same code with 1, 2, 3... instructions hits every point an interrupt could come in
+void hostInterruptAfter(uint32_t instructions, uint8_t priority, void (*isr)());
+bool hostInterruptArmed();
+void hostInterruptCancel();
+
+// simulated UARTs, flags on the received / sent bytes
+#define HOST_ADDRESS 0x100      // 9th bit set (9 bit mode address byte)
+#define HOST_TX_MAX 4096
+#define HOST_RX_MAX 4096
+
+void hostSimulateUarts();
+void hostUartReceive(uint8_t uart, const uint8_t* data, uint16_t length, uint16_t flags);
+uint16_t hostUartRxLeft(uint8_t uart);
+uint16_t hostUartSent(uint8_t uart, uint16_t* out, uint16_t max);
+void hostUartClear(uint8_t uart);
+
+// checks
+#define CHECK(condition) hostCheck((condition), #condition, __FILE__, __LINE__)
+void hostCheck(bool ok, const char* text, const char* file, int line);
+int hostResult(const char* name);
+
+#endif
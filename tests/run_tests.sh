@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+#  Builds and runs the host tests (x86-64 Linux, gcc). Each test is the real firmware
+#  source for the module under test plus host.c / stubs.c, see host.h for how that works.
+#
+#  ./run_tests.sh            all of them
+#  ./run_tests.sh ir_channel just test_ir_channel
+
+cd "$(dirname "$0")" || exit 1
+
+SRC=../ccs/cse3442_term_project
+OUT=${OUT:-/tmp/ir-uart-tests}
+CFLAGS="-std=gnu99 -D_GNU_SOURCE -O1 -g -Wall -Wno-main -Wno-int-to-pointer-cast -include host.h -I. -I$SRC"
+
+mkdir -p "$OUT"
+
+# test name and the firmware sources it runs against
+tests()
+{
+    echo "ir_channel ir_channel.c uart.c ir_frame.c diversity.c compress.c priority.c"
+    echo "fragment fragment.c"
+    echo "diversity diversity.c ir_frame.c compress.c"
+    echo "pwm pwm.c priority.c"
+    echo "uart uart.c"
+    echo "echo"
+    echo "csma csma.c priority.c"
+    echo "address uart7.c uart.c ir_channel.c ir_frame.c diversity.c compress.c priority.c"
+    echo "batch batch.c timer.c priority.c ir_frame.c compress.c"
+    echo "timer timer.c priority.c"
+    echo "calibration calibration.c priority.c strings.c"
+    echo "csma_load csma.c priority.c"
+    echo "mesh priority.c strings.c"
+}
+
+tests | {
+status=0
+
+while read -r name sources; do
+    [ -n "$1" ] && [ "$1" != "$name" ] && continue
+
+    files=""
+    for f in $sources; do
+        files="$files $SRC/$f"
+    done
+
+    if ! gcc $CFLAGS -o "$OUT/test_$name" "test_$name.c" host.c stubs.c $files -lm; then
+        echo "test_$name: build failed"
+        status=1
+        continue
+    fi
+
+    # a broken list (say a race in the timer wheel) spins forever instead of failing
+    timeout 60 "$OUT/test_$name"
+    case $? in
+        0) ;;
+        124) echo "test_$name: timed out"; status=1 ;;
+        *) status=1 ;;
+    esac
+done
+
+exit $status
+}
@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stubs.h"
+#include "uart0.h"
+#include "uart7.h"
+#include "ir_link.h"
+#include "scheduler.h"
+#include "pwm.h"
+#include "timer.h"
+#include "timestamp.h"
+#include "trace.h"
+#include "echo.h"
+#include "csma.h"
+#include "kernel.h"
+
+/*
+ *  Stand-ins for the firmware modules a test doesn't link in. They are all weak, so
+ *  when a test does link the real module that one wins. The ones that matter to a test
+ *  (the console, received frames, sent frames) are captured in the stub* variables.
+ */
+
+#define WEAK __attribute__((weak))
+
+char stubConsole[STUB_CONSOLE_SIZE];
+uint16_t stubConsoleLength = 0;
+
+IR_FRAME stubFrames[STUB_FRAME_MAX];
+uint8_t stubFrameChannels[STUB_FRAME_MAX];
+uint8_t stubFrameCount = 0;
+
+uint8_t stubWire[STUB_FRAME_MAX][IR_FRAME_MAX_WIRE + 1];
+uint8_t stubWireLength[STUB_FRAME_MAX];
+uint8_t stubWireAddress[STUB_FRAME_MAX];
+uint8_t stubWireCount = 0;
+
+uint32_t stubEvents = 0;
+
+void stubReset()
+{
+    stubConsoleLength = 0;
+    stubConsole[0] = 0;
+    stubFrameCount = 0;
+    stubWireCount = 0;
+    stubEvents = 0;
+}
+
+// uart0.c
+WEAK void putcUart0(char c)
+{
+    if (stubConsoleLength < STUB_CONSOLE_SIZE - 1)
+    {
+        stubConsole[stubConsoleLength++] = c;
+        stubConsole[stubConsoleLength] = 0;
+    }
+}
+
+WEAK void putsUart0(char* str)
+{
+    while (*str)
+        putcUart0(*str++);
+}
+
+WEAK bool kbhitUart0()
+{
+    return false;
+}
+
+// uart7.c
+WEAK uint32_t getUart7BaudRate()
+{
+    return 1200;
+}
+
+WEAK void setUart7Address(uint8_t address, uint8_t mask)
+{
+    (void)address;
+    (void)mask;
+}
+
+WEAK void clearUart7Address()
+{
+}
+
+// ir_link.c
+WEAK void printIrMessageHeader(uint8_t channel)
+{
+    (void)channel;
+}
+
+WEAK void processIrFrame(uint8_t channel, IR_FRAME* frame)
+{
+    if (stubFrameCount < STUB_FRAME_MAX)
+    {
+        stubFrames[stubFrameCount] = *frame;
+        stubFrameChannels[stubFrameCount] = channel;
+        stubFrameCount++;
+    }
+}
+
+// scheduler.c
+WEAK void postEvent(uint32_t events)
+{
+    stubEvents |= events;
+}
+
+WEAK bool isTaskPending()
+{
+    return stubEvents != 0;
+}
+
+WEAK void runTasks()
+{
+}
+
+// pwm.c
+WEAK void carrierOn(uint8_t channel)
+{
+    (void)channel;
+}
+
+WEAK void carrierOff(uint8_t channel)
+{
+    (void)channel;
+}
+
+WEAK uint32_t getUptimeMs()
+{
+    return hostMs;
+}
+
+// timer.c
+WEAK void initTimer(TIMER* timer, void (*callback)(void* context), void* context)
+{
+    (void)timer;
+    (void)callback;
+    (void)context;
+}
+
+WEAK void startTimer(TIMER* timer, uint32_t ms)
+{
+    (void)timer;
+    (void)ms;
+}
+
+WEAK void stopTimer(TIMER* timer)
+{
+    (void)timer;
+}
+
+// timestamp.c, virtual time that moves a little with every read
+WEAK uint32_t getTimestamp()
+{
+    hostCycles += hostCyclesPerRead;
+    return hostCycles;
+}
+
+// the same virtual time in us, added up so it doesn't wrap with hostCycles. A test that
+// sets hostCycles back goes back in us too
+WEAK uint64_t getUptimeUs()
+{
+    static uint32_t last = 0;
+    static uint64_t cycles = 0;
+
+    hostCycles += hostCyclesPerRead;
+    cycles += (int32_t)(hostCycles - last);
+    last = hostCycles;
+
+    return cycles / TIMESTAMP_TICKS_PER_US;
+}
+
+// trace.c
+WEAK void traceByte(uint8_t data, uint8_t flags)
+{
+    (void)data;
+    (void)flags;
+}
+
+// echo.c
+WEAK bool isEcho(uint8_t c)
+{
+    (void)c;
+    return false;
+}
+
+WEAK void noteEchoTx(uint8_t c)
+{
+    (void)c;
+}
+
+WEAK void waitForTurnaround()
+{
+}
+
+// csma.c, keeps the encoded frames instead of sending them
+WEAK void transmitIrWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    if (stubWireCount < STUB_FRAME_MAX)
+    {
+        memcpy(stubWire[stubWireCount], wire, length);
+        stubWireLength[stubWireCount] = length;
+        stubWireAddress[stubWireCount] = address;
+        stubWireCount++;
+    }
+}
+
+// csma.c, the queued ones go out right away
+WEAK bool queueIrWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    transmitIrWire(address, wire, length);
+    return true;
+}
+
+WEAK void notifyIrTxRoom(uint32_t events)
+{
+    postEvent(events);
+}
+
+// kernel.c, there is only one thread on the host
+WEAK void waitSemaphore(SEMAPHORE* semaphore)
+{
+    if (semaphore->count)
+        semaphore->count--;
+}
+
+WEAK bool tryWaitSemaphore(SEMAPHORE* semaphore)
+{
+    if (!semaphore->count)
+        return false;
+
+    semaphore->count--;
+    return true;
+}
+
+WEAK void postSemaphore(SEMAPHORE* semaphore)
+{
+    semaphore->count++;
+}
@@ -0,0 +1,30 @@
+#ifndef STUBS_H_
+#define STUBS_H_
+
+#include <stdint.h>
+#include "ir_frame.h"
+
+#define STUB_CONSOLE_SIZE 4096
+#define STUB_FRAME_MAX 32
+
+// what went out on UART0
+extern char stubConsole[STUB_CONSOLE_SIZE];
+extern uint16_t stubConsoleLength;
+
+// frames handed to processIrFrame
+extern IR_FRAME stubFrames[STUB_FRAME_MAX];
+extern uint8_t stubFrameChannels[STUB_FRAME_MAX];
+extern uint8_t stubFrameCount;
+
+// encoded frames handed to transmitIrWire
+extern uint8_t stubWire[STUB_FRAME_MAX][IR_FRAME_MAX_WIRE + 1];
+extern uint8_t stubWireLength[STUB_FRAME_MAX];
+extern uint8_t stubWireAddress[STUB_FRAME_MAX];
+extern uint8_t stubWireCount;
+
+// events given to postEvent
+extern uint32_t stubEvents;
+
+void stubReset();
+
+#endif
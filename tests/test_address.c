@@ -0,0 +1,159 @@
+/*
+ *  test_address - 9 bit mode node addressing on UART7
+ *
+ *  The simulated UART does the hardware's address matching (UART9BITADDR / AMASK), so
+ *  this sends frames behind an address byte and checks what makes it all the way
+ *  through drainIrChannelRx and pollIrRx: our own address and the broadcast get
+ *  through, another node's address gets filtered out before the CPU sees any of it.
+ *  It also checks the sending side puts the address out with the 9th bit set.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <string.h>
+#include "tm4c123gh6pm.h"
+#include "uart.h"
+#include "uart7.h"
+#include "ir_channel.h"
+#include "ir_frame.h"
+#include "stubs.h"
+
+static uint8_t wire[IR_FRAME_MAX_WIRE];
+static uint8_t wire_length;
+static const uint8_t text[] = "addressed";
+
+// an address byte with the 9th bit set and then the frame, like another board sends it
+static void receive(uint8_t address)
+{
+    hostUartReceive(7, &address, 1, HOST_ADDRESS);
+    hostUartReceive(7, wire, wire_length, 0);
+    drainIrChannelRx(0);
+    pollIrRx();
+}
+
+static void testSetNode()
+{
+    setIrNode(2);
+
+    CHECK(UART7_9BITADDR_R == (UART_9BITADDR_9BITEN | IR_NODE_ADDRESS(2)));
+    CHECK(UART7_9BITAMASK_R == IR_NODE_ADDRESS(2));
+    CHECK(UART7_LCRH_R == UART_9BIT_DATA);
+
+    // no diversity, so the other channels are separate links and stay 8E1
+    CHECK(UART1_9BITADDR_R == 0);
+    CHECK(UART1_LCRH_R == UART_8E1);
+}
+
+static void testMatch()
+{
+    stubReset();
+    hostUartClear(7);
+
+    receive(IR_NODE_ADDRESS(2));
+
+    CHECK(stubFrameCount == 1);
+    CHECK(stubFrames[0].length == sizeof(text));
+    CHECK(memcmp(stubFrames[0].payload, text, sizeof(text)) == 0);
+}
+
+static void testBroadcast()
+{
+    stubReset();
+    hostUartClear(7);
+
+    receive(IR_FRAME_BROADCAST);
+
+    CHECK(stubFrameCount == 1);
+}
+
+static void testMismatch()
+{
+    uint32_t rx_bytes = irChannels[0].rx_bytes;
+
+    stubReset();
+    hostUartClear(7);
+    NVIC_SW_TRIG_R = 0;
+
+    receive(IR_NODE_ADDRESS(3));
+
+    // the hardware threw it all away, so the ISR never even saw a byte
+    CHECK(stubFrameCount == 0);
+    CHECK(irChannels[0].rx_bytes == rx_bytes);
+    CHECK(NVIC_SW_TRIG_R == 0);
+
+    // and the next frame to us still gets through
+    receive(IR_NODE_ADDRESS(2));
+    CHECK(stubFrameCount == 1);
+}
+
+// node 0's address byte is 0x01, the same as SOH
+static void testNodeZero()
+{
+    setIrNode(0);
+    stubReset();
+    hostUartClear(7);
+
+    receive(IR_NODE_ADDRESS(0));
+    CHECK(stubFrameCount == 1);
+
+    receive(IR_NODE_ADDRESS(1));
+    CHECK(stubFrameCount == 1);
+}
+
+static void testSend()
+{
+    uint16_t sent[IR_FRAME_MAX_WIRE + 1];
+    uint16_t count;
+    uint8_t i;
+
+    setIrNode(2);
+    hostUartClear(7);
+
+    putAddressUart7(IR_NODE_ADDRESS(5));
+    for (i = 0; i < wire_length; i++)
+        putcUart7(wire[i]);
+
+    count = hostUartSent(7, sent, sizeof(sent) / sizeof(sent[0]));
+    CHECK(count == wire_length + 1);
+    CHECK(sent[0] == (HOST_ADDRESS | IR_NODE_ADDRESS(5)));
+    for (i = 0; i < wire_length; i++)
+        CHECK(sent[i + 1] == wire[i]);
+
+    // back to data bytes with stick parity 0 afterwards
+    CHECK(UART7_LCRH_R == UART_9BIT_DATA);
+}
+
+// no node, back to 8E1 where every byte gets through and an address byte is just junk
+static void testNoNode()
+{
+    setIrNode(IR_NODE_NONE);
+
+    CHECK(UART7_9BITADDR_R == 0);
+    CHECK(UART7_LCRH_R == UART_8E1);
+
+    stubReset();
+    hostUartClear(7);
+
+    receive(IR_NODE_ADDRESS(3));
+    CHECK(stubFrameCount == 1);
+}
+
+int main()
+{
+    hostSimulateUarts();
+    initIrChannels();
+    initUart7();
+    NVIC_SW_TRIG_R = 0;
+
+    wire_length = encodeIrFrame(IR_FRAME_TEXT, text, sizeof(text), wire);
+
+    testSetNode();
+    testMatch();
+    testBroadcast();
+    testMismatch();
+    testNodeZero();
+    testSend();
+    testNoNode();
+
+    return hostResult("test_address");
+}
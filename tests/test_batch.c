@@ -0,0 +1,456 @@
+/*
+ *  test_batch - packing short messages into batch frames and splitting them back up
+ *
+ *  Every batch frame that would go out is handed straight to handleBatchFrame, and the
+ *  messages that come out the other side have to be the same ones in the same order.
+ *  The edges are the longest message that still gets batched (32 bytes), one byte
+ *  more, and a batch that fills the 64 byte payload exactly vs by one byte too many.
+ *  The timer flush comes from the events thread, so it also gets cut in after every
+ *  instruction of the shell adding a message, and has to wait when the transmit queue
+ *  is full. The frames go through the real encoder and decoder, and the bytes on the
+ *  wire per message are compared to sending every message in its own frame.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "ir_frame.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "kernel.h"
+#include "stubs.h"
+
+#define MESSAGE_MAX 32          // BATCH_MAX_MESSAGE in batch.c
+#define RECEIVED_MAX 64
+
+typedef struct _MESSAGE
+{
+    uint8_t type;
+    uint16_t length;
+    uint8_t data[256];
+    bool batched;               // came out of a batch frame, not on its own
+}
+MESSAGE;
+
+static MESSAGE received[RECEIVED_MAX];
+static uint8_t received_count = 0;
+static uint8_t frame_lengths[RECEIVED_MAX];
+static uint8_t frame_count = 0;
+static bool unpacking = false;
+static bool tx_full = false;
+static uint32_t room_events = 0;
+static uint32_t wire_bytes = 0;       // everything that went to transmitIrWire
+
+// ir_link.c, where every message ends up
+void processIrMessage(uint8_t channel, uint8_t type, const uint8_t* data, uint16_t length)
+{
+    (void)channel;
+
+    if (received_count < RECEIVED_MAX)
+    {
+        received[received_count].type = type;
+        received[received_count].length = length;
+        received[received_count].batched = unpacking;
+        memcpy(received[received_count].data, data, length);
+        received_count++;
+    }
+}
+
+// csma.c, the real ir_frame.c encodes the batch frame and it comes back in here. It is
+// decoded again and goes straight to the receive side
+void transmitIrWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    IR_FRAME frame;
+    (void)address;
+
+    // SOH and the terminating 0 aren't part of what decodeIrFrame gets
+    CHECK(length >= 2 && wire[0] == IR_FRAME_SOH && wire[length - 1] == 0);
+    CHECK(decodeIrFrame(&wire[1], length - 2, &frame));
+    CHECK(frame.type == IR_FRAME_BATCH);
+    CHECK(frame.length <= IR_FRAME_MAX_PAYLOAD);
+
+    if (frame_count < RECEIVED_MAX)
+        frame_lengths[frame_count++] = frame.length;
+    wire_bytes += length;
+
+    unpacking = true;
+    handleBatchFrame(1, frame.payload, frame.length);
+    unpacking = false;
+}
+
+// the events thread queues it instead of waiting for the transmitter
+bool queueIrWire(uint8_t address, const uint8_t* wire, uint8_t length)
+{
+    if (tx_full)
+        return false;
+
+    transmitIrWire(address, wire, length);
+    return true;
+}
+
+// csma.c
+void notifyIrTxRoom(uint32_t events)
+{
+    room_events |= events;
+}
+
+// fragment.c, a message that doesn't get batched
+bool sendIrMessageTo(uint8_t address, uint8_t type, const uint8_t* data, uint16_t length)
+{
+    (void)address;
+    processIrMessage(0, type, data, length);
+    return true;
+}
+
+static void clear()
+{
+    received_count = 0;
+    frame_count = 0;
+    wire_bytes = 0;
+    memset(getBatchStats(), 0, sizeof(BATCH_STATS));
+}
+
+static void fill(uint8_t* data, uint8_t length, uint8_t seed)
+{
+    uint8_t i;
+
+    for (i = 0; i < length; i++)
+        data[i] = 'a' + (seed + i) % 26;
+}
+
+static bool isMessage(uint8_t index, const uint8_t* data, uint8_t length, bool batched)
+{
+    return index < received_count && received[index].type == IR_FRAME_TEXT &&
+           received[index].length == length && received[index].batched == batched &&
+           memcmp(received[index].data, data, length) == 0;
+}
+
+static void tickMs(uint32_t ms)
+{
+    while (ms--)
+        tickTimers();
+}
+
+static void testRoundTrip()
+{
+    uint8_t data[5][MESSAGE_MAX];
+    uint8_t lengths[5] = { 1, 7, 3, 12, 5 };
+    uint8_t i;
+
+    clear();
+    setBatchDelay(20);
+
+    for (i = 0; i < 5; i++)
+    {
+        fill(data[i], lengths[i], i);
+        sendBatchedText(data[i], lengths[i]);
+    }
+    CHECK(received_count == 0);     // all still waiting
+
+    flushBatch();
+
+    CHECK(frame_count == 1);
+    CHECK(frame_lengths[0] == 5 + 1 + 7 + 3 + 12 + 5);
+    CHECK(received_count == 5);
+    for (i = 0; i < 5; i++)
+        CHECK(isMessage(i, data[i], lengths[i], true));
+
+    CHECK(getBatchStats()->messages == 5);
+    CHECK(getBatchStats()->frames == 1);
+    CHECK(getBatchStats()->histogram[4] == 1);
+}
+
+// 32 bytes still gets batched, 33 goes out on its own after whatever was waiting
+static void testMaxLength()
+{
+    uint8_t small[3] = { 'x', 'y', 'z' };
+    uint8_t longest[MESSAGE_MAX];
+    uint8_t too_long[MESSAGE_MAX + 1];
+
+    clear();
+    setBatchDelay(20);
+    fill(longest, sizeof(longest), 3);
+    fill(too_long, sizeof(too_long), 9);
+
+    sendBatchedText(small, sizeof(small));
+    sendBatchedText(longest, sizeof(longest));
+    CHECK(received_count == 0);
+
+    sendBatchedText(too_long, sizeof(too_long));
+
+    CHECK(frame_count == 1);
+    CHECK(received_count == 3);
+    CHECK(isMessage(0, small, sizeof(small), true));
+    CHECK(isMessage(1, longest, sizeof(longest), true));
+    CHECK(isMessage(2, too_long, sizeof(too_long), false));
+}
+
+// length bytes included, 32 + 1 + 30 + 1 is exactly the 64 byte payload
+static void testFullFrame()
+{
+    uint8_t a[32];
+    uint8_t b[30];
+    uint8_t c[1] = { '!' };
+
+    clear();
+    setBatchDelay(20);
+    fill(a, sizeof(a), 1);
+    fill(b, sizeof(b), 2);
+
+    sendBatchedText(a, sizeof(a));
+    sendBatchedText(b, sizeof(b));
+    CHECK(frame_count == 0);        // fits exactly, so it keeps waiting
+
+    sendBatchedText(c, sizeof(c));  // 66 bytes now, so the first two go
+    CHECK(frame_count == 1);
+    CHECK(frame_lengths[0] == IR_FRAME_MAX_PAYLOAD);
+    CHECK(getBatchStats()->size_flushes == 1);
+    CHECK(received_count == 2);
+
+    flushBatch();
+    CHECK(frame_count == 2);
+    CHECK(frame_lengths[1] == 2);
+    CHECK(isMessage(0, a, sizeof(a), true));
+    CHECK(isMessage(1, b, sizeof(b), true));
+    CHECK(isMessage(2, c, sizeof(c), true));
+}
+
+// one byte over: 32 + 1 + 31 + 1 = 65 doesn't fit
+static void testOneOver()
+{
+    uint8_t a[32];
+    uint8_t b[31];
+
+    clear();
+    setBatchDelay(20);
+    fill(a, sizeof(a), 4);
+    fill(b, sizeof(b), 5);
+
+    sendBatchedText(a, sizeof(a));
+    sendBatchedText(b, sizeof(b));
+    CHECK(frame_count == 1);
+    CHECK(frame_lengths[0] == 33);
+    CHECK(getBatchStats()->size_flushes == 1);
+
+    flushBatch();
+    CHECK(isMessage(0, a, sizeof(a), true));
+    CHECK(isMessage(1, b, sizeof(b), true));
+}
+
+// nothing else came, the delay runs out and pollBatch sends it
+static void testTimerFlush()
+{
+    uint8_t data[4] = { 't', 'i', 'm', 'e' };
+
+    clear();
+    setBatchDelay(20);
+    stubEvents = 0;
+
+    sendBatchedText(data, sizeof(data));
+    tickMs(19);
+    CHECK(stubEvents == 0);
+    tickMs(2);
+    CHECK(stubEvents == EVENT_BATCH);
+
+    pollBatch();
+    CHECK(frame_count == 1);
+    CHECK(getBatchStats()->timer_flushes == 1);
+    CHECK(isMessage(0, data, sizeof(data), true));
+
+    // and a second poll doesn't send anything again
+    pollBatch();
+    CHECK(frame_count == 1);
+}
+
+// turning it off sends what was waiting, after that every message goes by itself
+static void testOff()
+{
+    uint8_t data[2] = { 'o', 'k' };
+
+    clear();
+    setBatchDelay(20);
+    sendBatchedText(data, sizeof(data));
+
+    setBatchDelay(0);
+    CHECK(frame_count == 1);
+    sendBatchedText(data, sizeof(data));
+    CHECK(frame_count == 1);
+    CHECK(isMessage(0, data, sizeof(data), true));
+    CHECK(isMessage(1, data, sizeof(data), false));
+
+    // and the stale flush_due from a timer doesn't send an empty batch
+    pollBatch();
+    CHECK(frame_count == 1);
+}
+
+// the transmit queue is full (the shell has been sending for a while), so the batch
+// stays put until there is room, and the flush is only counted once it went
+static void testTxQueueFull()
+{
+    uint8_t data[4] = { 'f', 'u', 'l', 'l' };
+
+    clear();
+    setBatchDelay(20);
+    room_events = 0;
+
+    sendBatchedText(data, sizeof(data));
+    tickMs(21);
+
+    tx_full = true;
+    pollBatch();
+    tx_full = false;
+    CHECK(frame_count == 0);
+    CHECK(room_events == EVENT_BATCH);
+    CHECK(getBatchStats()->timer_flushes == 0);
+
+    pollBatch();
+    CHECK(frame_count == 1);
+    CHECK(getBatchStats()->timer_flushes == 1);
+    CHECK(isMessage(0, data, sizeof(data), true));
+}
+
+// the events thread runs pollBatch if its event is posted, clearing it like runTasks
+static void runEvents()
+{
+    if (stubEvents & EVENT_BATCH)
+    {
+        stubEvents &= ~EVENT_BATCH;
+        pollBatch();
+    }
+}
+
+// the flush timer runs out and the events thread goes right away
+static void eventsCutIn()
+{
+    tickMs(1);
+    runEvents();
+}
+
+// the flush timer runs out while the shell is adding a message, after every instruction
+// of it. pollBatch can't wait for the shell, so if the shell has the buffer it leaves
+// it, and the shell has to post the flush again when it lets go. Both messages go out
+// once, in order, and the first one can't be stuck waiting after its delay is up
+static void testFlushWhileAdding()
+{
+    uint8_t a[3] = { 'o', 'n', 'e' };
+    uint8_t b[3] = { 't', 'w', 'o' };
+    uint32_t n;
+    bool ok = true;
+
+    for (n = 1; ok; n++)
+    {
+        clear();
+        setBatchDelay(20);
+        sendBatchedText(a, sizeof(a));
+        tickMs(19);
+        stubEvents = 0;
+
+        hostInterruptAfter(n, THREAD_LOWEST_PRIORITY, eventsCutIn);
+        sendBatchedText(b, sizeof(b));
+
+        if (hostInterruptArmed())
+        {
+            hostInterruptCancel();
+            break;  // it was done before the n-th instruction
+        }
+
+        runEvents();
+        ok = isMessage(0, a, sizeof(a), true);
+
+        flushBatch();
+        ok = ok && received_count == 2 && isMessage(1, b, sizeof(b), true);
+
+        if (!ok)
+            printf("  cut in after %u instructions\n", n);
+    }
+
+    CHECK(ok);
+    CHECK(n > 50);
+}
+
+// what batching buys on the wire: every frame costs SOH, type, COBS code, crc and the 0
+// (6 bytes, compression is off), a batched message costs its length byte. For each
+// message size and count it prints the bytes sent per message both ways. A message on
+// its own is encoded by itself like fragment.c would send it. Two 32 byte messages don't
+// fit in one frame, so those only come out ahead when something shorter rides along
+static void testOverhead()
+{
+    static const uint8_t sizes[] = { 1, 4, 8, 16, 32 };
+    static const uint8_t counts[] = { 1, 2, 4, 8, 16 };
+    uint8_t data[MESSAGE_MAX];
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+    uint8_t i;
+    uint8_t j;
+    uint8_t k;
+
+    printf("   size count  frames  unbatched B/msg  batched B/msg  saved\n");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        uint8_t size = sizes[i];
+        uint8_t per_frame = IR_FRAME_MAX_PAYLOAD / (size + 1);
+        uint8_t unbatched;
+
+        fill(data, size, i);
+        unbatched = encodeIrFrame(IR_FRAME_TEXT, data, size, wire);
+        CHECK(unbatched == size + 6);
+
+        for (j = 0; j < sizeof(counts) / sizeof(counts[0]); j++)
+        {
+            uint8_t count = counts[j];
+            uint8_t frames = (count + per_frame - 1) / per_frame;
+            double batched;
+
+            clear();
+            setBatchDelay(20);
+            for (k = 0; k < count; k++)
+                sendBatchedText(data, size);
+            flushBatch();
+
+            batched = (double)wire_bytes / count;
+            printf("  %5u %5u  %6u  %15u  %13.2f  %4.0f%%\n", size, count, frame_count,
+                   unbatched, batched, 100 * (1 - batched / unbatched));
+
+            CHECK(received_count == count);
+            CHECK(frame_count == frames);
+            CHECK(wire_bytes == count * (size + 1) + 6 * frames);
+
+            // alone in its frame it's the length byte worse off, as soon as two share a
+            // frame it's ahead
+            if (frames == count)
+                CHECK(wire_bytes == count * (unbatched + 1));
+            else
+                CHECK(wire_bytes < count * unbatched);
+        }
+    }
+}
+
+// a length byte that runs past the end of the frame stops the unpacking there
+static void testBadFrame()
+{
+    uint8_t frame[] = { 2, 'o', 'k', 5, 'c', 'u', 't' };
+
+    clear();
+    handleBatchFrame(1, frame, sizeof(frame));
+
+    CHECK(received_count == 1);
+    CHECK(received[0].length == 2);
+}
+
+int main()
+{
+    testRoundTrip();
+    testMaxLength();
+    testFullFrame();
+    testOneOver();
+    testTimerFlush();
+    testOff();
+    testTxQueueFull();
+    testFlushWhileAdding();
+    testOverhead();
+    testBadFrame();
+
+    return hostResult("test_batch");
+}
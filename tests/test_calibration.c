@@ -0,0 +1,295 @@
+/*
+ *  test_calibration - pulse width calibration against a made up IR channel
+ *
+ *  The channel turns the bytes of a frame into the edges the TSOP would give PE0: every
+ *  UART bit is a pulse of the line, and the mark (low, carrier on) ends late by the
+ *  stretch, so the space after it comes out that much shorter. A negative stretch is a
+ *  mark that got shrunk. Each edge is fed to the real PortE_Handler with the virtual
+ *  time set to when it happened, plus some jitter. Then it checks the bias the receiver
+ *  measures (the CAL_RESULT frame it sends back) and that runCalibration walks the duty
+ *  cycle into tolerance when the stretch depends on it, like it does on the TSOP.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <string.h>
+#include "tm4c123gh6pm.h"
+#include "calibration.h"
+#include "ir_frame.h"
+#include "timestamp.h"
+#include "pwm.h"
+
+// in us at 1200 baud (the stub getUart7BaudRate)
+#define BIT 833
+#define PATTERN_LENGTH 32       // CAL_PATTERN_LENGTH in calibration.c
+#define TOLERANCE 26            // CAL_TOLERANCE_US
+
+// the edge interrupt isn't in calibration.h
+void PortE_Handler(void);
+
+static uint32_t t = 1000000;    // us
+static int32_t jitter = 0;      // each edge moves up to this many us either way
+static uint32_t edges = 0;
+static uint32_t seed = 3442;
+
+// the channel: mark stretch at 50% duty, and how much it changes per percent of duty
+static int32_t stretch_at_50 = 0;
+static int32_t stretch_per_duty = 0;
+static bool link_up = true;
+static uint8_t duty = PWM_DEFAULT_DUTY;
+static uint8_t rounds = 0;
+
+static IR_FRAME result;
+static uint8_t results = 0;
+
+static int32_t stretch()
+{
+    return stretch_at_50 + stretch_per_duty * ((int32_t)duty - 50);
+}
+
+static int32_t nextJitter()
+{
+    if (!jitter)
+        return 0;
+
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (int32_t)(seed % (2 * jitter + 1)) - jitter;
+}
+
+// PE0 goes to the given level at us, through the real edge interrupt
+static void edge(uint32_t us, bool high)
+{
+    GPIO_PORTE_DATA_R = high;
+    hostCycles = (us + nextJitter()) * TIMESTAMP_TICKS_PER_US;
+    PortE_Handler();
+}
+
+// the bytes as the 9 bit mode UART sends them: start, 8 data bits LSB first, the 9th
+// bit (0 for data) and stop, back to back
+static void channel(const uint8_t* data, uint8_t length, int32_t mark_stretch)
+{
+    bool level = true;
+    uint8_t i;
+    uint8_t bit;
+
+    for (i = 0; i < length; i++)
+    {
+        uint16_t bits = 0x400 | (data[i] << 1);     // stop, 9th, data, start
+
+        for (bit = 0; bit < 11; bit++)
+        {
+            bool high = (bits >> bit) & 1;
+
+            // the falling edge is on time, the rising one is late by the stretch
+            if (high != level)
+                edge(high ? t + mark_stretch : t, high);
+            level = high;
+            t += BIT;
+        }
+    }
+
+    // idle long enough that the next burst's first pulse is thrown out
+    t += 100 * BIT;
+}
+
+// csma.c, carrier sense sees every edge too
+void noteRxEdge()
+{
+    edges++;
+}
+
+// pwm.c
+void setPWMDutyCycle(uint8_t percent)
+{
+    duty = percent;
+}
+
+uint8_t getPWMDutyCycle()
+{
+    return duty;
+}
+
+// wait.c
+void waitMicrosecond(uint32_t us)
+{
+    (void)us;
+}
+
+// ir_frame.c, the other board is right here: the request arms its capture, the pattern
+// goes through the channel and its result comes back
+void sendIrFrame(uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    if (type == IR_FRAME_CAL_REQUEST)
+    {
+        rounds++;
+        armCalibrationCapture();
+    }
+    else if (type == IR_FRAME_CAL_PATTERN)
+    {
+        channel(payload, length, stretch());
+        finishCalibrationCapture();
+    }
+    else if (type == IR_FRAME_CAL_RESULT)
+    {
+        result.type = type;
+        result.length = length;
+        memcpy(result.payload, payload, length);
+        results++;
+
+        if (link_up)
+            handleCalibrationResult(&result);
+    }
+}
+
+// the result is sent from the events thread, here it never has to wait
+bool queueIrFrame(uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    sendIrFrame(type, payload, length);
+    return true;
+}
+
+static int16_t resultMarkBias()
+{
+    return (int16_t)(result.payload[0] | (result.payload[1] << 8));
+}
+
+static int16_t resultSpaceBias()
+{
+    return (int16_t)(result.payload[2] | (result.payload[3] << 8));
+}
+
+static uint16_t resultMarks()
+{
+    return result.payload[4] | (result.payload[5] << 8);
+}
+
+static bool near(int32_t value, int32_t expected, int32_t within)
+{
+    return value >= expected - within && value <= expected + within;
+}
+
+// the receiver alone: one pattern frame with a fixed stretch
+static void measure(int32_t mark_stretch)
+{
+    uint8_t pattern[PATTERN_LENGTH];
+
+    memset(pattern, 0x55, sizeof(pattern));
+    results = 0;
+    edges = 0;
+
+    armCalibrationCapture();
+    CHECK(isCalibrationCapturing());
+    channel(pattern, sizeof(pattern), mark_stretch);
+    finishCalibrationCapture();
+    CHECK(!isCalibrationCapturing());
+    CHECK(results == 1 && result.length == 6);
+}
+
+// 0x55 in 9 bit mode is 0 1010101 0 0 1: five marks a byte (the last one 2 bits long)
+// and five spaces. The very first edge is only the reference, and the idle before a
+// burst is too long to be a pulse
+static void testMeasure()
+{
+    static const int32_t stretches[] = { -300, -150, -60, -26, 0, 26, 60, 150, 300 };
+    uint8_t i;
+
+    for (i = 0; i < sizeof(stretches) / sizeof(stretches[0]); i++)
+    {
+        measure(stretches[i]);
+        CHECK(edges == 10 * PATTERN_LENGTH);
+        CHECK(resultMarks() == 5 * PATTERN_LENGTH);
+        CHECK(near(resultMarkBias(), stretches[i], 1));
+        CHECK(near(resultSpaceBias(), -stretches[i], 1));
+    }
+
+    // a second frame on its own doesn't carry anything over from the first
+    measure(40);
+    measure(40);
+    CHECK(resultMarks() == 5 * PATTERN_LENGTH);
+    CHECK(near(resultMarkBias(), 40, 1));
+}
+
+// edge jitter averages out over the 160 marks
+static void testJitter()
+{
+    jitter = 60;
+    measure(100);
+    CHECK(resultMarks() == 5 * PATTERN_LENGTH);
+    CHECK(near(resultMarkBias(), 100, 10));
+    CHECK(near(resultSpaceBias(), -100, 10));
+
+    measure(-100);
+    CHECK(near(resultMarkBias(), -100, 10));
+    CHECK(near(resultSpaceBias(), 100, 10));
+    jitter = 0;
+}
+
+// edges that aren't armed only go to carrier sense, and nothing is sent without a capture
+static void testNotArmed()
+{
+    static const uint8_t text[] = "hello";
+
+    results = 0;
+    edges = 0;
+    channel(text, sizeof(text) - 1, 50);
+    finishCalibrationCapture();
+    CHECK(edges > 0);
+    CHECK(results == 0);
+    CHECK(!isCalibrationCapturing());
+}
+
+// the whole handshake, starting from the default duty
+static bool calibrate(int32_t at_50, int32_t per_duty)
+{
+    stretch_at_50 = at_50;
+    stretch_per_duty = per_duty;
+    duty = PWM_DEFAULT_DUTY;
+    rounds = 0;
+
+    return runCalibration();
+}
+
+// more duty stretches the marks, so it has to go down for a stretched channel and up for
+// a shrunk one, and stop as soon as the mark is within one carrier period
+static void testClosedLoop()
+{
+    CHECK(calibrate(0, 4));
+    CHECK(rounds == 1 && duty == PWM_DEFAULT_DUTY);
+
+    CHECK(calibrate(90, 4));
+    CHECK(duty < PWM_DEFAULT_DUTY);
+    CHECK(near(stretch(), 0, TOLERANCE));
+    CHECK(near(resultMarkBias(), stretch(), 1));
+    CHECK(rounds == 5);
+
+    CHECK(calibrate(-50, 4));
+    CHECK(duty > PWM_DEFAULT_DUTY);
+    CHECK(near(stretch(), 0, TOLERANCE));
+
+    // still out after every round, it gives up with the duty moved the right way
+    CHECK(!calibrate(300, 4));
+    CHECK(rounds == 6);
+    CHECK(duty < PWM_DEFAULT_DUTY);
+
+    // the result never makes it back
+    link_up = false;
+    CHECK(!calibrate(0, 4));
+    CHECK(rounds == 1);
+    link_up = true;
+}
+
+int main()
+{
+    hostCyclesPerRead = 0;      // the edge time is exactly what the channel says
+
+    initCalibration();
+
+    testMeasure();
+    testJitter();
+    testNotArmed();
+    testClosedLoop();
+
+    return hostResult("test_calibration");
+}
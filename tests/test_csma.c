@@ -0,0 +1,309 @@
+/*
+ *  test_csma - backoff window growth and the echo mismatch collision path
+ *
+ *  UART7 and the echo filter are faked in here: every attempt that goes out gets its
+ *  backoff slots recorded, and the test decides which attempts "collide" by bumping
+ *  the echo mismatch count when the last byte is written, which is what isEcho does
+ *  when somebody else talked over us.
+ *
+ *  The events thread's replies are checked by having it cut in while the shell is in
+ *  the middle of a send: they have to be queued instead of waiting, and go out after
+ *  it in the order they came.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <string.h>
+#include "csma.h"
+#include "echo.h"
+#include "ir_channel.h"
+#include "scheduler.h"
+#include "stubs.h"
+
+#define ATTEMPTS 6      // first try + CSMA_MAX_RETRIES
+#define FRAMES 300
+
+static const uint8_t windows[ATTEMPTS] = { 8, 16, 32, 64, 128, 128 };
+static const uint8_t frame[] = { 1, 'h', 'i', 0 };
+
+static ECHO_STATS echo_stats;
+static bool echo_seen = true;
+static int8_t node = IR_NODE_NONE;
+
+static uint8_t sent_bytes = 0;      // bytes of the current attempt
+static uint8_t attempt = 0;
+static uint8_t collide = 0;         // this many attempts in a row collide
+static uint32_t addresses = 0;
+static uint32_t slots_before = 0;
+static uint32_t max_slots[ATTEMPTS];
+
+// first byte of every attempt that went out, and replies the events thread sends
+// while the shell is on its first byte
+static uint8_t sent_log[16];
+static uint8_t sent_log_count = 0;
+static uint8_t cut_in_replies = 0;
+static uint8_t cut_in_queued = 0;
+static uint8_t reply[sizeof(frame)] = { 2, 'o', 'k', 0 };
+
+static void eventsCutIn()
+{
+    while (cut_in_replies)
+    {
+        cut_in_replies--;
+        if (queueIrWire(0xFF, reply, sizeof(reply)))
+            cut_in_queued++;
+        reply[0]++;
+    }
+}
+
+// uart7.c, each attempt writes the whole frame
+void putcUart7(char c)
+{
+
+    if (sent_bytes == 0)
+    {
+        uint32_t slots = getCsmaStats()->backoff_slots - slots_before;
+
+        if (attempt < ATTEMPTS && slots > max_slots[attempt])
+            max_slots[attempt] = slots;
+        slots_before = getCsmaStats()->backoff_slots;
+
+        if (sent_log_count < sizeof(sent_log))
+            sent_log[sent_log_count++] = c;
+    }
+
+    if (sent_bytes == 1)
+        eventsCutIn();
+
+    if (++sent_bytes == sizeof(frame))
+    {
+        if (attempt < collide)
+            echo_stats.mismatches++;
+        sent_bytes = 0;
+        attempt++;
+    }
+}
+
+void putAddressUart7(uint8_t address)
+{
+    (void)address;
+    addresses++;
+}
+
+// echo.c
+ECHO_STATS* getEchoStats()
+{
+    return &echo_stats;
+}
+
+bool isEchoSeen()
+{
+    return echo_seen;
+}
+
+// ir_channel.c
+int8_t getIrNode()
+{
+    return node;
+}
+
+static void sendFrame(uint8_t collisions)
+{
+    attempt = 0;
+    collide = collisions;
+    slots_before = getCsmaStats()->backoff_slots;
+    transmitIrWire(0xFF, frame, sizeof(frame));
+}
+
+static void clearStats()
+{
+    memset(getCsmaStats(), 0, sizeof(CSMA_STATS));
+    memset(&echo_stats, 0, sizeof(echo_stats));
+}
+
+static void testNoCollision()
+{
+    clearStats();
+    sendFrame(0);
+
+    CHECK(getCsmaStats()->frames == 1);
+    CHECK(getCsmaStats()->attempts == 1);
+    CHECK(getCsmaStats()->collisions == 0);
+    CHECK(attempt == 1);
+}
+
+// a mismatch in the echo means a collision, it goes again with a bigger window
+static void testRetry()
+{
+    clearStats();
+    sendFrame(2);
+
+    CHECK(getCsmaStats()->attempts == 3);
+    CHECK(getCsmaStats()->collisions == 2);
+    CHECK(getCsmaStats()->dropped == 0);
+    CHECK(attempt == 3);
+}
+
+static void testDropped()
+{
+    clearStats();
+    sendFrame(ATTEMPTS + 1);
+
+    CHECK(getCsmaStats()->attempts == ATTEMPTS);
+    CHECK(getCsmaStats()->collisions == ATTEMPTS);
+    CHECK(getCsmaStats()->dropped == 1);
+}
+
+// the window doubles every retry up to CSMA_MAX_WINDOW, the slots are picked from 0 to
+// window - 1, so over a lot of frames the biggest pick is close to the window
+static void testWindowGrowth()
+{
+    uint16_t i;
+    uint8_t a;
+
+    memset(max_slots, 0, sizeof(max_slots));
+
+    for (i = 0; i < FRAMES; i++)
+        sendFrame(ATTEMPTS);
+
+    for (a = 0; a < ATTEMPTS; a++)
+    {
+        CHECK(max_slots[a] < windows[a]);
+        CHECK(max_slots[a] >= windows[a] * 3 / 4);
+    }
+}
+
+// without an echo there is nothing to compare, so it can't see a collision
+static void testNoEcho()
+{
+    clearStats();
+    echo_seen = false;
+    sendFrame(1);
+    echo_seen = true;
+
+    CHECK(getCsmaStats()->attempts == 1);
+    CHECK(getCsmaStats()->collisions == 0);
+}
+
+static void testAddressed()
+{
+    clearStats();
+    node = 2;
+    addresses = 0;
+    sendFrame(1);
+    node = IR_NODE_NONE;
+
+    CHECK(getCsmaStats()->attempts == 2);
+    CHECK(addresses == 2);  // every attempt starts with the address byte
+}
+
+// an edge just now makes the medium busy for a couple of bytes, then it goes
+static void testDeferral()
+{
+    clearStats();
+    noteRxEdge();
+    CHECK(isMediumBusy());
+    sendFrame(0);
+
+    CHECK(getCsmaStats()->deferrals == 1);
+    CHECK(getCsmaStats()->forced == 0);
+    CHECK(getCsmaStats()->attempts == 1);
+    CHECK(!isMediumBusy());
+}
+
+// the transmitter is free, so a reply goes right out from the events thread
+static void testReplyNow()
+{
+    clearStats();
+    sent_log_count = 0;
+    reply[0] = 2;
+
+    CHECK(queueIrWire(0xFF, reply, sizeof(reply)));
+    CHECK(getCsmaStats()->queued == 0);
+    CHECK(sent_log_count == 1 && sent_log[0] == 2);
+}
+
+// the shell is sending, so the replies wait in the queue and the events thread gets
+// EVENT_TX once the shell lets go. One more than fits is dropped, and whoever asked
+// for room gets its event when the queue starts going out
+static void testReplyQueued()
+{
+    uint8_t i;
+
+    clearStats();
+    sent_log_count = 0;
+    cut_in_queued = 0;
+    cut_in_replies = 5;
+    reply[0] = 2;
+    stubEvents = 0;
+
+    sendFrame(0);
+    CHECK(cut_in_queued == 4);
+    CHECK(getCsmaStats()->queued == 4);
+    CHECK(getCsmaStats()->queue_full == 1);
+    CHECK(sent_log_count == 1 && sent_log[0] == 1);
+    CHECK(stubEvents & EVENT_TX);
+
+    notifyIrTxRoom(EVENT_MESH);
+    CHECK(!(stubEvents & EVENT_MESH));
+
+    stubEvents = 0;
+    pollIrTx();
+    CHECK(stubEvents == EVENT_MESH);
+    CHECK(sent_log_count == 5);
+    for (i = 0; i < 4; i++)
+        CHECK(sent_log[1 + i] == 2 + i);
+
+    // nothing left to send
+    stubEvents = 0;
+    pollIrTx();
+    CHECK(sent_log_count == 5);
+    CHECK(stubEvents == 0);
+}
+
+// the shell's next send takes whatever got queued along first, so it stays in order
+static void testReplyOrder()
+{
+    clearStats();
+    sent_log_count = 0;
+    cut_in_replies = 1;
+    reply[0] = 2;
+
+    sendFrame(0);
+    CHECK(sent_log_count == 1);
+    sendFrame(0);
+    CHECK(sent_log_count == 3);
+    CHECK(sent_log[0] == 1 && sent_log[1] == 2 && sent_log[2] == 1);
+}
+
+static void testOff()
+{
+    clearStats();
+    setCsma(false);
+    sendFrame(3);
+    setCsma(true);
+
+    CHECK(getCsmaStats()->frames == 0);
+    CHECK(attempt == 1);    // straight out, no retries
+}
+
+int main()
+{
+    // a slot is a byte time (9163 us at 1200 baud), so let time go by quicker
+    hostCyclesPerRead = 50000;
+    hostCycles = 100000000;
+
+    testNoCollision();
+    testRetry();
+    testDropped();
+    testWindowGrowth();
+    testNoEcho();
+    testAddressed();
+    testDeferral();
+    testReplyNow();
+    testReplyQueued();
+    testReplyOrder();
+    testOff();
+
+    return hostResult("test_csma");
+}
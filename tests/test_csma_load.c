@@ -0,0 +1,339 @@
+/*
+ *  test_csma_load - several boards on one IR channel, throughput and collisions vs load
+ *
+ *  Every node runs the real transmitIrWire on its own stack (ucontext), and they all
+ *  share one channel in virtual time that moves a bit time at a time. A node only gets
+ *  to run again on its next getUptimeUs read or when the byte it put in UART7 is done,
+ *  so the busy waits in csma.c cost virtual time like they do on the board. Whenever
+ *  anybody is sending, every node sees edges (noteRxEdge), and when two nodes are on
+ *  the air at the same time both of their attempts count as collided and their echo
+ *  filter sees a mismatch. An attempt that finishes without overlapping anyone made it.
+ *
+ *  Frames show up at every node at random (Poisson) and queue up, and the offered load
+ *  G (frame times offered per frame time) is swept. For each load it prints the
+ *  throughput S (frame times delivered per frame time) and the collision rate, with
+ *  csma on and with it off (straight out, which is pure ALOHA).
+ *
+ *  The nodes share csma.c's statics: the stats add up over all of them, which is what
+ *  this wants, the random seed is one sequence they all draw from in turn, and the last
+ *  edge time is the same for everybody anyways since they all hear the same channel.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <ucontext.h>
+#include "csma.h"
+#include "echo.h"
+#include "ir_channel.h"
+#include "kernel.h"
+
+// in us at 1200 baud (the stub getUart7BaudRate), csma.c counts 11 bits a byte
+#define BIT 833
+#define BYTE (11 * BIT)
+
+#define NODES_MAX 8
+#define FRAME_LENGTH 16
+#define FRAME_US (FRAME_LENGTH * BYTE)
+#define QUEUE_MAX 4             // frames a node holds before it drops new ones
+#define SIM_US 200000000ULL     // 200 s of channel time for each load
+#define STACK_SIZE 65536
+
+typedef struct _NODE
+{
+    ucontext_t context;
+    uint8_t stack[STACK_SIZE];
+    ECHO_STATS echo;
+    uint64_t next_arrival;
+    uint64_t on_air_until;      // end of the byte it is sending
+    uint16_t queued;
+    uint8_t sent;               // bytes of this attempt
+    bool collided;
+    uint32_t delivered;
+}
+NODE;
+
+typedef struct _RESULT
+{
+    double offered;             // G
+    double throughput;          // S
+    double collision_rate;      // collided attempts / attempts
+    uint32_t dropped;           // csma gave up after every retry
+}
+RESULT;
+
+static const uint8_t frame[FRAME_LENGTH] = { 1, 'l', 'o', 'a', 'd', 't', 'e', 's', 't', 0 };
+
+static NODE nodes[NODES_MAX];
+static uint8_t node_count;
+static NODE* current = 0;       // 0 = the channel, not a node
+static ucontext_t channel;
+static uint64_t now = 0;        // us
+static double rate;             // frames per us at each node
+static uint32_t arrivals;
+static uint32_t seed = 3442;
+
+static double nextUniform()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed + 1.0) / 4294967297.0;
+}
+
+// back to the channel until the next bit time
+static void yield()
+{
+    swapcontext(&current->context, &channel);
+}
+
+// timestamp.c, reading the time is where a node lets the others run
+uint64_t getUptimeUs()
+{
+    if (current)
+        yield();
+    return now;
+}
+
+// uart7.c, the byte is on the air for a byte time and the node waits it out like
+// putcUart7 waits on a full FIFO
+void putcUart7(char c)
+{
+    NODE* node = current;
+    (void)c;
+
+    if (node->sent == 0)
+        node->collided = false;
+
+    node->on_air_until = now + BYTE;
+    while (now < node->on_air_until)
+        yield();
+
+    if (++node->sent == FRAME_LENGTH)
+    {
+        if (!node->collided)
+            node->delivered++;
+        node->sent = 0;
+    }
+}
+
+void putAddressUart7(uint8_t address)
+{
+    (void)address;
+}
+
+// echo.c, every node has its own echo filter
+ECHO_STATS* getEchoStats()
+{
+    return &current->echo;
+}
+
+bool isEchoSeen()
+{
+    return true;
+}
+
+// ir_channel.c
+int8_t getIrNode()
+{
+    return IR_NODE_NONE;
+}
+
+// kernel.c, every node is its own board with its own lock
+void waitSemaphore(SEMAPHORE* semaphore)
+{
+    (void)semaphore;
+}
+
+void postSemaphore(SEMAPHORE* semaphore)
+{
+    (void)semaphore;
+}
+
+static void nodeMain()
+{
+    NODE* node = current;
+
+    while (true)
+    {
+        while (!node->queued)
+            yield();
+
+        transmitIrWire(IR_FRAME_BROADCAST, frame, FRAME_LENGTH);
+        node->queued--;
+    }
+}
+
+// one bit time of the channel: new frames, who is on the air, then every node that has
+// something to do runs until it waits again
+static void step()
+{
+    uint8_t on_air = 0;
+    uint8_t i;
+
+    for (i = 0; i < node_count; i++)
+    {
+        NODE* node = &nodes[i];
+
+        while (node->next_arrival <= now)
+        {
+            arrivals++;
+            if (node->queued < QUEUE_MAX)
+                node->queued++;
+            node->next_arrival += (uint64_t)(-log(nextUniform()) / rate) + 1;
+        }
+
+        if (now < node->on_air_until)
+            on_air++;
+    }
+
+    if (on_air)
+        noteRxEdge();
+
+    for (i = 0; i < node_count && on_air > 1; i++)
+    {
+        NODE* node = &nodes[i];
+
+        if (now < node->on_air_until && !node->collided)
+        {
+            node->collided = true;
+            node->echo.mismatches++;
+        }
+    }
+
+    for (i = 0; i < node_count; i++)
+    {
+        NODE* node = &nodes[i];
+
+        if (node->queued || node->sent || now < node->on_air_until)
+        {
+            current = node;
+            swapcontext(&channel, &node->context);
+            current = 0;
+        }
+    }
+
+    now += BIT;
+}
+
+// offered load G in frame times per frame time, over all the nodes
+static RESULT run(uint8_t count, double offered, bool csma)
+{
+    RESULT result;
+    uint32_t delivered = 0;
+    uint8_t i;
+
+    node_count = count;
+    rate = offered / FRAME_US / count;
+    arrivals = 0;
+    now = 1000000;
+    memset(getCsmaStats(), 0, sizeof(CSMA_STATS));
+    setCsma(csma);
+
+    for (i = 0; i < count; i++)
+    {
+        NODE* node = &nodes[i];
+
+        memset(&node->echo, 0, sizeof(node->echo));
+        node->next_arrival = now + (uint64_t)(-log(nextUniform()) / rate);
+        node->on_air_until = 0;
+        node->queued = 0;
+        node->sent = 0;
+        node->collided = false;
+        node->delivered = 0;
+
+        getcontext(&node->context);
+        node->context.uc_stack.ss_sp = node->stack;
+        node->context.uc_stack.ss_size = STACK_SIZE;
+        node->context.uc_link = 0;
+        makecontext(&node->context, nodeMain, 0);
+    }
+
+    // start every node so it is parked waiting for its first frame
+    for (i = 0; i < count; i++)
+    {
+        current = &nodes[i];
+        swapcontext(&channel, &nodes[i].context);
+        current = 0;
+    }
+
+    while (now < 1000000 + SIM_US)
+        step();
+
+    for (i = 0; i < count; i++)
+        delivered += nodes[i].delivered;
+
+    result.offered = (double)arrivals * FRAME_US / SIM_US;
+    result.throughput = (double)delivered * FRAME_US / SIM_US;
+    result.dropped = getCsmaStats()->dropped;
+
+    // with csma off the stats aren't kept, so count the attempts here
+    if (csma)
+        result.collision_rate = getCsmaStats()->attempts ?
+            (double)getCsmaStats()->collisions / getCsmaStats()->attempts : 0;
+    else
+    {
+        uint32_t collisions = 0;
+        for (i = 0; i < count; i++)
+            collisions += nodes[i].echo.mismatches;
+        result.collision_rate = delivered + collisions ? (double)collisions / (delivered + collisions) : 0;
+    }
+
+    setCsma(true);
+    return result;
+}
+
+// the lighter loads should all get through, and past saturation csma has to hold the
+// throughput up where ALOHA falls off
+static void testLoadSweep()
+{
+    static const double loads[] = { 0.05, 0.1, 0.2, 0.4, 0.8, 1.6, 3.2 };
+    uint8_t i;
+
+    printf("  %u nodes, %u byte frames at 1200 baud\n", 4, FRAME_LENGTH);
+    printf("      G   csma S  collided  dropped   aloha S  collided\n");
+
+    for (i = 0; i < sizeof(loads) / sizeof(loads[0]); i++)
+    {
+        RESULT csma = run(4, loads[i], true);
+        RESULT aloha = run(4, loads[i], false);
+
+        printf("  %5.2f   %6.3f  %7.1f%%  %7u   %7.3f  %7.1f%%\n", csma.offered, csma.throughput,
+               100 * csma.collision_rate, csma.dropped, aloha.throughput, 100 * aloha.collision_rate);
+
+        if (loads[i] <= 0.2)
+        {
+            CHECK(csma.throughput > 0.9 * csma.offered);
+            CHECK(csma.collision_rate < 0.05);
+            CHECK(csma.dropped == 0);
+        }
+        if (loads[i] >= 0.8)
+        {
+            CHECK(csma.throughput > 0.5);
+            CHECK(csma.throughput > 1.5 * aloha.throughput);
+            CHECK(csma.collision_rate < aloha.collision_rate);
+        }
+    }
+}
+
+// twice the nodes saturating the channel collide more since more of them pick the same
+// slot, but the window growth keeps it from falling off
+static void testManyNodes()
+{
+    RESULT result = run(NODES_MAX, 3.2, true);
+
+    printf("  %u nodes at G %.2f: S %.3f, %.1f%% collided, %u dropped\n", NODES_MAX,
+           result.offered, result.throughput, 100 * result.collision_rate, result.dropped);
+    CHECK(result.throughput > 0.5);
+    CHECK(result.collision_rate < 0.5);
+}
+
+int main()
+{
+    testLoadSweep();
+    testManyNodes();
+
+    return hostResult("test_csma_load");
+}
@@ -0,0 +1,172 @@
+/*
+ *  test_diversity - the receiver diversity combiner with made up errors
+ *
+ *  diversity.c doesn't touch hardware, so the copies are built with encodeIrFrame and
+ *  then broken on purpose: a good copy has to go through right away and only once, 3
+ *  broken copies have to be voted back together, and a window where nothing is good
+ *  has to count as lost once it runs out.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <string.h>
+#include "diversity.h"
+#include "ir_frame.h"
+
+#define WINDOW_MS 10
+
+static uint8_t wire[IR_FRAME_MAX_WIRE];
+static uint8_t wire_length;
+static const char text[] = "diversity test frame";
+
+// the receive buffer only has the COBS part, without the SOH and the 0 at the end
+#define RAW (wire + 1)
+#define RAW_LENGTH (wire_length - 2)
+
+static void makeFrame()
+{
+    wire_length = encodeIrFrame(IR_FRAME_TEXT, (const uint8_t*)text, sizeof(text), wire);
+}
+
+// a copy of the frame with one byte changed (never to 0, that would end the frame)
+static void breakCopy(uint8_t* copy, uint8_t at)
+{
+    memcpy(copy, RAW, RAW_LENGTH);
+    copy[at] = (copy[at] == 0x55) ? 0xAA : 0x55;
+}
+
+static bool isTheFrame(IR_FRAME* frame)
+{
+    return frame->type == IR_FRAME_TEXT && frame->length == sizeof(text) &&
+           memcmp(frame->payload, text, sizeof(text)) == 0;
+}
+
+static void testFirstGoodCopyWins()
+{
+    DIVERSITY d;
+    IR_FRAME frame;
+
+    initDiversity(&d, 2, WINDOW_MS);
+
+    CHECK(submitDiversityCopy(&d, 0, RAW, RAW_LENGTH, 100, &frame));
+    CHECK(isTheFrame(&frame));
+    CHECK(!submitDiversityCopy(&d, 1, RAW, RAW_LENGTH, 101, &frame));
+
+    CHECK(d.delivered_frames == 1);
+    CHECK(d.duplicates == 1);
+    CHECK(d.stats[0].good == 1 && d.stats[1].good == 1);
+    CHECK(!d.window_open);
+
+    // a late copy of the same frame right after the window closed isn't new either
+    CHECK(!submitDiversityCopy(&d, 1, RAW, RAW_LENGTH, 100 + WINDOW_MS + 1, &frame));
+    CHECK(d.delivered_frames == 1);
+}
+
+static void testBadThenGood()
+{
+    DIVERSITY d;
+    IR_FRAME frame;
+    uint8_t bad[IR_FRAME_MAX_ENCODED];
+
+    initDiversity(&d, 2, WINDOW_MS);
+    breakCopy(bad, 5);
+
+    CHECK(!submitDiversityCopy(&d, 0, bad, RAW_LENGTH, 100, &frame));
+    CHECK(submitDiversityCopy(&d, 1, RAW, RAW_LENGTH, 102, &frame));
+    CHECK(isTheFrame(&frame));
+    CHECK(d.stats[0].bad == 1);
+    CHECK(d.delivered_frames == 1);
+    CHECK(d.lost_frames == 0);
+}
+
+// every copy is broken in a different spot, so none pass the crc but the vote does
+static void testVote()
+{
+    DIVERSITY d;
+    IR_FRAME frame;
+    uint8_t copies[3][IR_FRAME_MAX_ENCODED];
+
+    initDiversity(&d, 3, WINDOW_MS);
+    breakCopy(copies[0], 2);
+    breakCopy(copies[1], 9);
+    breakCopy(copies[2], RAW_LENGTH - 1);
+
+    CHECK(!submitDiversityCopy(&d, 0, copies[0], RAW_LENGTH, 100, &frame));
+    CHECK(!submitDiversityCopy(&d, 1, copies[1], RAW_LENGTH, 101, &frame));
+    CHECK(submitDiversityCopy(&d, 2, copies[2], RAW_LENGTH, 101, &frame));
+    CHECK(isTheFrame(&frame));
+    CHECK(d.voted_frames == 1);
+    CHECK(d.stats[0].bad == 1 && d.stats[1].bad == 1 && d.stats[2].bad == 1);
+}
+
+// two copies broken in the same spot outvote the good byte, and a length nobody
+// agrees on can't be voted on at all
+static void testVoteFails()
+{
+    DIVERSITY d;
+    IR_FRAME frame;
+    uint8_t copies[3][IR_FRAME_MAX_ENCODED];
+
+    initDiversity(&d, 3, WINDOW_MS);
+    breakCopy(copies[0], 4);
+    breakCopy(copies[1], 4);
+    breakCopy(copies[2], 8);
+
+    CHECK(!submitDiversityCopy(&d, 0, copies[0], RAW_LENGTH, 100, &frame));
+    CHECK(!submitDiversityCopy(&d, 1, copies[1], RAW_LENGTH, 100, &frame));
+    CHECK(!submitDiversityCopy(&d, 2, copies[2], RAW_LENGTH, 100, &frame));
+    CHECK(d.lost_frames == 1);
+
+    CHECK(!submitDiversityCopy(&d, 0, copies[0], RAW_LENGTH, 200, &frame));
+    CHECK(!submitDiversityCopy(&d, 1, copies[1], RAW_LENGTH - 1, 200, &frame));
+    CHECK(!submitDiversityCopy(&d, 2, copies[2], RAW_LENGTH - 2, 200, &frame));
+    CHECK(d.lost_frames == 2);
+    CHECK(d.voted_frames == 0);
+}
+
+// nothing good came in and one receiver never saw it, the window has to run out
+static void testTimeout()
+{
+    DIVERSITY d;
+    IR_FRAME frame;
+    uint8_t bad[IR_FRAME_MAX_ENCODED];
+
+    initDiversity(&d, 2, WINDOW_MS);
+    breakCopy(bad, 3);
+
+    CHECK(!submitDiversityCopy(&d, 0, bad, RAW_LENGTH, 100, &frame));
+    CHECK(!pollDiversity(&d, 100 + WINDOW_MS, &frame));
+    CHECK(d.window_open);
+    CHECK(!pollDiversity(&d, 100 + WINDOW_MS + 1, &frame));
+    CHECK(!d.window_open);
+    CHECK(d.lost_frames == 1);
+    CHECK(d.stats[1].missing == 1);
+}
+
+// a receiver that isn't used (or diversity off) ignores copies
+static void testOff()
+{
+    DIVERSITY d;
+    IR_FRAME frame;
+
+    initDiversity(&d, 2, WINDOW_MS);
+    CHECK(!submitDiversityCopy(&d, 2, RAW, RAW_LENGTH, 100, &frame));
+
+    initDiversity(&d, 0, WINDOW_MS);
+    CHECK(!submitDiversityCopy(&d, 0, RAW, RAW_LENGTH, 100, &frame));
+    CHECK(d.delivered_frames == 0);
+}
+
+int main()
+{
+    makeFrame();
+
+    testFirstGoodCopyWins();
+    testBadThenGood();
+    testVote();
+    testVoteFails();
+    testTimeout();
+    testOff();
+
+    return hostResult("test_diversity");
+}
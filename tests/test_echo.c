@@ -0,0 +1,482 @@
+/*
+ *  test_echo - UART7 self echo suppression with made up TX / RX timing
+ *
+ *  The bytes "sent" with noteEchoTx and "received" with isEcho are timed by setting
+ *  the virtual time (in us, like getUptimeUs), so it checks exactly which received bytes get dropped as
+ *  our own echo, which ones count as a mismatch (and are only dropped in half duplex),
+ *  and which sent bytes expire without an echo.
+ *
+ *  Then two boards talk full duplex at the same time. echo.c is built into the test so
+ *  each board gets its own copy of its statics, and a made up channel hands every board
+ *  its own reflections (late by a varying amount, some garbled, some missing) mixed in
+ *  with the other board's bytes. None of the other board's bytes can be thrown away,
+ *  even the ones that come in while we are still waiting for our own echo, and none of
+ *  our own can get through.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "echo.c"
+
+// in us at 1200 baud (the stub getUart7BaudRate)
+#define BIT 833
+#define BYTE (11 * BIT)
+#define LATE (48 * BIT)
+
+#define NODES 2
+#define SIM_US 30000000         // 30 s of both boards sending
+#define BURST_MAX 16            // a FIFO worth
+#define LINE_MAX 8192
+
+#define FROM_PEER 0
+#define FROM_ECHO 1             // our own reflection, as sent
+#define FROM_GARBLED 2          // our own reflection, bits flipped
+
+static uint32_t t = 1000000;
+
+static void at(uint32_t us)
+{
+    hostCycles = us * TIMESTAMP_TICKS_PER_US;
+}
+
+static uint32_t now()
+{
+    return hostCycles / TIMESTAMP_TICKS_PER_US;
+}
+
+// sends bytes back to back like putcUart7 filling the FIFO, returns when the last is done
+static uint32_t send(const char* bytes)
+{
+    uint32_t done = t;
+
+    at(t);
+    UART7_FR_R = 0;     // the first one starts right away
+    while (*bytes)
+    {
+        noteEchoTx(*bytes++);
+        UART7_FR_R = UART_FR_BUSY;
+        done += BYTE;
+    }
+    UART7_FR_R = 0;
+
+    return done;
+}
+
+static void reset(uint8_t mode)
+{
+    ECHO_STATS* stats = getEchoStats();
+
+    // flush whatever is still waiting for an echo
+    t += 10 * LATE;
+    at(t);
+    isEcho(0);
+
+    setDuplexMode(mode);
+    stats->echoes = stats->mismatches = stats->expired = stats->turnarounds = 0;
+}
+
+static void testEchoDropped()
+{
+    uint32_t done;
+
+    reset(DUPLEX_AUTO);
+    CHECK(!isHalfDuplex());
+
+    done = send("AB");
+    CHECK(done == t + 2 * BYTE);
+
+    // the TSOP and the RX FIFO time out make it come in a bit after the stop bit
+    at(t + BYTE + 5 * BIT);
+    CHECK(isEcho('A'));
+    at(done + 32 * BIT);
+    CHECK(isEcho('B'));
+
+    CHECK(getEchoStats()->echoes == 2);
+    CHECK(getEchoStats()->mismatches == 0);
+    CHECK(isEchoSeen());
+    CHECK(isHalfDuplex());  // auto switches once an echo shows up
+}
+
+// a different byte where our echo should be is probably the other board on top of it
+static void testMismatch()
+{
+    reset(DUPLEX_FULL);
+    send("C");
+
+    at(t + BYTE);
+    CHECK(!isEcho('X'));    // full duplex: it could be real, so it is kept
+    CHECK(getEchoStats()->mismatches == 1);
+
+    reset(DUPLEX_HALF);
+    send("C");
+
+    at(t + BYTE);
+    CHECK(isEcho('X'));     // half duplex: nobody else is talking, so it's a garbled echo
+    CHECK(getEchoStats()->mismatches == 1);
+    CHECK(getEchoStats()->echoes == 0);
+}
+
+// bytes outside the window are the other board's, not an echo
+static void testOutsideWindow()
+{
+    reset(DUPLEX_FULL);
+    send("DE");
+
+    // more than a byte time before D could even be done
+    at(t - 2 * BIT);
+    CHECK(!isEcho('D'));
+    CHECK(getEchoStats()->echoes == 0);
+    CHECK(getEchoStats()->mismatches == 0);
+
+    // long after both were due, they expire and the byte is just received
+    at(t + 2 * BYTE + LATE + 1);
+    CHECK(!isEcho('E'));
+    CHECK(getEchoStats()->expired == 2);
+    CHECK(getEchoStats()->echoes == 0);
+}
+
+// the echo of the first byte went missing, the second one still matches
+static void testLostEcho()
+{
+    reset(DUPLEX_FULL);
+    send("FG");
+
+    at(t + BYTE + LATE + 1);
+    CHECK(isEcho('G'));
+    CHECK(getEchoStats()->expired == 1);
+    CHECK(getEchoStats()->echoes == 1);
+}
+
+static void testTurnaround()
+{
+    uint32_t per_read = hostCyclesPerRead;
+
+    // full duplex never waits
+    reset(DUPLEX_FULL);
+    at(t);
+    isEcho('x');
+    waitForTurnaround();
+    CHECK(getEchoStats()->turnarounds == 0);
+
+    // half duplex right after the other board sent something waits 4 quiet bytes
+    reset(DUPLEX_HALF);
+    at(t);
+    isEcho('x');
+    hostCyclesPerRead = BIT * TIMESTAMP_TICKS_PER_US;
+    waitForTurnaround();
+    CHECK(getEchoStats()->turnarounds == 1);
+    CHECK(now() - t >= 4 * BYTE);
+    CHECK(now() - t < 4 * BYTE + 4 * BIT);
+
+    // and not at all when it has been quiet long enough
+    at(t + 4 * BYTE + 1);
+    waitForTurnaround();
+    CHECK(getEchoStats()->turnarounds == 1);
+
+    hostCyclesPerRead = per_read;
+}
+
+// echo.c's statics for one board
+typedef struct _NODE_STATE
+{
+    ECHO_ENTRY entries[ECHO_RING_SIZE];
+    uint8_t head;
+    uint8_t tail;
+    uint32_t busy_until;
+    uint32_t last_rx;
+    uint8_t mode;
+    bool echo_seen;
+    ECHO_STATS stats;
+}
+NODE_STATE;
+
+// a byte on the air, end is when its stop bit is done
+typedef struct _BYTE_ON_AIR
+{
+    uint32_t end;
+    uint8_t c;
+    uint8_t from;
+}
+BYTE_ON_AIR;
+
+typedef struct _BURST
+{
+    uint32_t start;
+    uint8_t length;
+    uint8_t bytes[BURST_MAX];
+}
+BURST;
+
+typedef struct _NODE
+{
+    NODE_STATE state;
+    BURST bursts[LINE_MAX / 4];
+    uint16_t burst_count;
+    BYTE_ON_AIR sent[LINE_MAX];     // what it put on the air
+    uint16_t sent_count;
+    BYTE_ON_AIR rx[LINE_MAX];       // what its UART gets, end is when the ISR sees it
+    uint16_t rx_count;
+}
+NODE;
+
+static NODE nodes[NODES];
+static int8_t current = -1;
+static uint32_t seed = 3442;
+
+static uint32_t nextRandom(uint32_t range)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % range;
+}
+
+static void copyState(NODE_STATE* state, bool save)
+{
+#define SWAP(x) (save ? memcpy(&state->x, (void*)&x, sizeof(x)) : memcpy((void*)&x, &state->x, sizeof(x)))
+    SWAP(entries);
+    SWAP(head);
+    SWAP(tail);
+    SWAP(busy_until);
+    SWAP(last_rx);
+    SWAP(mode);
+    SWAP(echo_seen);
+    SWAP(stats);
+#undef SWAP
+}
+
+// echo.c's statics become this board's
+static void use(uint8_t node)
+{
+    if (current == node)
+        return;
+
+    if (current >= 0)
+        copyState(&nodes[current].state, true);
+    copyState(&nodes[node].state, false);
+    current = node;
+}
+
+// both boards send bursts of up to a FIFO at random, without waiting for each other. A
+// sends capitals and B small letters, so a byte of the other board can never be taken
+// for one of ours that happens to be the same
+static void makeBursts(uint8_t node, uint32_t start)
+{
+    NODE* n = &nodes[node];
+    uint32_t at_us = start + nextRandom(20 * BYTE);
+    uint8_t i;
+
+    n->burst_count = 0;
+    n->sent_count = 0;
+
+    while (at_us < start + SIM_US)
+    {
+        BURST* burst = &n->bursts[n->burst_count++];
+
+        burst->start = at_us;
+        burst->length = 1 + nextRandom(BURST_MAX);
+        for (i = 0; i < burst->length; i++)
+        {
+            burst->bytes[i] = (node ? 'a' : 'A') + nextRandom(26);
+            n->sent[n->sent_count].end = at_us + (i + 1) * BYTE;
+            n->sent[n->sent_count].c = burst->bytes[i];
+            n->sent[n->sent_count].from = FROM_PEER;
+            n->sent_count++;
+        }
+
+        at_us += burst->length * BYTE + nextRandom(30 * BYTE);
+    }
+}
+
+// what one board's TSOP gives its UART: its own reflections and the other board's bytes.
+// Where they overlap the other board's light is far stronger than our own reflection, so
+// only its byte comes through (if it didn't, nothing could run full duplex anyways). The
+// ISR gets each byte up to the 32 bit RX time out after it was done, in order
+static void makeRx(uint8_t node, uint16_t* captured)
+{
+    NODE* n = &nodes[node];
+    NODE* peer = &nodes[1 - node];
+    uint16_t own = 0;
+    uint16_t other = 0;
+    uint32_t last = 0;
+
+    n->rx_count = 0;
+
+    while (own < n->sent_count || other < peer->sent_count)
+    {
+        BYTE_ON_AIR byte;
+        bool reflection = other >= peer->sent_count ||
+                          (own < n->sent_count && n->sent[own].end < peer->sent[other].end);
+
+        if (reflection)
+        {
+            byte = n->sent[own++];
+            byte.end += nextRandom(3 * BIT);    // the path the light bounces along
+
+            // no reflection at all this time
+            if (nextRandom(10) == 0)
+                continue;
+
+            // the other board's bytes that are on the air at the same time win
+            if ((other < peer->sent_count && peer->sent[other].end - byte.end < BYTE) ||
+                (other > 0 && byte.end - peer->sent[other - 1].end < BYTE))
+            {
+                (*captured)++;
+                continue;
+            }
+
+            if (nextRandom(10) == 0)
+            {
+                byte.c ^= 0x80 | nextRandom(16);       // never turns into a letter
+                byte.from = FROM_GARBLED;
+            }
+            else
+                byte.from = FROM_ECHO;
+        }
+        else
+        {
+            byte = peer->sent[other++];
+            byte.end += nextRandom(3 * BIT);
+        }
+
+        byte.end += BIT + nextRandom(32 * BIT);
+        if ((int32_t)(byte.end - last) < 0)
+            byte.end = last;
+        last = byte.end;
+
+        n->rx[n->rx_count++] = byte;
+    }
+}
+
+// both boards full duplex for a while: every burst is noted the moment it goes into
+// the FIFO and every received byte goes through isEcho when the ISR would see it
+static void testTwoBoards()
+{
+    uint16_t burst_at[NODES] = { 0, 0 };
+    uint16_t rx_at[NODES] = { 0, 0 };
+    uint16_t captured = 0;
+    uint32_t peer_bytes = 0;
+    uint32_t in_window = 0;
+    uint32_t peer_dropped = 0;
+    uint32_t echoes = 0;
+    uint32_t echoes_kept = 0;
+    uint32_t garbled = 0;
+    uint32_t garbled_dropped = 0;
+    uint8_t node;
+    uint8_t i;
+
+    reset(DUPLEX_FULL);
+    for (node = 0; node < NODES; node++)
+    {
+        current = -1;
+        copyState(&nodes[node].state, true);
+        makeBursts(node, t);
+    }
+    for (node = 0; node < NODES; node++)
+        makeRx(node, &captured);
+
+    while (true)
+    {
+        uint32_t next = 0;
+        int8_t next_node = -1;
+        bool next_is_tx = false;
+
+        for (node = 0; node < NODES; node++)
+        {
+            NODE* n = &nodes[node];
+
+            if (burst_at[node] < n->burst_count &&
+                (next_node < 0 || (int32_t)(n->bursts[burst_at[node]].start - next) < 0))
+            {
+                next = n->bursts[burst_at[node]].start;
+                next_node = node;
+                next_is_tx = true;
+            }
+            if (rx_at[node] < n->rx_count &&
+                (next_node < 0 || (int32_t)(n->rx[rx_at[node]].end - next) < 0))
+            {
+                next = n->rx[rx_at[node]].end;
+                next_node = node;
+                next_is_tx = false;
+            }
+        }
+
+        if (next_node < 0)
+            break;
+
+        use(next_node);
+        at(next);
+
+        if (next_is_tx)
+        {
+            BURST* burst = &nodes[next_node].bursts[burst_at[next_node]++];
+
+            UART7_FR_R = 0;
+            for (i = 0; i < burst->length; i++)
+            {
+                noteEchoTx(burst->bytes[i]);
+                UART7_FR_R = UART_FR_BUSY;
+            }
+            UART7_FR_R = 0;
+        }
+        else
+        {
+            BYTE_ON_AIR* byte = &nodes[next_node].rx[rx_at[next_node]++];
+            bool waiting = tail != head &&
+                           (int32_t)(getUptimeUs() - entries[tail].due) >= -(int32_t)(BITS_PER_BYTE * bitUs());
+            bool dropped = isEcho(byte->c);
+
+            if (byte->from == FROM_PEER)
+            {
+                peer_bytes++;
+                in_window += waiting;
+                peer_dropped += dropped;
+            }
+            else if (byte->from == FROM_ECHO)
+            {
+                echoes++;
+                echoes_kept += !dropped;
+            }
+            else
+            {
+                garbled++;
+                garbled_dropped += dropped;
+            }
+        }
+    }
+
+    printf("  %u bytes from the other board, %u while waiting for our own echo, %u dropped\n",
+           peer_bytes, in_window, peer_dropped);
+    printf("  %u own echoes, %u let through, %u garbled, %u lost under the other board\n",
+           echoes, echoes_kept, garbled, captured);
+
+    // a garbled echo looks like any other byte, full duplex keeps it and the crc has to
+    // deal with it
+    CHECK(peer_dropped == 0);
+    CHECK(echoes_kept == 0);
+    CHECK(garbled_dropped == 0);
+
+    // and it really did all of that
+    CHECK(in_window > peer_bytes / 10);
+    CHECK(garbled > 100);
+    CHECK(captured > 100);
+
+    t = nodes[0].bursts[nodes[0].burst_count - 1].start + SIM_US;
+    current = -1;
+}
+
+int main()
+{
+    hostCyclesPerRead = 0;  // time only moves when the test says so
+
+    testEchoDropped();
+    testMismatch();
+    testOutsideWindow();
+    testLostEcho();
+    testTurnaround();
+    testTwoBoards();
+
+    return hostResult("test_echo");
+}
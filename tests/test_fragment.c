@@ -0,0 +1,168 @@
+/*
+ *  test_fragment - splitting a message up and putting it back together
+ *
+ *  The fragments sendIrMessageTo makes are fed straight into handleFragmentFrame, in
+ *  order and out of order, and the biggest message has to come back out whole. Fragments
+ *  that would write past the end of the buffer have to be dropped, and a message pushed
+ *  out by a newer one is counted apart from one that timed out.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <string.h>
+#include "fragment.h"
+#include "ir_frame.h"
+#include "stubs.h"
+
+#define SENT_MAX 80
+
+static IR_FRAME sent[SENT_MAX];
+static uint8_t sentCount = 0;
+
+static uint8_t message[FRAGMENT_MAX_MESSAGE];
+static uint16_t messageLength = 0;
+static uint8_t messageCount = 0;
+
+// ir_frame.c, keeps the frames instead of sending them
+void sendIrFrameTo(uint8_t address, uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    (void)address;
+
+    if (sentCount < SENT_MAX)
+    {
+        sent[sentCount].type = type;
+        sent[sentCount].length = length;
+        memcpy(sent[sentCount].payload, payload, length);
+        sentCount++;
+    }
+}
+
+// ir_link.c, where a whole message ends up
+void processIrMessage(uint8_t channel, uint8_t type, const uint8_t* data, uint16_t length)
+{
+    (void)channel;
+    (void)type;
+
+    memcpy(message, data, length);
+    messageLength = length;
+    messageCount++;
+}
+
+static void testRoundTrip(uint16_t length, bool reversed)
+{
+    static uint8_t data[FRAGMENT_MAX_MESSAGE];
+    uint16_t i;
+
+    for (i = 0; i < length; i++)
+        data[i] = i * 7 + length;
+
+    sentCount = 0;
+    messageCount = 0;
+
+    CHECK(sendIrMessageTo(IR_FRAME_BROADCAST, IR_FRAME_TEXT, data, length));
+    CHECK(sentCount == (length + FRAGMENT_DATA - 1) / FRAGMENT_DATA);
+
+    for (i = 0; i < sentCount; i++)
+        handleFragmentFrame(1, &sent[reversed ? sentCount - 1 - i : i]);
+
+    CHECK(messageCount == 1);
+    CHECK(messageLength == length);
+    CHECK(memcmp(message, data, length) == 0);
+}
+
+static void testTooLong()
+{
+    static uint8_t data[FRAGMENT_MAX_MESSAGE + 1];
+
+    sentCount = 0;
+    CHECK(!sendIrMessageTo(IR_FRAME_BROADCAST, IR_FRAME_TEXT, data, sizeof(data)));
+    CHECK(sentCount == 0);
+}
+
+// FRAGMENT_MAX_COUNT full fragments are more than FRAGMENT_MAX_MESSAGE bytes
+static void testPastTheEnd()
+{
+    uint8_t count = (FRAGMENT_MAX_MESSAGE + FRAGMENT_DATA - 1) / FRAGMENT_DATA;
+    uint32_t bad = getFragmentStats()->bad;
+    IR_FRAME frame;
+
+    memset(&frame, 0xAA, sizeof(frame));
+    frame.type = IR_FRAME_FRAGMENT;
+    frame.length = FRAGMENT_HEADER_LENGTH + FRAGMENT_DATA;
+    frame.payload[FRAGMENT_ID] = 200;
+    frame.payload[FRAGMENT_INDEX] = count - 1;
+    frame.payload[FRAGMENT_COUNT] = count;
+    frame.payload[FRAGMENT_TYPE] = IR_FRAME_TEXT;
+
+    handleFragmentFrame(2, &frame);
+    CHECK(getFragmentStats()->bad == bad + 1);
+
+    // the short last fragment that does fit is fine
+    frame.length = FRAGMENT_HEADER_LENGTH + FRAGMENT_MAX_MESSAGE - (count - 1) * FRAGMENT_DATA;
+    handleFragmentFrame(2, &frame);
+    CHECK(getFragmentStats()->bad == bad + 1);
+}
+
+// a third message while both slots are still waiting pushes out the oldest one, which
+// counts as evicted and not as a timeout, and pollFragments times out the others
+static void testEvicted()
+{
+    static uint8_t data[3][FRAGMENT_DATA * 3];
+    IR_FRAME frames[3][3];
+    FRAGMENT_STATS* stats = getFragmentStats();
+    uint32_t timeouts;
+    uint32_t evicted;
+    uint8_t i;
+
+    // the half message testPastTheEnd left times out first
+    hostMs += 100000;
+    pollFragments();
+    timeouts = stats->timeouts;
+    evicted = stats->evicted;
+
+    // only the first fragment of each goes in for now
+    for (i = 0; i < 3; i++)
+    {
+        memset(data[i], 'a' + i, sizeof(data[i]));
+        sentCount = 0;
+        CHECK(sendIrMessageTo(IR_FRAME_BROADCAST, IR_FRAME_TEXT, data[i], sizeof(data[i])));
+        CHECK(sentCount == 3);
+        memcpy(frames[i], sent, sizeof(frames[i]));
+
+        hostMs += 100;
+        handleFragmentFrame(1, &frames[i][0]);
+    }
+
+    CHECK(stats->evicted == evicted + 1);
+    CHECK(stats->timeouts == timeouts);
+
+    // the newer two are still there
+    messageCount = 0;
+    for (i = 1; i < 3; i++)
+    {
+        handleFragmentFrame(1, &frames[i][1]);
+        handleFragmentFrame(1, &frames[i][2]);
+        CHECK(messageCount == i && memcmp(message, data[i], sizeof(data[i])) == 0);
+    }
+
+    // the rest of the first one starts over and never finishes
+    handleFragmentFrame(1, &frames[0][1]);
+    hostMs += 100000;
+    pollFragments();
+    CHECK(messageCount == 2);
+    CHECK(stats->timeouts == timeouts + 1);
+    CHECK(stats->evicted == evicted + 1);
+}
+
+int main()
+{
+    testRoundTrip(IR_FRAME_MAX_PAYLOAD + 1, false);
+    testRoundTrip(FRAGMENT_DATA * 3, true);
+    testRoundTrip(FRAGMENT_MAX_MESSAGE, false);
+    testRoundTrip(FRAGMENT_MAX_MESSAGE, true);
+    testTooLong();
+    testPastTheEnd();
+    testEvicted();
+
+    return hostResult("test_fragment");
+}
@@ -0,0 +1,436 @@
+/*
+ *  test_ir_channel - loopback of every IR channel through its real ISR path
+ *
+ *  The UARTs are simulated (host.c), so the frame goes through writeIrChannel, the TX
+ *  FIFO refills at the EOT interrupt, comes back on the same UART's RX pin, gets drained
+ *  by the channel's handler into the ring, and pollIrRx decodes it. It also checks that
+ *  each channel turned on the NVIC interrupt its handler is actually on, and that with
+ *  all four rings filling up at once the round robin in pollIrRx gets every frame out
+ *  without one channel holding up the others.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tm4c123gh6pm.h"
+#include "ir_channel.h"
+#include "ir_frame.h"
+#include "uart.h"
+#include "priority.h"
+#include "stubs.h"
+
+void Uart1_Handler(void);
+void Uart3_Handler(void);
+void Uart5_Handler(void);
+
+static void (*const handlers[IR_CHANNEL_COUNT])(void) = { 0, Uart1_Handler, Uart3_Handler, Uart5_Handler };
+static const uint8_t vectors[IR_CHANNEL_COUNT] = { INT_UART7, INT_UART1, INT_UART3, INT_UART5 };
+
+static bool isIrqEnabled(uint8_t irq)
+{
+    return (*((volatile uint32_t *)(0xE000E100 + 4 * (irq / 32)))) & (1 << (irq % 32));
+}
+
+// runs the channel's ISR until it stops sending, with TX wired straight back to RX
+static void runLoopback(uint8_t channel)
+{
+    uint8_t uart = irChannels[channel].uart;
+    uint32_t base = uartConfig[uart].uart_base;
+    static uint16_t sent[HOST_TX_MAX];
+    uint16_t looped = 0;
+    uint16_t count;
+    uint8_t rounds = 0;
+
+    while ((count = hostUartSent(uart, sent, HOST_TX_MAX)) > looped && rounds++ < 100)
+    {
+        uint8_t bytes[HOST_TX_MAX];
+        uint16_t i;
+
+        for (i = looped; i < count; i++)
+            bytes[i - looped] = sent[i];
+        hostUartReceive(uart, bytes, count - looped, 0);
+        looped = count;
+
+        // the simulated FIFO is sent instantly, so it is always an RX + EOT interrupt
+        UART_REG(base, UART_O_MIS) = UART_MIS_RXMIS | UART_MIS_TXMIS;
+        handlers[channel]();
+    }
+}
+
+static void testInterrupts()
+{
+    uint8_t i;
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        CHECK(uartConfig[irChannels[i].uart].irq == vectors[i] - 16);
+
+    // channel 0 (UART7) is enabled by init_uart7_rx_interrupt in main.c, not here
+    for (i = 1; i < IR_CHANNEL_COUNT; i++)
+        CHECK(isIrqEnabled(vectors[i] - 16));
+
+    // and nothing else got turned on by mistake
+    CHECK(NVIC_EN0_R == (1 << (INT_UART1 - 16)));
+    CHECK(NVIC_EN1_R == ((1 << (INT_UART3 - 16 - 32)) | (1 << (INT_UART5 - 16 - 32))));
+}
+
+static void testFrameLoopback(uint8_t channel)
+{
+    char text[IR_FRAME_MAX_PAYLOAD];
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+    uint8_t length;
+    uint8_t wire_length;
+
+    // long enough that it takes a few FIFO refills
+    length = sprintf(text, "loopback on channel %d, more than one FIFO worth of bytes", channel);
+    wire_length = encodeIrFrame(IR_FRAME_TEXT, (uint8_t*)text, length, wire);
+
+    stubReset();
+    hostUartClear(irChannels[channel].uart);
+    NVIC_SW_TRIG_R = 0;
+
+    CHECK(writeIrChannel(channel, wire, wire_length));
+    runLoopback(channel);
+
+    CHECK(irChannels[channel].tx_tail == irChannels[channel].tx_head);
+    CHECK(NVIC_SW_TRIG_R == IR_RX_EVENT_IRQ);
+
+    pollIrRx();
+
+    CHECK(stubFrameCount == 1);
+    CHECK(stubFrameChannels[0] == channel);
+    CHECK(stubFrames[0].type == IR_FRAME_TEXT);
+    CHECK(stubFrames[0].length == length);
+    CHECK(memcmp(stubFrames[0].payload, text, length) == 0);
+}
+
+// UART7 sends with the blocking putcUart7, so only its RX side goes through the ring
+static void testUart7Rx()
+{
+    uint8_t payload[] = "to channel 0";
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+    uint8_t wire_length = encodeIrFrame(IR_FRAME_TEXT, payload, sizeof(payload), wire);
+
+    stubReset();
+    hostUartClear(7);
+    NVIC_SW_TRIG_R = 0;
+
+    hostUartReceive(7, wire, wire_length, 0);
+    drainIrChannelRx(0);
+
+    CHECK(hostUartRxLeft(7) == 0);
+    CHECK(NVIC_SW_TRIG_R == IR_RX_EVENT_IRQ);
+
+    pollIrRx();
+
+    CHECK(stubFrameCount == 1);
+    CHECK(stubFrameChannels[0] == 0);
+    CHECK(stubFrames[0].length == sizeof(payload));
+}
+
+// plain text (the old message format) comes out on the terminal
+static void testTextLoopback()
+{
+    const char message[] = "hello";
+
+    stubReset();
+    hostUartClear(irChannels[1].uart);
+
+    CHECK(writeIrChannel(1, (const uint8_t*)message, sizeof(message)));
+    runLoopback(1);
+    pollIrRx();
+
+    CHECK(stubFrameCount == 0);
+    CHECK(strstr(stubConsole, "hello") != NULL);
+    CHECK(irChannels[1].rx_messages == 1);
+}
+
+// half a frame and then nothing, the rx timer goes off and the partial frame is dropped
+static void testRxTimeout()
+{
+    uint8_t payload[] = "never finished";
+    uint8_t wire[IR_FRAME_MAX_WIRE];
+    uint8_t wire_length = encodeIrFrame(IR_FRAME_TEXT, payload, sizeof(payload), wire);
+    IR_CHANNEL* ch = &irChannels[0];
+    uint32_t truncated = ch->rx_truncated;
+
+    stubReset();
+    hostUartClear(7);
+
+    hostUartReceive(7, wire, wire_length / 2, 0);
+    drainIrChannelRx(0);
+    pollIrRx();
+    CHECK(ch->in_frame);
+
+    // what rxTimeout does from SysTick
+    ch->rx_timed_out = true;
+    pollIrRx();
+
+    CHECK(!ch->in_frame);
+    CHECK(!ch->rx_timed_out);
+    CHECK(ch->rx_truncated == truncated + 1);
+    CHECK(hostPrimask == 0);
+
+    // plain text that stops says so on the terminal
+    hostUartReceive(7, (const uint8_t*)"cut", 3, 0);
+    drainIrChannelRx(0);
+    pollIrRx();
+    ch->rx_timed_out = true;
+    pollIrRx();
+
+    CHECK(strstr(stubConsole, "(cut off)") != NULL);
+    CHECK(ch->rx_truncated == truncated + 2);
+    CHECK(stubFrameCount == 0);
+}
+
+// the RX ISR's trigger to IrRxEvent_Handler starting is timed, a second trigger before
+// the handler runs is the same interrupt. Only the outermost interrupts off is timed
+static void testLatency()
+{
+    LATENCY_STATS* latency = getLatencyStats();
+    uint32_t per_read = hostCyclesPerRead;
+    uint8_t byte = 'x';
+    uint32_t outer;
+    uint32_t inner;
+
+    hostCyclesPerRead = 0;
+    hostUartClear(7);
+    noteRxEventStart();     // whatever the tests before left waiting
+
+    hostCycles = 1000;
+    NVIC_SW_TRIG_R = 0;
+    hostUartReceive(7, &byte, 1, 0);
+    drainIrChannelRx(0);
+    CHECK(NVIC_SW_TRIG_R == IR_RX_EVENT_IRQ);
+
+    hostCycles = 1200;
+    hostUartReceive(7, &byte, 1, 0);
+    drainIrChannelRx(0);
+
+    hostCycles = 1500;
+    noteRxEventStart();
+    CHECK(latency->rx_event_last == 500);
+    CHECK(latency->rx_event_max >= 500);
+
+    // the handler running again without a new trigger doesn't count
+    hostCycles = 9000;
+    noteRxEventStart();
+    CHECK(latency->rx_event_last == 500);
+
+    latency->masked_max = 0;
+    hostCycles = 2000;
+    outer = disableInterrupts();
+    hostCycles = 2100;
+    inner = disableInterrupts();
+    hostCycles = 2200;
+    restoreInterrupts(inner);
+    CHECK(latency->masked_max == 0);
+    CHECK(hostPrimask == 1);
+    hostCycles = 2300;
+    restoreInterrupts(outer);
+    CHECK(latency->masked_max == 300);
+    CHECK(hostPrimask == 0);
+
+    pollIrRx();
+    hostCyclesPerRead = per_read;
+}
+
+// every channel hears its own stream of frames at the same time
+#define LOAD_PAYLOAD 25
+#define LOAD_WIRE (LOAD_PAYLOAD + 6)
+#define LOAD_FRAMES 40
+
+static uint8_t streams[IR_CHANNEL_COUNT][LOAD_FRAMES * LOAD_WIRE];
+static uint16_t stream_at[IR_CHANNEL_COUNT];
+static uint8_t next_frame[IR_CHANNEL_COUNT];  // the one each channel should hand up next
+static uint8_t delivered[IR_CHANNEL_COUNT];
+
+static void makeStreams()
+{
+    uint8_t channel;
+    uint8_t i;
+
+    for (channel = 0; channel < IR_CHANNEL_COUNT; channel++)
+    {
+        for (i = 0; i < LOAD_FRAMES; i++)
+        {
+            char text[32];
+
+            snprintf(text, sizeof(text), "channel %u frame %02u .......", channel, i);
+            CHECK(encodeIrFrame(IR_FRAME_TEXT, (uint8_t*)text, LOAD_PAYLOAD,
+                                &streams[channel][i * LOAD_WIRE]) == LOAD_WIRE);
+        }
+
+        stream_at[channel] = 0;
+        next_frame[channel] = 0;
+        delivered[channel] = 0;
+        hostUartClear(irChannels[channel].uart);
+
+        // whatever the tests before left half received times out
+        irChannels[channel].rx_timed_out = true;
+    }
+
+    pollIrRx();
+}
+
+// the next length bytes of the channel's stream land in its FIFO and its ISR runs
+static void receive(uint8_t channel, uint16_t length)
+{
+    uint8_t uart = irChannels[channel].uart;
+
+    if (stream_at[channel] + length > sizeof(streams[channel]))
+        length = sizeof(streams[channel]) - stream_at[channel];
+
+    hostUartReceive(uart, &streams[channel][stream_at[channel]], length, 0);
+    stream_at[channel] += length;
+
+    if (channel == 0)
+        drainIrChannelRx(0);    // Uart7_Handler is in main.c, this is all it does for RX
+    else
+    {
+        UART_REG(uartConfig[uart].uart_base, UART_O_MIS) = UART_MIS_RXMIS;
+        handlers[channel]();
+    }
+    CHECK(hostUartRxLeft(uart) == 0);
+}
+
+static uint16_t ringUsed(uint8_t channel)
+{
+    return (irChannels[channel].rx_head - irChannels[channel].rx_tail) & (IR_CHANNEL_BUFFER_SIZE - 1);
+}
+
+// what pollIrRx handed up, every channel's frames have to come out whole and in order
+static void collect()
+{
+    uint8_t i;
+
+    for (i = 0; i < stubFrameCount; i++)
+    {
+        uint8_t channel = stubFrameChannels[i];
+        char text[32];
+
+        snprintf(text, sizeof(text), "channel %u frame %02u .......", channel, next_frame[channel]);
+        CHECK(stubFrames[i].length == LOAD_PAYLOAD);
+        CHECK(memcmp(stubFrames[i].payload, text, LOAD_PAYLOAD) == 0);
+        next_frame[channel]++;
+        delivered[channel]++;
+    }
+
+    stubReset();
+}
+
+static uint32_t overflows()
+{
+    uint32_t count = 0;
+    uint8_t i;
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        count += irChannels[i].rx_overflows + irChannels[i].rx_overruns;
+
+    return count;
+}
+
+// all four rings filled up at once, a FIFO at a time each like the ISRs would, before the
+// events thread gets to run. One pollIrRx empties every ring, and since it takes a byte
+// from each in turn the frames come out one from every channel, then the next ones
+static void testFourRingsFull()
+{
+    uint32_t before = overflows();
+    uint8_t round;
+    uint8_t i;
+
+    makeStreams();
+    stubReset();
+
+    // 4 frames is 124 bytes, the most a ring holds is 127
+    for (round = 0; round < 8; round++)
+    {
+        for (i = 0; i < IR_CHANNEL_COUNT; i++)
+            receive((i + round) % IR_CHANNEL_COUNT, round < 7 ? 16 : 4 * LOAD_WIRE - 7 * 16);
+    }
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        CHECK(ringUsed(i) == 4 * LOAD_WIRE);
+    CHECK(overflows() == before);
+
+    pollIrRx();
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        CHECK(irChannels[i].rx_tail == irChannels[i].rx_head);
+
+    CHECK(stubFrameCount == 4 * IR_CHANNEL_COUNT);
+    for (i = 0; i < stubFrameCount; i++)
+        CHECK(stubFrameChannels[i] == i % IR_CHANNEL_COUNT);
+    collect();
+
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        CHECK(delivered[i] == 4);
+}
+
+// one channel has a full ring and another only one frame: the short one is done after
+// the first frame of the busy one, not after all four of them
+static void testNoStarvation()
+{
+    makeStreams();
+    stubReset();
+
+    receive(1, 4 * LOAD_WIRE);
+    receive(3, LOAD_WIRE);
+    pollIrRx();
+
+    CHECK(stubFrameCount == 5);
+    CHECK(stubFrameChannels[0] == 1);
+    CHECK(stubFrameChannels[1] == 3);
+    collect();
+    CHECK(delivered[1] == 4 && delivered[3] == 1);
+}
+
+// all four keep coming at full speed, a FIFO each at a time in a different order every
+// round, and the events thread gets to run after every round. Nothing overflows, every
+// frame gets through in order and no ring is left with anything in it
+static void testSustainedLoad()
+{
+    uint32_t before = overflows();
+    uint16_t round;
+    uint8_t i;
+
+    makeStreams();
+    stubReset();
+
+    for (round = 0; stream_at[0] < sizeof(streams[0]); round++)
+    {
+        for (i = 0; i < IR_CHANNEL_COUNT; i++)
+            receive((i + round) % IR_CHANNEL_COUNT, 16);
+
+        pollIrRx();
+        collect();
+
+        for (i = 0; i < IR_CHANNEL_COUNT; i++)
+            CHECK(ringUsed(i) == 0);
+    }
+
+    CHECK(overflows() == before);
+    for (i = 0; i < IR_CHANNEL_COUNT; i++)
+        CHECK(delivered[i] == LOAD_FRAMES);
+}
+
+int main()
+{
+    uint8_t channel;
+
+    hostSimulateUarts();
+    initIrChannels();
+
+    testInterrupts();
+    for (channel = 1; channel < IR_CHANNEL_COUNT; channel++)
+        testFrameLoopback(channel);
+    testUart7Rx();
+    testTextLoopback();
+    testRxTimeout();
+    testLatency();
+    testFourRingsFull();
+    testNoStarvation();
+    testSustainedLoad();
+
+    return hostResult("test_ir_channel");
+}
@@ -0,0 +1,567 @@
+/*
+ *  test_mesh - store and forward over a made up topology, latency and throughput per hop
+ *
+ *  mesh.c keeps the routes, seen list and queues of one board in its statics, so this
+ *  includes it and swaps every node's copy of them in before doing anything as that
+ *  node. Each node has a fake events thread (handleMeshFrame for every frame that came
+ *  in, pollMesh when EVENT_MESH is posted) and a fake shell that starts messages.
+ *
+ *  The IR channel moves a bit time at a time. A frame is heard by every neighbor of the
+ *  sender (9 bit mode drops it at the ones it isn't addressed to), a node only starts
+ *  sending when none of its neighbors is on the air plus a random backoff like csma.c,
+ *  and a frame is lost at a node that hears two neighbors at once (the hidden node
+ *  case, there is no retry in the mesh). Sending blocks the events thread like
+ *  queueIrWire does.
+ *
+ *  It checks single messages and learned routes on a line and a diamond, then prints
+ *  the end to end latency and the throughput for a burst at every hop count.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mesh.c"
+
+// in us at 1200 baud (the stub getUart7BaudRate), 11 bits a byte
+#define BIT 833
+#define BYTE (11 * BIT)
+
+// the address byte, SOH, COBS code, type, 2 byte crc and the 0 around the payload
+#define WIRE_OVERHEAD 7
+
+#define NODES 6
+#define RX_DEPTH 8
+#define AIR_MAX 8
+#define MESSAGES_MAX 64
+#define BACKOFF_SLOTS 8     // CSMA_MIN_WINDOW
+
+typedef struct _NODE_STATE
+{
+    bool relay;
+    int8_t next_hop[IR_NODE_COUNT];
+    bool static_route[IR_NODE_COUNT];
+    MESH_QUEUE queues[MESH_QUEUES];
+    uint8_t next_queue;
+    MESH_SEEN seen[MESH_SEEN_SIZE];
+    uint8_t seen_count;
+    uint8_t seen_next;
+    uint8_t sequence;
+    MESH_STATS stats;
+}
+NODE_STATE;
+
+typedef struct _NODE
+{
+    NODE_STATE state;
+    uint8_t neighbors;          // bit per node it can see
+    bool mesh_pending;          // EVENT_MESH
+    uint32_t ready_at;          // backoff done, 0 = not waiting for the medium
+    uint32_t busy_until;        // events thread sending
+    IR_FRAME rx[RX_DEPTH];
+    uint8_t rx_count;
+}
+NODE;
+
+// a frame on the air
+typedef struct _AIR
+{
+    bool used;
+    uint8_t from;
+    uint8_t address;
+    uint32_t end;
+    uint8_t collided;           // bit per node that heard something else at the same time
+    IR_FRAME frame;
+}
+AIR;
+
+typedef struct _MESSAGE
+{
+    uint8_t src;
+    uint8_t dst;
+    uint32_t sent_at;
+    uint32_t delivered_at;
+    uint8_t copies;
+}
+MESSAGE;
+
+static NODE nodes[NODES];
+static uint8_t node_count;
+static int8_t current = -1;
+static AIR air[AIR_MAX];
+static uint32_t now;
+static uint32_t seed = 3442;
+static uint32_t lost;           // frames lost to a collision somewhere they were for
+
+static MESSAGE messages[MESSAGES_MAX];
+static uint8_t message_count;
+
+static uint32_t nextRandom()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void copyState(NODE_STATE* state, bool save)
+{
+#define SWAP(x) (save ? memcpy(&state->x, &x, sizeof(x)) : memcpy(&x, &state->x, sizeof(x)))
+    SWAP(relay);
+    SWAP(next_hop);
+    SWAP(static_route);
+    SWAP(queues);
+    SWAP(next_queue);
+    SWAP(seen);
+    SWAP(seen_count);
+    SWAP(seen_next);
+    SWAP(sequence);
+    SWAP(stats);
+#undef SWAP
+}
+
+// mesh.c's statics become this node's
+static void use(uint8_t node)
+{
+    if (current == node)
+        return;
+
+    if (current >= 0)
+        copyState(&nodes[current].state, true);
+    copyState(&nodes[node].state, false);
+    current = node;
+}
+
+static MESH_STATS* statsOf(uint8_t node)
+{
+    use(node);
+    return &stats;
+}
+
+// ir_channel.c
+int8_t getIrNode()
+{
+    return current;
+}
+
+// scheduler.c, the events thread of whichever node is running
+void postEvent(uint32_t events)
+{
+    if (events & EVENT_MESH)
+        nodes[current].mesh_pending = true;
+}
+
+// ir_frame.c, pollMesh sends a relay. It is on the air right away (the medium was
+// checked before pollMesh got to run) and the events thread is stuck until it's done
+bool queueIrFrameTo(uint8_t address, uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    uint8_t i;
+
+    for (i = 0; i < AIR_MAX && air[i].used; i++);
+    CHECK(i < AIR_MAX);
+    if (i == AIR_MAX)
+        return false;
+
+    air[i].used = true;
+    air[i].from = current;
+    air[i].address = address;
+    air[i].end = now + (length + WIRE_OVERHEAD) * BYTE;
+    air[i].collided = 0;
+    air[i].frame.type = type;
+    air[i].frame.length = length;
+    memcpy(air[i].frame.payload, payload, length);
+
+    nodes[current].busy_until = air[i].end;
+    return true;
+}
+
+static bool isOnAir(uint8_t node)
+{
+    uint8_t i;
+
+    for (i = 0; i < AIR_MAX; i++)
+    {
+        if (air[i].used && air[i].from == node)
+            return true;
+    }
+
+    return false;
+}
+
+// carrier sense: the node or something it can hear is sending
+static bool isHeardBusy(uint8_t node)
+{
+    uint8_t n;
+
+    for (n = 0; n < node_count; n++)
+    {
+        if ((n == node || (nodes[node].neighbors & (1 << n))) && isOnAir(n))
+            return true;
+    }
+
+    return false;
+}
+
+static void link(uint8_t a, uint8_t b)
+{
+    nodes[a].neighbors |= 1 << b;
+    nodes[b].neighbors |= 1 << a;
+}
+
+static void reset(uint8_t count)
+{
+    uint8_t n;
+
+    current = -1;
+    memset(nodes, 0, sizeof(nodes));
+    memset(air, 0, sizeof(air));
+    message_count = 0;
+    lost = 0;
+    now = 0;
+    node_count = count;
+
+    // every node starts out like mesh.c does, relaying and with nothing learned
+    for (n = 0; n < count; n++)
+    {
+        NODE_STATE* state = &nodes[n].state;
+
+        memset(state->next_hop, IR_NODE_NONE, sizeof(state->next_hop));
+        state->relay = true;
+    }
+}
+
+// line 0 - 1 - 2 ... every node only sees the ones next to it
+static void line(uint8_t count)
+{
+    uint8_t n;
+
+    reset(count);
+    for (n = 0; n + 1 < count; n++)
+        link(n, n + 1);
+}
+
+// the shell on src starts a message, the data is its index so the receiver knows which
+static bool start(uint8_t src, uint8_t dst)
+{
+    uint8_t data[2] = { message_count, 0 };
+
+    if (message_count == MESSAGES_MAX)
+        return false;
+
+    use(src);
+    if (!sendMeshMessage(dst, data, sizeof(data)))
+        return false;
+
+    messages[message_count].src = src;
+    messages[message_count].dst = dst;
+    messages[message_count].sent_at = now;
+    messages[message_count].delivered_at = 0;
+    messages[message_count].copies = 0;
+    message_count++;
+
+    return true;
+}
+
+// one bit time of the channel
+static void step()
+{
+    uint8_t i;
+    uint8_t n;
+
+    // frames that ended go to every neighbor they were addressed to, unless they
+    // overlapped with another one there
+    for (i = 0; i < AIR_MAX; i++)
+    {
+        AIR* a = &air[i];
+
+        if (!a->used || now < a->end)
+            continue;
+
+        for (n = 0; n < node_count; n++)
+        {
+            NODE* node = &nodes[n];
+
+            if (!(nodes[a->from].neighbors & (1 << n)))
+                continue;
+            if (a->address != IR_FRAME_BROADCAST && !(a->address & IR_NODE_ADDRESS(n)))
+                continue;
+
+            if (a->collided & (1 << n))
+                lost++;
+            else if (node->rx_count < RX_DEPTH)
+                node->rx[node->rx_count++] = a->frame;
+        }
+
+        a->used = false;
+    }
+
+    // two neighbors at once garble both at whoever hears them
+    for (n = 0; n < node_count; n++)
+    {
+        uint8_t heard = 0;
+
+        for (i = 0; i < AIR_MAX; i++)
+        {
+            if (air[i].used && (nodes[n].neighbors & (1 << air[i].from)))
+                heard++;
+        }
+
+        for (i = 0; i < AIR_MAX && heard > 1; i++)
+        {
+            if (air[i].used && (nodes[n].neighbors & (1 << air[i].from)))
+                air[i].collided |= 1 << n;
+        }
+    }
+
+    for (n = 0; n < node_count; n++)
+    {
+        NODE* node = &nodes[n];
+
+        if (now < node->busy_until)
+            continue;
+
+        // RX first, that's the more important task
+        while (node->rx_count)
+        {
+            IR_FRAME frame = node->rx[0];
+            uint32_t delivered;
+
+            memmove(&node->rx[0], &node->rx[1], --node->rx_count * sizeof(IR_FRAME));
+
+            use(n);
+            delivered = stats.delivered;
+            handleMeshFrame(&frame);
+
+            if (stats.delivered != delivered && frame.payload[MESH_HEADER_LENGTH] < message_count)
+            {
+                MESSAGE* message = &messages[frame.payload[MESH_HEADER_LENGTH]];
+
+                if (!message->copies++)
+                    message->delivered_at = now;
+            }
+        }
+
+        if (!node->mesh_pending)
+            continue;
+
+        // wait for the medium, then a random backoff, then it has to still be free
+        if (isHeardBusy(n))
+            node->ready_at = 0;
+        else if (!node->ready_at)
+            node->ready_at = now + (nextRandom() % BACKOFF_SLOTS) * BYTE + 1;
+        else if (now >= node->ready_at)
+        {
+            node->ready_at = 0;
+            node->mesh_pending = false;
+            use(n);
+            pollMesh();
+        }
+    }
+
+    now += BIT;
+}
+
+static bool isIdle()
+{
+    uint8_t n;
+    uint8_t i;
+
+    for (i = 0; i < AIR_MAX; i++)
+    {
+        if (air[i].used)
+            return false;
+    }
+
+    for (n = 0; n < node_count; n++)
+    {
+        if (nodes[n].mesh_pending || nodes[n].rx_count)
+            return false;
+    }
+
+    return true;
+}
+
+static void runUntilIdle()
+{
+    uint32_t limit = now + 60000000;
+
+    do
+        step();
+    while (!isIdle() && now < limit);
+
+    CHECK(isIdle());
+}
+
+// one message down a line to every distance, TTL 4 gets it 4 hops and no further
+static void testLine()
+{
+    uint8_t h;
+
+    for (h = 1; h <= 5; h++)
+    {
+        line(6);
+        CHECK(start(0, h));
+        runUntilIdle();
+
+        if (h <= MESH_DEFAULT_TTL)
+        {
+            CHECK(messages[0].copies == 1);
+            CHECK(statsOf(h)->delivered == 1);
+        }
+        else
+        {
+            CHECK(messages[0].copies == 0);
+            CHECK(statsOf(h - 1)->ttl_expired == 1);
+        }
+
+        // flooded, since nothing is known yet, and every relay on the way sent it on once
+        CHECK(statsOf(0)->flooded == 1);
+        CHECK(h == 1 || statsOf(1)->forwarded == 1);
+    }
+}
+
+// the shell retrying a full queue can't use up sequence numbers, or after 254 tries the
+// next message has the same one as the first and the other side drops it as seen
+static void testFullQueue()
+{
+    uint16_t i;
+
+    line(2);
+    CHECK(start(0, 1));
+    CHECK(start(0, 1));
+    for (i = 0; i < 254; i++)
+        CHECK(!start(0, 1));
+    CHECK(statsOf(0)->queue_full == 254);
+
+    runUntilIdle();
+    CHECK(start(0, 1));
+    runUntilIdle();
+    CHECK(messages[0].copies == 1 && messages[1].copies == 1 && messages[2].copies == 1);
+    CHECK(statsOf(1)->duplicates == 0);
+}
+
+// 0 - 1 - {2, 3} - 4, the flood takes both sides and 4 drops the second copy. 2 and 3
+// see each other, otherwise their relays of the flood land on top of each other at 4.
+// The answer teaches everybody the way back, so after that it goes unicast down one
+// side only
+static void testDiamond()
+{
+    uint8_t other;
+
+    reset(5);
+    link(0, 1);
+    link(1, 2);
+    link(1, 3);
+    link(2, 3);
+    link(2, 4);
+    link(3, 4);
+
+    CHECK(start(0, 4));
+    runUntilIdle();
+    CHECK(messages[0].copies == 1);
+    CHECK(statsOf(2)->forwarded + statsOf(3)->forwarded == 2);
+    CHECK(statsOf(4)->duplicates == 1);
+
+    // 4 learned which of 2 / 3 got there first
+    CHECK(statsOf(4)->sent == 0);
+    CHECK(getMeshRoute(0) == 2 || getMeshRoute(0) == 3);
+    other = getMeshRoute(0) == 2 ? 3 : 2;
+
+    CHECK(start(4, 0));
+    runUntilIdle();
+    CHECK(messages[1].copies == 1);
+    CHECK(statsOf(4)->flooded == 0);
+
+    // now 0 knows the way, and the side 4 didn't pick never even hears it
+    uint32_t forwarded = statsOf(other)->forwarded;
+    uint32_t duplicates = statsOf(other)->duplicates;
+
+    CHECK(start(0, 4));
+    runUntilIdle();
+    CHECK(messages[2].copies == 1);
+    CHECK(statsOf(0)->flooded == 1);
+    CHECK(statsOf(other)->forwarded == forwarded);
+    CHECK(statsOf(other)->duplicates == duplicates);
+}
+
+// latency of one message on an idle line, then a burst of them with the shell sending
+// the next one as soon as there is room in the queue, for every hop count. The
+// throughput is from the first message going out to the last one getting there
+static void testPerHop()
+{
+    static const uint8_t burst = 20;
+    uint32_t latency[MESH_DEFAULT_TTL + 1];
+    double throughput_1 = 0;
+    uint8_t h;
+
+    printf("  hops  latency ms  burst msg/s  delivered\n");
+
+    for (h = 1; h <= MESH_DEFAULT_TTL; h++)
+    {
+        uint32_t first;
+        uint32_t last = 0;
+        uint8_t delivered = 0;
+        uint8_t i;
+
+        // learn the routes both ways first so it's all unicast
+        line(h + 1);
+        start(0, h);
+        runUntilIdle();
+        start(h, 0);
+        runUntilIdle();
+        CHECK(messages[0].copies == 1 && messages[1].copies == 1);
+
+        CHECK(start(0, h));
+        runUntilIdle();
+        latency[h] = messages[2].delivered_at - messages[2].sent_at;
+
+        first = now;
+        message_count = 0;
+        while (message_count < burst)
+        {
+            if (!start(0, h))
+                step();
+        }
+        runUntilIdle();
+
+        for (i = 0; i < burst; i++)
+        {
+            if (messages[i].copies)
+            {
+                delivered++;
+                if (messages[i].delivered_at > last)
+                    last = messages[i].delivered_at;
+            }
+        }
+
+        printf("  %4u  %10.0f  %11.2f  %6u/%u\n", h, latency[h] / 1000.0,
+               delivered * 1000000.0 / (last - first), delivered, burst);
+
+        // every hop is a whole frame time plus up to the backoff, store and forward
+        uint32_t frame_us = (MESH_HEADER_LENGTH + 2 + WIRE_OVERHEAD) * BYTE;
+        CHECK(latency[h] >= h * frame_us);
+        CHECK(latency[h] <= h * (frame_us + BACKOFF_SLOTS * BYTE + 2 * BIT));
+        CHECK(h == 1 || latency[h] > latency[h - 1]);
+
+        // a single hop has nobody to collide with. Past that 0 can't hear 2 relaying the
+        // last one and sends the next one on top of it at 1 (hidden node), and with no
+        // retry in the mesh those are gone, so it only has to be slower and never doubled
+        CHECK(h > 1 || delivered == burst);
+        CHECK(delivered > 0);
+        CHECK(h == 1 || delivered * 1000000.0 / (last - first) < throughput_1);
+        if (h == 1)
+            throughput_1 = delivered * 1000000.0 / (last - first);
+        for (i = 0; i < burst; i++)
+            CHECK(messages[i].copies <= 1);
+    }
+}
+
+int main()
+{
+    testLine();
+    testFullQueue();
+    testDiamond();
+    testPerHop();
+
+    return hostResult("test_mesh");
+}
@@ -0,0 +1,138 @@
+/*
+ *  test_pwm - carrier frequency / duty cycle math and the carrier gating
+ *
+ *  Checks the load and compare values that end up in the PWM generator for the TSOP
+ *  frequencies, how far off the real frequency is, the duty cycle limits, and that the
+ *  carrier only goes off once every channel is done sending.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdlib.h>
+#include "tm4c123gh6pm.h"
+#include "pwm.h"
+
+static const uint32_t tsop[] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+
+static bool isOutputOn()
+{
+    return (PWM0_ENABLE_R & PWM_ENABLE_PWM0EN) != 0;
+}
+
+static void testDefault()
+{
+    CHECK(PWM_PERIOD_FOR(38000) == 263);
+    CHECK(PWM_COMPARE_FOR(263, 50) == 131);
+
+    CHECK(PWM0_0_LOAD_R == 262);
+    CHECK(PWM0_0_CMPA_R == 131);
+    CHECK(getPWMDutyCycle() == PWM_DEFAULT_DUTY);
+    CHECK(getPWMFrequency() == 38023);
+    CHECK(getPWMFrequencyError() == 23);
+
+    // gating is on by default, so the pin stays off until something is sent
+    CHECK(!isOutputOn());
+    CHECK(!isCarrierOn());
+}
+
+static void testFrequencies()
+{
+    uint8_t i;
+
+    for (i = 0; i < sizeof(tsop) / sizeof(tsop[0]); i++)
+    {
+        uint32_t period = PWM_PERIOD_FOR(tsop[i]);
+
+        CHECK(setPWMCarrier(tsop[i], 50));
+        CHECK(PWM0_0_LOAD_R == period - 1);
+        CHECK(PWM0_0_CMPA_R == PWM_COMPARE_FOR(period, 50));
+
+        // the period is rounded to the nearest clock, so it is off by at most half a clock
+        CHECK((uint32_t)abs(getPWMFrequencyError()) <= tsop[i] / (2 * period) + 1);
+    }
+
+    CHECK(setPWMCarrier(36000, 50));
+    CHECK(getPWMFrequency() == 35971);
+    CHECK(getPWMFrequencyError() == -29);
+
+    // out of range leaves it alone
+    CHECK(!setPWMCarrier(PWM_MIN_FREQUENCY - 1, 50));
+    CHECK(!setPWMCarrier(PWM_MAX_FREQUENCY + 1, 50));
+    CHECK(!setPWMCarrier(38000, 0));
+    CHECK(!setPWMCarrier(38000, 100));
+    CHECK(PWM0_0_LOAD_R == PWM_PERIOD_FOR(36000) - 1);
+
+    // the generator counter is 16 bits
+    loadPWMCarrier(1, 50, 5000000);
+    loadPWMCarrier(0x10000, 50, 152);
+    CHECK(PWM0_0_LOAD_R == PWM_PERIOD_FOR(36000) - 1);
+}
+
+static void testDutyCycle()
+{
+    uint32_t period;
+    uint8_t percent;
+
+    CHECK(setPWMCarrier(38000, 50));
+    period = PWM0_0_LOAD_R + 1;
+
+    for (percent = 1; percent <= 99; percent++)
+    {
+        setPWMDutyCycle(percent);
+
+        // high from the load down to CMPA, so the high time is period - CMPA clocks
+        uint32_t high = period - PWM0_0_CMPA_R;
+        CHECK(high * 100 >= percent * period && high * 100 < percent * period + 100);
+    }
+
+    setPWMDutyCycle(0);
+    CHECK(getPWMDutyCycle() == 1);
+    setPWMDutyCycle(100);
+    CHECK(getPWMDutyCycle() == 99);
+    CHECK(PWM0_0_CMPA_R == PWM_COMPARE_FOR(period, 99));
+
+    // changing the frequency keeps the duty cycle it was given
+    CHECK(setPWMCarrier(56000, 25));
+    CHECK(getPWMDutyCycle() == 25);
+    CHECK(PWM0_0_CMPA_R == PWM_COMPARE_FOR(PWM_PERIOD_FOR(56000), 25));
+}
+
+static void testGating()
+{
+    uint32_t starts = getCarrierStarts();
+
+    carrierOn(1);
+    carrierOn(2);
+    CHECK(isOutputOn());
+    CHECK(getCarrierStarts() == starts + 1);
+
+    carrierOff(1);
+    CHECK(isOutputOn());
+    carrierOff(2);
+    CHECK(!isOutputOn());
+    CHECK(!isCarrierOn());
+    CHECK(hostPrimask == 0);
+
+    // gating off, the carrier just stays on
+    setCarrierGating(false);
+    CHECK(isOutputOn());
+    carrierOn(0);
+    carrierOff(0);
+    CHECK(isOutputOn());
+    setCarrierGating(true);
+    carrierOn(0);
+    carrierOff(0);
+    CHECK(!isOutputOn());
+}
+
+int main()
+{
+    initPWM();
+
+    testDefault();
+    testFrequencies();
+    testDutyCycle();
+    testGating();
+
+    return hostResult("test_pwm");
+}
@@ -0,0 +1,344 @@
+/*
+ *  test_timer - the 3 level timer wheel, ticked by hand
+ *
+ *  Every timer records the tick it went off on, so this checks they go off on exactly
+ *  the right tick when they have to cascade down at the 64 ms and 4096 ms boundaries,
+ *  that TIMER_MAX_MS still fits from anywhere in a block, and that getNextTimerMs never
+ *  tells the tickless idle to sleep past something tickTimers has to do.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timer.h"
+
+#define TIMERS 8
+
+static uint32_t ticks = 0;              // same as now in timer.c, it starts at 0 too
+static uint32_t fired_at[TIMERS];
+static uint8_t fired_count[TIMERS];
+static TIMER timers[TIMERS];
+
+static void callback(void* context)
+{
+    uint32_t i = (uint32_t)(uintptr_t)context;
+
+    fired_at[i] = ticks;
+    fired_count[i]++;
+}
+
+static void tick(uint32_t ms)
+{
+    while (ms--)
+    {
+        ticks++;
+        tickTimers();
+    }
+}
+
+// ticks until now is at the given offset in a block of the given size
+static void tickTo(uint32_t block, uint32_t offset)
+{
+    while ((ticks & (block - 1)) != offset)
+        tick(1);
+}
+
+static void clear()
+{
+    uint8_t i;
+
+    for (i = 0; i < TIMERS; i++)
+        stopTimer(&timers[i]);
+
+    memset(fired_at, 0, sizeof(fired_at));
+    memset(fired_count, 0, sizeof(fired_count));
+    memset(getTimerStats(), 0, sizeof(TIMER_STATS));
+}
+
+// goes off on the right tick, once, and not a tick before
+static void checkFires(uint8_t i, uint32_t ms)
+{
+    uint32_t start = ticks;
+
+    fired_count[i] = 0;
+    tick(ms - 1);
+    CHECK(fired_count[i] == 0);
+    CHECK(isTimerRunning(&timers[i]));
+
+    tick(1);
+    CHECK(fired_count[i] == 1);
+    CHECK(fired_at[i] == start + ms);
+    CHECK(!isTimerRunning(&timers[i]));
+}
+
+// inside the current 64 ms block it sits in level 0 and never moves
+static void testLevel0()
+{
+    clear();
+    tickTo(64, 0);
+
+    startTimer(&timers[0], 1);
+    checkFires(0, 1);
+
+    startTimer(&timers[0], 62);
+    checkFires(0, 62);
+    CHECK(getTimerStats()->cascaded == 0);
+
+    // 0 is bumped up to 1 so it doesn't get lost in the slot that was already ticked
+    startTimer(&timers[0], 0);
+    checkFires(0, 1);
+}
+
+// the first tick of the next block is in level 1 and comes down on the 64 ms boundary
+static void testCascade64()
+{
+    clear();
+    tickTo(64, 0);
+
+    startTimer(&timers[0], 64);
+    checkFires(0, 64);
+    CHECK(getTimerStats()->cascaded == 1);
+
+    // from the last tick of a block even 1 ms is in the next block, so it cascades and
+    // fires on the same tick
+    clear();
+    tickTo(64, 63);
+    startTimer(&timers[1], 1);
+    startTimer(&timers[2], 65);
+    checkFires(1, 1);
+    CHECK(getTimerStats()->cascaded == 1);
+    checkFires(2, 64);
+    CHECK(getTimerStats()->cascaded == 2);
+
+    clear();
+    tickTo(64, 10);
+    startTimer(&timers[0], 100);
+    checkFires(0, 100);
+    CHECK(getTimerStats()->cascaded == 1);
+}
+
+// 4096 ms away is level 2, it comes down to level 0 right on the 4096 ms boundary
+static void testCascade4096()
+{
+    clear();
+    tickTo(4096, 0);
+
+    startTimer(&timers[0], 4095);  // last slot of level 1
+    startTimer(&timers[1], 4096);
+    checkFires(0, 4095);
+    CHECK(getTimerStats()->cascaded == 1);
+    tick(1);
+    CHECK(fired_count[1] == 1);
+    CHECK(fired_at[1] == fired_at[0] + 1);
+    CHECK(getTimerStats()->cascaded == 2);
+
+    // level 2 to level 1 on the 4096 boundary, then to level 0 on a 64 boundary
+    clear();
+    tickTo(4096, 100);
+    startTimer(&timers[2], 5000);
+    checkFires(2, 5000);
+    CHECK(getTimerStats()->cascaded == 2);
+}
+
+// the longest timeout fires on time from the start, middle and end of a block, anything
+// longer is cut down to TIMER_MAX_MS
+static void testMax()
+{
+    static const uint32_t offsets[] = { 0, 1, 2047, 4095 };
+    uint8_t i;
+
+    for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+    {
+        clear();
+        tickTo(4096, offsets[i]);
+
+        startTimer(&timers[0], TIMER_MAX_MS);
+        startTimer(&timers[1], TIMER_MAX_MS + 5000);
+        startTimer(&timers[2], 0xFFFFFFFF);
+        checkFires(0, TIMER_MAX_MS);
+        CHECK(fired_count[1] == 1 && fired_at[1] == fired_at[0]);
+        CHECK(fired_count[2] == 1 && fired_at[2] == fired_at[0]);
+        CHECK(getTimerStats()->fired == 3);
+        CHECK(getTimerStats()->max_per_tick == 3);
+    }
+}
+
+static void testStop()
+{
+    clear();
+    startTimer(&timers[0], 10);
+    startTimer(&timers[1], 10);
+    startTimer(&timers[2], 10);
+
+    // the middle one of the slot's list
+    stopTimer(&timers[1]);
+    CHECK(!isTimerRunning(&timers[1]));
+    stopTimer(&timers[1]);
+
+    tick(10);
+    CHECK(fired_count[0] == 1 && fired_count[1] == 0 && fired_count[2] == 1);
+
+    // restarting a running one moves it instead of having it in two lists
+    startTimer(&timers[0], 5000);
+    startTimer(&timers[0], 20);
+    checkFires(0, 20);
+    tick(6000);
+    CHECK(fired_count[0] == 1);
+}
+
+static void testNextTimer()
+{
+    clear();
+    CHECK(getNextTimerMs(1000) == 1000);
+
+    tickTo(4096, 0);
+    startTimer(&timers[0], 10);
+    CHECK(getNextTimerMs(1000) == 10);
+    CHECK(getNextTimerMs(5) == 5);
+
+    // further out it only knows the block, so it wakes up at the cascade
+    stopTimer(&timers[0]);
+    startTimer(&timers[0], 100);
+    CHECK(getNextTimerMs(1000) == 64);
+    CHECK(getNextTimerMs(50) == 50);
+    tick(64);
+    CHECK(getNextTimerMs(1000) == 36);
+    tick(36);
+    CHECK(fired_count[0] == 1);
+
+    // level 2 comes down on the 4096 boundary
+    clear();
+    tickTo(4096, 100);
+    startTimer(&timers[1], 5000);
+    CHECK(getNextTimerMs(10000) == 4096 - 100);
+    CHECK(getNextTimerMs(TIMER_MAX_MS) == 4096 - 100);
+    stopTimer(&timers[1]);
+    CHECK(getNextTimerMs(10000) == 10000);
+}
+
+// random timers, sleeping as long as getNextTimerMs says never skips a tick that fires
+// or cascades something, which is what the tickless idle relies on
+static void testNextTimerRandom()
+{
+    uint16_t round;
+    uint8_t i;
+
+    clear();
+    srand(3442);
+
+    for (round = 0; round < 2000; round++)
+    {
+        uint32_t fired = getTimerStats()->fired;
+        uint32_t cascaded = getTimerStats()->cascaded;
+        uint32_t max = 1 + rand() % 5000;
+        uint32_t next;
+
+        for (i = 0; i < TIMERS; i++)
+        {
+            if (!isTimerRunning(&timers[i]) && rand() % 4 == 0)
+                startTimer(&timers[i], rand() % 3 ? rand() % 300 : rand() % 20000);
+        }
+
+        next = getNextTimerMs(max);
+        CHECK(next >= 1 && next <= max);
+
+        tick(next - 1);
+        CHECK(getTimerStats()->fired == fired);
+        CHECK(getTimerStats()->cascaded == cascaded);
+        tick(1);
+    }
+}
+
+// what IrRxEvent_Handler does at priority 2, above SysTick: restart the LED timer
+static TIMER* led = &timers[TIMERS - 1];
+static uint32_t restarted_at;
+
+static void rxEvent()
+{
+    startTimer(led, 500);
+    restarted_at = ticks;
+}
+
+// the RX event cuts into the tick that cascades a level 1 slot with the LED timer in it,
+// once after every single instruction of it. Every timer still has to go off exactly
+// once on its tick and nothing can be left in the wheel
+static void testStartInCascade()
+{
+    static const uint32_t ms[] = { 1, 10, 33, 63, 64 };
+    const uint8_t count = sizeof(ms) / sizeof(ms[0]);
+    uint32_t n;
+    uint8_t i;
+    bool hit = false;
+
+    for (n = 1; ; n++)
+    {
+        uint32_t start;
+        bool ok = true;
+
+        clear();
+        tickTo(64, 63);
+        start = ticks;
+
+        // the LED timer ends up in the middle of the slot's list
+        for (i = 0; i < count; i++)
+        {
+            startTimer(&timers[i], ms[i]);
+            if (i == 2)
+                startTimer(led, 20);
+        }
+
+        hostInterruptAfter(n, 2, rxEvent);
+        tick(1);
+
+        if (hostInterruptArmed())
+        {
+            hostInterruptCancel();
+            break;  // the tick was over before the n-th instruction
+        }
+
+        tick(600);
+
+        for (i = 0; i < count; i++)
+            ok = ok && fired_count[i] == 1 && fired_at[i] == start + ms[i];
+        // before tickTimers does now++ the wheel is still on the last tick, so it goes off
+        // a tick early from where this test counts
+        ok = ok && fired_count[TIMERS - 1] == 1 &&
+             (fired_at[TIMERS - 1] == restarted_at + 500 || fired_at[TIMERS - 1] == restarted_at + 499);
+        for (i = 0; i < TIMERS; i++)
+            ok = ok && !isTimerRunning(&timers[i]);
+        ok = ok && getNextTimerMs(5000) == 5000;
+
+        if (!ok)
+        {
+            printf("  interrupted after %u instructions\n", n);
+            CHECK(ok);
+            return;
+        }
+
+        hit = true;
+    }
+
+    CHECK(hit);
+    CHECK(n > 100);     // it really stepped through a cascade
+}
+
+int main()
+{
+    uint8_t i;
+
+    for (i = 0; i < TIMERS; i++)
+        initTimer(&timers[i], callback, (void*)(uintptr_t)i);
+
+    testLevel0();
+    testCascade64();
+    testCascade4096();
+    testMax();
+    testStop();
+    testNextTimer();
+    testNextTimerRandom();
+    testStartInCascade();
+
+    return hostResult("test_timer");
+}
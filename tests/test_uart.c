@@ -0,0 +1,204 @@
+/*
+ *  test_uart - the generic UART driver: baud rate divisors and the config table
+ *
+ *  The divisors are checked against the data-sheet formula (BRD = clock / (16 * baud),
+ *  FBRD = round(fraction * 64)) for every baud rate the project uses, and every row of
+ *  uartConfig is checked against the data-sheet memory map, the pin table and the
+ *  vector table. Then each UART gets initialized and has to end up set up like that.
+ *
+ *  Build:  see run_tests.sh
+ */
+
+#include <math.h>
+#include "tm4c123gh6pm.h"
+#include "uart.h"
+
+#define GPIO_O_AFSEL 0x420
+#define GPIO_O_DEN   0x51C
+#define GPIO_O_LOCK  0x520
+#define GPIO_O_CR    0x524
+#define GPIO_O_PCTL  0x52C
+
+static const uint32_t bauds[] = { 300, 1200, 2400, 9600, 19200, 38400, 57600, 115200 };
+
+// APB base address of each GPIO port, by its RCGCGPIO bit (A - F)
+static const uint32_t gpio_bases[] = { 0x40004000, 0x40005000, 0x40006000, 0x40007000, 0x40024000, 0x40025000 };
+
+static const uint8_t vectors[UART_COUNT] = { INT_UART0, INT_UART1, INT_UART2, INT_UART3,
+                                             INT_UART4, INT_UART5, INT_UART6, INT_UART7 };
+
+static double actualBaud(uint32_t ibrd, uint32_t fbrd)
+{
+    return UART_SYSCLOCK / (16.0 * (ibrd + fbrd / 64.0));
+}
+
+static void testKnownDivisors()
+{
+    uint32_t base = uartConfig[7].uart_base;
+
+    // 40 MHz / (16 * 1200) = 2083.333, .333 * 64 = 21.3
+    setUartBaudRate(7, 1200, UART_SYSCLOCK);
+    CHECK(UART_REG(base, UART_O_IBRD) == 2083);
+    CHECK(UART_REG(base, UART_O_FBRD) == 21);
+
+    // 40 MHz / (16 * 115200) = 21.701, .701 * 64 = 44.9
+    setUartBaudRate(7, 115200, UART_SYSCLOCK);
+    CHECK(UART_REG(base, UART_O_IBRD) == 21);
+    CHECK(UART_REG(base, UART_O_FBRD) == 45);
+}
+
+static void testDivisorError()
+{
+    uint32_t base = uartConfig[1].uart_base;
+    uint8_t i;
+
+    for (i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+    {
+        double exact = UART_SYSCLOCK / (16.0 * bauds[i]);
+        uint32_t ibrd;
+        uint32_t fbrd;
+
+        setUartBaudRate(1, bauds[i], UART_SYSCLOCK);
+        ibrd = UART_REG(base, UART_O_IBRD);
+        fbrd = UART_REG(base, UART_O_FBRD);
+
+        CHECK(ibrd == (uint32_t)exact);
+        CHECK(fbrd < 64);
+        CHECK(fabs(fbrd - (exact - ibrd) * 64) <= 0.5 + 1e-9);
+        CHECK(fabs(actualBaud(ibrd, fbrd) - bauds[i]) / bauds[i] < 0.001);
+    }
+}
+
+// a baud rate change keeps the line settings and turns the UART back on
+static void testBaudKeepsSettings()
+{
+    uint32_t base = uartConfig[3].uart_base;
+
+    UART_REG(base, UART_O_LCRH) = UART_8E1;
+    UART_REG(base, UART_O_CTL) = UART_CTL_EOT;
+
+    setUartBaudRate(3, 9600, UART_SYSCLOCK);
+
+    CHECK(UART_REG(base, UART_O_LCRH) == UART_8E1);
+    CHECK(UART_REG(base, UART_O_CTL) == (UART_CTL_EOT | UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN));
+}
+
+static bool isOneBit(uint8_t mask)
+{
+    return mask && !(mask & (mask - 1));
+}
+
+// PCTL has 4 bits per pin
+static uint32_t pctlField(uint8_t pin)
+{
+    uint8_t bit = 0;
+
+    while (!(pin & (1 << bit)))
+        bit++;
+
+    return 0xF << (4 * bit);
+}
+
+static void testConfigTable()
+{
+    uint8_t uart;
+
+    for (uart = 0; uart < UART_COUNT; uart++)
+    {
+        const UART_CONFIG* config = &uartConfig[uart];
+
+        CHECK(config->uart_base == 0x4000C000 + 0x1000 * uart);
+        CHECK(config->irq == vectors[uart] - 16);
+        CHECK(config->gpio_clock < sizeof(gpio_bases) / sizeof(gpio_bases[0]));
+        CHECK(config->gpio_base == gpio_bases[config->gpio_clock]);
+
+        CHECK(isOneBit(config->rx_pin) && isOneBit(config->tx_pin));
+        CHECK(config->rx_pin != config->tx_pin);
+        CHECK(config->pctl_mask == (pctlField(config->rx_pin) | pctlField(config->tx_pin)));
+        CHECK((config->pctl_value & ~config->pctl_mask) == 0);
+
+        // every UART pin is alternate function 1 (page 1351)
+        CHECK(config->pctl_value == (0x11111111 & config->pctl_mask));
+
+        // only PD7 (UART2 TX) is locked
+        CHECK(config->locked == (uart == 2));
+    }
+}
+
+static void testInit()
+{
+    uint8_t uart;
+
+    for (uart = 0; uart < UART_COUNT; uart++)
+    {
+        const UART_CONFIG* config = &uartConfig[uart];
+        uint32_t gpio = config->gpio_base;
+        uint8_t pins = config->rx_pin | config->tx_pin;
+
+        initUart(uart, 1200, UART_8E1);
+
+        CHECK(SYSCTL_RCGCUART_R & (1 << uart));
+        CHECK(SYSCTL_RCGCGPIO_R & (1 << config->gpio_clock));
+        CHECK((UART_REG(gpio, GPIO_O_AFSEL) & pins) == pins);
+        CHECK((UART_REG(gpio, GPIO_O_DEN) & pins) == pins);
+        CHECK((UART_REG(gpio, GPIO_O_PCTL) & config->pctl_mask) == config->pctl_value);
+        if (config->locked)
+            CHECK((UART_REG(gpio, GPIO_O_CR) & pins) == pins);
+
+        CHECK(UART_REG(config->uart_base, UART_O_CC) == UART_CC_CS_SYSCLK);
+        CHECK(UART_REG(config->uart_base, UART_O_LCRH) == UART_8E1);
+        CHECK(UART_REG(config->uart_base, UART_O_IBRD) == 2083);
+        CHECK(UART_REG(config->uart_base, UART_O_CTL) & UART_CTL_UARTEN);
+    }
+
+    // UARTs sharing a port (UART3 / UART4 on C, UART2 / UART6 on D) don't undo each other
+    CHECK((UART_REG(0x40006000, GPIO_O_PCTL) & 0xFFFF0000) == 0x11110000);
+    CHECK((UART_REG(0x40007000, GPIO_O_PCTL) & 0xFFFF0000) == 0x11110000);
+}
+
+static void testRxInterrupt()
+{
+    const UART_CONFIG* config = &uartConfig[5];
+
+    enableUartRxInterrupt(5, 3);
+
+    CHECK(*((volatile uint8_t *)(0xE000E400 + config->irq)) == 3 << 5);
+    CHECK(NVIC_EN1_R & (1 << (config->irq - 32)));
+    CHECK((UART_REG(config->uart_base, UART_O_IM) & (UART_IM_RXIM | UART_IM_RTIM)) == (UART_IM_RXIM | UART_IM_RTIM));
+    CHECK(UART_REG(config->uart_base, UART_O_CTL) & UART_CTL_UARTEN);
+}
+
+// bytes through the simulated UART, with the error bits kept by getcUartStatus
+static void testData()
+{
+    uint16_t sent[4];
+    uint8_t data[] = { 'o', 'k' };
+
+    hostUartClear(4);
+    putsUart(4, "hi");
+    CHECK(hostUartSent(4, sent, 4) == 2);
+    CHECK(sent[0] == 'h' && sent[1] == 'i');
+
+    CHECK(!kbhitUart(4));
+    hostUartReceive(4, data, 1, 0);
+    hostUartReceive(4, data + 1, 1, HOST_ADDRESS);
+    CHECK(kbhitUart(4));
+    CHECK(getcUart(4) == 'o');
+    CHECK(getcUartStatus(4) == ('k' | UART_DR_PE));     // 9th bit set in 8E1 mode
+    CHECK(!kbhitUart(4));
+}
+
+int main()
+{
+    testKnownDivisors();
+    testDivisorError();
+    testBaudKeepsSettings();
+    testConfigTable();
+    testInit();
+
+    hostSimulateUarts();
+    testRxInterrupt();
+    testData();
+
+    return hostResult("test_uart");
+}
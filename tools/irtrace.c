@@ -0,0 +1,380 @@
+/*
+ *  irtrace - turns the board's "trace dump" into a timeline
+ *
+ *  irtrace dump <serial port> [file]
+ *      types "trace dump bin" on the board, reads the binary dump and prints it. With a
+ *      file the raw dump is also saved so it can be decoded again later.
+ *
+ *  irtrace decode <file>
+ *      decodes a saved binary dump, or a terminal log with a "trace dump" (hex) in it.
+ *
+ *  Each line is one byte on the UART7 link: the time since the first byte, the time since
+ *  the one before it, RX or TX, the byte and its flags. Long quiet spells and the 0 at the
+ *  end of every message / frame are marked so the frames are easy to pick out.
+ *
+ *  Build:  gcc -O2 -Wall -o irtrace irtrace.c
+ *
+ *  The timestamps are the board's microsecond uptime (the dump says how many ticks per
+ *  second, so older dumps in DWT cycles still decode). It keeps counting while the board
+ *  sleeps (tickless), and the 32 bits wrap every ~71 minutes, so only a gap longer than
+ *  that is off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+
+// same as trace.h on the board
+#define TRACE_FE        0x01
+#define TRACE_PE        0x02
+#define TRACE_BE        0x04
+#define TRACE_OE        0x08
+#define TRACE_TX        0x10
+#define TRACE_ECHO      0x20
+#define TRACE_ADDRESS   0x40
+
+#define TRACE_MAGIC "IRTR"
+#define TRACE_ENTRY_LENGTH 6
+#define TRACE_MAX 65535
+
+#define READ_TIMEOUT 5      // seconds, the dump itself only takes a fraction of that
+#define QUIET_US 100000     // marks a gap this long between two bytes
+
+typedef struct
+{
+    uint32_t ticks;
+    uint8_t data;
+    uint8_t flags;
+}
+ENTRY;
+
+static ENTRY entries[TRACE_MAX];
+static int entry_count = 0;
+static uint32_t ticks_per_s = 1000000;
+
+static int openPort(const char* path)
+{
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    // 115200 8N1 raw, same as UART0 on the board
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~CRTSCTS;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    return fd;
+}
+
+// next byte from the port, or -1 after timeout seconds
+static int readByte(int fd, int timeout)
+{
+    struct timeval tv = { timeout, 0 };
+    fd_set set;
+    uint8_t c;
+
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    if (select(fd + 1, &set, NULL, NULL, &tv) <= 0 || read(fd, &c, 1) != 1)
+        return -1;
+
+    return c;
+}
+
+static uint32_t readLittle(const uint8_t* p, int bytes)
+{
+    uint32_t value = 0;
+
+    while (bytes--)
+        value = (value << 8) | p[bytes];
+
+    return value;
+}
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static int parseHex(const char* str, int digits, uint32_t* value)
+{
+    *value = 0;
+
+    while (digits--)
+    {
+        int digit = hexDigit(*str++);
+        if (digit < 0)
+            return 0;
+        *value = (*value << 4) | digit;
+    }
+
+    return 1;
+}
+
+// the entries after the header of a binary dump, returns 0 if it is cut short
+static int parseBinary(const uint8_t* data, size_t length)
+{
+    size_t i;
+    int count;
+
+    if (length < 10)
+        return 0;
+
+    count = readLittle(&data[4], 2);
+    ticks_per_s = readLittle(&data[6], 4);
+    data += 10;
+    length -= 10;
+
+    for (i = 0; i < (size_t)count; i++)
+    {
+        if (length < TRACE_ENTRY_LENGTH)
+            return 0;
+
+        entries[entry_count].ticks = readLittle(data, 4);
+        entries[entry_count].data = data[4];
+        entries[entry_count].flags = data[5];
+        entry_count++;
+
+        data += TRACE_ENTRY_LENGTH;
+        length -= TRACE_ENTRY_LENGTH;
+    }
+
+    return 1;
+}
+
+// "Trace start <count> <ticks per s>" / ":TTTTTTTTDDFF" / "Trace end" lines in a log
+static int parseHexLog(char* text)
+{
+    char* line = strtok(text, "\r\n");
+    int started = 0;
+
+    for (; line; line = strtok(NULL, "\r\n"))
+    {
+        unsigned long rate;
+        uint32_t ticks, data, flags;
+
+        if (sscanf(line, "Trace start %*d %lu", &rate) == 1)
+        {
+            ticks_per_s = rate;
+            entry_count = 0;    // the last dump in the log wins
+            started = 1;
+        }
+        else if (started && line[0] == ':' && strlen(line) >= 13 &&
+                 parseHex(line + 1, 8, &ticks) && parseHex(line + 9, 2, &data) &&
+                 parseHex(line + 11, 2, &flags) && entry_count < TRACE_MAX)
+        {
+            entries[entry_count].ticks = ticks;
+            entries[entry_count].data = data;
+            entries[entry_count].flags = flags;
+            entry_count++;
+        }
+        else if (strncmp(line, "Trace end", 9) == 0)
+        {
+            started = 0;
+        }
+    }
+
+    return entry_count > 0;
+}
+
+static void printByte(uint8_t c)
+{
+    static const char* names[] = { "NUL", "SOH", "STX", "ETX", "EOT", "ENQ", "ACK", "BEL",
+                                   "BS", "TAB", "LF", "VT", "FF", "CR", "SO", "SI" };
+
+    printf("%02X ", c);
+    if (c < 16)
+        printf("%-5s", names[c]);
+    else if (c >= 0x20 && c < 0x7F)
+        printf("'%c'  ", c);
+    else
+        printf("     ");
+}
+
+static void printTimeline()
+{
+    uint64_t time = 0;
+    int i;
+
+    printf("%d bytes\n", entry_count);
+    printf("      time (us)   delta (us)  dir  byte\n");
+
+    for (i = 0; i < entry_count; i++)
+    {
+        ENTRY* entry = &entries[i];
+        uint64_t delta = 0;
+
+        // the 32 bit difference is right across a wrap of the counter
+        if (i > 0)
+        {
+            delta = (uint32_t)(entry->ticks - entries[i - 1].ticks);
+            time += delta;
+        }
+
+        uint64_t delta_us = delta * 1000000 / ticks_per_s;
+
+        if (i > 0 && delta_us >= QUIET_US)
+            printf("  --- quiet for %.1f ms ---\n", delta_us / 1000.0);
+
+        printf("%15.1f %12.1f  %s   ", time * 1000000.0 / ticks_per_s,
+               delta * 1000000.0 / ticks_per_s, (entry->flags & TRACE_TX) ? "TX" : "RX");
+        printByte(entry->data);
+
+        if (entry->flags & TRACE_ADDRESS)
+            printf(" address");
+        if (entry->flags & TRACE_ECHO)
+            printf(" echo (dropped)");
+        if (entry->flags & TRACE_OE)
+            printf(" overrun");
+        if (entry->flags & TRACE_BE)
+            printf(" break (dropped)");
+        if (entry->flags & TRACE_PE)
+            printf(" parity error (dropped)");
+        if (entry->flags & TRACE_FE)
+            printf(" framing error (dropped)");
+        if (entry->data == 0 && !(entry->flags & (TRACE_ADDRESS | TRACE_ECHO)))
+            printf(" <- end of message");
+
+        printf("\n");
+    }
+}
+
+static int dumpPort(const char* path, const char* save)
+{
+    static uint8_t dump[10 + TRACE_MAX * TRACE_ENTRY_LENGTH];
+    const char* command = "trace dump bin\r";
+    size_t length = 0;
+    size_t needed = 10;
+    int matched = 0;
+    int fd = openPort(path);
+    int c;
+
+    if (write(fd, command, strlen(command)) != (ssize_t)strlen(command))
+    {
+        perror("write");
+        return 1;
+    }
+
+    // the command echo comes first, the dump starts at the magic
+    while (matched < 4)
+    {
+        c = readByte(fd, READ_TIMEOUT);
+        if (c < 0)
+        {
+            fprintf(stderr, "no trace dump from the board\n");
+            return 1;
+        }
+
+        if (c == TRACE_MAGIC[matched])
+            matched++;
+        else
+            matched = (c == TRACE_MAGIC[0]);
+    }
+    memcpy(dump, TRACE_MAGIC, 4);
+    length = 4;
+
+    while (length < needed)
+    {
+        c = readByte(fd, READ_TIMEOUT);
+        if (c < 0)
+        {
+            fprintf(stderr, "dump cut short after %zu bytes\n", length);
+            return 1;
+        }
+        dump[length++] = c;
+
+        if (length == 10)
+            needed = 10 + readLittle(&dump[4], 2) * TRACE_ENTRY_LENGTH;
+    }
+    close(fd);
+
+    if (save)
+    {
+        FILE* file = fopen(save, "wb");
+        if (!file || fwrite(dump, 1, length, file) != length)
+        {
+            perror(save);
+            return 1;
+        }
+        fclose(file);
+    }
+
+    parseBinary(dump, length);
+    printTimeline();
+    return 0;
+}
+
+static int decodeFile(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    char* data;
+    long length;
+
+    if (!file)
+    {
+        perror(path);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data = malloc(length + 1);
+    if (!data || fread(data, 1, length, file) != (size_t)length)
+    {
+        perror(path);
+        return 1;
+    }
+    data[length] = 0;
+    fclose(file);
+
+    if (length >= 4 && memcmp(data, TRACE_MAGIC, 4) == 0)
+    {
+        if (!parseBinary((uint8_t*)data, length))
+            fprintf(stderr, "dump cut short, decoding what is there\n");
+    }
+    else if (!parseHexLog(data))
+    {
+        fprintf(stderr, "%s has no trace dump in it\n", path);
+        return 1;
+    }
+
+    printTimeline();
+    free(data);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "dump") == 0)
+        return dumpPort(argv[2], argc > 3 ? argv[3] : NULL);
+    if (argc == 3 && strcmp(argv[1], "decode") == 0)
+        return decodeFile(argv[2]);
+
+    fprintf(stderr, "usage: irtrace dump <serial port> [file]\n"
+                    "       irtrace decode <file>\n");
+    return 1;
+}
@@ -0,0 +1,323 @@
+/*
+ *  irxfer - PC side of the xfer command
+ *
+ *  irxfer send <serial port> <file> [node]
+ *      types "xfer [node]" on the sending board and then sends the file with YMODEM
+ *      (CRC, 1024 byte blocks). The board only ACKs a block once it made it across
+ *      the IR link, so this just waits as long as that takes.
+ *
+ *  irxfer recv <serial port> <file>
+ *      watches the receiving board's terminal output and writes the file back out
+ *      from the "Bulk transfer start" / ":<offset><hex>" / "Bulk transfer end" lines.
+ *
+ *  Build:  gcc -O2 -Wall -o irxfer irxfer.c
+ *
+ *  Any serial port works, including a pseudo terminal. To try it without boards:
+ *      socat -d -d pty,raw,echo=0 pty,raw,echo=0
+ *  gives two connected ptys, run irxfer on one end and play the board on the other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#define SOH 0x01
+#define STX 0x02
+#define EOT 0x04
+#define ACK 0x06
+#define NAK 0x15
+#define CAN 0x18
+#define CRC 'C'
+
+#define BLOCK_SIZE 1024
+#define START_TIMEOUT 60    // seconds for the board to ask for the first block
+#define ACK_TIMEOUT 120     // a 1K block at 300 baud with resends can take a while
+#define MAX_RESENDS 10
+
+static int openPort(const char* path)
+{
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    // 115200 8N1 raw, same as UART0 on the board
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~CRTSCTS;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    return fd;
+}
+
+// next byte from the port, or -1 after timeout seconds
+static int readByte(int fd, int timeout)
+{
+    struct timeval tv = { timeout, 0 };
+    fd_set set;
+    uint8_t c;
+
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    if (select(fd + 1, &set, NULL, NULL, &tv) <= 0 || read(fd, &c, 1) != 1)
+        return -1;
+
+    return c;
+}
+
+// waits for one of the XMODEM control bytes, the board's normal text output is skipped
+static int readControl(int fd, int timeout)
+{
+    int c;
+
+    do
+        c = readByte(fd, timeout);
+    while (c >= 0 && c != ACK && c != NAK && c != CAN && c != CRC);
+
+    return c;
+}
+
+static void writeAll(int fd, const uint8_t* data, size_t length)
+{
+    while (length)
+    {
+        ssize_t n = write(fd, data, length);
+        if (n <= 0)
+        {
+            perror("write");
+            exit(1);
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+// CRC-16/XMODEM, poly 0x1021, init 0
+static uint16_t crc16(const uint8_t* data, size_t length)
+{
+    uint16_t crc = 0;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+// sends one block and waits for the ACK, resending on NAK
+static int sendBlock(int fd, uint8_t number, const uint8_t* data, size_t size)
+{
+    uint8_t packet[3 + BLOCK_SIZE + 2];
+    uint16_t crc = crc16(data, size);
+    int tries;
+
+    packet[0] = (size == BLOCK_SIZE) ? STX : SOH;
+    packet[1] = number;
+    packet[2] = ~number;
+    memcpy(&packet[3], data, size);
+    packet[3 + size] = crc >> 8;
+    packet[4 + size] = crc & 0xFF;
+
+    for (tries = 0; tries < MAX_RESENDS; tries++)
+    {
+        writeAll(fd, packet, size + 5);
+
+        // a 'C' here is the board asking again, same as a NAK
+        int c = readControl(fd, ACK_TIMEOUT);
+        if (c == ACK)
+            return 0;
+        if (c == CAN || c < 0)
+            break;
+    }
+
+    return -1;
+}
+
+static int sendFile(const char* port, const char* path, const char* node)
+{
+    uint8_t block[BLOCK_SIZE];
+    uint8_t number = 1;
+    char command[16];
+    const char* name;
+    long size;
+    long sent = 0;
+    FILE* file = fopen(path, "rb");
+    int fd = openPort(port);
+
+    if (!file)
+    {
+        perror(path);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    snprintf(command, sizeof(command), node ? "xfer %s\r" : "xfer\r", node);
+    writeAll(fd, (uint8_t*)command, strlen(command));
+
+    if (readControl(fd, START_TIMEOUT) != CRC)
+    {
+        fprintf(stderr, "board never asked for the file\n");
+        return 1;
+    }
+
+    // YMODEM block 0: name, 0, size in decimal
+    name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    memset(block, 0, 128);
+    snprintf((char*)block, 128, "%s", name);
+    snprintf((char*)block + strlen((char*)block) + 1, 128 - strlen((char*)block) - 1, "%ld", size);
+    if (sendBlock(fd, 0, block, 128) || readControl(fd, ACK_TIMEOUT) != CRC)
+    {
+        fprintf(stderr, "header block failed\n");
+        return 1;
+    }
+
+    while (sent < size)
+    {
+        size_t n = fread(block, 1, BLOCK_SIZE, file);
+        memset(block + n, 0x1A, BLOCK_SIZE - n);    // XMODEM pads with SUB
+
+        if (sendBlock(fd, number++, block, BLOCK_SIZE))
+        {
+            fprintf(stderr, "\nblock failed at byte %ld\n", sent);
+            return 1;
+        }
+
+        sent += n;
+        fprintf(stderr, "\r%ld / %ld bytes", sent, size);
+    }
+
+    uint8_t eot = EOT;
+    writeAll(fd, &eot, 1);
+    if (readControl(fd, ACK_TIMEOUT) != ACK)
+    {
+        fprintf(stderr, "\nno ACK for EOT\n");
+        return 1;
+    }
+
+    // empty block 0 ends the YMODEM batch
+    if (readControl(fd, 10) == CRC)
+    {
+        memset(block, 0, 128);
+        sendBlock(fd, 0, block, 128);
+    }
+
+    fprintf(stderr, "\ndone\n");
+    return 0;
+}
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static int receiveFile(const char* port, const char* path)
+{
+    char line[512];
+    size_t length = 0;
+    long size = 0;
+    int started = 0;
+    int fd = openPort(port);
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        perror(path);
+        return 1;
+    }
+
+    while (1)
+    {
+        int c = readByte(fd, 3600);
+        if (c < 0)
+        {
+            fprintf(stderr, "timed out\n");
+            return 1;
+        }
+
+        if (c != '\r' && c != '\n')
+        {
+            if (length < sizeof(line) - 1)
+                line[length++] = c;
+            continue;
+        }
+
+        line[length] = 0;
+        length = 0;
+
+        if (sscanf(line, "Bulk transfer start %ld", &size) == 1)
+        {
+            started = 1;
+            fprintf(stderr, "receiving %s\n", line + strlen("Bulk transfer start "));
+        }
+        else if (started && line[0] == ':' && strlen(line) > 9)
+        {
+            char digits[9];
+            char* hex = line + 9;
+
+            memcpy(digits, line + 1, 8);
+            digits[8] = 0;
+            unsigned long offset = strtoul(digits, NULL, 16);
+
+            fseek(file, offset, SEEK_SET);
+            while (hexDigit(hex[0]) >= 0 && hexDigit(hex[1]) >= 0)
+            {
+                fputc(hexDigit(hex[0]) << 4 | hexDigit(hex[1]), file);
+                hex += 2;
+                offset++;
+            }
+            fprintf(stderr, "\r%lu bytes", offset);
+        }
+        else if (started && strncmp(line, "Bulk transfer end", 17) == 0)
+        {
+            long bytes = atol(line + 18);
+
+            // the XMODEM padding gets cut off if YMODEM told us the real size
+            fflush(file);
+            if (ftruncate(fileno(file), size ? size : bytes))
+                perror("ftruncate");
+            fclose(file);
+            fprintf(stderr, "\ndone\n");
+            return 0;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 4 && strcmp(argv[1], "send") == 0)
+        return sendFile(argv[2], argv[3], argc > 4 ? argv[4] : NULL);
+    if (argc == 4 && strcmp(argv[1], "recv") == 0)
+        return receiveFile(argv[2], argv[3]);
+
+    fprintf(stderr, "usage: irxfer send <serial port> <file> [node]\n"
+                    "       irxfer recv <serial port> <file>\n");
+    return 1;
+}
@@ -0,0 +1,257 @@
+/*
+ *  irzip - round trip check and benchmark of the board's LZSS payload compression
+ *
+ *  irzip
+ *      runs the built in sets: short text messages like the send command makes, and
+ *      telemetry (the same readings over and over, as text and as binary records)
+ *
+ *  irzip <file>...
+ *      also runs each file, cut into 64 byte payloads the way fragment.c cuts up a
+ *      long message
+ *
+ *  Every payload goes through compressPayload and, if it came out smaller, back
+ *  through decompressPayload and has to match. For each set it prints how many bytes
+ *  go on the wire vs the raw payloads, and the cycles per payload byte to compress
+ *  and to decompress. It compiles compress.c from the firmware, so it is the exact
+ *  same code, just on the PC:
+ *
+ *  Build:  gcc -O2 -Wall -I../ccs/cse3442_term_project -o irzip irzip.c ../ccs/cse3442_term_project/compress.c
+ *
+ *  On x86 the cycles are the TSC, anywhere else it is nanoseconds. Either way it is the
+ *  PC, the Cortex-M4 is a lot slower per byte, the stats command on the board shows
+ *  the real cycles per byte there. The ratio is the same on both.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "compress.h"
+#include "ir_frame.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT "cycles"
+#else
+#define UNIT "ns"
+#endif
+
+#define SET_MAX 4096        // payloads in one set
+#define REPEAT 200          // every payload is timed this many times
+
+typedef struct
+{
+    uint8_t data[IR_FRAME_MAX_PAYLOAD];
+    uint8_t length;
+}
+PAYLOAD;
+
+static PAYLOAD set[SET_MAX];
+static int set_count = 0;
+static int failures = 0;
+
+// compress.c times itself with this, the board's DWT cycle counter
+uint32_t getTimestamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+static void addPayload(const uint8_t* data, size_t length)
+{
+    if (set_count == SET_MAX || length == 0)
+        return;
+    if (length > IR_FRAME_MAX_PAYLOAD)
+        length = IR_FRAME_MAX_PAYLOAD;
+
+    memcpy(set[set_count].data, data, length);
+    set[set_count].length = length;
+    set_count++;
+}
+
+// what people type at the send command
+static void textSet()
+{
+    static const char* messages[] =
+    {
+        "hello from board 1",
+        "can you see this?",
+        "yes I can see it, the LED is blinking on my side too",
+        "testing testing 1 2 3",
+        "the quick brown fox jumps over the lazy dog",
+        "ok sending the next one now",
+        "message received, sending it back to you now",
+        "is the receiver still pointed at the window? lots of errors",
+        "moving the boards closer together, try again",
+        "hi",
+        "lunch?",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+        "abcabcabcabcabcabcabcabcabcabcabcabcabc",
+        "0123456789 0123456789 0123456789 0123456789",
+    };
+    int i;
+
+    set_count = 0;
+    for (i = 0; i < (int)(sizeof(messages) / sizeof(messages[0])); i++)
+        addPayload((const uint8_t*)messages[i], strlen(messages[i]));
+}
+
+// readings a board might send every second, values drifting a little each time
+static void telemetryTextSet()
+{
+    char line[IR_FRAME_MAX_PAYLOAD + 1];
+    int i;
+
+    set_count = 0;
+    for (i = 0; i < 256; i++)
+    {
+        int length = snprintf(line, sizeof(line), "N2 T=%06d TEMP=%d.%d V=3.%02d RX=%05d ERR=%04d",
+                              i, 23 + (i / 64), i % 10, 28 + (i % 3), 1200 + 7 * i, i / 16);
+        addPayload((const uint8_t*)line, length);
+    }
+}
+
+// the same thing as packed little endian counters, 4 records to a payload
+static void telemetryBinarySet()
+{
+    uint8_t payload[IR_FRAME_MAX_PAYLOAD];
+    int i;
+    int r;
+
+    set_count = 0;
+    for (i = 0; i < 256; i++)
+    {
+        int length = 0;
+
+        for (r = 0; r < 4; r++)
+        {
+            uint32_t n = i * 4 + r;
+            uint32_t values[4] = { n, 2300 + n / 64, 1200 + 7 * n, n / 16 };
+            int v;
+
+            for (v = 0; v < 4; v++)
+            {
+                payload[length++] = values[v];
+                payload[length++] = values[v] >> 8;
+                payload[length++] = values[v] >> 16;
+                payload[length++] = values[v] >> 24;
+            }
+        }
+
+        addPayload(payload, length);
+    }
+}
+
+static int fileSet(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    uint8_t buffer[IR_FRAME_MAX_PAYLOAD];
+    size_t length;
+
+    if (!file)
+    {
+        perror(path);
+        return 0;
+    }
+
+    set_count = 0;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        addPayload(buffer, length);
+
+    fclose(file);
+    return 1;
+}
+
+static void runSet(const char* name)
+{
+    uint64_t raw_bytes = 0;
+    uint64_t wire_bytes = 0;
+    uint64_t compress_time = 0;
+    uint64_t decompress_time = 0;
+    uint64_t compressed_bytes = 0;
+    int compressed = 0;
+    int i;
+    int r;
+
+    for (i = 0; i < set_count; i++)
+    {
+        PAYLOAD* p = &set[i];
+        uint8_t packed[IR_FRAME_MAX_PAYLOAD];
+        uint8_t unpacked[IR_FRAME_MAX_PAYLOAD];
+        uint8_t unpacked_length = 0;
+        uint8_t length = 0;
+        uint32_t start;
+
+        start = getTimestamp();
+        for (r = 0; r < REPEAT; r++)
+            length = compressPayload(p->data, p->length, packed);
+        compress_time += getTimestamp() - start;
+
+        raw_bytes += p->length;
+        wire_bytes += length ? length : p->length;
+
+        if (!length)
+            continue;
+
+        compressed++;
+        compressed_bytes += p->length;
+
+        start = getTimestamp();
+        for (r = 0; r < REPEAT; r++)
+            decompressPayload(packed, length, unpacked, &unpacked_length);
+        decompress_time += getTimestamp() - start;
+
+        if (!decompressPayload(packed, length, unpacked, &unpacked_length) ||
+            unpacked_length != p->length || memcmp(unpacked, p->data, p->length) != 0)
+        {
+            printf("  round trip FAILED on payload %d (%d bytes)\n", i, p->length);
+            failures++;
+        }
+    }
+
+    printf("%-18s %5d %8llu %8llu %6.1f%% %5d %10.1f %10.1f\n", name, set_count,
+           (unsigned long long)raw_bytes, (unsigned long long)wire_bytes,
+           raw_bytes ? 100.0 * wire_bytes / raw_bytes : 100.0, compressed,
+           raw_bytes ? (double)compress_time / REPEAT / raw_bytes : 0.0,
+           compressed_bytes ? (double)decompress_time / REPEAT / compressed_bytes : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    int i;
+
+    setCompression(true);
+
+    printf("%-18s %5s %8s %8s %7s %5s %10s %10s\n", "set", "count", "raw", "wire", "ratio",
+           "lzss", "compress", "decompress");
+
+    textSet();
+    runSet("text");
+    telemetryTextSet();
+    runSet("telemetry text");
+    telemetryBinarySet();
+    runSet("telemetry binary");
+
+    for (i = 1; i < argc; i++)
+    {
+        if (fileSet(argv[i]))
+            runSet(argv[i]);
+        else
+            failures++;
+    }
+
+    printf("\nraw / wire = payload bytes without / with compression (wire keeps the raw payload\n"
+           "when it doesn't get smaller), lzss = payloads that went out compressed,\n"
+           "compress / decompress = PC " UNIT " per payload byte\n");
+
+    if (failures)
+        printf("%d FAILED\n", failures);
+
+    return failures ? 1 : 0;
+}